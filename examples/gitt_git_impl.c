@@ -0,0 +1,190 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <gitt_transport.h>
+#include <gitt_errno.h>
+#include "gitt_io_impl.h"
+
+/*
+ * Talks to git daemon on "git://host[:port]/path" over plain TCP. The
+ * socket is always non-blocking, a blocking call polls it until it is
+ * ready or a limit is reached. Pushes need the receive-pack service of
+ * the daemon, "git daemon --enable=receive-pack".
+ */
+struct git_link {
+	int sock;
+	bool nonblock;
+	struct gitt_io_bound bound;
+};
+
+static int git_write(void *handle, char *buf, int size);
+
+static int git_open(void *param, void **handle, const char *url, const char *exec,
+		    const char *protocol, struct gitt_ssh_limit *limit)
+{
+	struct gitt_transport_url parsed;
+	struct git_link *link;
+	char request[160];
+	int len;
+	int ret;
+
+	ret = gitt_transport_url_pad(&parsed, url, "git://", GITT_TRANSPORT_GIT_PORT);
+	if (ret)
+		return ret;
+	len = gitt_transport_git_request(request, sizeof(request), &parsed, exec, protocol);
+	if (len < 0)
+		return len;
+
+	link = (struct git_link *)calloc(1, sizeof(struct git_link));
+	if (!link)
+		return -GITT_ERRNO_NOMEM;
+	link->sock = -1;
+	gitt_io_begin(&link->bound, limit);
+
+	ret = gitt_io_connect(&link->bound, parsed.host, parsed.port);
+	if (ret < 0)
+		goto err0;
+	link->sock = ret;
+
+	ret = git_write(link, request, len);
+	if (ret != len)
+		goto err1;
+
+	*handle = link;
+	return 0;
+
+err1:
+	close(link->sock);
+	ret = ret < 0 ? ret : -GITT_ERRNO_INVAL;
+err0:
+	free(link);
+	return ret;
+}
+
+static int git_read(void *handle, char *buf, int size)
+{
+	struct git_link *link = (struct git_link *)handle;
+	int wait;
+	int ret;
+
+	/* A non-blocking caller bounds the waits for the fd, only the total here */
+	ret = gitt_io_wait(&link->bound, gitt_io_now(), &wait);
+	if (ret)
+		return ret;
+
+	for (;;) {
+		ret = recv(link->sock, buf, size, 0);
+		if (ret >= 0)
+			return ret;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return -GITT_ERRNO_INVAL;
+		if (link->nonblock)
+			return -GITT_ERRNO_AGAIN;
+
+		ret = gitt_io_poll(&link->bound, link->sock, POLLIN);
+		if (ret)
+			return ret;
+	}
+}
+
+static int git_write(void *handle, char *buf, int size)
+{
+	struct git_link *link = (struct git_link *)handle;
+	int done = 0;
+	int wait;
+	int ret;
+
+	ret = gitt_io_wait(&link->bound, gitt_io_now(), &wait);
+	if (ret)
+		return ret;
+
+	while (done < size) {
+		ret = send(link->sock, buf + done, size - done, MSG_NOSIGNAL);
+		if (ret >= 0) {
+			done += ret;
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return -GITT_ERRNO_INVAL;
+		if (link->nonblock)
+			return done ? done : -GITT_ERRNO_AGAIN;
+
+		ret = gitt_io_poll(&link->bound, link->sock, POLLOUT);
+		if (ret)
+			return ret;
+	}
+
+	return done;
+}
+
+static int git_nonblock(void *handle, bool nonblock)
+{
+	struct git_link *link = (struct git_link *)handle;
+
+	link->nonblock = nonblock;
+	return 0;
+}
+
+static int git_fd(void *handle, bool write)
+{
+	struct git_link *link = (struct git_link *)handle;
+
+	return link->sock;
+}
+
+static void git_close(void *handle)
+{
+	struct git_link *link = (struct git_link *)handle;
+
+	close(link->sock);
+	free(link);
+}
+
+static struct gitt_transport git_transport = {
+	.open = git_open,
+	.read = git_read,
+	.write = git_write,
+	.nonblock = git_nonblock,
+	.fd = git_fd,
+	.close = git_close,
+	.param = NULL,
+};
+
+/* Pull from and push to git daemon, without SSH */
+struct gitt_transport *gitt_git_impl(void)
+{
+	return &git_transport;
+}
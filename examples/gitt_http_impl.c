@@ -0,0 +1,803 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <zlib.h>
+#include <gitt_transport.h>
+#include <gitt_errno.h>
+#include "gitt_io_impl.h"
+
+/* Bytes read from the server at once, and the most of a chunk sent */
+#define HTTP_BUF_SIZE		16384
+/* "xxxxxxxx\r\n" in front of a chunk, "\r\n" after it */
+#define HTTP_CHUNK_HEAD		10
+#define HTTP_CHUNK_TAIL		2
+/* The output buffer is sent before making a chunk smaller than this */
+#define HTTP_CHUNK_MIN		256
+/* Connections kept for the next commands, and for how long */
+#define HTTP_POOL_SIZE		8
+#define HTTP_POOL_AGE		30000
+/* At the end of a command, the rest of a response is read to keep the connection */
+#define HTTP_DRAIN_WAIT		100
+#define HTTP_DRAIN_MAX		4096
+
+/*
+ * Talks smart HTTP to "http://host[:port]/path", as git http-backend
+ * serves it. open gets the refs with "GET info/refs". What the command
+ * writes next is POSTed to exec in chunks as it comes. The response is
+ * read once the command reads. Negotiation is sent compressed with gzip.
+ * A connection whose response was read to the end is kept in a pool, and
+ * the next command to the same server uses it again instead of
+ * connecting. Set http_proxy to go through a proxy, https:// is not
+ * supported.
+ */
+struct http_idle {
+	int sock;
+	char host[32];
+	char port[8];
+	uint64_t since;
+};
+
+struct http_pool {
+	pthread_mutex_t lock;
+	struct http_idle idle[HTTP_POOL_SIZE];
+	uint8_t number;
+};
+
+struct http_link {
+	int sock;
+	bool nonblock;
+	bool broken;
+	bool sending;
+	bool deflating;
+	bool inflating;
+	bool inflate_full;
+	uint8_t flags;
+	struct gitt_io_bound bound;
+	struct http_pool *pool;
+	struct gitt_transport_url parsed;
+	struct gitt_transport_url server;
+	char exec[24];
+	char protocol[24];
+	struct gitt_transport_http http;
+	z_stream deflate;
+	z_stream inflate;
+	char held[5];
+	uint8_t held_pos;
+	uint8_t held_len;
+	uint8_t in[HTTP_BUF_SIZE];
+	int in_pos;
+	int in_len;
+	uint8_t out[HTTP_BUF_SIZE];
+	int out_len;
+};
+
+/* Take a kept connection to the server that is still open, or -1 */
+static int http_pool_get(struct http_pool *pool, struct gitt_transport_url *server)
+{
+	struct pollfd pfd = { .events = POLLIN };
+	uint64_t now = gitt_io_now();
+	struct http_idle idle;
+	uint8_t index = 0;
+	int sock = -1;
+
+	pthread_mutex_lock(&pool->lock);
+	while (sock < 0 && index < pool->number) {
+		if (strcmp(pool->idle[index].host, server->host) ||
+		    strcmp(pool->idle[index].port, server->port)) {
+			index++;
+			continue;
+		}
+		idle = pool->idle[index];
+		pool->number--;
+		memmove(pool->idle + index, pool->idle + index + 1,
+			(pool->number - index) * sizeof(struct http_idle));
+
+		/* Too old, or closed by the server, which makes it readable */
+		pfd.fd = idle.sock;
+		if (now - idle.since > HTTP_POOL_AGE || poll(&pfd, 1, 0)) {
+			close(idle.sock);
+			continue;
+		}
+		sock = idle.sock;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return sock;
+}
+
+/* Keep a connection for the next commands, the oldest one goes if there is no room */
+static void http_pool_put(struct http_pool *pool, struct gitt_transport_url *server, int sock)
+{
+	struct http_idle *idle;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->number == HTTP_POOL_SIZE) {
+		close(pool->idle[0].sock);
+		pool->number--;
+		memmove(pool->idle, pool->idle + 1, pool->number * sizeof(struct http_idle));
+	}
+	idle = &pool->idle[pool->number++];
+	idle->sock = sock;
+	strcpy(idle->host, server->host);
+	strcpy(idle->port, server->port);
+	idle->since = gitt_io_now();
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* A kept connection to the server, or a new one */
+static int http_attach(struct http_link *link, bool *reused)
+{
+	int ret;
+
+	link->in_pos = 0;
+	link->in_len = 0;
+	link->sock = http_pool_get(link->pool, &link->server);
+	*reused = link->sock >= 0;
+	if (*reused)
+		return 0;
+
+	ret = gitt_io_connect(&link->bound, link->server.host, link->server.port);
+	if (ret < 0)
+		return ret;
+	link->sock = ret;
+
+	return 0;
+}
+
+/* Hosts in no_proxy, separated by commas, or "*", are reached directly */
+static bool http_no_proxy(const char *host)
+{
+	const char *list = getenv("no_proxy");
+	int len = strlen(host);
+	const char *end;
+
+	while (list && *list) {
+		end = strchr(list, ',');
+		end = end ? end : list + strlen(list);
+		if ((end - list == 1 && *list == '*') ||
+		    (end - list == len && !strncmp(list, host, len)))
+			return true;
+		list = *end ? end + 1 : end;
+	}
+
+	return false;
+}
+
+/* Connect to the proxy in http_proxy instead of the server, if there is one */
+static int http_proxy(struct http_link *link)
+{
+	const char *proxy = getenv("http_proxy");
+	char url[96];
+
+	link->server = link->parsed;
+	if (!proxy || !proxy[0] || http_no_proxy(link->parsed.host))
+		return 0;
+
+	/* The proxy may be given without a path */
+	snprintf(url, sizeof(url), "%s%s", proxy,
+		 strlen(proxy) > 7 && strchr(proxy + 7, '/') ? "" : "/");
+	if (gitt_transport_url_pad(&link->server, url, "http://", GITT_TRANSPORT_HTTP_PORT)) {
+		fprintf(stderr, "Cannot use http_proxy: %s\n", proxy);
+		return -GITT_ERRNO_INVAL;
+	}
+	link->flags = GITT_TRANSPORT_HTTP_PROXY;
+
+	return 0;
+}
+
+/* Send the output buffer, all of it unless only what the socket takes now */
+static int http_flush(struct http_link *link, bool all)
+{
+	int done = 0;
+	int ret = 0;
+
+	while (done < link->out_len) {
+		ret = send(link->sock, link->out + done, link->out_len - done, MSG_NOSIGNAL);
+		if (ret >= 0) {
+			done += ret;
+			ret = 0;
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			ret = -GITT_ERRNO_INVAL;
+			break;
+		}
+		ret = 0;
+		if (!all)
+			break;
+		ret = gitt_io_poll(&link->bound, link->sock, POLLOUT);
+		if (ret)
+			break;
+	}
+
+	memmove(link->out, link->out + done, link->out_len - done);
+	link->out_len -= done;
+
+	return ret;
+}
+
+/* Read more of the response once the input buffer is used up, 0 at the end */
+static int http_fill(struct http_link *link)
+{
+	int ret;
+
+	link->in_pos = 0;
+	link->in_len = 0;
+	for (;;) {
+		ret = recv(link->sock, link->in, sizeof(link->in), 0);
+		if (ret >= 0) {
+			link->in_len = ret;
+			return ret;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return -GITT_ERRNO_INVAL;
+		if (link->nonblock)
+			return -GITT_ERRNO_AGAIN;
+
+		ret = gitt_io_poll(&link->bound, link->sock, POLLIN);
+		if (ret)
+			return ret;
+	}
+}
+
+/* Queue the head of a request */
+static int http_request(struct http_link *link, uint8_t flags)
+{
+	int len;
+
+	len = gitt_transport_http_request((char *)link->out + link->out_len,
+					  sizeof(link->out) - link->out_len, &link->parsed,
+					  link->exec, link->protocol[0] ? link->protocol : NULL,
+					  flags | link->flags);
+	if (len < 0)
+		return len;
+	link->out_len += len;
+
+	return 0;
+}
+
+/* Read the head of the response, the body is read next */
+static int http_head(struct http_link *link)
+{
+	int ret;
+
+	while (link->http.state < GITT_TRANSPORT_HTTP_BODY) {
+		if (link->in_pos == link->in_len) {
+			ret = http_fill(link);
+			if (ret <= 0)
+				return ret ? ret : -GITT_ERRNO_INVAL;
+		}
+		ret = gitt_transport_http_head(&link->http, (char *)link->in + link->in_pos,
+					       link->in_len - link->in_pos);
+		if (ret < 0)
+			return ret;
+		link->in_pos += ret;
+	}
+
+	if (link->http.status != 200) {
+		fprintf(stderr, "HTTP %u from %s\n", link->http.status, link->parsed.host);
+		return -GITT_ERRNO_INVAL;
+	}
+
+	if (link->http.gzip) {
+		memset(&link->inflate, 0, sizeof(z_stream));
+		if (inflateInit2(&link->inflate, 16 + MAX_WBITS) != Z_OK)
+			return -GITT_ERRNO_NOMEM;
+		link->inflating = true;
+		link->inflate_full = false;
+	}
+
+	return 0;
+}
+
+/* Up to size bytes of the body, 0 at its end */
+static int http_body(struct http_link *link, char *buf, int size)
+{
+	bool payload;
+	int avail;
+	int ret;
+
+	for (;;) {
+		/* Inflate what is taken, it may give more than fits at once */
+		if (link->inflating && (link->inflate.avail_in || link->inflate_full)) {
+			link->inflate.next_out = (Bytef *)buf;
+			link->inflate.avail_out = size;
+			ret = inflate(&link->inflate, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END)
+				link->inflate.avail_in = 0;
+			else if (ret != Z_OK && ret != Z_BUF_ERROR)
+				return -GITT_ERRNO_INVAL;
+			link->inflate_full = !link->inflate.avail_out;
+			if (size - (int)link->inflate.avail_out)
+				return size - link->inflate.avail_out;
+			link->inflate.avail_in = 0;
+			continue;
+		}
+
+		if (link->http.state == GITT_TRANSPORT_HTTP_DONE)
+			return 0;
+
+		if (link->in_pos == link->in_len) {
+			ret = http_fill(link);
+			if (ret < 0)
+				return ret;
+
+			/* A body with no size and no chunks ends with the connection */
+			if (!ret && link->http.state == GITT_TRANSPORT_HTTP_BODY &&
+			    !link->http.sized) {
+				link->http.state = GITT_TRANSPORT_HTTP_DONE;
+				continue;
+			} else if (!ret) {
+				return -GITT_ERRNO_INVAL;
+			}
+		}
+
+		avail = link->in_len - link->in_pos;
+		if (!link->inflating && avail > size)
+			avail = size;
+		ret = gitt_transport_http_body(&link->http, link->in + link->in_pos, avail,
+					       &payload);
+		if (ret < 0)
+			return ret;
+
+		if (payload && link->inflating) {
+			link->inflate.next_in = link->in + link->in_pos;
+			link->inflate.avail_in = ret;
+		} else if (payload) {
+			memcpy(buf, link->in + link->in_pos, ret);
+			link->in_pos += ret;
+			return ret;
+		}
+		link->in_pos += ret;
+	}
+}
+
+/* Exactly size bytes of the body */
+static int http_body_all(struct http_link *link, char *buf, int size)
+{
+	int done = 0;
+	int ret;
+
+	while (done < size) {
+		ret = http_body(link, buf + done, size - done);
+		if (ret <= 0)
+			return ret ? ret : -GITT_ERRNO_INVAL;
+		done += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * The refs of v0 come after "# service=<exec>" and a flush-pkt, which are
+ * not for the command. What comes instead is given to the first reads.
+ */
+static int http_service(struct http_link *link)
+{
+	char line[64];
+	long length;
+	int ret;
+
+	ret = http_body_all(link, link->held, sizeof(link->held));
+	if (ret)
+		return ret;
+	if (link->held[4] != '#') {
+		link->held_len = sizeof(link->held);
+		return 0;
+	}
+
+	memcpy(line, link->held, 4);
+	line[4] = '\0';
+	length = strtol(line, NULL, 16);
+	if (length < 5 || length - 5 + 4 > sizeof(line))
+		return -GITT_ERRNO_INVAL;
+
+	ret = http_body_all(link, line, length - 5 + 4);
+	if (ret)
+		return ret;
+	if (memcmp(line + length - 5, "0000", 4))
+		return -GITT_ERRNO_INVAL;
+
+	return 0;
+}
+
+/*
+ * Read what is left of the response, with waits of up to idle ms if it is
+ * set. True if it ended cleanly and the connection can take another request.
+ */
+static bool http_drain(struct http_link *link, uint32_t idle)
+{
+	struct gitt_io_bound bound = link->bound;
+	bool nonblock = link->nonblock;
+	char buf[256];
+	int total = 0;
+	int ret;
+
+	if (link->broken || link->sending || link->http.close ||
+	    link->http.state < GITT_TRANSPORT_HTTP_BODY)
+		return false;
+
+	if (idle) {
+		link->bound.limit.idle = idle;
+		link->bound.limit.total = 0;
+	}
+	link->nonblock = false;
+	while (link->http.state != GITT_TRANSPORT_HTTP_DONE && total < HTTP_DRAIN_MAX) {
+		ret = http_body(link, buf, sizeof(buf));
+		if (ret <= 0)
+			break;
+		total += ret;
+	}
+	link->nonblock = nonblock;
+	link->bound = bound;
+
+	return link->http.state == GITT_TRANSPORT_HTTP_DONE && !link->http.close &&
+	       link->in_pos == link->in_len;
+}
+
+/* Start a POST, on the connection of the last response if it ended cleanly */
+static int http_post(struct http_link *link)
+{
+	uint8_t flags = GITT_TRANSPORT_HTTP_POST;
+	bool reused;
+	int ret;
+
+	if (!http_drain(link, 0)) {
+		close(link->sock);
+		ret = http_attach(link, &reused);
+		if (ret)
+			return ret;
+	}
+	if (link->inflating) {
+		inflateEnd(&link->inflate);
+		link->inflating = false;
+	}
+	link->held_len = 0;
+
+	/* Negotiation is text and compresses well, a pack does not */
+	if (!strcmp(link->exec, "git-upload-pack")) {
+		memset(&link->deflate, 0, sizeof(z_stream));
+		if (deflateInit2(&link->deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return -GITT_ERRNO_NOMEM;
+		link->deflating = true;
+		flags |= GITT_TRANSPORT_HTTP_GZIP;
+	}
+
+	ret = http_request(link, flags);
+	if (ret)
+		return ret;
+	link->sending = true;
+
+	return 0;
+}
+
+/*
+ * Queue up to size bytes of the body as one chunk, compressed if the body
+ * is. end finishes the compressed stream. Returns the bytes taken, 0 if the
+ * output buffer is too full.
+ */
+static int http_chunk(struct http_link *link, char *data, int size, bool end)
+{
+	int room = sizeof(link->out) - link->out_len - HTTP_CHUNK_HEAD - HTTP_CHUNK_TAIL;
+	uint8_t *body = link->out + link->out_len + HTTP_CHUNK_HEAD;
+	char head[HTTP_CHUNK_HEAD + 1];
+	int take;
+	int made;
+	int ret;
+
+	if (room < HTTP_CHUNK_MIN)
+		return 0;
+
+	if (link->deflating) {
+		link->deflate.next_in = (Bytef *)data;
+		link->deflate.avail_in = size;
+		link->deflate.next_out = body;
+		link->deflate.avail_out = room;
+		ret = deflate(&link->deflate, end ? Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_ERROR)
+			return -GITT_ERRNO_INVAL;
+		take = size - link->deflate.avail_in;
+		made = room - link->deflate.avail_out;
+		if (ret == Z_STREAM_END) {
+			deflateEnd(&link->deflate);
+			link->deflating = false;
+		}
+	} else {
+		take = size < room ? size : room;
+		made = take;
+		memcpy(body, data, take);
+	}
+
+	/* The size is padded with zeros, so that the chunk is made in place */
+	if (made) {
+		snprintf(head, sizeof(head), "%08x\r\n", made);
+		memcpy(link->out + link->out_len, head, HTTP_CHUNK_HEAD);
+		memcpy(body + made, "\r\n", HTTP_CHUNK_TAIL);
+		link->out_len += HTTP_CHUNK_HEAD + made + HTTP_CHUNK_TAIL;
+	}
+
+	return take;
+}
+
+/*
+ * The command reads, so the body is over: send the last chunk, then read
+ * the response. This is written at once even when non-blocking, the
+ * server is reading it.
+ */
+static int http_finish(struct http_link *link)
+{
+	int ret;
+
+	while (link->deflating) {
+		ret = http_chunk(link, NULL, 0, true);
+		if (ret < 0)
+			return ret;
+		if (link->deflating) {
+			ret = http_flush(link, true);
+			if (ret)
+				return ret;
+		}
+	}
+
+	if (sizeof(link->out) - link->out_len < 5) {
+		ret = http_flush(link, true);
+		if (ret)
+			return ret;
+	}
+	memcpy(link->out + link->out_len, "0\r\n\r\n", 5);
+	link->out_len += 5;
+
+	ret = http_flush(link, true);
+	if (ret)
+		return ret;
+
+	link->sending = false;
+	gitt_transport_http_begin(&link->http);
+
+	return 0;
+}
+
+static void http_free(struct http_link *link)
+{
+	if (link->deflating)
+		deflateEnd(&link->deflate);
+	if (link->inflating)
+		inflateEnd(&link->inflate);
+	if (link->sock >= 0)
+		close(link->sock);
+	free(link);
+}
+
+static int http_open(void *param, void **handle, const char *url, const char *exec,
+		     const char *protocol, struct gitt_ssh_limit *limit)
+{
+	struct http_link *link;
+	char type[48];
+	bool reused;
+	int ret;
+
+	if (strlen(exec) >= sizeof(link->exec) ||
+	    (protocol && strlen(protocol) >= sizeof(link->protocol)))
+		return -GITT_ERRNO_INVAL;
+
+	link = (struct http_link *)calloc(1, sizeof(struct http_link));
+	if (!link)
+		return -GITT_ERRNO_NOMEM;
+	link->sock = -1;
+	gitt_io_begin(&link->bound, limit);
+	link->pool = (struct http_pool *)param;
+	strcpy(link->exec, exec);
+	if (protocol)
+		strcpy(link->protocol, protocol);
+
+	ret = gitt_transport_url_pad(&link->parsed, url, "http://", GITT_TRANSPORT_HTTP_PORT);
+	if (ret) {
+		if (!strncmp(url, "https://", 8))
+			fprintf(stderr, "https:// is not supported\n");
+		goto err;
+	}
+	ret = http_proxy(link);
+	if (ret)
+		goto err;
+
+	/* A kept connection may have been closed by the server meanwhile, then connect */
+	do {
+		ret = http_attach(link, &reused);
+		if (ret)
+			goto err;
+
+		gitt_transport_http_begin(&link->http);
+		ret = http_request(link, 0);
+		if (!ret)
+			ret = http_flush(link, true);
+		if (!ret)
+			ret = http_head(link);
+		if (ret) {
+			close(link->sock);
+			link->sock = -1;
+			link->out_len = 0;
+		}
+	} while (ret && reused && ret != -GITT_ERRNO_TIMEOUT && ret != -GITT_ERRNO_CANCELED &&
+		 link->http.state == GITT_TRANSPORT_HTTP_STATUS && !link->http.line_len);
+	if (ret)
+		goto err;
+
+	/* A dumb server sends the refs as a file */
+	snprintf(type, sizeof(type), "application/x-%s-advertisement", exec);
+	if (strncmp(link->http.type, type, strlen(type))) {
+		fprintf(stderr, "Not a smart HTTP server: %s\n", link->parsed.host);
+		ret = -GITT_ERRNO_INVAL;
+		goto err;
+	}
+
+	ret = http_service(link);
+	if (ret)
+		goto err;
+
+	*handle = link;
+	return 0;
+
+err:
+	http_free(link);
+	return ret;
+}
+
+static int http_read(void *handle, char *buf, int size)
+{
+	struct http_link *link = (struct http_link *)handle;
+	int wait;
+	int ret;
+
+	/* A non-blocking caller bounds the waits for the fd, only the total here */
+	ret = gitt_io_wait(&link->bound, gitt_io_now(), &wait);
+	if (ret)
+		return ret;
+
+	if (link->held_pos < link->held_len) {
+		ret = link->held_len - link->held_pos;
+		ret = ret < size ? ret : size;
+		memcpy(buf, link->held + link->held_pos, ret);
+		link->held_pos += ret;
+		return ret;
+	}
+
+	if (link->sending) {
+		ret = http_finish(link);
+		if (ret)
+			goto out;
+	}
+	if (link->http.state < GITT_TRANSPORT_HTTP_BODY) {
+		ret = http_head(link);
+		if (ret)
+			goto out;
+	}
+	ret = http_body(link, buf, size);
+
+out:
+	if (ret < 0 && ret != -GITT_ERRNO_AGAIN)
+		link->broken = true;
+	return ret;
+}
+
+static int http_write(void *handle, char *buf, int size)
+{
+	struct http_link *link = (struct http_link *)handle;
+	int done = 0;
+	int wait;
+	int ret;
+
+	ret = gitt_io_wait(&link->bound, gitt_io_now(), &wait);
+	if (ret)
+		return ret;
+
+	if (!link->sending) {
+		ret = http_post(link);
+		if (ret)
+			goto out;
+	}
+
+	while (done < size) {
+		ret = http_chunk(link, buf + done, size - done, false);
+		if (ret < 0)
+			goto out;
+		done += ret;
+		if (ret)
+			continue;
+
+		/* The output buffer is full */
+		ret = http_flush(link, !link->nonblock);
+		if (ret)
+			goto out;
+		if (link->nonblock &&
+		    sizeof(link->out) - link->out_len < HTTP_CHUNK_HEAD + HTTP_CHUNK_MIN + HTTP_CHUNK_TAIL)
+			break;
+	}
+	ret = done ? done : -GITT_ERRNO_AGAIN;
+
+out:
+	if (ret < 0 && ret != -GITT_ERRNO_AGAIN)
+		link->broken = true;
+	return ret;
+}
+
+static int http_nonblock(void *handle, bool nonblock)
+{
+	struct http_link *link = (struct http_link *)handle;
+
+	link->nonblock = nonblock;
+	return 0;
+}
+
+static int http_fd(void *handle, bool write)
+{
+	struct http_link *link = (struct http_link *)handle;
+
+	return link->sock;
+}
+
+/* The connection is kept if its response was read to the end */
+static void http_close(void *handle)
+{
+	struct http_link *link = (struct http_link *)handle;
+
+	if (http_drain(link, HTTP_DRAIN_WAIT)) {
+		http_pool_put(link->pool, &link->server, link->sock);
+		link->sock = -1;
+	}
+	http_free(link);
+}
+
+static struct http_pool http_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct gitt_transport http_transport = {
+	.open = http_open,
+	.read = http_read,
+	.write = http_write,
+	.nonblock = http_nonblock,
+	.fd = http_fd,
+	.close = http_close,
+	.param = &http_pool,
+	.stateless = true,
+};
+
+/* Pull from and push to a smart HTTP server, with connections kept between commands */
+struct gitt_transport *gitt_http_impl(void)
+{
+	return &http_transport;
+}
@@ -0,0 +1,761 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <gitt_errno.h>
+#include "gitt_hub.h"
+
+#define HUB_STATE_IDLE			0	/* In the heap until the next poll */
+#define HUB_STATE_QUEUED		1	/* On a worker */
+#define HUB_STATE_WAITING		2	/* Waiting for its fd, in the heap if it is kicked */
+
+#define HUB_HEAP_NONE			0xffffffff
+#define HUB_EVENTS			64
+#define HUB_IDLE_TICK			1000
+
+/* A worker steps the repositories of its queue, or takes the last one of another queue */
+struct hub_worker {
+	struct gitt_hub *hub;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct gitt_hub_repo *head;
+	struct gitt_hub_repo *tail;
+};
+
+/* Repositories waiting for one fd, a shared SSH session has several */
+struct hub_fd {
+	struct gitt_hub_repo *waiters;
+	uint32_t events;
+};
+
+/*
+ * The heap, the fd table and the repository list belong to the thread of
+ * gitt_hub_run(). lock guards the rest, which the workers share.
+ */
+struct gitt_hub {
+	int epoll;
+	int wake;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t pending;
+	bool stop;
+	struct gitt_hub_repo *done;
+	struct gitt_hub_metrics metrics;
+	struct hub_worker *workers;
+	uint32_t worker_num;
+	struct gitt_hub_repo **heap;
+	uint32_t heap_num;
+	uint32_t heap_len;
+	struct gitt_hub_repo **repos;
+	uint32_t repo_num;
+	uint32_t repo_len;
+	struct hub_fd *fds;
+	int fd_len;
+	uint32_t homes;
+	uint64_t idle_at;
+};
+
+static uint64_t hub_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Room for one more repository */
+static int hub_grow(struct gitt_hub_repo ***array, uint32_t number, uint32_t *length)
+{
+	struct gitt_hub_repo **items;
+	uint32_t size;
+
+	if (number < *length)
+		return 0;
+
+	size = *length ? *length * 2 : 64;
+	items = (struct gitt_hub_repo **)realloc(*array, size * sizeof(*items));
+	if (!items)
+		return -GITT_ERRNO_NOMEM;
+
+	*array = items;
+	*length = size;
+	return 0;
+}
+
+static void hub_heap_set(struct gitt_hub *hub, uint32_t index, struct gitt_hub_repo *repo)
+{
+	hub->heap[index] = repo;
+	repo->heap = index;
+}
+
+static void hub_heap_up(struct gitt_hub *hub, uint32_t index)
+{
+	struct gitt_hub_repo *repo = hub->heap[index];
+	uint32_t parent;
+
+	while (index) {
+		parent = (index - 1) / 2;
+		if (hub->heap[parent]->due <= repo->due)
+			break;
+		hub_heap_set(hub, index, hub->heap[parent]);
+		index = parent;
+	}
+	hub_heap_set(hub, index, repo);
+}
+
+static void hub_heap_down(struct gitt_hub *hub, uint32_t index)
+{
+	struct gitt_hub_repo *repo = hub->heap[index];
+	uint32_t child;
+
+	while ((child = index * 2 + 1) < hub->heap_num) {
+		if (child + 1 < hub->heap_num && hub->heap[child + 1]->due < hub->heap[child]->due)
+			child++;
+		if (repo->due <= hub->heap[child]->due)
+			break;
+		hub_heap_set(hub, index, hub->heap[child]);
+		index = child;
+	}
+	hub_heap_set(hub, index, repo);
+}
+
+static int hub_heap_push(struct gitt_hub *hub, struct gitt_hub_repo *repo, uint64_t due)
+{
+	int ret;
+
+	ret = hub_grow(&hub->heap, hub->heap_num, &hub->heap_len);
+	if (ret)
+		return ret;
+
+	repo->due = due;
+	hub_heap_set(hub, hub->heap_num++, repo);
+	hub_heap_up(hub, repo->heap);
+	return 0;
+}
+
+static void hub_heap_del(struct gitt_hub *hub, struct gitt_hub_repo *repo)
+{
+	uint32_t index = repo->heap;
+	struct gitt_hub_repo *last;
+
+	if (index == HUB_HEAP_NONE)
+		return;
+
+	repo->heap = HUB_HEAP_NONE;
+	last = hub->heap[--hub->heap_num];
+	if (last == repo)
+		return;
+
+	hub_heap_set(hub, index, last);
+	hub_heap_up(hub, index);
+	hub_heap_down(hub, last->heap);
+}
+
+/* Wait for the fd, with the other repositories waiting for it */
+static int hub_wait(struct gitt_hub *hub, struct gitt_hub_repo *repo, int want)
+{
+	struct epoll_event event;
+	struct hub_fd *entry;
+	struct hub_fd *fds;
+	int length;
+	int op;
+
+	if (repo->fd < 0)
+		return -GITT_ERRNO_INVAL;
+
+	if (repo->fd >= hub->fd_len) {
+		length = repo->fd + 64;
+		fds = (struct hub_fd *)realloc(hub->fds, length * sizeof(struct hub_fd));
+		if (!fds)
+			return -GITT_ERRNO_NOMEM;
+		memset(fds + hub->fd_len, 0, (length - hub->fd_len) * sizeof(struct hub_fd));
+		hub->fds = fds;
+		hub->fd_len = length;
+	}
+
+	entry = &hub->fds[repo->fd];
+	event.events = entry->events;
+	event.events |= want == GITT_REPOSITORY_WANT_WRITE ? EPOLLOUT : EPOLLIN;
+	event.data.fd = repo->fd;
+	if (event.events != entry->events) {
+		op = entry->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		if (epoll_ctl(hub->epoll, op, repo->fd, &event)) {
+			fprintf(stderr, "Cannot wait for fd %d: %s\n", repo->fd, strerror(errno));
+			return -GITT_ERRNO_INVAL;
+		}
+		entry->events = event.events;
+	}
+
+	repo->prev = NULL;
+	repo->next = entry->waiters;
+	if (entry->waiters)
+		entry->waiters->prev = repo;
+	entry->waiters = repo;
+
+	return 0;
+}
+
+static void hub_unwait(struct gitt_hub *hub, struct gitt_hub_repo *repo)
+{
+	struct hub_fd *entry;
+
+	if (repo->fd < 0)
+		return;
+
+	entry = &hub->fds[repo->fd];
+	if (repo->prev)
+		repo->prev->next = repo->next;
+	else
+		entry->waiters = repo->next;
+	if (repo->next)
+		repo->next->prev = repo->prev;
+	repo->prev = NULL;
+	repo->next = NULL;
+
+	/* Nobody left, the fd may be closed and reused */
+	if (!entry->waiters && entry->events) {
+		epoll_ctl(hub->epoll, EPOLL_CTL_DEL, repo->fd, NULL);
+		entry->events = 0;
+	}
+	repo->fd = -1;
+}
+
+/* Queue the next step of the repository on its worker */
+static void hub_dispatch(struct gitt_hub *hub, struct gitt_hub_repo *repo)
+{
+	struct hub_worker *worker = &hub->workers[repo->home];
+
+	repo->state = HUB_STATE_QUEUED;
+
+	pthread_mutex_lock(&worker->lock);
+	repo->prev = worker->tail;
+	repo->next = NULL;
+	if (worker->tail)
+		worker->tail->next = repo;
+	else
+		worker->head = repo;
+	worker->tail = repo;
+	pthread_mutex_unlock(&worker->lock);
+
+	pthread_mutex_lock(&hub->lock);
+	hub->pending++;
+	pthread_cond_signal(&hub->cond);
+	pthread_mutex_unlock(&hub->lock);
+}
+
+/*
+ * The front of our queue, or the back of another one. A pending count was
+ * taken for it, so there is one somewhere.
+ */
+static struct gitt_hub_repo *hub_take(struct gitt_hub *hub, struct hub_worker *worker)
+{
+	struct gitt_hub_repo *repo = NULL;
+	struct hub_worker *victim;
+	uint32_t index = worker - hub->workers;
+	uint32_t count;
+
+	for (count = 0; !repo; count++) {
+		victim = &hub->workers[(index + count) % hub->worker_num];
+
+		pthread_mutex_lock(&victim->lock);
+		repo = victim == worker ? victim->head : victim->tail;
+		if (repo) {
+			if (repo->prev)
+				repo->prev->next = repo->next;
+			else
+				victim->head = repo->next;
+			if (repo->next)
+				repo->next->prev = repo->prev;
+			else
+				victim->tail = repo->prev;
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+
+	if (victim != worker) {
+		pthread_mutex_lock(&hub->lock);
+		hub->metrics.steals++;
+		pthread_mutex_unlock(&hub->lock);
+	}
+
+	return repo;
+}
+
+/* Connect if needed and go on with the pull, reading and unpacking happen here */
+static void hub_step(struct gitt_hub_repo *repo)
+{
+	int ret;
+
+	if (!repo->begun) {
+		ret = gitt_update_begin(repo->g);
+		if (ret) {
+			repo->ret = ret;
+			return;
+		}
+		repo->begun = true;
+	}
+
+	ret = gitt_update_step(repo->g, &repo->fd);
+	if (ret <= 0) {
+		gitt_update_end(repo->g);
+		repo->begun = false;
+	}
+	repo->ret = ret;
+}
+
+static void *hub_worker_thread(void *arg)
+{
+	struct hub_worker *worker = (struct hub_worker *)arg;
+	struct gitt_hub *hub = worker->hub;
+	struct gitt_hub_repo *repo;
+	uint64_t one = 1;
+
+	while (1) {
+		pthread_mutex_lock(&hub->lock);
+		while (!hub->pending && !hub->stop)
+			pthread_cond_wait(&hub->cond, &hub->lock);
+		if (hub->stop) {
+			pthread_mutex_unlock(&hub->lock);
+			break;
+		}
+		hub->pending--;
+		pthread_mutex_unlock(&hub->lock);
+
+		repo = hub_take(hub, worker);
+		hub_step(repo);
+
+		pthread_mutex_lock(&hub->lock);
+		repo->next = hub->done;
+		hub->done = repo;
+		pthread_mutex_unlock(&hub->lock);
+
+		if (write(hub->wake, &one, sizeof(one)) != sizeof(one))
+			fprintf(stderr, "Cannot wake the hub\n");
+	}
+
+	return NULL;
+}
+
+/* When a waiting pull is stepped without its fd, UINT64_MAX for never */
+static uint64_t hub_kick_due(struct gitt_hub_repo *repo, uint64_t now)
+{
+	struct gitt *g = repo->g;
+	uint64_t due = UINT64_MAX;
+
+	if (!g->transport && g->pool)
+		due = now + repo->kick;
+	if (g->timeout_total && repo->start + g->timeout_total < due)
+		due = repo->start + g->timeout_total;
+	if (g->cancel && now + GITT_HUB_KICK_MAX < due)
+		due = now + GITT_HUB_KICK_MAX;
+
+	return due;
+}
+
+/* A step is back from the worker: wait for the fd, or the pull is over */
+static void hub_finish(struct gitt_hub *hub, struct gitt_hub_repo *repo, uint64_t now)
+{
+	uint64_t latency;
+	uint64_t due;
+
+	if (repo->ret > 0) {
+		repo->state = HUB_STATE_WAITING;
+		due = hub_kick_due(repo, now);
+		if (hub_wait(hub, repo, repo->ret)) {
+			/* Nothing to wait for, step it again soon */
+			repo->fd = -1;
+			if (due > now + GITT_HUB_KICK)
+				due = now + GITT_HUB_KICK;
+		}
+		if (due == UINT64_MAX || !hub_heap_push(hub, repo, due))
+			return;
+		/* Lost track of it, end the pull */
+		hub_unwait(hub, repo);
+		gitt_update_end(repo->g);
+		repo->begun = false;
+		repo->ret = -GITT_ERRNO_NOMEM;
+	}
+
+	repo->fd = -1;
+	latency = now - repo->start;
+	pthread_mutex_lock(&hub->lock);
+	hub->metrics.active--;
+	hub->metrics.polls++;
+	if (repo->ret < 0)
+		hub->metrics.failed++;
+	hub->metrics.latency_total += latency;
+	if (latency > hub->metrics.latency_max)
+		hub->metrics.latency_max = latency;
+	pthread_mutex_unlock(&hub->lock);
+
+	repo->state = HUB_STATE_IDLE;
+	if (hub_heap_push(hub, repo, now + (uint64_t)repo->interval * 1000))
+		fprintf(stderr, "No memory to schedule a repository, it is not polled again\n");
+
+	if (repo->done)
+		repo->done(repo, repo->ret);
+}
+
+static void hub_finished(struct gitt_hub *hub)
+{
+	struct gitt_hub_repo *repo;
+	struct gitt_hub_repo *next;
+	uint64_t now = hub_now();
+	uint32_t steps = 0;
+
+	pthread_mutex_lock(&hub->lock);
+	repo = hub->done;
+	hub->done = NULL;
+	pthread_mutex_unlock(&hub->lock);
+
+	for (; repo; repo = next) {
+		next = repo->next;
+		repo->next = NULL;
+		hub_finish(hub, repo, now);
+		steps++;
+	}
+
+	pthread_mutex_lock(&hub->lock);
+	hub->metrics.steps += steps;
+	pthread_mutex_unlock(&hub->lock);
+}
+
+/* Start the polls that are due, and step the pulls that waited too long */
+static void hub_timers(struct gitt_hub *hub, uint64_t now)
+{
+	struct gitt_hub_repo *repo;
+	uint32_t index;
+
+	while (hub->heap_num && hub->heap[0]->due <= now) {
+		repo = hub->heap[0];
+		hub_heap_del(hub, repo);
+
+		pthread_mutex_lock(&hub->lock);
+		if (repo->state == HUB_STATE_WAITING) {
+			hub->metrics.kicks++;
+		} else {
+			repo->start = now;
+			hub->metrics.active++;
+		}
+		pthread_mutex_unlock(&hub->lock);
+
+		/* Nothing came, wait longer the next time */
+		if (repo->state == HUB_STATE_WAITING)
+			repo->kick = repo->kick * 2 < GITT_HUB_KICK_MAX ?
+				     repo->kick * 2 : GITT_HUB_KICK_MAX;
+		else
+			repo->kick = GITT_HUB_KICK;
+
+		if (repo->state == HUB_STATE_WAITING)
+			hub_unwait(hub, repo);
+		hub_dispatch(hub, repo);
+	}
+
+	/* Keep the idle sessions alive, or close them */
+	if (now - hub->idle_at < HUB_IDLE_TICK)
+		return;
+	for (index = 0; index < hub->repo_num; index++)
+		if (hub->repos[index]->state == HUB_STATE_IDLE)
+			gitt_idle(hub->repos[index]->g, (now - hub->idle_at) / 1000);
+	hub->idle_at = now;
+}
+
+static void hub_ready(struct gitt_hub *hub, int fd)
+{
+	struct gitt_hub_repo *repo;
+	uint32_t wakeups = 0;
+
+	if (fd < 0 || fd >= hub->fd_len)
+		return;
+
+	while ((repo = hub->fds[fd].waiters)) {
+		hub_unwait(hub, repo);
+		hub_heap_del(hub, repo);
+		repo->kick = GITT_HUB_KICK;
+		hub_dispatch(hub, repo);
+		wakeups++;
+	}
+
+	pthread_mutex_lock(&hub->lock);
+	hub->metrics.wakeups += wakeups;
+	pthread_mutex_unlock(&hub->lock);
+}
+
+/**
+ * @brief Create a hub with a pool of worker threads
+ *
+ * @param workers Number of threads
+ * @return struct gitt_hub* NULL: Error
+ */
+struct gitt_hub *gitt_hub_alloc(uint32_t workers)
+{
+	struct epoll_event event;
+	struct gitt_hub *hub;
+	uint32_t index;
+
+	if (!workers)
+		return NULL;
+
+	hub = (struct gitt_hub *)calloc(1, sizeof(struct gitt_hub));
+	if (!hub)
+		return NULL;
+
+	hub->workers = (struct hub_worker *)calloc(workers, sizeof(struct hub_worker));
+	if (!hub->workers)
+		goto err0;
+
+	hub->epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (hub->epoll < 0)
+		goto err1;
+
+	hub->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (hub->wake < 0)
+		goto err2;
+
+	event.events = EPOLLIN;
+	event.data.fd = hub->wake;
+	if (epoll_ctl(hub->epoll, EPOLL_CTL_ADD, hub->wake, &event))
+		goto err3;
+
+	pthread_mutex_init(&hub->lock, NULL);
+	pthread_cond_init(&hub->cond, NULL);
+	hub->idle_at = hub_now();
+
+	for (index = 0; index < workers; index++) {
+		hub->workers[index].hub = hub;
+		pthread_mutex_init(&hub->workers[index].lock, NULL);
+		if (pthread_create(&hub->workers[index].thread, NULL, hub_worker_thread,
+				   &hub->workers[index]))
+			break;
+		hub->worker_num++;
+	}
+	if (!hub->worker_num) {
+		gitt_hub_free(hub);
+		return NULL;
+	}
+
+	return hub;
+
+err3:
+	close(hub->wake);
+err2:
+	close(hub->epoll);
+err1:
+	free(hub->workers);
+err0:
+	free(hub);
+	return NULL;
+}
+
+/**
+ * @brief Poll the repository every repo->interval seconds, starting now
+ *
+ * @param hub
+ * @param repo
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_hub_add(struct gitt_hub *hub, struct gitt_hub_repo *repo)
+{
+	int ret;
+
+	if (!hub || !repo || !repo->g)
+		return -GITT_ERRNO_INVAL;
+
+	ret = hub_grow(&hub->repos, hub->repo_num, &hub->repo_len);
+	if (ret)
+		return ret;
+
+	repo->hub = hub;
+	repo->prev = NULL;
+	repo->next = NULL;
+	repo->state = HUB_STATE_IDLE;
+	repo->begun = false;
+	repo->fd = -1;
+	repo->kick = GITT_HUB_KICK;
+	repo->home = hub->homes++ % hub->worker_num;
+	ret = hub_heap_push(hub, repo, hub_now());
+	if (ret)
+		return ret;
+
+	hub->repos[hub->repo_num] = repo;
+	hub->repo_num++;
+
+	pthread_mutex_lock(&hub->lock);
+	hub->metrics.repos++;
+	pthread_mutex_unlock(&hub->lock);
+
+	return 0;
+}
+
+/**
+ * @brief Stop polling the repository, a pull it is waiting in is ended
+ *
+ * @param hub
+ * @param repo
+ * @return int 0: Good
+ * @return int -GITT_ERRNO_AGAIN: A worker has it, run the hub and try again
+ */
+int gitt_hub_remove(struct gitt_hub *hub, struct gitt_hub_repo *repo)
+{
+	uint32_t index;
+
+	if (!hub || !repo || repo->hub != hub)
+		return -GITT_ERRNO_INVAL;
+
+	if (repo->state == HUB_STATE_QUEUED)
+		return -GITT_ERRNO_AGAIN;
+
+	hub_heap_del(hub, repo);
+	if (repo->state == HUB_STATE_WAITING) {
+		hub_unwait(hub, repo);
+		gitt_update_end(repo->g);
+		repo->begun = false;
+		pthread_mutex_lock(&hub->lock);
+		hub->metrics.active--;
+		pthread_mutex_unlock(&hub->lock);
+	}
+
+	for (index = 0; index < hub->repo_num; index++) {
+		if (hub->repos[index] == repo) {
+			hub->repos[index] = hub->repos[--hub->repo_num];
+			break;
+		}
+	}
+	repo->hub = NULL;
+
+	pthread_mutex_lock(&hub->lock);
+	hub->metrics.repos--;
+	pthread_mutex_unlock(&hub->lock);
+
+	return 0;
+}
+
+/**
+ * @brief Start the polls that are due, wait for the fds and the workers,
+ *        and call the done callbacks
+ *
+ * @param hub
+ * @param timeout Most milliseconds to wait, -1 until something is due
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_hub_run(struct gitt_hub *hub, int timeout)
+{
+	struct epoll_event events[HUB_EVENTS];
+	uint64_t counter;
+	uint64_t now;
+	uint64_t wait;
+	int number;
+	int index;
+
+	now = hub_now();
+	hub_timers(hub, now);
+
+	wait = hub->idle_at + HUB_IDLE_TICK - now;
+	if (hub->heap_num)
+		wait = hub->heap[0]->due - now < wait ? hub->heap[0]->due - now : wait;
+	if (timeout < 0 || wait < timeout)
+		timeout = wait;
+
+	number = epoll_wait(hub->epoll, events, HUB_EVENTS, timeout);
+	if (number < 0 && errno != EINTR)
+		return -GITT_ERRNO_INVAL;
+
+	for (index = 0; index < number; index++) {
+		if (events[index].data.fd == hub->wake) {
+			if (read(hub->wake, &counter, sizeof(counter)) < 0 && errno != EAGAIN)
+				fprintf(stderr, "Cannot read the wake counter\n");
+			continue;
+		}
+		hub_ready(hub, events[index].data.fd);
+	}
+
+	hub_finished(hub);
+
+	return 0;
+}
+
+/**
+ * @brief Counters of the hub, latency is from the start to the end of a
+ *        poll in milliseconds
+ *
+ * @param hub
+ * @param metrics Out
+ */
+void gitt_hub_metrics(struct gitt_hub *hub, struct gitt_hub_metrics *metrics)
+{
+	pthread_mutex_lock(&hub->lock);
+	*metrics = hub->metrics;
+	pthread_mutex_unlock(&hub->lock);
+}
+
+/**
+ * @brief Stop the workers, end the pulls in progress and free the hub
+ *
+ * @param hub
+ */
+void gitt_hub_free(struct gitt_hub *hub)
+{
+	uint32_t index;
+
+	if (!hub)
+		return;
+
+	pthread_mutex_lock(&hub->lock);
+	hub->stop = true;
+	pthread_cond_broadcast(&hub->cond);
+	pthread_mutex_unlock(&hub->lock);
+
+	for (index = 0; index < hub->worker_num; index++)
+		pthread_join(hub->workers[index].thread, NULL);
+
+	for (index = 0; index < hub->repo_num; index++) {
+		if (hub->repos[index]->begun)
+			gitt_update_end(hub->repos[index]->g);
+		hub->repos[index]->begun = false;
+		hub->repos[index]->hub = NULL;
+	}
+
+	for (index = 0; index < hub->worker_num; index++)
+		pthread_mutex_destroy(&hub->workers[index].lock);
+	pthread_cond_destroy(&hub->cond);
+	pthread_mutex_destroy(&hub->lock);
+	close(hub->wake);
+	close(hub->epoll);
+	free(hub->fds);
+	free(hub->repos);
+	free(hub->heap);
+	free(hub->workers);
+	free(hub);
+}
@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __GITT_HUB_H_
+#define __GITT_HUB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <gitt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Milliseconds a pull on a shared SSH session waits for its fd before it is
+ * stepped anyway, since another channel may have read its data into the
+ * session. It doubles up to GITT_HUB_KICK_MAX while nothing comes. Other
+ * pulls wait for their fd alone, and are only stepped to see their
+ * timeout_total or cancel.
+ */
+#define GITT_HUB_KICK			100
+#define GITT_HUB_KICK_MAX		1600
+
+struct gitt_hub;
+struct gitt_hub_repo;
+
+typedef void (*gitt_hub_done)(struct gitt_hub_repo *repo, int ret);
+
+/*
+ * A repository polled by the hub. Set g (initialized, with a ring that
+ * holds the advertisement), interval and the optional done callback, the
+ * rest belongs to the hub. The events of g are dumped on a worker thread,
+ * done is called on the thread of gitt_hub_run().
+ */
+struct gitt_hub_repo {
+	struct gitt *g;
+	uint32_t interval;
+	gitt_hub_done done;
+	void *param;
+	/* Private */
+	struct gitt_hub *hub;
+	struct gitt_hub_repo *prev;
+	struct gitt_hub_repo *next;
+	uint8_t state;
+	bool begun;
+	int ret;
+	int fd;
+	uint32_t heap;
+	uint32_t home;
+	uint64_t due;
+	uint64_t start;
+	uint32_t kick;
+};
+
+struct gitt_hub_metrics {
+	uint32_t repos;
+	uint32_t active;
+	uint64_t polls;
+	uint64_t failed;
+	uint64_t steps;
+	uint64_t wakeups;
+	uint64_t kicks;
+	uint64_t steals;
+	uint64_t latency_total;
+	uint64_t latency_max;
+};
+
+struct gitt_hub *gitt_hub_alloc(uint32_t workers);
+int gitt_hub_add(struct gitt_hub *hub, struct gitt_hub_repo *repo);
+int gitt_hub_remove(struct gitt_hub *hub, struct gitt_hub_repo *repo);
+int gitt_hub_run(struct gitt_hub *hub, int timeout);
+void gitt_hub_metrics(struct gitt_hub *hub, struct gitt_hub_metrics *metrics);
+void gitt_hub_free(struct gitt_hub *hub);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __GITT_HUB_H_ */
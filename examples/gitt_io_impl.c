@@ -0,0 +1,188 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <gitt_errno.h>
+#include "gitt_io_impl.h"
+
+/*
+ * Waits of the transports that run on a file descriptor, bounded by the
+ * limits of the command, and the connect of those that run on TCP.
+ */
+
+/**
+ * @brief Milliseconds from a fixed point
+ *
+ * @return uint64_t
+ */
+uint64_t gitt_io_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief The command starts now, with these limits
+ *
+ * @param bound
+ * @param limit As passed to the open of the transport
+ */
+void gitt_io_begin(struct gitt_io_bound *bound, const struct gitt_ssh_limit *limit)
+{
+	bound->limit = *limit;
+	bound->start = gitt_io_now();
+}
+
+/**
+ * @brief How long the next wait may take, after waiting since a time
+ *
+ * @param bound
+ * @param since When the wait began
+ * @param wait Out: milliseconds for poll(), -1 for no limit
+ * @return int 0: Wait
+ * @return int other: -GITT_ERRNO_CANCELED or -GITT_ERRNO_TIMEOUT
+ */
+int gitt_io_wait(struct gitt_io_bound *bound, uint64_t since, int *wait)
+{
+	uint64_t now = gitt_io_now();
+	uint64_t end = UINT64_MAX;
+
+	if (bound->limit.cancel && bound->limit.cancel->canceled)
+		return -GITT_ERRNO_CANCELED;
+	if (bound->limit.idle)
+		end = since + bound->limit.idle;
+	if (bound->limit.total && bound->start + bound->limit.total < end)
+		end = bound->start + bound->limit.total;
+	if (now >= end)
+		return -GITT_ERRNO_TIMEOUT;
+
+	if (end == UINT64_MAX && !bound->limit.cancel)
+		*wait = -1;
+	else
+		*wait = end - now < GITT_IO_LIMIT_WAIT ? (int)(end - now) : GITT_IO_LIMIT_WAIT;
+	return 0;
+}
+
+/**
+ * @brief Wait until the fd is ready, or a limit is reached
+ *
+ * @param bound
+ * @param fd
+ * @param events POLLIN or POLLOUT
+ * @return int 0: Ready
+ * @return int other: Error
+ */
+int gitt_io_poll(struct gitt_io_bound *bound, int fd, short events)
+{
+	struct pollfd pfd = { .fd = fd, .events = events };
+	uint64_t since = gitt_io_now();
+	int wait;
+	int ret;
+
+	do {
+		ret = gitt_io_wait(bound, since, &wait);
+		if (ret)
+			return ret;
+		ret = poll(&pfd, 1, wait);
+	} while (!ret || (ret < 0 && errno == EINTR));
+
+	return ret < 0 ? -GITT_ERRNO_INVAL : 0;
+}
+
+/* Connect to one address, the socket is non-blocking */
+static int gitt_io_connect_to(struct gitt_io_bound *bound, int sock, struct addrinfo *ai)
+{
+	socklen_t len = sizeof(int);
+	int err;
+	int ret;
+
+	if (!connect(sock, ai->ai_addr, ai->ai_addrlen))
+		return 0;
+	if (errno != EINPROGRESS)
+		return -GITT_ERRNO_INVAL;
+
+	ret = gitt_io_poll(bound, sock, POLLOUT);
+	if (ret)
+		return ret;
+	if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+		return -GITT_ERRNO_INVAL;
+
+	return 0;
+}
+
+/**
+ * @brief Connect over TCP to the first address of host that answers
+ *
+ * @param bound
+ * @param host
+ * @param port
+ * @return int >=0: The socket, non-blocking
+ * @return int other: Error
+ */
+int gitt_io_connect(struct gitt_io_bound *bound, const char *host, const char *port)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *list;
+	struct addrinfo *ai;
+	int one = 1;
+	int sock;
+	int ret;
+
+	/* Name lookup itself is not bounded */
+	if (getaddrinfo(host, port, &hints, &list))
+		return -GITT_ERRNO_INVAL;
+
+	ret = -GITT_ERRNO_INVAL;
+	for (ai = list; ai; ai = ai->ai_next) {
+		sock = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			      ai->ai_protocol);
+		if (sock < 0)
+			continue;
+
+		/* Small writes go out at once, the remote waits for them */
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		ret = gitt_io_connect_to(bound, sock, ai);
+		if (!ret) {
+			ret = sock;
+			break;
+		}
+
+		close(sock);
+		if (ret == -GITT_ERRNO_TIMEOUT || ret == -GITT_ERRNO_CANCELED)
+			break;
+	}
+	freeaddrinfo(list);
+
+	return ret;
+}
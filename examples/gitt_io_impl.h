@@ -0,0 +1,57 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __GITT_IO_IMPL_H_
+#define __GITT_IO_IMPL_H_
+
+#include <stdint.h>
+#include <gitt_ssh.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Milliseconds a bounded call waits at once, so that a cancel is seen */
+#define GITT_IO_LIMIT_WAIT		100
+
+/*
+ * The limits of one command of a transport, as passed to its open, and
+ * when it was opened
+ */
+struct gitt_io_bound {
+	struct gitt_ssh_limit limit;
+	uint64_t start;
+};
+
+uint64_t gitt_io_now(void);
+void gitt_io_begin(struct gitt_io_bound *bound, const struct gitt_ssh_limit *limit);
+int gitt_io_wait(struct gitt_io_bound *bound, uint64_t since, int *wait);
+int gitt_io_poll(struct gitt_io_bound *bound, int fd, short events);
+int gitt_io_connect(struct gitt_io_bound *bound, const char *host, const char *port);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __GITT_IO_IMPL_H_ */
@@ -0,0 +1,283 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* pipe2(), execvpe() */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <gitt_transport.h>
+#include <gitt_errno.h>
+#include "gitt_io_impl.h"
+
+/*
+ * Runs git-upload-pack or git-receive-pack on a local bare repository, and
+ * talks to it over a pipe each way. The url is the path of the repository.
+ */
+struct local_link {
+	pid_t pid;
+	int rfd;
+	int wfd;
+	bool nonblock;
+	bool broken;
+	struct gitt_io_bound bound;
+};
+
+/*
+ * Our environment with GIT_PROTOCOL set to protocol. It is built before
+ * fork(), since the child of a threaded process may only call functions
+ * that are async-signal-safe, which setenv() is not.
+ */
+static char **local_env(const char *protocol, char **variable)
+{
+	extern char **environ;
+	char **env;
+	size_t number = 0;
+	size_t count = 0;
+	size_t index;
+
+	while (environ[number])
+		number++;
+
+	env = (char **)calloc(number + 2, sizeof(char *));
+	if (!env)
+		return NULL;
+
+	for (index = 0; index < number; index++) {
+		if (!strncmp(environ[index], "GIT_PROTOCOL=", 13))
+			continue;
+		env[count++] = environ[index];
+	}
+
+	*variable = NULL;
+	if (protocol) {
+		*variable = (char *)malloc(strlen("GIT_PROTOCOL=") + strlen(protocol) + 1);
+		if (!*variable) {
+			free(env);
+			return NULL;
+		}
+		sprintf(*variable, "GIT_PROTOCOL=%s", protocol);
+		env[count++] = *variable;
+	}
+
+	return env;
+}
+
+static int local_open(void *param, void **handle, const char *url, const char *exec,
+		      const char *protocol, struct gitt_ssh_limit *limit)
+{
+	struct local_link *link;
+	char *variable;
+	char **env;
+	int in[2];
+	int out[2];
+
+	/* Only the git commands, run through git itself */
+	if (strncmp(exec, "git-", 4))
+		return -GITT_ERRNO_INVAL;
+
+	link = (struct local_link *)calloc(1, sizeof(struct local_link));
+	if (!link)
+		return -GITT_ERRNO_NOMEM;
+	gitt_io_begin(&link->bound, limit);
+
+	env = local_env(protocol, &variable);
+	if (!env)
+		goto err0;
+
+	if (pipe2(in, O_CLOEXEC))
+		goto err1;
+	if (pipe2(out, O_CLOEXEC))
+		goto err2;
+
+	link->pid = fork();
+	if (link->pid < 0)
+		goto err3;
+
+	if (!link->pid) {
+		char *argv[] = {"git", (char *)exec + 4, "--", (char *)url, NULL};
+
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		/* A url starting with '-' is still a path, not an option */
+		execvpe("git", argv, env);
+		_exit(127);
+	}
+
+	close(in[0]);
+	close(out[1]);
+	free(variable);
+	free(env);
+	link->wfd = in[1];
+	link->rfd = out[0];
+	*handle = link;
+
+	return 0;
+
+err3:
+	close(out[0]);
+	close(out[1]);
+err2:
+	close(in[0]);
+	close(in[1]);
+err1:
+	free(variable);
+	free(env);
+err0:
+	free(link);
+	return -GITT_ERRNO_INVAL;
+}
+
+static int local_read(void *handle, char *buf, int size)
+{
+	struct local_link *link = (struct local_link *)handle;
+	int wait;
+	int ret;
+
+	/* The caller waits for the fd, and bounds that */
+	ret = link->nonblock ? gitt_io_wait(&link->bound, gitt_io_now(), &wait) :
+			       gitt_io_poll(&link->bound, link->rfd, POLLIN);
+	if (ret)
+		goto out;
+
+	do {
+		ret = read(link->rfd, buf, size);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0 && errno == EAGAIN)
+		return -GITT_ERRNO_AGAIN;
+	if (ret < 0)
+		ret = -GITT_ERRNO_INVAL;
+out:
+	if (ret < 0)
+		link->broken = true;
+	return ret;
+}
+
+static int local_write(void *handle, char *buf, int size)
+{
+	struct local_link *link = (struct local_link *)handle;
+	int wait;
+	int done;
+	int ret;
+
+	if (link->nonblock) {
+		ret = gitt_io_wait(&link->bound, gitt_io_now(), &wait);
+		if (ret)
+			goto out;
+		do {
+			ret = write(link->wfd, buf, size);
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0 && errno == EAGAIN)
+			return -GITT_ERRNO_AGAIN;
+		if (ret < 0)
+			ret = -GITT_ERRNO_INVAL;
+		goto out;
+	}
+
+	for (done = 0; done < size; done += ret) {
+		ret = gitt_io_poll(&link->bound, link->wfd, POLLOUT);
+		if (ret)
+			goto out;
+		ret = write(link->wfd, buf + done, size - done);
+		if (ret < 0 && errno == EINTR)
+			ret = 0;
+		else if (ret < 0) {
+			ret = -GITT_ERRNO_INVAL;
+			goto out;
+		}
+	}
+	ret = done;
+out:
+	if (ret < 0)
+		link->broken = true;
+	return ret;
+}
+
+static int local_nonblock(void *handle, bool nonblock)
+{
+	struct local_link *link = (struct local_link *)handle;
+	int fds[2] = { link->rfd, link->wfd };
+	int flags;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		flags = fcntl(fds[i], F_GETFL);
+		if (flags < 0)
+			return -GITT_ERRNO_INVAL;
+		flags = nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+		if (fcntl(fds[i], F_SETFL, flags))
+			return -GITT_ERRNO_INVAL;
+	}
+	link->nonblock = nonblock;
+
+	return 0;
+}
+
+static int local_fd(void *handle, bool write)
+{
+	struct local_link *link = (struct local_link *)handle;
+
+	return write ? link->wfd : link->rfd;
+}
+
+static void local_close(void *handle)
+{
+	struct local_link *link = (struct local_link *)handle;
+
+	/* Closing stdin ends it, unless it hangs after a failure */
+	close(link->wfd);
+	close(link->rfd);
+	if (link->broken)
+		kill(link->pid, SIGTERM);
+	while (waitpid(link->pid, NULL, 0) < 0 && errno == EINTR)
+		;
+	free(link);
+}
+
+static struct gitt_transport local_transport = {
+	.open = local_open,
+	.read = local_read,
+	.write = local_write,
+	.nonblock = local_nonblock,
+	.fd = local_fd,
+	.close = local_close,
+	.param = NULL,
+};
+
+/* Pull from and push to a local bare repository, without a network */
+struct gitt_transport *gitt_local_impl(void)
+{
+	/* A command that exits early must not kill us on the next write */
+	signal(SIGPIPE, SIG_IGN);
+
+	return &local_transport;
+}
@@ -0,0 +1,738 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gitt_errno.h>
+#include "gitt_mirror.h"
+
+#define MIRROR_QUEUE			32	/* Jobs waiting on one remote */
+#define MIRROR_RETRY			256	/* Failed pushes kept for one remote, to be sent again */
+#define MIRROR_WINDOW			4096	/* Events of one device told apart, from the oldest missing */
+#define MIRROR_SEQUENCE			"\nmirror-seq "	/* Ends each event, then <nonce>.<sequence> */
+
+#define MIRROR_JOB_INIT			0
+#define MIRROR_JOB_COMMIT		1
+#define MIRROR_JOB_CHECK		2
+#define MIRROR_JOB_PULL			3
+
+/* round is that of the call waiting for it, 0 if none is */
+struct mirror_job {
+	uint8_t type;
+	uint64_t round;
+	char date[16];
+	char zone[8];
+	char data[GITT_MIRROR_EVENT_SIZE];
+};
+
+/*
+ * The events of one device, as long as its mirror lives. Those below next
+ * were handed out, bit (sequence % MIRROR_WINDOW) of seen tells whether one
+ * from next on was.
+ */
+struct mirror_stream {
+	char device[GITT_DEVICE_ID_SIZE];
+	uint32_t nonce;
+	uint32_t next;
+	uint64_t seen[MIRROR_WINDOW / 64];
+};
+
+/*
+ * Each remote has a thread running its jobs in order, a struct gitt is
+ * used by one thread at a time. Its callbacks are replaced by the mirror's,
+ * the user's ones are kept here. Pushes that failed wait in retry, only
+ * the thread uses it.
+ */
+struct mirror_remote {
+	struct gitt_mirror *mirror;
+	struct gitt *g;
+	pthread_t thread;
+	pthread_cond_t cond;
+	struct mirror_job jobs[MIRROR_QUEUE];
+	uint32_t head;
+	uint32_t count;
+	struct mirror_job *job;
+	bool up;
+	struct mirror_job *retry;
+	uint32_t retry_head;
+	uint32_t retry_count;
+	uint32_t retried;
+	uint32_t dropped;
+	gitt_get_date get_date;
+	gitt_get_zone get_zone;
+	gitt_remote_event remote_event;
+};
+
+/*
+ * lock guards the queues and the rounds, cond is signaled when a job is
+ * done. event_lock serializes the events handed to the user, and streams.
+ * Events pushed by this mirror carry nonce and the next sequence.
+ */
+struct gitt_mirror {
+	struct mirror_remote *remotes;
+	uint32_t number;
+	uint32_t quorum;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+	uint32_t nonce;
+	uint32_t sequence;
+	uint64_t round;
+	uint32_t inits;
+	/* The commit waiting for its quorum */
+	uint64_t commit_round;
+	uint32_t acks;
+	uint32_t fails;
+	int commit_ret;
+	/* The update waiting for a remote with news, then for its pull */
+	uint64_t update_round;
+	uint32_t answers;
+	uint32_t *candidates;
+	uint32_t candidate_num;
+	bool pulled;
+	int pull_ret;
+	pthread_mutex_t event_lock;
+	struct mirror_stream *streams;
+	uint32_t stream_num;
+	struct gitt_mirror_metrics metrics;
+};
+
+/* The remote whose thread this is, for the callbacks of its struct gitt */
+static __thread struct mirror_remote *mirror_self;
+
+/* The date of the event being pushed, the same on every remote */
+static int mirror_get_date(char *buf, uint8_t size)
+{
+	struct mirror_job *job = mirror_self ? mirror_self->job : NULL;
+
+	if (!job || !job->date[0] || strlen(job->date) >= size)
+		return -1;
+
+	strcpy(buf, job->date);
+	return 0;
+}
+
+static int mirror_get_zone(char *buf, uint8_t size)
+{
+	struct mirror_job *job = mirror_self ? mirror_self->job : NULL;
+
+	if (!job || !job->zone[0] || strlen(job->zone) >= size)
+		return -1;
+
+	strcpy(buf, job->zone);
+	return 0;
+}
+
+/* The stream of the device, a new one has nothing handed out yet */
+static struct mirror_stream *mirror_stream(struct gitt_mirror *mirror, const char *device,
+					   uint32_t nonce)
+{
+	struct mirror_stream *streams;
+	struct mirror_stream *stream;
+	uint32_t i;
+
+	for (i = 0; i < mirror->stream_num; i++)
+		if (mirror->streams[i].nonce == nonce && !strcmp(mirror->streams[i].device, device))
+			return &mirror->streams[i];
+
+	streams = (struct mirror_stream *)realloc(mirror->streams,
+						  (mirror->stream_num + 1) * sizeof(*streams));
+	if (!streams)
+		return NULL;
+	mirror->streams = streams;
+
+	stream = &streams[mirror->stream_num++];
+	memset(stream, 0, sizeof(*stream));
+	strcpy(stream->device, device);
+	stream->nonce = nonce;
+	stream->next = 1;
+	return stream;
+}
+
+static bool mirror_bit(struct mirror_stream *stream, uint32_t sequence, bool set, bool clear)
+{
+	uint64_t *word = &stream->seen[sequence % MIRROR_WINDOW / 64];
+	uint64_t mask = 1ULL << (sequence % 64);
+	bool was = *word & mask;
+
+	if (set)
+		*word |= mask;
+	if (clear)
+		*word &= ~mask;
+	return was;
+}
+
+/*
+ * Whether the event was handed out already, it is remembered if not. A
+ * sequence MIRROR_WINDOW past the oldest missing one gives that one up.
+ */
+static bool mirror_seen(struct mirror_stream *stream, uint32_t sequence)
+{
+	if (sequence < stream->next)
+		return true;
+
+	if (sequence - stream->next >= 2 * MIRROR_WINDOW) {
+		memset(stream->seen, 0, sizeof(stream->seen));
+		stream->next = sequence - MIRROR_WINDOW + 1;
+	}
+	while (sequence - stream->next >= MIRROR_WINDOW)
+		mirror_bit(stream, stream->next++, false, true);
+
+	if (mirror_bit(stream, sequence, true, false))
+		return true;
+
+	while (mirror_bit(stream, stream->next, false, true))
+		stream->next++;
+	return false;
+}
+
+/*
+ * Every remote brings the event, the first one hands it out. Events pushed
+ * by a mirror end with their device's sequence, which is cut off. Others
+ * were pushed to one remote only, and are handed out as they come.
+ */
+static void mirror_remote_event(struct gitt *g, struct gitt_device *device,
+				char *date, char *zone, char *event)
+{
+	struct mirror_remote *remote = mirror_self;
+	struct gitt_mirror *mirror = remote->mirror;
+	struct mirror_stream *stream = NULL;
+	uint32_t sequence;
+	uint32_t nonce;
+	char *tag = NULL;
+	char *p;
+
+	for (p = event; (p = strstr(p, MIRROR_SEQUENCE)); p++)
+		tag = p;
+	if (tag && sscanf(tag + strlen(MIRROR_SEQUENCE), "%8x.%u", &nonce, &sequence) == 2)
+		*tag = '\0';
+	else
+		tag = NULL;
+
+	pthread_mutex_lock(&mirror->event_lock);
+	if (tag)
+		stream = mirror_stream(mirror, device->id, nonce);
+	if (stream && mirror_seen(stream, sequence))
+		mirror->metrics.duplicates++;
+	else if (remote->remote_event)
+		remote->remote_event(g, device, date, zone, event);
+	pthread_mutex_unlock(&mirror->event_lock);
+}
+
+/* Called with the lock held, NULL if the queue is full */
+static struct mirror_job *mirror_queue(struct mirror_remote *remote, uint8_t type,
+				       uint64_t round)
+{
+	struct mirror_job *job;
+
+	if (remote->count == MIRROR_QUEUE)
+		return NULL;
+
+	job = &remote->jobs[(remote->head + remote->count) % MIRROR_QUEUE];
+	job->type = type;
+	job->round = round;
+	job->date[0] = '\0';
+	job->zone[0] = '\0';
+	job->data[0] = '\0';
+	remote->count++;
+	pthread_cond_signal(&remote->cond);
+
+	return job;
+}
+
+/* Keep a failed push to send it again, the oldest one goes if there is no room */
+static void mirror_keep(struct mirror_remote *remote, struct mirror_job *job)
+{
+	if (remote->retry_count == MIRROR_RETRY) {
+		remote->retry_head = (remote->retry_head + 1) % MIRROR_RETRY;
+		remote->retry_count--;
+		remote->dropped++;
+	}
+
+	remote->retry[(remote->retry_head + remote->retry_count) % MIRROR_RETRY] = *job;
+	remote->retry_count++;
+}
+
+/* Send the failed pushes again in order, until one fails again */
+static void mirror_resend(struct mirror_remote *remote)
+{
+	struct mirror_job *current = remote->job;
+	int ret;
+
+	while (remote->retry_count) {
+		remote->job = &remote->retry[remote->retry_head];
+		ret = gitt_commit_event(remote->g, remote->job->data);
+		if (ret)
+			break;
+		remote->retry_head = (remote->retry_head + 1) % MIRROR_RETRY;
+		remote->retry_count--;
+		remote->retried++;
+	}
+
+	remote->job = current;
+}
+
+/* Called with the lock held, count what the thread of the remote did alone */
+static void mirror_count(struct mirror_remote *remote)
+{
+	struct gitt_mirror *mirror = remote->mirror;
+
+	mirror->metrics.pushes_retried += remote->retried;
+	mirror->metrics.pushes_dropped += remote->dropped;
+	remote->retried = 0;
+	remote->dropped = 0;
+}
+
+static int mirror_run(struct mirror_remote *remote, struct mirror_job *job, bool *news)
+{
+	int ret;
+
+	/* A remote that was not reached at first is tried again */
+	if (job->type == MIRROR_JOB_INIT || !remote->up) {
+		ret = gitt_init(remote->g);
+		remote->up = !ret;
+		if (ret || job->type == MIRROR_JOB_INIT)
+			return ret;
+	}
+
+	/* The pushes that failed go first, the events keep their order */
+	mirror_resend(remote);
+
+	switch (job->type) {
+	case MIRROR_JOB_COMMIT:
+		return gitt_commit_event(remote->g, job->data);
+	case MIRROR_JOB_CHECK:
+		return gitt_check_event(remote->g, news);
+	default:
+		return gitt_update_event(remote->g);
+	}
+}
+
+/* Called with the lock held, tell the waiting call how the job went */
+static void mirror_done(struct mirror_remote *remote, struct mirror_job *job, int ret,
+			bool news)
+{
+	struct gitt_mirror *mirror = remote->mirror;
+
+	mirror_count(remote);
+
+	switch (job->type) {
+	case MIRROR_JOB_INIT:
+		mirror->inits++;
+		break;
+	case MIRROR_JOB_COMMIT:
+		if (ret)
+			mirror->metrics.pushes_failed++;
+		if (job->round != mirror->commit_round) {
+			mirror->metrics.pushes_late++;
+		} else if (!ret) {
+			mirror->acks++;
+		} else {
+			mirror->fails++;
+			if (!mirror->commit_ret)
+				mirror->commit_ret = ret;
+		}
+		break;
+	case MIRROR_JOB_CHECK:
+		if (job->round == mirror->update_round) {
+			mirror->answers++;
+			if (!ret && news)
+				mirror->candidates[mirror->candidate_num++] = remote - mirror->remotes;
+		} else if (!ret && news) {
+			/* Another remote was pulled, catch up in the background */
+			mirror_queue(remote, MIRROR_JOB_PULL, 0);
+		}
+		break;
+	default:
+		if (job->round && job->round == mirror->update_round) {
+			mirror->pulled = true;
+			mirror->pull_ret = ret;
+		}
+		break;
+	}
+
+	pthread_cond_broadcast(&mirror->cond);
+}
+
+static void *mirror_thread(void *arg)
+{
+	struct mirror_remote *remote = (struct mirror_remote *)arg;
+	struct gitt_mirror *mirror = remote->mirror;
+	struct mirror_job *job;
+	bool news;
+	int ret;
+
+	mirror_self = remote;
+
+	pthread_mutex_lock(&mirror->lock);
+	for (;;) {
+		while (!remote->count && !mirror->stop)
+			pthread_cond_wait(&remote->cond, &mirror->lock);
+		/* Stop once the background pushes are done */
+		if (!remote->count)
+			break;
+		job = &remote->jobs[remote->head];
+		pthread_mutex_unlock(&mirror->lock);
+
+		remote->job = job;
+		news = false;
+		ret = mirror_run(remote, job, &news);
+		if (ret && job->type == MIRROR_JOB_COMMIT)
+			mirror_keep(remote, job);
+		remote->job = NULL;
+
+		pthread_mutex_lock(&mirror->lock);
+		remote->head = (remote->head + 1) % MIRROR_QUEUE;
+		remote->count--;
+		mirror_done(remote, job, ret, news);
+	}
+	pthread_mutex_unlock(&mirror->lock);
+
+	/* A last try for the pushes that failed */
+	if (remote->retry_count) {
+		if (!remote->up)
+			remote->up = !gitt_init(remote->g);
+		if (remote->up)
+			mirror_resend(remote);
+		if (remote->retry_count)
+			fprintf(stderr, "Mirror: %u events not pushed to remote %u\n",
+				remote->retry_count, (uint32_t)(remote - mirror->remotes));
+		remote->dropped += remote->retry_count;
+
+		pthread_mutex_lock(&mirror->lock);
+		mirror_count(remote);
+		pthread_mutex_unlock(&mirror->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Keep the same events on several remotes. Each struct gitt is set
+ *        up as for gitt_init(), with its own url and buffers. The callbacks
+ *        of the first one are used for all of them, and each of them is
+ *        only used by the mirror until gitt_mirror_free().
+ *
+ * @param remotes
+ * @param number
+ * @param quorum Remotes that must take an event before a commit returns,
+ *               1 to return at the first of them
+ * @return struct gitt_mirror*
+ */
+struct gitt_mirror *gitt_mirror_alloc(struct gitt *remotes[], uint32_t number,
+				      uint32_t quorum)
+{
+	struct gitt_mirror *mirror;
+	struct mirror_remote *remote;
+	gitt_get_date get_date;
+	gitt_get_zone get_zone;
+	gitt_remote_event remote_event;
+	uint32_t created;
+	uint32_t i;
+
+	if (!remotes || !number || !quorum || quorum > number) {
+		fprintf(stderr, "Mirror needs a quorum of 1 to %u remotes\n", number);
+		return NULL;
+	}
+
+	mirror = (struct gitt_mirror *)calloc(1, sizeof(*mirror));
+	if (!mirror)
+		return NULL;
+
+	mirror->remotes = (struct mirror_remote *)calloc(number, sizeof(*mirror->remotes));
+	mirror->candidates = (uint32_t *)calloc(number, sizeof(*mirror->candidates));
+	if (!mirror->remotes || !mirror->candidates)
+		goto err0;
+	for (i = 0; i < number; i++) {
+		mirror->remotes[i].retry = (struct mirror_job *)calloc(MIRROR_RETRY,
+								       sizeof(struct mirror_job));
+		if (!mirror->remotes[i].retry)
+			goto err0;
+	}
+
+	mirror->number = number;
+	mirror->quorum = quorum;
+	/* Tells the sequences apart from those before a restart */
+	mirror->nonce = (uint32_t)time(NULL) ^ (uint32_t)getpid() << 16;
+	pthread_mutex_init(&mirror->lock, NULL);
+	pthread_cond_init(&mirror->cond, NULL);
+	pthread_mutex_init(&mirror->event_lock, NULL);
+
+	get_date = remotes[0]->get_date;
+	get_zone = remotes[0]->get_zone;
+	remote_event = remotes[0]->remote_event;
+	for (i = 0; i < number; i++) {
+		remote = &mirror->remotes[i];
+		remote->mirror = mirror;
+		remote->g = remotes[i];
+		remote->get_date = get_date;
+		remote->get_zone = get_zone;
+		remote->remote_event = remote_event;
+		pthread_cond_init(&remote->cond, NULL);
+
+		if (pthread_create(&remote->thread, NULL, mirror_thread, remote)) {
+			pthread_cond_destroy(&remote->cond);
+			goto err1;
+		}
+	}
+
+	for (i = 0; i < number; i++) {
+		remotes[i]->get_date = mirror_get_date;
+		remotes[i]->get_zone = mirror_get_zone;
+		remotes[i]->remote_event = mirror_remote_event;
+	}
+
+	return mirror;
+
+err1:
+	created = i;
+	pthread_mutex_lock(&mirror->lock);
+	mirror->stop = true;
+	for (i = 0; i < created; i++)
+		pthread_cond_signal(&mirror->remotes[i].cond);
+	pthread_mutex_unlock(&mirror->lock);
+	for (i = 0; i < created; i++) {
+		pthread_join(mirror->remotes[i].thread, NULL);
+		pthread_cond_destroy(&mirror->remotes[i].cond);
+	}
+	pthread_mutex_destroy(&mirror->event_lock);
+	pthread_cond_destroy(&mirror->cond);
+	pthread_mutex_destroy(&mirror->lock);
+err0:
+	for (i = 0; mirror->remotes && i < number; i++)
+		free(mirror->remotes[i].retry);
+	free(mirror->candidates);
+	free(mirror->remotes);
+	free(mirror);
+	return NULL;
+}
+
+/**
+ * @brief Initialize every remote at once. Remotes that cannot be reached
+ *        are tried again with the next call that needs them.
+ *
+ * @param mirror
+ * @return int 0: At least quorum remotes are ready
+ * @return int other: Error of the first remote that failed
+ */
+int gitt_mirror_init(struct gitt_mirror *mirror)
+{
+	uint32_t up = 0;
+	int ret = 0;
+	uint32_t i;
+
+	pthread_mutex_lock(&mirror->lock);
+	mirror->inits = 0;
+	for (i = 0; i < mirror->number; i++)
+		if (!mirror_queue(&mirror->remotes[i], MIRROR_JOB_INIT, 0))
+			mirror->inits++;
+	while (mirror->inits < mirror->number)
+		pthread_cond_wait(&mirror->cond, &mirror->lock);
+
+	for (i = 0; i < mirror->number; i++)
+		if (mirror->remotes[i].up)
+			up++;
+	pthread_mutex_unlock(&mirror->lock);
+
+	if (up < mirror->quorum) {
+		fprintf(stderr, "Mirror: %u of %u remotes ready\n", up, mirror->number);
+		ret = -GITT_ERRNO_INVAL;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Push an event to every remote at once, and return as soon as
+ *        quorum of them took it. The others go on in the background, a
+ *        remote pushes its events in order.
+ *
+ * @param mirror
+ * @param data Event, copied
+ * @return int 0: Taken by quorum remotes
+ * @return int other: Error of the first remote that failed
+ */
+int gitt_mirror_commit_event(struct gitt_mirror *mirror, char *data)
+{
+	struct mirror_remote *first = &mirror->remotes[0];
+	struct mirror_job *job;
+	char date[16];
+	char zone[8];
+	uint32_t i;
+	int ret;
+
+	/* Room for the sequence: nonce, '.' and up to 10 digits */
+	if (strlen(data) + strlen(MIRROR_SEQUENCE) + 8 + 1 + 10 >= GITT_MIRROR_EVENT_SIZE) {
+		fprintf(stderr, "Mirror: event too long\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	/* The event is the same on each remote, its date too */
+	if (!first->get_date || first->get_date(date, sizeof(date)))
+		date[0] = '\0';
+	if (!first->get_zone || first->get_zone(zone, sizeof(zone)))
+		zone[0] = '\0';
+
+	pthread_mutex_lock(&mirror->lock);
+	mirror->commit_round = ++mirror->round;
+	mirror->acks = 0;
+	mirror->fails = 0;
+	mirror->commit_ret = 0;
+	mirror->sequence++;
+
+	for (i = 0; i < mirror->number; i++) {
+		job = mirror_queue(&mirror->remotes[i], MIRROR_JOB_COMMIT, mirror->commit_round);
+		if (!job) {
+			mirror->fails++;
+			if (!mirror->commit_ret)
+				mirror->commit_ret = -GITT_ERRNO_NOMEM;
+			continue;
+		}
+		strcpy(job->date, date);
+		strcpy(job->zone, zone);
+		sprintf(job->data, "%s" MIRROR_SEQUENCE "%08x.%u", data, mirror->nonce,
+			mirror->sequence);
+	}
+
+	while (mirror->acks < mirror->quorum &&
+	       mirror->fails <= mirror->number - mirror->quorum)
+		pthread_cond_wait(&mirror->cond, &mirror->lock);
+
+	ret = mirror->acks >= mirror->quorum ? 0 : mirror->commit_ret;
+	if (ret)
+		mirror->metrics.failed++;
+	else
+		mirror->metrics.commits++;
+	mirror->commit_round = 0;
+	pthread_mutex_unlock(&mirror->lock);
+
+	return ret;
+}
+
+/**
+ * @brief Ask every remote for its head at once, and pull from the first
+ *        one that has news. If that pull fails, the next one is used. The
+ *        other remotes with news pull in the background, their events are
+ *        not handed out again.
+ *
+ * @param mirror
+ * @return int 0: Pulled, or no remote has news
+ * @return int other: Error of the last pull
+ */
+int gitt_mirror_update_event(struct gitt_mirror *mirror)
+{
+	uint32_t tried = 0;
+	uint32_t winner;
+	int ret = 0;
+	uint32_t i;
+
+	pthread_mutex_lock(&mirror->lock);
+	mirror->update_round = ++mirror->round;
+	mirror->answers = 0;
+	mirror->candidate_num = 0;
+
+	for (i = 0; i < mirror->number; i++)
+		if (!mirror_queue(&mirror->remotes[i], MIRROR_JOB_CHECK, mirror->update_round))
+			mirror->answers++;
+
+	for (;;) {
+		while (tried == mirror->candidate_num && mirror->answers < mirror->number)
+			pthread_cond_wait(&mirror->cond, &mirror->lock);
+		if (tried == mirror->candidate_num)
+			break;
+
+		winner = mirror->candidates[tried++];
+		mirror->pulled = false;
+		if (!mirror_queue(&mirror->remotes[winner], MIRROR_JOB_PULL,
+				  mirror->update_round)) {
+			ret = -GITT_ERRNO_NOMEM;
+			continue;
+		}
+		while (!mirror->pulled)
+			pthread_cond_wait(&mirror->cond, &mirror->lock);
+
+		ret = mirror->pull_ret;
+		if (!ret) {
+			if (winner)
+				mirror->metrics.hedged++;
+			break;
+		}
+	}
+
+	/* The ones with news that were not needed, and those still to answer */
+	while (tried < mirror->candidate_num)
+		mirror_queue(&mirror->remotes[mirror->candidates[tried++]], MIRROR_JOB_PULL, 0);
+	mirror->update_round = 0;
+	mirror->metrics.updates++;
+	pthread_mutex_unlock(&mirror->lock);
+
+	return ret;
+}
+
+void gitt_mirror_metrics(struct gitt_mirror *mirror, struct gitt_mirror_metrics *metrics)
+{
+	pthread_mutex_lock(&mirror->lock);
+	pthread_mutex_lock(&mirror->event_lock);
+	*metrics = mirror->metrics;
+	pthread_mutex_unlock(&mirror->event_lock);
+	pthread_mutex_unlock(&mirror->lock);
+}
+
+/**
+ * @brief Wait for the pushes still going on, then end every remote
+ *
+ * @param mirror
+ */
+void gitt_mirror_free(struct gitt_mirror *mirror)
+{
+	struct mirror_remote *remote;
+	uint32_t i;
+
+	pthread_mutex_lock(&mirror->lock);
+	mirror->stop = true;
+	for (i = 0; i < mirror->number; i++)
+		pthread_cond_signal(&mirror->remotes[i].cond);
+	pthread_mutex_unlock(&mirror->lock);
+
+	for (i = 0; i < mirror->number; i++) {
+		remote = &mirror->remotes[i];
+		pthread_join(remote->thread, NULL);
+		pthread_cond_destroy(&remote->cond);
+		if (remote->up)
+			gitt_end(remote->g);
+		free(remote->retry);
+	}
+
+	pthread_mutex_destroy(&mirror->event_lock);
+	pthread_cond_destroy(&mirror->cond);
+	pthread_mutex_destroy(&mirror->lock);
+	free(mirror->streams);
+	free(mirror->candidates);
+	free(mirror->remotes);
+	free(mirror);
+}
@@ -0,0 +1,65 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __GITT_MIRROR_H_
+#define __GITT_MIRROR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <gitt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Longest event a mirror takes, it is copied for each remote */
+#define GITT_MIRROR_EVENT_SIZE		1024
+
+struct gitt_mirror;
+
+struct gitt_mirror_metrics {
+	uint64_t commits;
+	uint64_t failed;
+	uint64_t pushes_late;
+	uint64_t pushes_failed;
+	uint64_t pushes_retried;
+	uint64_t pushes_dropped;
+	uint64_t updates;
+	uint64_t hedged;
+	uint64_t duplicates;
+};
+
+struct gitt_mirror *gitt_mirror_alloc(struct gitt *remotes[], uint32_t number,
+				      uint32_t quorum);
+int gitt_mirror_init(struct gitt_mirror *mirror);
+int gitt_mirror_commit_event(struct gitt_mirror *mirror, char *data);
+int gitt_mirror_update_event(struct gitt_mirror *mirror);
+void gitt_mirror_metrics(struct gitt_mirror *mirror, struct gitt_mirror_metrics *metrics);
+void gitt_mirror_free(struct gitt_mirror *mirror);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __GITT_MIRROR_H_ */
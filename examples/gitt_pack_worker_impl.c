@@ -0,0 +1,158 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <gitt_pack.h>
+#include <gitt_errno.h>
+
+#define WORKER_THREAD_NUMBER		4
+
+struct worker_job {
+	struct gitt_pack_zobj *zobj;
+	struct worker_job *next;
+	int done;
+};
+
+struct worker_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	pthread_t threads[WORKER_THREAD_NUMBER];
+	struct worker_job *head;
+	struct worker_job *tail;
+	int started;
+};
+
+static struct worker_pool pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.job_cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *worker_thread(void *arg)
+{
+	struct worker_pool *pool = (struct worker_pool *)arg;
+	struct worker_job *job;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->head)
+			pthread_cond_wait(&pool->job_cond, &pool->lock);
+		job = pool->head;
+		pool->head = job->next;
+		if (!pool->head)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		/* Compress outside the lock */
+		gitt_pack_compress(job->zobj);
+
+		pthread_mutex_lock(&pool->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+static int worker_submit(void *param, struct gitt_pack_zobj *zobj)
+{
+	struct worker_pool *pool = (struct worker_pool *)param;
+	struct worker_job *job;
+
+	job = (struct worker_job *)malloc(sizeof(struct worker_job));
+	if (!job)
+		return -GITT_ERRNO_NOMEM;
+
+	zobj->buf_len = gitt_pack_compress_bound(&zobj->obj);
+	zobj->buf = (uint8_t *)malloc(zobj->buf_len);
+	if (!zobj->buf) {
+		free(job);
+		return -GITT_ERRNO_NOMEM;
+	}
+
+	job->zobj = zobj;
+	job->next = NULL;
+	job->done = 0;
+	zobj->priv = job;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail)
+		pool->tail->next = job;
+	else
+		pool->head = job;
+	pool->tail = job;
+	pthread_cond_signal(&pool->job_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+static int worker_wait(void *param, struct gitt_pack_zobj *zobj)
+{
+	struct worker_pool *pool = (struct worker_pool *)param;
+	struct worker_job *job = (struct worker_job *)zobj->priv;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!job->done)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	return zobj->ret;
+}
+
+static void worker_release(void *param, struct gitt_pack_zobj *zobj)
+{
+	free(zobj->priv);
+	free(zobj->buf);
+	zobj->priv = NULL;
+	zobj->buf = NULL;
+}
+
+static struct gitt_pack_worker worker = {
+	.submit = worker_submit,
+	.wait = worker_wait,
+	.release = worker_release,
+	.param = &pool,
+};
+
+/* Compress pack objects on a pool of threads */
+struct gitt_pack_worker *gitt_pack_worker_impl(void)
+{
+	int i;
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.started < WORKER_THREAD_NUMBER) {
+		if (pthread_create(&pool.threads[pool.started], NULL, worker_thread, &pool))
+			break;
+		pthread_detach(pool.threads[pool.started]);
+		pool.started++;
+	}
+	i = pool.started;
+	pthread_mutex_unlock(&pool.lock);
+
+	return i ? &worker : NULL;
+}
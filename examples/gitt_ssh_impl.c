@@ -24,19 +24,90 @@
 
 #include <stdio.h>
 #include <malloc.h>
+#include <pthread.h>
+#include <time.h>
 #include <libssh/libssh.h>
 #include <gitt_ssh.h>
 #include <gitt_errno.h>
 
+/* Milliseconds a read waits for its channel before others get the session */
+#define SSH_SHARED_READ_WAIT		10
+/* Milliseconds a bounded read waits at once, so that a cancel is seen */
+#define SSH_LIMIT_READ_WAIT		100
+
+/*
+ * libssh does not let several threads use one session at once, so the
+ * channels attached to a shared session take turns with its lock.
+ */
 struct gitt_ssh {
 	ssh_session session;
 	ssh_key privkey;
 	ssh_channel channel;
+	pthread_mutex_t lock;
+	pthread_mutex_t *shared;
+	bool nonblock;
+	struct gitt_ssh_limit limit;
+	uint64_t start;
+};
+
+struct ssh_pool_lock {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static struct ssh_pool_lock pool_lock = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
 };
 
+static void ssh_shared_lock(struct gitt_ssh *ssh)
+{
+	if (ssh->shared)
+		pthread_mutex_lock(ssh->shared);
+}
+
+static void ssh_shared_unlock(struct gitt_ssh *ssh)
+{
+	if (ssh->shared)
+		pthread_mutex_unlock(ssh->shared);
+}
+
+static uint64_t ssh_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool ssh_limited(struct gitt_ssh *ssh)
+{
+	return ssh->limit.idle || ssh->limit.total || ssh->limit.cancel;
+}
+
+/* How long the next wait may take, after waiting since a time */
+static int ssh_wait(struct gitt_ssh *ssh, uint64_t since, int *wait)
+{
+	uint64_t now = ssh_now();
+	uint64_t end = UINT64_MAX;
+
+	if (ssh->limit.cancel && ssh->limit.cancel->canceled)
+		return -GITT_ERRNO_CANCELED;
+	if (ssh->limit.idle)
+		end = since + ssh->limit.idle;
+	if (ssh->limit.total && ssh->start + ssh->limit.total < end)
+		end = ssh->start + ssh->limit.total;
+	if (now >= end)
+		return -GITT_ERRNO_TIMEOUT;
+
+	*wait = end - now < SSH_LIMIT_READ_WAIT ? (int)(end - now) : SSH_LIMIT_READ_WAIT;
+	return 0;
+}
+
 struct gitt_ssh* gitt_ssh_alloc_impl(void)
 {
-	return (struct gitt_ssh *)malloc(sizeof(struct gitt_ssh));
+	/* Limits are zero until gitt_ssh_limit() */
+	return (struct gitt_ssh *)calloc(1, sizeof(struct gitt_ssh));
 }
 
 void gitt_ssh_free_impl(struct gitt_ssh *ssh)
@@ -44,11 +115,15 @@ void gitt_ssh_free_impl(struct gitt_ssh *ssh)
 	free(ssh);
 }
 
-int gitt_ssh_connect_impl(struct gitt_ssh *ssh, struct gitt_ssh_url *ssh_url,
-			  const char *exec, const char *privkey)
+int gitt_ssh_open_impl(struct gitt_ssh *ssh, struct gitt_ssh_url *ssh_url, const char *privkey)
 {
+	long usec;
 	int err;
 
+	ssh->channel = NULL;
+	ssh->shared = NULL;
+	ssh->nonblock = false;
+
 	/* Open session and set options */
 	ssh->session = ssh_new();
 	if (ssh->session == NULL)
@@ -56,6 +131,11 @@ int gitt_ssh_connect_impl(struct gitt_ssh *ssh, struct gitt_ssh_url *ssh_url,
 	ssh_options_set(ssh->session, SSH_OPTIONS_USER, ssh_url->user);
 	ssh_options_set(ssh->session, SSH_OPTIONS_HOST, ssh_url->host);
 	ssh_options_set(ssh->session, SSH_OPTIONS_PORT_STR, ssh_url->port);
+	/* Also bounds the blocking calls of libssh, like connect and write */
+	if (ssh->limit.idle) {
+		usec = (long)ssh->limit.idle * 1000;
+		ssh_options_set(ssh->session, SSH_OPTIONS_TIMEOUT_USEC, &usec);
+	}
 	// ssh_options_set(ssh->session, SSH_OPTIONS_LOG_VERBOSITY_STR, "3");
 
 	/* Connect to server */
@@ -84,10 +164,7 @@ int gitt_ssh_connect_impl(struct gitt_ssh *ssh, struct gitt_ssh_url *ssh_url,
 		goto out3;
 	}
 
-	/* Open channel */
-	ssh->channel = ssh_channel_new(ssh->session);
-	ssh_channel_open_session(ssh->channel);
-	ssh_channel_request_exec(ssh->channel, exec);
+	pthread_mutex_init(&ssh->lock, NULL);
 
 	return 0;
 
@@ -101,21 +178,214 @@ out0:
 	return -GITT_ERRNO_INVAL;
 }
 
-int gitt_ssh_read_impl(struct gitt_ssh *ssh, char *buf, int size)
+int gitt_ssh_channel_open_impl(struct gitt_ssh *ssh, const char *exec, const char *protocol)
 {
-	return ssh_channel_read(ssh->channel, buf, size, 0);
+	ssh_shared_lock(ssh);
+
+	/* Open channel */
+	ssh->channel = ssh_channel_new(ssh->session);
+	if (ssh->channel == NULL)
+		goto out0;
+
+	if (ssh_channel_open_session(ssh->channel) != SSH_OK)
+		goto out1;
+
+	/* The server may refuse it, and then talks protocol v0 */
+	if (protocol)
+		ssh_channel_request_env(ssh->channel, "GIT_PROTOCOL", protocol);
+	if (ssh_channel_request_exec(ssh->channel, exec) != SSH_OK)
+		goto out1;
+
+	ssh_shared_unlock(ssh);
+	return 0;
+
+out1:
+	ssh_channel_free(ssh->channel);
+	ssh->channel = NULL;
+out0:
+	ssh_shared_unlock(ssh);
+	return -GITT_ERRNO_INVAL;
 }
 
-int gitt_ssh_write_impl(struct gitt_ssh *ssh, char *buf, int size)
+void gitt_ssh_channel_close_impl(struct gitt_ssh *ssh)
+{
+	if (ssh->channel == NULL)
+		return;
+
+	ssh_shared_lock(ssh);
+	ssh_channel_close(ssh->channel);
+	ssh_channel_free(ssh->channel);
+	ssh->channel = NULL;
+	ssh_shared_unlock(ssh);
+}
+
+int gitt_ssh_keepalive_impl(struct gitt_ssh *ssh)
 {
-	return ssh_channel_write(ssh->channel, buf, size);
+	int err;
+
+	pthread_mutex_lock(&ssh->lock);
+	err = ssh_send_keepalive(ssh->session);
+	pthread_mutex_unlock(&ssh->lock);
+
+	return err == SSH_OK ? 0 : -GITT_ERRNO_INVAL;
 }
 
-void gitt_ssh_disconnect_impl(struct gitt_ssh *ssh)
+void gitt_ssh_close_impl(struct gitt_ssh *ssh)
 {
 	/* Free and disconnect */
-	ssh_channel_close(ssh->channel);
 	ssh_disconnect(ssh->session);
 	ssh_key_free(ssh->privkey);
 	ssh_free(ssh->session);
+	pthread_mutex_destroy(&ssh->lock);
+}
+
+void gitt_ssh_attach_impl(struct gitt_ssh *ssh, struct gitt_ssh *session)
+{
+	ssh->session = session->session;
+	ssh->privkey = NULL;
+	ssh->channel = NULL;
+	ssh->shared = &session->lock;
+	ssh->nonblock = false;
+}
+
+void gitt_ssh_detach_impl(struct gitt_ssh *ssh)
+{
+	ssh->session = NULL;
+	ssh->shared = NULL;
+}
+
+/* Only what has arrived, the session stays blocking for the other channels */
+static int ssh_read_nonblock(struct gitt_ssh *ssh, char *buf, int size)
+{
+	int wait;
+	int ret;
+
+	/* The caller waits for the fd, and bounds that */
+	ret = ssh_wait(ssh, ssh_now(), &wait);
+	if (ret)
+		return ret;
+
+	ssh_shared_lock(ssh);
+	ret = ssh_channel_read_nonblocking(ssh->channel, buf, size, 0);
+	if (!ret && !ssh_channel_is_eof(ssh->channel))
+		ret = -GITT_ERRNO_AGAIN;
+	ssh_shared_unlock(ssh);
+
+	return ret == SSH_EOF ? 0 : ret;
+}
+
+int gitt_ssh_read_impl(struct gitt_ssh *ssh, char *buf, int size)
+{
+	uint64_t since;
+	int wait;
+	int ret;
+
+	if (ssh->nonblock)
+		return ssh_read_nonblock(ssh, buf, size);
+
+	if (!ssh->shared && !ssh_limited(ssh))
+		return ssh_channel_read(ssh->channel, buf, size, 0);
+
+	/*
+	 * Wait a little at a time, so the other channels can go on, and the
+	 * limits are checked in between
+	 */
+	since = ssh_now();
+	do {
+		ret = ssh_wait(ssh, since, &wait);
+		if (ret)
+			return ret;
+		if (ssh->shared && wait > SSH_SHARED_READ_WAIT)
+			wait = SSH_SHARED_READ_WAIT;
+
+		ssh_shared_lock(ssh);
+		ret = ssh_channel_read_timeout(ssh->channel, buf, size, 0, wait);
+		if (!ret && ssh_channel_is_eof(ssh->channel))
+			ret = SSH_EOF;
+		ssh_shared_unlock(ssh);
+	} while (!ret);
+
+	return ret == SSH_EOF ? 0 : ret;
+}
+
+int gitt_ssh_write_impl(struct gitt_ssh *ssh, char *buf, int size)
+{
+	uint32_t window;
+	int wait;
+	int ret;
+
+	ret = ssh_wait(ssh, ssh_now(), &wait);
+	if (ret)
+		return ret;
+
+	ssh_shared_lock(ssh);
+
+	/* Only what the window of the remote takes without waiting */
+	if (ssh->nonblock) {
+		window = ssh_channel_window_size(ssh->channel);
+		if (!window) {
+			ssh_shared_unlock(ssh);
+			return -GITT_ERRNO_AGAIN;
+		}
+		size = size < window ? size : window;
+	}
+
+	ret = ssh_channel_write(ssh->channel, buf, size);
+	ssh_shared_unlock(ssh);
+
+	return ret;
+}
+
+int gitt_ssh_nonblock_impl(struct gitt_ssh *ssh, bool nonblock)
+{
+	ssh->nonblock = nonblock;
+	return 0;
+}
+
+int gitt_ssh_fd_impl(struct gitt_ssh *ssh)
+{
+	return ssh_get_fd(ssh->session);
+}
+
+int gitt_ssh_limit_impl(struct gitt_ssh *ssh, struct gitt_ssh_limit *limit)
+{
+	ssh->limit = *limit;
+	ssh->start = ssh_now();
+	return 0;
+}
+
+static void ssh_pool_lock(void *param)
+{
+	pthread_mutex_lock(&((struct ssh_pool_lock *)param)->lock);
+}
+
+static void ssh_pool_unlock(void *param)
+{
+	pthread_mutex_unlock(&((struct ssh_pool_lock *)param)->lock);
+}
+
+static void ssh_pool_wait(void *param)
+{
+	struct ssh_pool_lock *lock = (struct ssh_pool_lock *)param;
+
+	pthread_cond_wait(&lock->cond, &lock->lock);
+}
+
+static void ssh_pool_wake(void *param)
+{
+	pthread_cond_broadcast(&((struct ssh_pool_lock *)param)->cond);
+}
+
+static struct gitt_ssh_lock ssh_lock = {
+	.lock = ssh_pool_lock,
+	.unlock = ssh_pool_unlock,
+	.wait = ssh_pool_wait,
+	.wake = ssh_pool_wake,
+	.param = &pool_lock,
+};
+
+/* Lock of a pool of connections shared by repositories on several threads */
+struct gitt_ssh_lock *gitt_ssh_lock_impl(void)
+{
+	return &ssh_lock;
 }
@@ -32,6 +32,7 @@
 #include <gitt.h>
 #include <gitt_errno.h>
 #include <time.h>
+#include "gitt_hub.h"
 
 #define DEFAULT_PRIVKEY_PATH		"id_ed25519"
 
@@ -42,6 +43,12 @@
 #define EXAMPLE_STATE_RUN		1
 
 #define DEFAULT_LOOP_TIME		5
+#define EXAMPLE_HUB_WORKERS		2
+
+struct gitt_pack_worker *gitt_pack_worker_impl(void);
+struct gitt_transport *gitt_local_impl(void);
+struct gitt_transport *gitt_git_impl(void);
+struct gitt_transport *gitt_http_impl(void);
 
 struct gitt_example {
 	struct gitt g;
@@ -49,6 +56,10 @@ struct gitt_example {
 	char privkey[2048];
 	char repository[64];
 	uint8_t buffer[4096];
+	struct gitt_delta delta;
+	uint8_t delta_buffer[3072];
+	uint8_t ring_buffer[16384];
+	uint8_t out_buffer[8192];
 	int state;
 };
 
@@ -162,6 +173,11 @@ static int gitt_get_date_impl(char *buf, uint8_t size)
 	return 0;
 }
 
+static void gitt_delay_impl(uint32_t ms)
+{
+	usleep(ms * 1000);
+}
+
 static int gitt_get_zone_impl(char *buf, uint8_t size)
 {
 	int h, m;
@@ -180,23 +196,11 @@ static int gitt_get_zone_impl(char *buf, uint8_t size)
 	return 0;
 }
 
-static int cmd_func_init(struct gitt_example *example, int args, char *argv[])
+static int load_privkey(struct gitt_example *example, int args, char *argv[])
 {
-	int ret = 0;
 	FILE *file;
 	char privkey_path[256];
-
-	/* A repository url is required */
-	if (args < 2) {
-		fprintf(stderr, "Invalid: Please enter the repository URL\n");
-		return -1;
-	}
-	if (strlen(argv[1]) + 1 > sizeof(example->repository)) {
-		fprintf(stderr, "Invalid: Repository URL too long\n");
-		return -1;
-	}
-	strcpy(example->repository, argv[1]);
-	printf("Repository URL: %s\n", argv[1]);
+	int ret;
 
 	if (args >= 3) {
 		if (strlen(argv[2]) + 1 > sizeof(privkey_path)) {
@@ -226,6 +230,45 @@ static int cmd_func_init(struct gitt_example *example, int args, char *argv[])
 	printf("Private key loading completed\n");
 	fclose(file);
 
+	return 0;
+}
+
+static int cmd_func_init(struct gitt_example *example, int args, char *argv[])
+{
+	int ret = 0;
+
+	/* A repository url is required */
+	if (args < 2) {
+		fprintf(stderr, "Invalid: Please enter the repository URL\n");
+		return -1;
+	}
+	if (strlen(argv[1]) + 1 > sizeof(example->repository)) {
+		fprintf(stderr, "Invalid: Repository URL too long\n");
+		return -1;
+	}
+	strcpy(example->repository, argv[1]);
+	printf("Repository URL: %s\n", argv[1]);
+
+	/*
+	 * A path is a local bare repository, run git on it instead of SSH.
+	 * git:// is git daemon, over plain TCP. http:// is smart HTTP.
+	 */
+	if (argv[1][0] == '/' || argv[1][0] == '.') {
+		example->g.transport = gitt_local_impl();
+		example->privkey[0] = '\0';
+	} else if (!strncmp(argv[1], "git://", 6)) {
+		example->g.transport = gitt_git_impl();
+		example->privkey[0] = '\0';
+	} else if (!strncmp(argv[1], "http://", 7)) {
+		example->g.transport = gitt_http_impl();
+		example->privkey[0] = '\0';
+	} else {
+		example->g.transport = NULL;
+		ret = load_privkey(example, args, argv);
+		if (ret)
+			return ret;
+	}
+
 	ret = print_warning(example);
 	if (ret)
 		return ret;
@@ -237,10 +280,41 @@ static int cmd_func_init(struct gitt_example *example, int args, char *argv[])
 	example->g.buf_len = sizeof(example->buffer);
 	example->g.remote_event = gitt_remote_event_callback;
 
+	/* Optional, compress pack objects on a thread pool */
+	example->g.worker = gitt_pack_worker_impl();
+
+	/* Optional, push commits as deltas of the previous ones */
+	example->delta.buf = example->delta_buffer;
+	example->delta.buf_len = sizeof(example->delta_buffer);
+	example->g.delta = &example->delta;
+
+	/* Optional, read ahead from and write to the remote with bigger buffers */
+	example->g.ring = example->ring_buffer;
+	example->g.ring_len = sizeof(example->ring_buffer);
+	example->g.out = example->out_buffer;
+	example->g.out_len = sizeof(example->out_buffer);
+
+	/*
+	 * Optional, keep the SSH session between operations for 5 minutes.
+	 * Several repositories on one host can share connections with g.pool
+	 * instead, see gitt_ssh_lock_impl() if they run on several threads.
+	 */
+	example->g.session_idle = 300;
+
+	/* Optional, pull commits only if the remote allows it */
+	example->g.filter = GITT_REPOSITORY_FILTER_TREE_0;
+
 	/* These two functions are optional, you can choose not to implement them */
 	example->g.get_date = gitt_get_date_impl;
 	example->g.get_zone = gitt_get_zone_impl;
 
+	/* Optional, wait a little before a rejected push is sent again */
+	example->g.delay = gitt_delay_impl;
+
+	/* Optional, give up on a remote silent for 10 seconds, or a pull or push over 60 */
+	example->g.timeout_idle = 10000;
+	example->g.timeout_total = 60000;
+
 	printf("Initialize...\n");
 	ret = gitt_init(&example->g);
 	printf("Initialize result: %s\n", GITT_ERRNO_STR(ret));
@@ -343,11 +417,23 @@ static int hit(void)
 	return 0;
 }
 
+static void gitt_hub_done_callback(struct gitt_hub_repo *repo, int ret)
+{
+	if (ret)
+		printf("Update event result: %s\n", GITT_ERRNO_STR(ret));
+}
+
+/*
+ * The hub polls any number of repositories without a thread for each of
+ * them, here there is only one.
+ */
 static int cmd_func_loop(struct gitt_example *example, int args, char *argv[])
 {
 	int interval = DEFAULT_LOOP_TIME;
+	struct gitt_hub_repo repo = {0};
+	struct gitt_hub_metrics metrics;
+	struct gitt_hub *hub;
 	int ret;
-	int count = 0;
 
 	if (example->state != EXAMPLE_STATE_RUN) {
 		fprintf(stderr, "Invalid: Please use the initialization command to initialize first\n");
@@ -360,25 +446,37 @@ static int cmd_func_loop(struct gitt_example *example, int args, char *argv[])
 	printf("Interval time: %d second\n", interval);
 	printf("Entering the loop, you can press any key to end it\n");
 
-	while (1) {
-		if (!count) {
-			ret = gitt_update_event(&example->g);
-			// printf("Update event result: %s\n", GITT_ERRNO_STR(ret));
-			if (ret)
-				break;
-		}
+	hub = gitt_hub_alloc(EXAMPLE_HUB_WORKERS);
+	if (!hub) {
+		fprintf(stderr, "Hub creation fail\n");
+		return -1;
+	}
 
-		if (hit())
+	repo.g = &example->g;
+	repo.interval = interval;
+	repo.done = gitt_hub_done_callback;
+	ret = gitt_hub_add(hub, &repo);
+	if (ret) {
+		gitt_hub_free(hub);
+		return -1;
+	}
+
+	while (!hit()) {
+		ret = gitt_hub_run(hub, 100);
+		if (ret)
 			break;
+	}
 
-		sleep(1);
-		count++;
+	while (gitt_hub_remove(hub, &repo) == -GITT_ERRNO_AGAIN)
+		gitt_hub_run(hub, 100);
 
-		if (count >= interval)
-			count = 0;
-	}
+	gitt_hub_metrics(hub, &metrics);
+	gitt_hub_free(hub);
 
 	printf("\nExit loop\n");
+	printf("Polls: %llu, failed: %llu, steps: %llu, longest: %llums\n",
+	       (unsigned long long)metrics.polls, (unsigned long long)metrics.failed,
+	       (unsigned long long)metrics.steps, (unsigned long long)metrics.latency_max);
 
 	return 0;
 }
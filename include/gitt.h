@@ -27,26 +27,65 @@
 
 #include <gitt_repository.h>
 #include <gitt_device.h>
+#include <gitt_version.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
-#define GITT_VERSION			"0_90"
+/* Ref template of sharded mode, %s is the device id */
+#define GITT_SHARD_DEVICE		"refs/heads/%s"
 
 struct gitt;
 
 typedef int (*gitt_get_date)(char *buf, uint8_t size);
 typedef int (*gitt_get_zone)(char *buf, uint8_t size);
+typedef void (*gitt_delay)(uint32_t ms);
 typedef void (*gitt_remote_event)(struct gitt *g, struct gitt_device *device,
 				 char *date, char *zone, char *event);
 
+/*
+ * delay:    Optional, wait before a rejected push is sent again
+ * catch_up: Pull the remote events a push was based on right after it,
+ *           instead of with the next gitt_update_event()
+ * session_idle: Seconds the SSH session is kept open between operations, 0 to
+ *               connect for each of them. Call gitt_idle() while waiting.
+ * pool:     Optional, share connections with other struct gitt of the same
+ *           user, host, port and key. session_idle is not used then.
+ * transport: Optional, reach the remote another way than SSH, for example
+ *           a local repository. url is then what the transport takes.
+ * timeout_idle:  Optional, milliseconds to wait for the remote at once
+ * timeout_total: Optional, milliseconds one pull or push may take
+ * cancel:   Optional, set cancel->canceled from another thread to give up.
+ *           Calls then return -GITT_ERRNO_TIMEOUT or -GITT_ERRNO_CANCELED,
+ *           the events pulled so far are kept.
+ * pushed:   Out, number of events the last gitt_commit_events() pushed, also
+ *           when a later batch of it failed
+ */
 struct gitt {
 	struct gitt_device device;
 	struct gitt_repository repository;
 	gitt_get_date get_date;
 	gitt_get_zone get_zone;
+	gitt_delay delay;
 	gitt_remote_event remote_event;
+	struct gitt_pack_worker *worker;
+	struct gitt_delta *delta;
+	uint8_t *ring;
+	uint16_t ring_len;
+	uint8_t *out;
+	uint16_t out_len;
+	const char *filter;
+	struct gitt_refs *ref_table;
+	const char *shard;
+	bool catch_up;
+	uint32_t session_idle;
+	struct gitt_ssh_pool *pool;
+	struct gitt_transport *transport;
+	uint32_t timeout_idle;
+	uint32_t timeout_total;
+	struct gitt_cancel *cancel;
+	uint32_t pushed;
 	char *url;
 	char *privkey;
 	uint8_t *buf;
@@ -55,8 +94,18 @@ struct gitt {
 
 int gitt_init(struct gitt *g);
 int gitt_update_event(struct gitt *g);
+int gitt_update_begin(struct gitt *g);
+int gitt_update_step(struct gitt *g, int *fd);
+void gitt_update_end(struct gitt *g);
+int gitt_check_event(struct gitt *g, bool *news);
 int gitt_commit_event(struct gitt *g, char *data);
+int gitt_commit_events(struct gitt *g, char *data[], uint32_t number);
+int gitt_commit_event_blob(struct gitt *g, char *data, uint8_t *payload, uint16_t size);
+int gitt_commit_event_source(struct gitt *g, char *data, struct gitt_obj_source *source);
 int gitt_history(struct gitt *g);
+int gitt_history_last(struct gitt *g, uint32_t number);
+int gitt_history_since(struct gitt *g, uint32_t timestamp);
+int gitt_idle(struct gitt *g, uint32_t seconds);
 void gitt_end(struct gitt *g);
 char *gitt_version(void);
 
@@ -26,24 +26,177 @@
 #define __GITT_COMMAND_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <gitt_ssh.h>
+#include <gitt_transport.h>
+#include <gitt_refs.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
+#define GITT_COMMAND_VERSION_0		0
+#define GITT_COMMAND_VERSION_2		2
+
+/* Capabilities advertised by the remote */
+#define GITT_COMMAND_CAP_FILTER			(1 << 0)
+#define GITT_COMMAND_CAP_SHALLOW		(1 << 1)
+#define GITT_COMMAND_CAP_DEEPEN_SINCE		(1 << 2)
+#define GITT_COMMAND_CAP_MULTI_ACK_DETAILED	(1 << 3)
+#define GITT_COMMAND_CAP_SIDE_BAND		(1 << 4)
+#define GITT_COMMAND_CAP_SIDE_BAND_64K		(1 << 5)
+#define GITT_COMMAND_CAP_THIN_PACK		(1 << 6)
+#define GITT_COMMAND_CAP_OFS_DELTA		(1 << 7)
+#define GITT_COMMAND_CAP_NO_PROGRESS		(1 << 8)
+#define GITT_COMMAND_CAP_REPORT_STATUS		(1 << 9)
+#define GITT_COMMAND_CAP_REPORT_STATUS_V2	(1 << 10)
+#define GITT_COMMAND_CAP_QUIET			(1 << 11)
+#define GITT_COMMAND_CAP_AGENT			(1 << 12)
+
+/* Number of have lines sent before waiting for the acknowledgments */
+#define GITT_COMMAND_HAVE_BATCH		8
+
+/* Number of shallow commits kept, the remote sends history below the others again */
+#define GITT_COMMAND_SHALLOW_NUMBER	8
+
+#define GITT_COMMAND_RING_MIN		64
+#define GITT_COMMAND_OUT_MIN		256
+
+/* What a non-blocking command waits for, see gitt_command_rewind() */
+#define GITT_COMMAND_WANT_READ		1
+#define GITT_COMMAND_WANT_WRITE		2
+
 typedef int (*gitt_command_pack_dump)(void *param, char *data, int size);
 
-struct gitt_ssh* gitt_command_start_receive(const char *url, const char *privkey);
-struct gitt_ssh* gitt_command_start_upload(const char *url, const char *privkey);
-int gitt_command_get_head(struct gitt_ssh* ssh, char head[41], char refs[32]);
-void gitt_command_end(struct gitt_ssh* ssh);
-int gitt_command_say_byebye(struct gitt_ssh* ssh);
-int gitt_command_want(struct gitt_ssh* ssh, char want_sha1[41], char have_sha1[41]);
-int gitt_command_get_pack(struct gitt_ssh* ssh, gitt_command_pack_dump dump, void *param);
-int gitt_command_set_pack(struct gitt_ssh* ssh, const char *head, const char *id, const char *refs);
-int gitt_command_write_pack(struct gitt_ssh* ssh, uint8_t *buf, uint16_t size);
-int gitt_command_get_state(struct gitt_ssh* ssh);
+/* Commits we have without their parents, the boundary of a shallow fetch */
+struct gitt_command_shallow {
+	char ids[GITT_COMMAND_SHALLOW_NUMBER][41];
+	uint8_t number;
+};
+
+/*
+ * Optional arguments of gitt_command_want(), left out if the server does
+ * not support them.
+ * filter: Filter spec such as "tree:0", or NULL
+ * depth:  Number of commits to fetch from want, 0 for no limit
+ * since:  Fetch commits newer than this unix time only, 0 for no limit
+ * shards: Also want the refs of the table under this prefix that changed
+ *         since they were settled, or NULL
+ * every:  Want all the refs under shards, changed or not
+ * shallow: Or NULL. Sent as shallow lines, so the remote does not send the
+ *         history below them, and updated from its shallow and unshallow
+ *         lines until gitt_command_get_pack() is done
+ * delta:  Ask for ofs-delta and thin-pack, otherwise deltas in the pack are
+ *         based on objects of the same pack and by SHA-1
+ */
+struct gitt_command_options {
+	const char *filter;
+	uint32_t depth;
+	uint32_t since;
+	const char *shards;
+	bool every;
+	struct gitt_command_shallow *shallow;
+	bool delta;
+};
+
+/*
+ * Data from the remote is read ahead into a ring buffer, and pack data is
+ * handed to the dump callback straight from it. Set ring and ring_len
+ * before starting, otherwise ring_min is used. A bigger ring means fewer
+ * reads and bigger pieces of pack.
+ *
+ * Data to the remote is collected in out, and written when a request is
+ * complete (flush-pkt, done, end of pack) or before reading. Without one,
+ * out_min is used.
+ *
+ * If table is set, every ref of the advertisement is kept in it.
+ *
+ * If idle_max is set, the SSH session stays open after gitt_command_end()
+ * and the next start only opens a new channel on it. gitt_command_idle()
+ * keeps it alive, and closes it once it has been idle for idle_max seconds.
+ *
+ * If pool is set, the channels are opened on a connection of the pool that
+ * other commands share, and idle_max is not used.
+ *
+ * If transport is set, the remote is reached through it instead of SSH,
+ * with link as the handle of the started command. pool and idle_max are
+ * not used then.
+ *
+ * After gitt_command_nonblock(), a call fails with again set instead of
+ * waiting for the remote. gitt_command_rewind() puts back what it read
+ * since gitt_command_mark(), so it can be called again from the mark once
+ * the fd is ready; what it already queued for writing is not queued twice.
+ * back: Bytes read since the mark, they stay in the ring
+ * sent: Bytes queued since the mark, skip: of them already queued before
+ * pack_left: Pack data left of the current line
+ * adv, found, track: Where the advertisement is, gitt_command_get_head()
+ *         goes on from the last ref line it took, so only a line needs
+ *         to fit in the ring
+ *
+ * limit bounds the waits for the remote, see gitt_ssh_limit(). When the
+ * transport times out or is canceled, fault keeps why, as the callers in
+ * between only return an error. received counts the bytes read so far.
+ */
+struct gitt_command {
+	struct gitt_ssh *ssh;
+	struct gitt_ssh_pool *pool;
+	struct gitt_ssh_conn *conn;
+	struct gitt_transport *transport;
+	void *link;
+	struct gitt_refs *table;
+	uint8_t *ring;
+	uint16_t ring_len;
+	uint16_t head;
+	uint16_t count;
+	uint8_t *out;
+	uint16_t out_len;
+	uint16_t out_count;
+	uint16_t caps;
+	bool deepen;
+	struct gitt_command_shallow *shallow;
+	uint32_t idle_max;
+	uint32_t idle;
+	uint32_t quiet;
+	bool nonblock;
+	bool again;
+	uint8_t want;
+	uint16_t back;
+	uint32_t sent;
+	uint32_t skip;
+	uint16_t pack_left;
+	uint8_t adv;
+	bool found;
+	char track[32];
+	struct gitt_ssh_limit limit;
+	int fault;
+	uint32_t received;
+	uint8_t ring_min[GITT_COMMAND_RING_MIN];
+	uint8_t out_min[GITT_COMMAND_OUT_MIN];
+};
+
+int gitt_command_start_receive(struct gitt_command *command, const char *url,
+			       const char *privkey);
+int gitt_command_start_upload(struct gitt_command *command, const char *url,
+			      const char *privkey);
+int gitt_command_get_head(struct gitt_command *command, char head[41], char refs[32],
+			  uint8_t *version);
+void gitt_command_end(struct gitt_command *command);
+void gitt_command_idle(struct gitt_command *command, uint32_t seconds);
+void gitt_command_close(struct gitt_command *command);
+int gitt_command_say_byebye(struct gitt_command *command);
+int gitt_command_want(struct gitt_command *command, char want_sha1[41], char (*haves)[41],
+		      uint8_t have_num, uint8_t version, struct gitt_command_options *options);
+int gitt_command_get_pack(struct gitt_command *command, gitt_command_pack_dump dump,
+			  void *param);
+int gitt_command_set_pack(struct gitt_command *command, const char *head, const char *id,
+			  const char *refs);
+int gitt_command_write_pack(struct gitt_command *command, uint8_t *buf, uint16_t size);
+int gitt_command_flush(struct gitt_command *command);
+int gitt_command_get_state(struct gitt_command *command);
+int gitt_command_nonblock(struct gitt_command *command, bool nonblock);
+void gitt_command_mark(struct gitt_command *command);
+int gitt_command_rewind(struct gitt_command *command);
+int gitt_command_fd(struct gitt_command *command);
 
 #ifdef __cplusplus
 }
@@ -27,6 +27,7 @@
 
 #include <stdint.h>
 #include <gitt_obj.h>
+#include <gitt_tree.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -39,8 +40,10 @@ struct gitt_commit_id {
 	char sha1[41];
 };
 
+/* If tree is set, it is pushed along with the commit */
 struct gitt_commit_tree {
 	char *sha1;
+	struct gitt_tree *tree;
 };
 
 struct gitt_commit_parent {
@@ -68,11 +71,13 @@ struct gitt_commit {
 	struct gitt_commit_author author;
 	struct gitt_commit_committer committer;
 	char *message;
+	/* If set, the message is read from it and message is not used */
+	struct gitt_obj_source *source;
 };
 
 int gitt_commit_parse(char *buf, uint16_t size, struct gitt_commit *commit);
 int gitt_commit_build(gitt_obj_data dump, void *p, struct gitt_commit *commit);
-uint16_t gitt_commit_length(struct gitt_commit *commit);
+uint32_t gitt_commit_length(struct gitt_commit *commit);
 int gitt_commit_sha1_update(struct gitt_commit *commit);
 
 #ifdef __cplusplus
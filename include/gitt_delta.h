@@ -0,0 +1,67 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __GITT_DELTA_H_
+#define __GITT_DELTA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define GITT_DELTA_BLOCK		16
+#define GITT_DELTA_HASH_SIZE		256
+#define GITT_DELTA_MIN_SIZE		64
+
+/*
+ * The work buffer is split into three equal slots: the base object,
+ * the target object and the delta output.
+ */
+struct gitt_delta {
+	uint8_t *buf;
+	uint16_t buf_len;
+	uint16_t slot_len;
+	uint8_t base;
+	uint16_t base_len;
+	uint16_t target_len;
+	char base_sha1[41];
+	uint16_t index[GITT_DELTA_HASH_SIZE];
+};
+
+int gitt_delta_init(struct gitt_delta *delta);
+void gitt_delta_reset(struct gitt_delta *delta);
+void gitt_delta_target_reset(struct gitt_delta *delta);
+int gitt_delta_target_dump(void *p, uint8_t *buf, uint16_t size, bool end);
+int gitt_delta_encode(struct gitt_delta *delta, uint8_t **out, uint16_t *out_len);
+void gitt_delta_commit(struct gitt_delta *delta, const char *sha1);
+int gitt_delta_apply(const uint8_t *base, uint16_t base_len, const uint8_t *data,
+		     uint16_t size, uint8_t *out, uint16_t out_len);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __GITT_DELTA_H_ */
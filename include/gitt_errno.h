@@ -35,6 +35,9 @@ const char *gitt_errno_str(int errno);
 #define GITT_ERRNO_INVAL		1
 #define GITT_ERRNO_NOMEM		2
 #define GITT_ERRNO_RETRY		3
+#define GITT_ERRNO_AGAIN		4
+#define GITT_ERRNO_TIMEOUT		5
+#define GITT_ERRNO_CANCELED		6
 
 #define GITT_ERRNO_STR(no)	gitt_errno_str(no)
 
@@ -32,11 +32,28 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#define GITT_OBJ_SOURCE_CHUNK		256
+
 typedef int (*gitt_obj_data)(void *p, uint8_t *buf, uint16_t size, bool end);
 
+/*
+ * rewind: Go back to the first byte, called before every pass over the content
+ * read:   Fill buf with up to size bytes, return the number of bytes or an error
+ */
+typedef int (*gitt_obj_rewind)(void *param);
+typedef int (*gitt_obj_read)(void *param, uint8_t *buf, uint16_t size);
+
+/* Object content that is never held in memory as a whole */
+struct gitt_obj_source {
+	gitt_obj_rewind rewind;
+	gitt_obj_read read;
+	uint32_t length;
+	void *param;
+};
+
 struct gitt_obj {
 	uint8_t type;
-	uint16_t size;
+	uint32_t size;
 	void *data;
 };
 
@@ -51,6 +68,9 @@ extern const char *gitt_obj_types[];
 
 #define GITT_OBJ_STR(no)	gitt_obj_types[no]
 
+int gitt_obj_hex_to_bin(const char *hex, uint8_t bin[20]);
+int gitt_obj_source_dump(struct gitt_obj_source *source, gitt_obj_data dump, void *p, bool end);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -34,21 +34,73 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#define GITT_PACK_WINDOW		8
+
 typedef int (*gitt_pack_data)(void *p, uint8_t *buf, uint16_t size);
 
+/*
+ * Data of GITT_OBJ_TYPE_REF_DELTA and GITT_OBJ_TYPE_OFS_DELTA objects.
+ * The base of an OFS_DELTA is always the previous object in the pack.
+ * With a worker, data must be kept until gitt_pack_settle() has returned.
+ */
+struct gitt_pack_delta {
+	char *base_sha1;
+	uint8_t *data;
+	uint16_t size;
+};
+
+/* An object compressed into its own buffer, a delta keeps its own head */
+struct gitt_pack_zobj {
+	struct gitt_obj obj;
+	struct gitt_pack_delta delta;
+	char base_sha1[41];
+	uint8_t *buf;
+	uint32_t buf_len;
+	uint32_t valid_len;
+	int ret;
+	void *priv;
+};
+
+/*
+ * submit:  Set buf and buf_len (at least gitt_pack_compress_bound()), then
+ *          arrange for gitt_pack_compress() to be called, on any thread
+ * wait:    Block until gitt_pack_compress() has returned, and return its result.
+ *          It can be called again for the same object.
+ * release: The compressed data has been written out, buf can be freed
+ */
+typedef int (*gitt_pack_submit)(void *param, struct gitt_pack_zobj *zobj);
+typedef int (*gitt_pack_wait)(void *param, struct gitt_pack_zobj *zobj);
+typedef void (*gitt_pack_release)(void *param, struct gitt_pack_zobj *zobj);
+
+struct gitt_pack_worker {
+	gitt_pack_submit submit;
+	gitt_pack_wait wait;
+	gitt_pack_release release;
+	void *param;
+};
+
 struct gitt_pack {
 	uint8_t *buf;
 	uint16_t buf_len;
-	uint8_t obj_num;
-	uint8_t state;
+	uint32_t obj_num;
+	uint32_t state;
+	uint32_t submitted;
+	uint32_t offset;
+	uint32_t last_offset;
 	struct gitt_sha1 sha1;
 	gitt_pack_data data_dump;
 	struct gitt_zlib zlib;
+	struct gitt_pack_worker *worker;
+	struct gitt_pack_zobj window[GITT_PACK_WINDOW];
 };
 
 int gitt_pack_init(struct gitt_pack *pack);
 int gitt_pack_update(struct gitt_pack *pack, struct gitt_obj *obj);
+int gitt_pack_flush(struct gitt_pack *pack);
+int gitt_pack_settle(struct gitt_pack *pack);
 void gitt_pack_end(struct gitt_pack *pack);
+uint32_t gitt_pack_compress_bound(struct gitt_obj *obj);
+int gitt_pack_compress(struct gitt_pack_zobj *zobj);
 
 #ifdef __cplusplus
 }
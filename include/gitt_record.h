@@ -0,0 +1,107 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __GITT_RECORD_H_
+#define __GITT_RECORD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <gitt_transport.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * A transcript is a run of records, each of them a kind, the microseconds
+ * since the command was opened and the length of the data (4 bytes each,
+ * big-endian), then the data.
+ * open:  Took that long to connect, data is the stateless flag, exec, '\0'
+ *        and protocol
+ * read:  Data the remote sent
+ * write: Data sent to the remote
+ * close: The end of the command
+ */
+#define GITT_RECORD_OPEN		'O'
+#define GITT_RECORD_READ		'R'
+#define GITT_RECORD_WRITE		'W'
+#define GITT_RECORD_CLOSE		'C'
+
+#define GITT_RECORD_HEAD_SIZE		9
+
+/* Microseconds from any fixed point */
+typedef uint64_t (*gitt_record_now)(void);
+/* Wait for that many microseconds */
+typedef void (*gitt_record_delay)(uint32_t us);
+
+/*
+ * Records the commands run through inner, or serves a transcript back.
+ * Reach the remote through transport, one command at a time.
+ * inner:    Recording, the transport that reaches the remote
+ * buf:      The transcript, used bytes of it are filled
+ * now:      Needed to record, and to replay with the recorded timing
+ * delay:    Replaying, if set, each read waits until as long after the open
+ *           as it took when recorded. Otherwise it is served at once.
+ * overflow: The transcript did not fit, it stops before the command that
+ *           overflowed
+ * skipped:  Replaying, commands of the transcript that were not asked for
+ * diverged: Replaying, bytes written that differ from the recorded ones
+ * Other members are where the open command is.
+ * Recording passes the fd of inner on. Replaying sets no fd: the data is in
+ * memory and timed reads wait in delay, so a call never returns
+ * -GITT_ERRNO_AGAIN. A non-blocking pull then ends in one step, but there is
+ * nothing to poll, so replay cannot stand in for a remote in the hub.
+ */
+struct gitt_record {
+	struct gitt_transport transport;
+	struct gitt_transport *inner;
+	uint8_t *buf;
+	uint32_t buf_len;
+	uint32_t used;
+	gitt_record_now now;
+	gitt_record_delay delay;
+	bool overflow;
+	uint32_t skipped;
+	uint32_t diverged;
+	void *link;
+	bool opened;
+	uint64_t start;
+	uint32_t begin;
+	uint32_t pos;
+	uint32_t end;
+	uint32_t read_pos;
+	uint32_t read_left;
+	uint32_t write_pos;
+	uint32_t write_left;
+};
+
+int gitt_record_init(struct gitt_record *record, struct gitt_transport *inner);
+int gitt_record_replay(struct gitt_record *record);
+void gitt_record_rewind(struct gitt_record *record);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __GITT_RECORD_H_ */
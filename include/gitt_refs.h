@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __GITT_REFS_H_
+#define __GITT_REFS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define GITT_REFS_MAX			16384
+#define GITT_REFS_EMPTY			0xffff
+
+/*
+ * oid:   Id in the last advertisement
+ * known: Id when the ref was last settled, zero for never
+ * live:  The ref was in the last advertisement
+ */
+struct gitt_refs_entry {
+	uint8_t oid[20];
+	uint8_t known[20];
+	uint32_t name;
+	bool live;
+};
+
+/*
+ * Refs of the advertisements. The work buffer holds, in this order, the
+ * entries (max of them), a hash of slot_num entry indexes for lookup by
+ * name, and the arena of the names ('\0' terminated). buf must be aligned
+ * to 4 bytes.
+ *
+ * Refs are kept across advertisements, so that the ones changed since
+ * they were settled can be found.
+ */
+struct gitt_refs {
+	uint8_t *buf;
+	uint32_t buf_len;
+	uint16_t max;
+	uint16_t number;
+	uint16_t slot_num;
+	struct gitt_refs_entry *entries;
+	uint16_t *slots;
+	char *arena;
+	uint32_t arena_len;
+	uint32_t arena_used;
+};
+
+int gitt_refs_init(struct gitt_refs *refs);
+void gitt_refs_reset(struct gitt_refs *refs);
+void gitt_refs_begin(struct gitt_refs *refs);
+int gitt_refs_add(struct gitt_refs *refs, const char *sha1, const char *name);
+int gitt_refs_find(struct gitt_refs *refs, const char *name);
+int gitt_refs_get(struct gitt_refs *refs, const char *name, char sha1[41]);
+const char *gitt_refs_entry(struct gitt_refs *refs, uint16_t index, char sha1[41]);
+bool gitt_refs_changed(struct gitt_refs *refs, uint16_t index);
+bool gitt_refs_match(struct gitt_refs *refs, uint16_t index, const char *prefix, bool every);
+void gitt_refs_settle(struct gitt_refs *refs, uint16_t index);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __GITT_REFS_H_ */
@@ -28,17 +28,65 @@
 #include <gitt_unpack.h>
 #include <gitt_commit.h>
 #include <gitt_pack.h>
-#include <gitt_ssh.h>
+#include <gitt_command.h>
+#include <gitt_delta.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
+#define GITT_REPOSITORY_KNOWN_NUMBER	8
+#define GITT_REPOSITORY_HAVE_NUMBER	16
+#define GITT_REPOSITORY_SHARD_SIZE	64
+#define GITT_REPOSITORY_PUSHED_NUMBER	8
+
+/*
+ * Returned by gitt_repository_pull_step() and gitt_repository_push_step(),
+ * wait for the fd and call it again
+ */
+#define GITT_REPOSITORY_WANT_READ	GITT_COMMAND_WANT_READ
+#define GITT_REPOSITORY_WANT_WRITE	GITT_COMMAND_WANT_WRITE
+
+#define GITT_REPOSITORY_ZERO_SHA1	"0000000000000000000000000000000000000000"
+
+/* Pull only commits and trees, or only commits */
+#define GITT_REPOSITORY_FILTER_BLOB_NONE	"blob:none"
+#define GITT_REPOSITORY_FILTER_TREE_0		"tree:0"
+
 struct gitt_repository;
 
 typedef void (*gitt_repository_commit)(struct gitt_repository *repository,
 				      struct gitt_commit *commit);
 
+/*
+ * known_head, known: Trees and blobs our pushes left reachable from known_head.
+ *         A push skips them while the remote head is still known_head. A
+ *         commit without parent leaves only its own objects reachable, so
+ *         the older ones are forgotten then, the remote may prune them.
+ * shard:  If set, commits are pushed to this ref instead of the head
+ * shards: If set, pulls want the refs of ref_table under this prefix that
+ *         changed, instead of the head
+ * pushed: Our commits pushed on top of remote commits that were not pulled,
+ *         head stays behind them so the next pull gets those remote commits,
+ *         and these are not dumped again
+ * session_idle: If set, the SSH session is kept between operations for up
+ *               to this many idle seconds, see gitt_repository_idle()
+ * pool: If set, channels are opened on a connection shared with other
+ *       repositories, and session_idle is not used
+ * transport: If set, the remote is reached through it instead of SSH, url
+ *       is what it takes, privkey, session_idle and pool are not used
+ * step, version, remote_head, remote_refs, options: Where a pull or a push
+ *       is, so that gitt_repository_pull_step() or gitt_repository_push_step()
+ *       can go on with it
+ * commits, commit_num: What the push is sending
+ * timeout_idle, timeout_total, cancel: Bound each operation, see
+ *       gitt_ssh_limit(). It then fails with -GITT_ERRNO_TIMEOUT or
+ *       -GITT_ERRNO_CANCELED.
+ * pulled: Commits dumped by the last pull. If it did not finish, the head
+ *       stays, and the next pull does not dump them again.
+ * shallow: Boundary of a shallow clone, sent with each later pull so that
+ *       the remote does not send the history below it
+ */
 struct gitt_repository {
 	struct gitt_unpack unpack;
 	struct gitt_pack pack;
@@ -46,18 +94,63 @@ struct gitt_repository {
 	char *privkey;
 	char head[41];
 	char refs[32];
+	char known_head[41];
+	char known[GITT_REPOSITORY_KNOWN_NUMBER][41];
+	uint8_t known_num;
+	char haves[GITT_REPOSITORY_HAVE_NUMBER][41];
+	uint8_t have_num;
+	struct gitt_command_shallow shallow;
 	uint8_t *buf;
 	uint16_t buf_len;
 	gitt_repository_commit commit_dump;
-	struct gitt_ssh* ssh;
+	struct gitt_pack_worker *worker;
+	struct gitt_delta *delta;
+	uint8_t *ring;
+	uint16_t ring_len;
+	uint8_t *out;
+	uint16_t out_len;
+	const char *filter;
+	struct gitt_refs *ref_table;
+	char shard[GITT_REPOSITORY_SHARD_SIZE];
+	char shards[GITT_REPOSITORY_SHARD_SIZE];
+	char pushed[GITT_REPOSITORY_PUSHED_NUMBER][41];
+	uint8_t pushed_num;
+	uint32_t session_idle;
+	struct gitt_ssh_pool *pool;
+	struct gitt_transport *transport;
+	uint8_t step;
+	uint8_t version;
+	char remote_head[41];
+	char remote_refs[32];
+	struct gitt_command_options options;
+	struct gitt_commit *commits;
+	uint32_t commit_num;
+	uint32_t timeout_idle;
+	uint32_t timeout_total;
+	struct gitt_cancel *cancel;
+	uint32_t pulled;
+	struct gitt_command command;
 };
 
 int gitt_repository_init(struct gitt_repository *repository);
 int gitt_repository_clone(struct gitt_repository *repository);
+int gitt_repository_clone_shallow(struct gitt_repository *repository, uint32_t depth,
+				  uint32_t since);
 int gitt_repository_push_commit(struct gitt_repository *repository,
 			       struct gitt_commit *commit);
+int gitt_repository_push_commits(struct gitt_repository *repository,
+				 struct gitt_commit *commits, uint32_t number);
 int gitt_repository_pull(struct gitt_repository *repository);
+int gitt_repository_pull_begin(struct gitt_repository *repository);
+int gitt_repository_pull_step(struct gitt_repository *repository, int *fd);
+void gitt_repository_pull_end(struct gitt_repository *repository);
+int gitt_repository_push_begin(struct gitt_repository *repository,
+			       struct gitt_commit *commits, uint32_t number);
+int gitt_repository_push_step(struct gitt_repository *repository, int *fd);
+void gitt_repository_push_end(struct gitt_repository *repository);
 int gitt_repository_update_head(struct gitt_repository *repository);
+int gitt_repository_remote_head(struct gitt_repository *repository, char head[41]);
+void gitt_repository_idle(struct gitt_repository *repository, uint32_t seconds);
 int gitt_repository_end(struct gitt_repository *repository);
 
 #ifdef __cplusplus
@@ -26,12 +26,14 @@
 #define __GITT_SSH_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
 struct gitt_ssh;
+struct gitt_transport;
 
 struct gitt_ssh_url {
 	char user[16];
@@ -40,13 +42,112 @@ struct gitt_ssh_url {
 	char repository[64];
 };
 
+#define GITT_SSH_CONN_CHANNELS	4
+
+/* Seconds without traffic before an idle session is kept alive */
+#define GITT_SSH_KEEPALIVE	30
+
+/*
+ * lock:   Protect the pool, it is used by several repositories at once
+ * unlock: Release it
+ * wait:   Called with the lock held, release it until wake is called, then
+ *         take it again
+ * wake:   Wake up every waiter
+ */
+struct gitt_ssh_lock {
+	void (*lock)(void *param);
+	void (*unlock)(void *param);
+	void (*wait)(void *param);
+	void (*wake)(void *param);
+	void *param;
+};
+
+/* Set canceled from any thread to make the calls waiting for the remote give up */
+struct gitt_cancel {
+	volatile bool canceled;
+};
+
+/*
+ * Bounds of the calls on a channel, 0 or NULL for none. Past them, read and
+ * write return -GITT_ERRNO_TIMEOUT or -GITT_ERRNO_CANCELED.
+ * idle:   Milliseconds one call waits for the remote, also used to connect
+ * total:  Milliseconds from gitt_ssh_limit() to the end of the operation
+ * cancel: Checked while waiting
+ */
+struct gitt_ssh_limit {
+	uint32_t idle;
+	uint32_t total;
+	struct gitt_cancel *cancel;
+};
+
+struct gitt_ssh_pool;
+
+/*
+ * One authenticated session, shared by the repositories with the same
+ * user, host, port and key. Each repository opens its channels on it
+ * through its own struct gitt_ssh. Channels are handed out in the order
+ * they are asked for, at most channel_max of them at once. connecting is
+ * set while the session is opened without the pool lock. users counts the
+ * repositories between gitt_ssh_pool_get() and the end of their channel,
+ * the connection is handed out for another host once none is left and the
+ * session is closed.
+ */
+struct gitt_ssh_conn {
+	struct gitt_ssh_pool *pool;
+	struct gitt_ssh *ssh;
+	struct gitt_ssh_url url;
+	const char *privkey;
+	uint8_t channel_num;
+	uint32_t ticket_next;
+	uint32_t ticket_serve;
+	uint32_t idle;
+	uint32_t quiet;
+	uint32_t users;
+	bool connecting;
+	bool used;
+};
+
+/*
+ * conns:       Connections to hand out, one per user, host, port and key
+ * channel_max: Channels of a connection at once, GITT_SSH_CONN_CHANNELS if 0
+ * idle_max:    Seconds a connection without channels stays open, see
+ *              gitt_ssh_pool_idle(). If 0, it is closed with its last channel.
+ *              A closed connection that no repository uses is given back.
+ * lock:        Optional, needed if the repositories run on several threads
+ */
+struct gitt_ssh_pool {
+	struct gitt_ssh_conn *conns;
+	uint8_t number;
+	uint8_t channel_max;
+	uint32_t idle_max;
+	struct gitt_ssh_lock *lock;
+};
+
 struct gitt_ssh* gitt_ssh_alloc(void);
 void gitt_ssh_free(struct gitt_ssh *ssh);
+int gitt_ssh_open(struct gitt_ssh *ssh, const char *url, const char *privkey);
+int gitt_ssh_channel_open(struct gitt_ssh *ssh, const char *url, const char *exec,
+			  const char *protocol);
+void gitt_ssh_channel_close(struct gitt_ssh *ssh);
+int gitt_ssh_keepalive(struct gitt_ssh *ssh);
+void gitt_ssh_close(struct gitt_ssh *ssh);
 int gitt_ssh_connect(struct gitt_ssh *ssh, const char *url, const char *exec,
-		     const char *privkey);
+		     const char *privkey, const char *protocol);
 int gitt_ssh_read(struct gitt_ssh *ssh, char *buf, int size);
 int gitt_ssh_write(struct gitt_ssh *ssh, char *buf, int size);
+int gitt_ssh_nonblock(struct gitt_ssh *ssh, bool nonblock);
+int gitt_ssh_fd(struct gitt_ssh *ssh);
+int gitt_ssh_limit(struct gitt_ssh *ssh, struct gitt_ssh_limit *limit);
 void gitt_ssh_disconnect(struct gitt_ssh *ssh);
+int gitt_ssh_pool_init(struct gitt_ssh_pool *pool);
+struct gitt_ssh_conn *gitt_ssh_pool_get(struct gitt_ssh_pool *pool, const char *url,
+					const char *privkey);
+void gitt_ssh_pool_idle(struct gitt_ssh_pool *pool, uint32_t seconds);
+void gitt_ssh_pool_end(struct gitt_ssh_pool *pool);
+int gitt_ssh_conn_open(struct gitt_ssh_conn *conn, struct gitt_ssh *ssh, const char *url,
+		       const char *exec, const char *protocol);
+void gitt_ssh_conn_close(struct gitt_ssh_conn *conn, struct gitt_ssh *ssh);
+int gitt_ssh_transport(struct gitt_transport *transport, const char *privkey);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,134 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __GITT_TRANSPORT_H_
+#define __GITT_TRANSPORT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <gitt_ssh.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Default port of git:// */
+#define GITT_TRANSPORT_GIT_PORT		"9418"
+
+/* Default port of http:// */
+#define GITT_TRANSPORT_HTTP_PORT	"80"
+
+/* Flags of gitt_transport_http_request() */
+#define GITT_TRANSPORT_HTTP_POST	(1 << 0)	/* Send to exec, else discover the refs */
+#define GITT_TRANSPORT_HTTP_GZIP	(1 << 1)	/* The body is compressed with gzip */
+#define GITT_TRANSPORT_HTTP_PROXY	(1 << 2)	/* Ask a proxy, for the whole url */
+
+/* Where the reading of an HTTP response is */
+#define GITT_TRANSPORT_HTTP_STATUS	0
+#define GITT_TRANSPORT_HTTP_FIELD	1
+#define GITT_TRANSPORT_HTTP_BODY	2
+#define GITT_TRANSPORT_HTTP_CHUNK_SIZE	3
+#define GITT_TRANSPORT_HTTP_CHUNK_DATA	4
+#define GITT_TRANSPORT_HTTP_CHUNK_END	5
+#define GITT_TRANSPORT_HTTP_TRAILER	6
+#define GITT_TRANSPORT_HTTP_DONE	7
+
+/* Parts of "scheme://host[:port]/path" */
+struct gitt_transport_url {
+	char host[32];
+	char port[8];
+	char path[64];
+};
+
+/*
+ * One HTTP response, read by gitt_transport_http_head() and then
+ * gitt_transport_http_body().
+ * status:  For example 200
+ * type:    Content-Type, cut to fit
+ * sized:   Content-Length was given, length is what is left of the body
+ * chunked: The body comes in chunks, chunk is what is left of this one
+ * gzip:    The body is compressed with gzip
+ * close:   The connection cannot be used for another request. A body with
+ *          no size and no chunks ends when the connection is closed.
+ */
+struct gitt_transport_http {
+	uint8_t state;
+	uint16_t status;
+	char type[48];
+	bool sized;
+	bool chunked;
+	bool gzip;
+	bool close;
+	bool skip;
+	uint32_t length;
+	uint32_t chunk;
+	char line[64];
+	uint8_t line_len;
+};
+
+/*
+ * Another way than SSH to reach the remote, for example a local process or
+ * a socket. Each command opens its own handle, and closes it at the end.
+ * open:     Run exec ("git-upload-pack" or "git-receive-pack") on url. url
+ *           is passed as given, protocol is the GIT_PROTOCOL value or NULL,
+ *           limit bounds the calls as in gitt_ssh_limit().
+ * read:     Up to size bytes, 0 at the end of the data
+ * write:    All of size bytes, or in non-blocking mode what fits now
+ * nonblock: Optional, as gitt_ssh_nonblock(), needed by non-blocking pulls
+ * fd:       Optional, to wait on before reading, or writing if write is set
+ * close:    Stop exec and release the handle
+ * stateless: Each request is answered on its own, as with smart HTTP. The
+ *           session is not ended with a flush-pkt, and v0 sends all haves
+ *           with done instead of waiting for acknowledgments in between.
+ * Calls return a negative -GITT_ERRNO_* on error, -GITT_ERRNO_AGAIN if they
+ * would block in non-blocking mode.
+ */
+struct gitt_transport {
+	int (*open)(void *param, void **handle, const char *url, const char *exec,
+		    const char *protocol, struct gitt_ssh_limit *limit);
+	int (*read)(void *handle, char *buf, int size);
+	int (*write)(void *handle, char *buf, int size);
+	int (*nonblock)(void *handle, bool nonblock);
+	int (*fd)(void *handle, bool write);
+	void (*close)(void *handle);
+	void *param;
+	bool stateless;
+};
+
+int gitt_transport_url_pad(struct gitt_transport_url *parsed, const char *url,
+			   const char *scheme, const char *port);
+int gitt_transport_git_request(char *buf, int size, struct gitt_transport_url *parsed,
+			       const char *exec, const char *protocol);
+int gitt_transport_http_request(char *buf, int size, struct gitt_transport_url *parsed,
+				const char *exec, const char *protocol, uint8_t flags);
+void gitt_transport_http_begin(struct gitt_transport_http *http);
+int gitt_transport_http_head(struct gitt_transport_http *http, const char *data, int size);
+int gitt_transport_http_body(struct gitt_transport_http *http, const uint8_t *data, int size,
+			     bool *payload);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __GITT_TRANSPORT_H_ */
@@ -25,11 +25,37 @@
 #ifndef __GITT_TREE_H_
 #define __GITT_TREE_H_
 
+#include <stdint.h>
+#include <gitt_obj.h>
+#include <gitt_blob.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
 #define GITT_TREE_EMPTY_SHA1		"4b825dc642cb6eb9a060e54bf8d69288fbee4904"
+#define GITT_TREE_MODE_FILE		"100644"
+
+struct gitt_tree_id {
+	char sha1[41];
+};
+
+/* Entries must be sorted by name */
+struct gitt_tree_entry {
+	char *mode;
+	char *name;
+	struct gitt_blob *blob;
+};
+
+struct gitt_tree {
+	struct gitt_tree_id id;
+	struct gitt_tree_entry *entries;
+	uint16_t number;
+};
+
+int gitt_tree_build(gitt_obj_data dump, void *p, struct gitt_tree *tree);
+uint16_t gitt_tree_length(struct gitt_tree *tree);
+int gitt_tree_sha1_update(struct gitt_tree *tree);
 
 #ifdef __cplusplus
 }
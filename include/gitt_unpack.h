@@ -41,15 +41,29 @@ typedef void (*gitt_unpack_header)(uint32_t *version, uint32_t *number);
 typedef void (*gitt_unpack_obj)(struct gitt_obj *obj);
 typedef void (*gitt_unpack_verify)(bool pass, struct gitt_sha1 *sha1);
 
+/*
+ * Bytes kept of the commits of a pack, so that later OFS_DELTA and REF_DELTA
+ * objects based on them are rebuilt. A commit bigger than this is not kept,
+ * and a delta of it is dumped as it is.
+ */
+#define GITT_UNPACK_BASE_SIZE		2048
+
 struct gitt_unpack {
 	uint8_t *buf;
 	uint16_t buf_len;
-	uint16_t valid_len;
+	uint8_t base[GITT_UNPACK_BASE_SIZE];
+	uint16_t base_used;
+	uint32_t offset;
+	uint32_t obj_offset;
+	uint32_t base_offset;
+	uint8_t base_sha1[20];
+	uint32_t valid_len;
 	gitt_unpack_header header_dump;
 	gitt_unpack_obj obj_dump;
 	gitt_unpack_verify verify_dump;
 	uint8_t pack_state;
 	uint8_t obj_state;
+	bool discard;
 	uint32_t version;
 	uint32_t number;
 	struct gitt_zlib zlib;
@@ -42,6 +42,14 @@
 #define GITT_EMAIL_FORMAT		"%s@%s.GITT"
 
 #define GITT_TRY_NUMBER			5
+#define GITT_RETRY_DELAY		20
+#define GITT_RETRY_DELAY_MAX		640
+#define GITT_BATCH_NUMBER		8
+
+#define GITT_BLOB_NAME			"payload"
+
+#define GITT_DATE_SIZE			16
+#define GITT_ZONE_SIZE			8
 
 static void gitt_repository_commit_dump(struct gitt_repository *repository,
 					struct gitt_commit *commit)
@@ -106,6 +114,30 @@ static void gitt_repository_commit_dump(struct gitt_repository *repository,
 	}
 }
 
+/* Each device pushes to its own ref, and pulls the refs of all devices */
+static int gitt_shard_init(struct gitt *g)
+{
+	const char *p;
+
+	g->repository.shard[0] = '\0';
+	g->repository.shards[0] = '\0';
+	if (!g->shard)
+		return 0;
+
+	/* Only one %s is allowed, it is used as a format */
+	p = strstr(g->shard, "%s");
+	if (!p || p == g->shard || strchr(p + 2, '%') || strchr(g->shard, '%') != p ||
+	    strlen(g->shard) >= GITT_REPOSITORY_SHARD_SIZE - GITT_DEVICE_ID_SIZE) {
+		gitt_log_error("Invalid shard: %s\n", g->shard);
+		return -GITT_ERRNO_INVAL;
+	}
+
+	memcpy(g->repository.shards, g->shard, p - g->shard);
+	g->repository.shards[p - g->shard] = '\0';
+
+	return 0;
+}
+
 /**
  * @brief Initialize GITT
  *
@@ -127,6 +159,25 @@ int gitt_init(struct gitt *g)
 	g->repository.buf = g->buf;
 	g->repository.buf_len = g->buf_len;
 	g->repository.commit_dump = gitt_repository_commit_dump;
+	g->repository.worker = g->worker;
+	g->repository.delta = g->delta;
+	g->repository.ring = g->ring;
+	g->repository.ring_len = g->ring_len;
+	g->repository.out = g->out;
+	g->repository.out_len = g->out_len;
+	g->repository.filter = g->filter;
+	g->repository.ref_table = g->ref_table;
+	g->repository.session_idle = g->session_idle;
+	g->repository.pool = g->pool;
+	g->repository.transport = g->transport;
+	g->repository.timeout_idle = g->timeout_idle;
+	g->repository.timeout_total = g->timeout_total;
+	g->repository.cancel = g->cancel;
+	g->pushed = 0;
+
+	ret = gitt_shard_init(g);
+	if (ret)
+		goto err0;
 
 	ret = gitt_repository_init(&g->repository);
 	if (ret) {
@@ -174,97 +225,374 @@ int gitt_update_event(struct gitt *g)
 }
 
 /**
- * @brief Submit events to remote repository
+ * @brief Start refreshing from remote repository without waiting for it,
+ *        call gitt_update_step() until it is done
  *
  * @param g struct gitt
- * @param data event data
  * @return int     0: no error
  * @return int other: error
  */
-int gitt_commit_event(struct gitt *g, char *data)
+int gitt_update_begin(struct gitt *g)
 {
-	int retval;
 	int ret;
-	int count;
-	struct gitt_commit commit = {0};
-	char date[16];
-	char zone[8];
-	char id[GITT_DEVICE_ID_SIZE + 10];
 
 	if (g == NULL) {
 		gitt_log_error("Pointer cannot be null\n");
 		return -GITT_ERRNO_INVAL;
 	}
 
-	if (data == NULL || !strlen(data)) {
-		gitt_log_error("Date cannot be null\n");
+	ret = gitt_repository_pull_begin(&g->repository);
+	if (ret) {
+		gitt_log_error("Pull the repository fail\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Go on refreshing, see gitt_repository_pull_step()
+ *
+ * @param g struct gitt
+ * @param fd Out: what to wait on
+ * @return int     0: done
+ * @return int GITT_REPOSITORY_WANT_READ/GITT_REPOSITORY_WANT_WRITE: wait for fd
+ * @return int other: error
+ */
+int gitt_update_step(struct gitt *g, int *fd)
+{
+	int ret;
+
+	ret = gitt_repository_pull_step(&g->repository, fd);
+	if (ret < 0)
+		gitt_log_error("Pull the repository fail\n");
+
+	return ret;
+}
+
+/**
+ * @brief End refreshing, done or not
+ *
+ * @param g struct gitt
+ */
+void gitt_update_end(struct gitt *g)
+{
+	gitt_repository_pull_end(&g->repository);
+}
+
+/**
+ * @brief Whether the remote has events that were not pulled yet, without
+ *        pulling them. Sharded remotes are always said to have some.
+ *
+ * @param g struct gitt
+ * @param news Out
+ * @return int     0: no error
+ * @return int other: error
+ */
+int gitt_check_event(struct gitt *g, bool *news)
+{
+	char head[41];
+	int ret;
+
+	if (g == NULL || news == NULL) {
+		gitt_log_error("Pointer cannot be null\n");
 		return -GITT_ERRNO_INVAL;
 	}
 
+	ret = gitt_repository_remote_head(&g->repository, head);
+	if (ret)
+		return ret;
+
+	*news = strlen(g->repository.shards) || strcmp(head, g->repository.head);
+
+	return 0;
+}
+
+static void gitt_commit_fill(struct gitt *g, struct gitt_commit *commit,
+			     char *date, char *zone, char *id, char *data)
+{
+	memset(commit, 0, sizeof(*commit));
+
 	/* Initialize commit */
-	commit.tree.sha1       = GITT_TREE_EMPTY_SHA1;
+	commit->tree.sha1       = GITT_TREE_EMPTY_SHA1;
 
 	/*
 	 * TODO:
 	 *   Here, change GITT_COMMIT_AUTO_BASE to GITT_COMMIT_NO_BASE.
 	 *   Please see the [1] item in the TODO file for the reason.
+	 *   Commits of one batch are still chained to each other, see
+	 *   gitt_commit_events().
 	 */
-	// commit.parent.sha1     = GITT_COMMIT_AUTO_BASE;
-	commit.parent.sha1     = GITT_COMMIT_NO_BASE;
+	// commit->parent.sha1     = GITT_COMMIT_AUTO_BASE;
+	commit->parent.sha1     = GITT_COMMIT_NO_BASE;
 
+	commit->author.date     = date;
+	commit->committer.date  = date;
+	commit->author.zone     = zone;
+	commit->committer.zone  = zone;
+
+	/* Fill name and email */
+	commit->author.email    = strlen(id) ? id : GITT_UNKNOWN_EMAIL;
+	commit->author.name     = strlen(g->device.name) ? g->device.name : GITT_UNKNOWN_NEME;
+	commit->committer.email = GITT_COMMITTER_EMAIL;
+	commit->committer.name  = GITT_COMMITTER_NAME;
+
+	commit->message         = data;
+}
+
+static void gitt_commit_info(struct gitt *g, char *date, char *zone, char *id)
+{
 	/* Fill date */
-	if (g->get_date && !g->get_date(date, sizeof(date))) {
-		commit.author.date     = date;
-		commit.committer.date  = date;
-	} else {
-		commit.author.date     = GITT_DEFAULT_DATE;
-		commit.committer.date  = GITT_DEFAULT_DATE;
-	}
+	if (!g->get_date || g->get_date(date, GITT_DATE_SIZE))
+		strcpy(date, GITT_DEFAULT_DATE);
 
 	/* Fill zone */
-	if (g->get_zone && !g->get_zone(zone, sizeof(zone))) {
-		commit.author.zone     = zone;
-		commit.committer.zone  = zone;
-	} else {
-		commit.author.zone     = GITT_DEFAULT_ZONE;
-		commit.committer.zone  = GITT_DEFAULT_ZONE;
-	}
+	if (!g->get_zone || g->get_zone(zone, GITT_ZONE_SIZE))
+		strcpy(zone, GITT_DEFAULT_ZONE);
 
-	/* Fill name and email */
-	if (strlen(g->device.id)) {
+	/* Fill email */
+	if (strlen(g->device.id))
 		sprintf(id, GITT_EMAIL_FORMAT, g->device.id, GITT_VERSION);
-		commit.author.email    = id;
-	} else {
-		commit.author.email    = GITT_UNKNOWN_EMAIL;
+	else
+		id[0] = '\0';
+}
+
+/*
+ * Wait before the next try, the window doubles each time. The commit id
+ * is as good as a random number, and it differs from device to device.
+ */
+static void gitt_commit_backoff(struct gitt *g, struct gitt_commit *commit, int count)
+{
+	uint32_t window;
+	unsigned int random;
+
+	if (!g->delay)
+		return;
+
+	window = GITT_RETRY_DELAY << (count - 1);
+	if (window > GITT_RETRY_DELAY_MAX)
+		window = GITT_RETRY_DELAY_MAX;
+
+	if (sscanf(commit->id.sha1, "%8x", &random) != 1)
+		random = 0;
+	g->delay(window / 2 + random % (window / 2 + 1));
+}
+
+static int gitt_commit_push(struct gitt *g, struct gitt_commit *commits, uint32_t number)
+{
+	int retval;
+	int ret;
+	int count;
+
+	/* The device id may be set after gitt_init() */
+	if (g->shard) {
+		if (!strlen(g->device.id)) {
+			gitt_log_error("Device id cannot be empty with shard\n");
+			return -GITT_ERRNO_INVAL;
+		}
+		sprintf(g->repository.shard, g->shard, g->device.id);
 	}
-	commit.author.name     = strlen(g->device.name) ? g->device.name : GITT_UNKNOWN_NEME;
-	commit.committer.email = GITT_COMMITTER_EMAIL;
-	commit.committer.name  = GITT_COMMITTER_NAME;
 
-	commit.message         = data;
+	/* No room to remember more of our commits, pull the ones under them first */
+	if (g->repository.pushed_num + number > GITT_REPOSITORY_PUSHED_NUMBER) {
+		retval = gitt_update_event(g);
+		if (retval)
+			return retval;
+	}
 
 	/* Try to commit */
 	count = 0;
 	do {
-		retval = gitt_repository_push_commit(&g->repository, &commit);
+		retval = gitt_repository_push_commits(&g->repository, commits, number);
 		count++;
 
 		if (retval == -GITT_ERRNO_RETRY) {
 			gitt_log_info("Retry count: %d\n", count);
 
-			/* Update */
-			ret = gitt_update_event(g);
-			if (ret)
-				return ret;
+			/*
+			 * Someone pushed first. Instead of pulling, send the commits
+			 * again on top of the head that the next session advertises.
+			 */
+			if (count < GITT_TRY_NUMBER)
+				gitt_commit_backoff(g, &commits[0], count);
+			commits[0].parent.sha1 = GITT_COMMIT_AUTO_BASE;
 		} else {
 			gitt_log_debug("End code: %d\n", retval);
 			break;
 		}
 	} while (count < GITT_TRY_NUMBER);
 
+	/* The remote events under our commits */
+	if (!retval && g->catch_up && g->repository.pushed_num) {
+		ret = gitt_update_event(g);
+		if (ret)
+			gitt_log_info("Catch up later, code: %d\n", ret);
+	}
+
 	return retval;
 }
 
+/**
+ * @brief Submit events to remote repository
+ *
+ * @param g struct gitt
+ * @param data event data
+ * @return int     0: no error
+ * @return int other: error
+ */
+int gitt_commit_event(struct gitt *g, char *data)
+{
+	return gitt_commit_events(g, &data, 1);
+}
+
+/**
+ * @brief Submit several events to remote repository. Up to GITT_BATCH_NUMBER
+ *        events are chained into one pack and pushed in one session.
+ *        gitt.pushed tells how many were pushed.
+ *
+ * @param g struct gitt
+ * @param data event data list
+ * @param number number of events
+ * @return int     0: no error
+ * @return int other: error, the first gitt.pushed events were pushed
+ */
+int gitt_commit_events(struct gitt *g, char *data[], uint32_t number)
+{
+	int retval = 0;
+	uint32_t index;
+	uint32_t batch;
+	struct gitt_commit commits[GITT_BATCH_NUMBER];
+	char date[GITT_DATE_SIZE];
+	char zone[GITT_ZONE_SIZE];
+	char id[GITT_DEVICE_ID_SIZE + 10];
+
+	if (g == NULL) {
+		gitt_log_error("Pointer cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	if (data == NULL || !number) {
+		gitt_log_error("Date cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	for (index = 0; index < number; index++) {
+		if (data[index] == NULL || !strlen(data[index])) {
+			gitt_log_error("Date cannot be null\n");
+			return -GITT_ERRNO_INVAL;
+		}
+	}
+
+	gitt_commit_info(g, date, zone, id);
+
+	g->pushed = 0;
+	while (number) {
+		batch = number < GITT_BATCH_NUMBER ? number : GITT_BATCH_NUMBER;
+		for (index = 0; index < batch; index++)
+			gitt_commit_fill(g, &commits[index], date, zone, id, data[index]);
+
+		retval = gitt_commit_push(g, commits, batch);
+		if (retval) {
+			if (g->pushed)
+				gitt_log_info("Pushed %u events before code: %d\n", g->pushed, retval);
+			return retval;
+		}
+
+		g->pushed += batch;
+		data += batch;
+		number -= batch;
+	}
+
+	return retval;
+}
+
+static int gitt_commit_push_blob(struct gitt *g, char *data, struct gitt_blob *blob)
+{
+	struct gitt_commit commit;
+	struct gitt_tree_entry entry;
+	struct gitt_tree tree;
+	char date[GITT_DATE_SIZE];
+	char zone[GITT_ZONE_SIZE];
+	char id[GITT_DEVICE_ID_SIZE + 10];
+
+	if (g == NULL) {
+		gitt_log_error("Pointer cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	if (data == NULL || !strlen(data)) {
+		gitt_log_error("Date cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	gitt_commit_info(g, date, zone, id);
+	gitt_commit_fill(g, &commit, date, zone, id, data);
+
+	entry.mode = GITT_TREE_MODE_FILE;
+	entry.name = GITT_BLOB_NAME;
+	entry.blob = blob;
+	tree.entries = &entry;
+	tree.number = 1;
+	commit.tree.tree = &tree;
+
+	return gitt_commit_push(g, &commit, 1);
+}
+
+/**
+ * @brief Submit an event with binary payload to remote repository.
+ *        The payload is stored in a blob of the commit tree, and it is
+ *        not uploaded again if the remote already has it.
+ *
+ * @param g struct gitt
+ * @param data event data
+ * @param payload binary payload
+ * @param size payload size
+ * @return int     0: no error
+ * @return int other: error
+ */
+int gitt_commit_event_blob(struct gitt *g, char *data, uint8_t *payload, uint16_t size)
+{
+	struct gitt_blob blob;
+
+	if (payload == NULL && size) {
+		gitt_log_error("Date cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	blob.data = payload;
+	blob.size = size;
+	blob.source = NULL;
+
+	return gitt_commit_push_blob(g, data, &blob);
+}
+
+/**
+ * @brief Same as gitt_commit_event_blob(), but the payload is read from
+ *        source piece by piece. It is read several times (hash, pack and
+ *        each retry), and is never held in memory as a whole.
+ *
+ * @param g struct gitt
+ * @param data event data
+ * @param source payload source
+ * @return int     0: no error
+ * @return int other: error
+ */
+int gitt_commit_event_source(struct gitt *g, char *data, struct gitt_obj_source *source)
+{
+	struct gitt_blob blob;
+
+	if (source == NULL || !source->rewind || !source->read) {
+		gitt_log_error("Source cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	blob.data = NULL;
+	blob.size = 0;
+	blob.source = source;
+
+	return gitt_commit_push_blob(g, data, &blob);
+}
+
 /**
  * @brief Get all history in the repository
  *
@@ -288,6 +616,73 @@ int gitt_history(struct gitt *g)
 	return 0;
 }
 
+/**
+ * @brief Get the last events in the repository
+ *
+ * @param g struct gitt
+ * @param number number of events
+ * @return int     0: no error
+ * @return int other: error
+ */
+int gitt_history_last(struct gitt *g, uint32_t number)
+{
+	if (g == NULL) {
+		gitt_log_error("Pointer cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	if (!number) {
+		gitt_log_error("Number cannot be zero\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	return gitt_repository_clone_shallow(&g->repository, number, 0);
+}
+
+/**
+ * @brief Get the events newer than a time in the repository
+ *
+ * @param g struct gitt
+ * @param timestamp unix time
+ * @return int     0: no error
+ * @return int other: error
+ */
+int gitt_history_since(struct gitt *g, uint32_t timestamp)
+{
+	if (g == NULL) {
+		gitt_log_error("Pointer cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	if (!timestamp) {
+		gitt_log_error("Timestamp cannot be zero\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	return gitt_repository_clone_shallow(&g->repository, 0, timestamp);
+}
+
+/**
+ * @brief Tell GITT that time passed without other calls. The kept SSH
+ *        session is sent keepalives, and closed once idle for too long.
+ *
+ * @param g struct gitt
+ * @param seconds Seconds since the last call
+ * @return int     0: no error
+ * @return int other: error
+ */
+int gitt_idle(struct gitt *g, uint32_t seconds)
+{
+	if (g == NULL) {
+		gitt_log_error("Pointer cannot be null\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	gitt_repository_idle(&g->repository, seconds);
+
+	return 0;
+}
+
 /**
  * @brief Free GITT
  *
@@ -299,7 +694,25 @@ void gitt_end(struct gitt *g)
 
 	g->get_date = NULL;
 	g->get_zone = NULL;
+	g->delay = NULL;
 	g->remote_event = NULL;
+	g->worker = NULL;
+	g->delta = NULL;
+	g->ring = NULL;
+	g->ring_len = 0;
+	g->out = NULL;
+	g->out_len = 0;
+	g->filter = NULL;
+	g->ref_table = NULL;
+	g->shard = NULL;
+	g->catch_up = false;
+	g->session_idle = 0;
+	g->pool = NULL;
+	g->transport = NULL;
+	g->timeout_idle = 0;
+	g->timeout_total = 0;
+	g->cancel = NULL;
+	g->pushed = 0;
 	g->url = NULL;
 	g->privkey = NULL;
 	g->buf = NULL;
@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <gitt_blob.h>
+#include <gitt_log.h>
+#include <gitt_sha1.h>
+#include <gitt_errno.h>
+
+int gitt_blob_build(gitt_obj_data dump, void *p, struct gitt_blob *blob)
+{
+	if (blob->source)
+		return gitt_obj_source_dump(blob->source, dump, p, true);
+
+	return dump(p, blob->data, blob->size, true);
+}
+
+uint32_t gitt_blob_length(struct gitt_blob *blob)
+{
+	return blob->source ? blob->source->length : blob->size;
+}
+
+static int gitt_obj_data_dump(void *p, uint8_t *buf, uint16_t size, bool end)
+{
+	if (!size)
+		return 0;
+
+	return gitt_sha1_update((struct gitt_sha1 *)p, buf, size);
+}
+
+int gitt_blob_sha1_update(struct gitt_blob *blob)
+{
+	struct gitt_sha1 sha1;
+	int ret;
+	char front_str[16];
+
+	gitt_sha1_init(&sha1);
+
+	ret = sprintf(front_str, "blob %u", (unsigned int)gitt_blob_length(blob));
+	if (ret <= 0)
+		return -GITT_ERRNO_INVAL;
+
+	ret = gitt_sha1_update(&sha1, (uint8_t *)front_str, ret + 1);
+	if (ret)
+		return ret;
+
+	ret = gitt_blob_build(gitt_obj_data_dump, &sha1, blob);
+	if (ret)
+		return ret;
+
+	ret = gitt_sha1_hexdigest(&sha1, blob->id.sha1);
+	if (ret)
+		return ret;
+
+	gitt_log_debug("SHA1: %s\n", blob->id.sha1);
+	return 0;
+}
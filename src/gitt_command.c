@@ -29,29 +29,373 @@
 #include <gitt_ssh.h>
 #include <gitt_log.h>
 #include <gitt_command.h>
+#include <gitt_refs.h>
 #include <gitt_errno.h>
+#include <gitt_version.h>
+
+#define GITT_COMMAND_AGENT		"agent=gitt/" GITT_VERSION
+#define GITT_COMMAND_LINE_SIZE		128
+#define GITT_COMMAND_TOKEN_SIZE		32
+
+/* Where gitt_command_get_head() is in the advertisement */
+#define GITT_COMMAND_ADV_FIRST		0
+#define GITT_COMMAND_ADV_V2_CAPS	1
+#define GITT_COMMAND_ADV_V2_LS		2
+#define GITT_COMMAND_ADV_V2_REFS	3
+#define GITT_COMMAND_ADV_V0_REFS	4
 
 struct line_data {
 	char *data;
 	uint16_t size;
 };
 
-static struct gitt_ssh* gitt_command_start(const char *url, const char *privkey, char *type)
+/* Keep why the transport gave up, the callers in between only see an error */
+static int gitt_command_fail(struct gitt_command *command, int ret)
+{
+	if (ret == -GITT_ERRNO_TIMEOUT || ret == -GITT_ERRNO_CANCELED) {
+		command->fault = ret;
+		return ret;
+	}
+
+	return -GITT_ERRNO_INVAL;
+}
+
+static bool gitt_command_canceled(struct gitt_command *command)
+{
+	if (!command->limit.cancel || !command->limit.cancel->canceled)
+		return false;
+
+	gitt_log_info("Canceled\n");
+	command->fault = -GITT_ERRNO_CANCELED;
+	return true;
+}
+
+/* Each request is answered on its own, there is no session to keep state in */
+static bool gitt_command_stateless(struct gitt_command *command)
+{
+	return command->transport && command->transport->stateless;
+}
+
+static int gitt_command_remote_read(struct gitt_command *command, char *buf, int size)
+{
+	if (command->transport)
+		return command->transport->read(command->link, buf, size);
+
+	return gitt_ssh_read(command->ssh, buf, size);
+}
+
+static int gitt_command_remote_write(struct gitt_command *command, char *buf, int size)
+{
+	if (command->transport)
+		return command->transport->write(command->link, buf, size);
+
+	return gitt_ssh_write(command->ssh, buf, size);
+}
+
+static int gitt_command_start(struct gitt_command *command, const char *url,
+			      const char *privkey, char *type, const char *protocol)
 {
-	struct gitt_ssh* ssh = gitt_ssh_alloc();
 	int ret;
 
-	if (!ssh)
-		return NULL;
+	/* Use the built-in buffers if none is given */
+	if (!command->ring || !command->ring_len) {
+		command->ring = command->ring_min;
+		command->ring_len = sizeof(command->ring_min);
+	}
+	if (!command->out || !command->out_len) {
+		command->out = command->out_min;
+		command->out_len = sizeof(command->out_min);
+	}
+	command->head = 0;
+	command->count = 0;
+	command->out_count = 0;
+	command->nonblock = false;
+	command->again = false;
+	command->pack_left = 0;
+	command->adv = GITT_COMMAND_ADV_FIRST;
+	gitt_command_mark(command);
+
+	command->idle = 0;
+	command->quiet = 0;
+	command->fault = 0;
+	command->received = 0;
+
+	if (gitt_command_canceled(command))
+		return -GITT_ERRNO_CANCELED;
+
+	/* Another transport, a handle for each command */
+	if (command->transport) {
+		ret = command->transport->open(command->transport->param, &command->link, url,
+					       type, protocol, &command->limit);
+		if (ret) {
+			command->link = NULL;
+			return gitt_command_fail(command, ret);
+		}
+		return 0;
+	}
+
+	/* A channel on the shared connection */
+	if (command->pool) {
+		command->ssh = gitt_ssh_alloc();
+		if (!command->ssh)
+			return -GITT_ERRNO_NOMEM;
+
+		command->conn = gitt_ssh_pool_get(command->pool, url, privkey);
+		if (!command->conn) {
+			gitt_ssh_free(command->ssh);
+			command->ssh = NULL;
+			return -GITT_ERRNO_NOMEM;
+		}
+
+		gitt_ssh_limit(command->ssh, &command->limit);
+		ret = gitt_ssh_conn_open(command->conn, command->ssh, url, type, protocol);
+		if (ret) {
+			gitt_ssh_free(command->ssh);
+			command->ssh = NULL;
+			return gitt_command_fail(command, ret);
+		}
+		return 0;
+	}
+
+	/* A kept session only needs a new channel, unless it is gone */
+	if (command->ssh) {
+		gitt_ssh_limit(command->ssh, &command->limit);
+		ret = gitt_ssh_channel_open(command->ssh, url, type, protocol);
+		if (!ret)
+			return 0;
+		gitt_log_info("Session lost, connect again\n");
+		gitt_command_close(command);
+	}
+
+	command->ssh = gitt_ssh_alloc();
+	if (!command->ssh)
+		return -GITT_ERRNO_NOMEM;
 
 	/* Connect */
-	ret = gitt_ssh_connect(ssh, url, type, privkey);
+	gitt_ssh_limit(command->ssh, &command->limit);
+	ret = gitt_ssh_connect(command->ssh, url, type, privkey, protocol);
 	if (ret) {
-		gitt_ssh_free(ssh);
-		return NULL;
+		gitt_ssh_free(command->ssh);
+		command->ssh = NULL;
+		return gitt_command_fail(command, ret);
+	}
+
+	return 0;
+}
+
+/* The remote is not ready, the call is to be made again from the mark */
+static int gitt_command_again(struct gitt_command *command, uint8_t want)
+{
+	command->again = true;
+	command->want = want;
+
+	return -GITT_ERRNO_AGAIN;
+}
+
+/* Write what the remote takes now, the rest stays in the output buffer */
+static int gitt_command_flush_nonblock(struct gitt_command *command)
+{
+	int ret;
+
+	ret = gitt_command_remote_write(command, (char *)command->out, command->out_count);
+	if (ret == -GITT_ERRNO_AGAIN) {
+		ret = 0;
+	} else if (ret < 0 || ret > command->out_count) {
+		gitt_log_debug("Error writing to remote\n");
+		command->out_count = 0;
+		return gitt_command_fail(command, ret);
+	}
+
+	memmove(command->out, command->out + ret, command->out_count - ret);
+	command->out_count -= ret;
+	if (command->out_count)
+		return gitt_command_again(command, GITT_COMMAND_WANT_WRITE);
+
+	return 0;
+}
+
+/**
+ * @brief Write out what is waiting in the output buffer
+ *
+ * @param command
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_command_flush(struct gitt_command *command)
+{
+	int ret;
+
+	if (!command->out_count)
+		return 0;
+
+	if (command->nonblock)
+		return gitt_command_flush_nonblock(command);
+
+	ret = gitt_command_remote_write(command, (char *)command->out, command->out_count);
+	if (ret != command->out_count) {
+		gitt_log_debug("Error writing to remote\n");
+		command->out_count = 0;
+		return gitt_command_fail(command, ret);
+	}
+	command->out_count = 0;
+
+	return 0;
+}
+
+/*
+ * Non-blocking: everything goes through the output buffer, and what an
+ * earlier try of the call queued already is dropped.
+ */
+static int gitt_command_queue(struct gitt_command *command, char *buf, uint16_t size)
+{
+	uint32_t drop = 0;
+	uint16_t room;
+	int ret;
+
+	if (command->skip > command->sent)
+		drop = command->skip - command->sent < size ? command->skip - command->sent : size;
+	command->sent += drop;
+	buf += drop;
+	size -= drop;
+
+	while (size) {
+		if (command->out_count == command->out_len) {
+			ret = gitt_command_flush(command);
+			if (ret)
+				return ret;
+		}
+
+		room = command->out_len - command->out_count;
+		room = room < size ? room : size;
+		memcpy(command->out + command->out_count, buf, room);
+		command->out_count += room;
+		command->sent += room;
+		buf += room;
+		size -= room;
+	}
+
+	return 0;
+}
+
+/* Queue data in the output buffer, what does not fit is written directly */
+static int gitt_command_write(struct gitt_command *command, char *buf, uint16_t size)
+{
+	int ret;
+
+	if (command->nonblock)
+		return gitt_command_queue(command, buf, size);
+
+	if (command->out_count + size > command->out_len) {
+		ret = gitt_command_flush(command);
+		if (ret)
+			return ret;
+	}
+
+	if (size >= command->out_len) {
+		ret = gitt_command_remote_write(command, buf, size);
+		if (ret != size) {
+			gitt_log_debug("Error writing to remote\n");
+			return gitt_command_fail(command, ret);
+		}
+		return 0;
+	}
+
+	memcpy(command->out + command->out_count, buf, size);
+	command->out_count += size;
+
+	return 0;
+}
+
+/* Read as much as fits in the free part of the ring with one call */
+static int gitt_command_fill(struct gitt_command *command)
+{
+	uint16_t tail;
+	uint16_t space;
+	uint16_t avail;
+	int ret;
+
+	/* The remote may be waiting for what we have not sent yet */
+	ret = gitt_command_flush(command);
+	if (ret)
+		return ret;
+
+	if (!command->count && !command->back)
+		command->head = 0;
+
+	/* What was read since the mark is kept for gitt_command_rewind() */
+	tail = (command->head + command->count) % command->ring_len;
+	avail = command->ring_len - command->count - command->back;
+	if (!avail && command->nonblock) {
+		gitt_log_error("Reply does not fit in the ring\n");
+		return -GITT_ERRNO_NOMEM;
+	} else if (!avail) {
+		return 0;
+	}
+	space = command->ring_len - tail;
+	space = space < avail ? space : avail;
+
+	if (gitt_command_canceled(command))
+		return -GITT_ERRNO_CANCELED;
+
+	ret = gitt_command_remote_read(command, (char *)command->ring + tail, space);
+	if (ret == -GITT_ERRNO_AGAIN)
+		return gitt_command_again(command, GITT_COMMAND_WANT_READ);
+	if (ret <= 0 || ret > space) {
+		gitt_log_debug("Failed to read from remote\n");
+		return gitt_command_fail(command, ret);
+	}
+	command->count += ret;
+	command->received += ret;
+
+	return 0;
+}
+
+/*
+ * Take up to size bytes that are contiguous in the ring, without copying.
+ * They stay valid until the next read.
+ */
+static int gitt_command_span(struct gitt_command *command, uint8_t **data, uint16_t size)
+{
+	uint16_t valid;
+	int ret;
+
+	if (!command->count) {
+		ret = gitt_command_fill(command);
+		if (ret)
+			return ret;
+	}
+
+	valid = command->ring_len - command->head;
+	valid = valid < command->count ? valid : command->count;
+	valid = valid < size ? valid : size;
+
+	*data = command->ring + command->head;
+	command->head = (command->head + valid) % command->ring_len;
+	command->count -= valid;
+	if (command->nonblock)
+		command->back += valid;
+
+	return valid;
+}
+
+/* Read exactly size bytes */
+static int gitt_command_read(struct gitt_command *command, char *buf, int size)
+{
+	uint8_t *data = NULL;
+	int valid = 0;
+	int ret;
+
+	while (valid < size) {
+		ret = gitt_command_span(command, &data, size - valid);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return -GITT_ERRNO_INVAL;
+		memcpy(buf + valid, data, ret);
+		valid += ret;
 	}
 
-	return ssh;
+	return valid;
 }
 
 static inline int8_t gitt_command_char_to_half_byte(char ch)
@@ -67,7 +411,7 @@ static inline int8_t gitt_command_char_to_half_byte(char ch)
 	return -GITT_ERRNO_INVAL;
 }
 
-static int gitt_command_get_line_length(struct gitt_ssh* ssh)
+static int gitt_command_get_line_length(struct gitt_command *command)
 {
 	int ret = 0;
 	int8_t half_byte;
@@ -75,7 +419,7 @@ static int gitt_command_get_line_length(struct gitt_ssh* ssh)
 	char buf[4];
 
 	/* Read 4byte */
-	ret = gitt_ssh_read(ssh, buf, sizeof(buf));
+	ret = gitt_command_read(command, buf, sizeof(buf));
 	if (ret != sizeof(buf)) {
 		gitt_log_debug("Failed to read 4 bytes\n");
 		return -GITT_ERRNO_INVAL;
@@ -94,221 +438,965 @@ static int gitt_command_get_line_length(struct gitt_ssh* ssh)
 	return ret;
 }
 
-struct gitt_ssh* gitt_command_start_receive(const char *url, const char *privkey)
+/* Read a whole line, what does not fit in buf is dropped. Return 0 for flush/delim. */
+static int gitt_command_read_line(struct gitt_command *command, char *buf, int size)
 {
-	return gitt_command_start(url, privkey, "git-receive-pack");
+	int length;
+	int valid;
+	int ret;
+	char skip[32];
+
+	length = gitt_command_get_line_length(command);
+	if (length < 0)
+		return length;
+	else if (length < 4)
+		return 0;
+	length -= 4;
+
+	valid = length < size ? length : size - 1;
+	ret = gitt_command_read(command, buf, valid);
+	if (ret != valid)
+		return -GITT_ERRNO_INVAL;
+	buf[valid] = '\0';
+	length -= valid;
+
+	while (length) {
+		ret = length < sizeof(skip) ? length : sizeof(skip);
+		ret = gitt_command_read(command, skip, ret);
+		if (ret <= 0)
+			return -GITT_ERRNO_INVAL;
+		length -= ret;
+	}
+
+	return valid;
 }
 
-struct gitt_ssh* gitt_command_start_upload(const char *url, const char *privkey)
+static void gitt_command_set_line_length(char *line, uint16_t length)
 {
-	return gitt_command_start(url, privkey, "git-upload-pack");
+	uint8_t count;
+	const char *tables = "0123456789abcdef";
+
+	if (length == 4)
+		length = 0;
+
+	for (count = 0; count < 4; count++)
+		line[count] = tables[(length >> (12 - 4 * count)) & 0xf];
 }
 
-int gitt_command_say_byebye(struct gitt_ssh* ssh)
+static int gitt_command_line_write(struct gitt_command *command, struct line_data *line, uint8_t part)
+{
+	char buf[5] = {0};
+	uint16_t length;
+	int ret;
+	uint8_t i;
+
+	/* Total line size */
+	length = 0;
+	for (i = 0; i < part; i++)
+		length += line[i].size;
+
+	if (length)
+		length += 4;
+
+	/* Set the length of the line and write */
+	gitt_command_set_line_length(buf, length);
+	gitt_log_debug(buf);
+	ret = gitt_command_write(command, buf, 4);
+	if (ret) {
+		gitt_log_debug("Error writing line, at %d\n", __LINE__);
+		return ret;
+	}
+
+	/* A flush-pkt ends a request, send it all out */
+	if (!length)
+		return gitt_command_flush(command);
+
+	/* Write each part of the line */
+	for (i = 0; i < part; i++) {
+		gitt_log_debug(line[i].data);
+		ret = gitt_command_write(command, line[i].data, line[i].size);
+		if (ret) {
+			gitt_log_debug("Error writing line, at %d\n", __LINE__);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int gitt_command_start_receive(struct gitt_command *command, const char *url,
+			       const char *privkey)
+{
+	return gitt_command_start(command, url, privkey, "git-receive-pack", NULL);
+}
+
+/* Ask for protocol v2, the server answers in v0 if it does not know it */
+int gitt_command_start_upload(struct gitt_command *command, const char *url,
+			      const char *privkey)
+{
+	return gitt_command_start(command, url, privkey, "git-upload-pack", "version=2");
+}
+
+int gitt_command_say_byebye(struct gitt_command *command)
 {
 	const char *end = "0000\n";
 	int ret;
 
-	ret = gitt_ssh_write(ssh, (char *)end, 5);
-	if (ret != 5) {
+	if (gitt_command_stateless(command))
+		return 0;
+
+	ret = gitt_command_write(command, (char *)end, 5);
+	if (!ret)
+		ret = gitt_command_flush(command);
+	if (ret) {
 		gitt_log_debug("Saying goodbye went wrong\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	uint16_t cap;
+} gitt_command_caps[] = {
+	{ "filter", GITT_COMMAND_CAP_FILTER },
+	{ "shallow", GITT_COMMAND_CAP_SHALLOW },
+	{ "deepen-since", GITT_COMMAND_CAP_DEEPEN_SINCE },
+	{ "multi_ack_detailed", GITT_COMMAND_CAP_MULTI_ACK_DETAILED },
+	{ "side-band", GITT_COMMAND_CAP_SIDE_BAND },
+	{ "side-band-64k", GITT_COMMAND_CAP_SIDE_BAND_64K },
+	{ "thin-pack", GITT_COMMAND_CAP_THIN_PACK },
+	{ "ofs-delta", GITT_COMMAND_CAP_OFS_DELTA },
+	{ "no-progress", GITT_COMMAND_CAP_NO_PROGRESS },
+	{ "report-status", GITT_COMMAND_CAP_REPORT_STATUS },
+	{ "report-status-v2", GITT_COMMAND_CAP_REPORT_STATUS_V2 },
+	{ "quiet", GITT_COMMAND_CAP_QUIET },
+};
+
+/* Take note of the server capabilities that we make use of */
+static void gitt_command_cap(struct gitt_command *command, const char *cap)
+{
+	uint8_t index;
+
+	if (!strncmp(cap, "agent=", 6)) {
+		command->caps |= GITT_COMMAND_CAP_AGENT;
+		return;
+	}
+
+	for (index = 0; index < sizeof(gitt_command_caps) / sizeof(gitt_command_caps[0]); index++) {
+		if (!strcmp(cap, gitt_command_caps[index].name)) {
+			command->caps |= gitt_command_caps[index].cap;
+			return;
+		}
+	}
+}
+
+/* Add " <text>" to the first line of a request if the remote supports it */
+static uint8_t gitt_command_caps_add(struct gitt_command *command, struct line_data *line,
+				     uint8_t part, uint16_t cap, const char *text)
+{
+	if (!(command->caps & cap))
+		return part;
+
+	line[part].data = (char *)text;
+	line[part].size = strlen(text);
+
+	return part + 1;
+}
+
+/* Both ends of a band must agree, only side-band-64k or side-band can be used */
+static uint8_t gitt_command_caps_add_band(struct gitt_command *command, struct line_data *line,
+					  uint8_t part)
+{
+	if (command->caps & GITT_COMMAND_CAP_SIDE_BAND_64K)
+		return gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_SIDE_BAND_64K,
+					     " side-band-64k");
+
+	return gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_SIDE_BAND,
+				     " side-band");
+}
+
+/* Capabilities are separated by spaces, v0 ends the ref name with '\0' */
+static void gitt_command_caps_parse(struct gitt_command *command, char *token,
+				    uint8_t *token_len, char *buf, int size)
+{
+	int index;
+
+	for (index = 0; index < size; index++) {
+		if (buf[index] == ' ' || buf[index] == '\0' || buf[index] == '\n') {
+			token[*token_len] = '\0';
+			gitt_command_cap(command, token);
+			*token_len = 0;
+		} else if (*token_len < GITT_COMMAND_TOKEN_SIZE - 1) {
+			token[(*token_len)++] = buf[index];
+		}
+	}
+}
+
+static int gitt_command_delim_write(struct gitt_command *command)
+{
+	int ret;
+
+	ret = gitt_command_write(command, "0001", 4);
+	if (ret) {
+		gitt_log_debug("Error writing line, at %d\n", __LINE__);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int gitt_command_text_write(struct gitt_command *command, const char *text, const char *arg)
+{
+	struct line_data line[3];
+	uint8_t part = 1;
+
+	line[0].data = (char *)text;
+	line[0].size = strlen(text);
+	if (arg) {
+		line[1].data = (char *)arg;
+		line[1].size = strlen(arg);
+		line[2].data = "\n";
+		line[2].size = 1;
+		part = 3;
+	}
+
+	return gitt_command_line_write(command, line, part);
+}
+
+/* Keep a ref of the advertisement, peeled tags are left out */
+static void gitt_command_table_add(struct gitt_command *command, const char *sha1,
+				   const char *name)
+{
+	size_t length = strlen(name);
+
+	if (length >= 3 && !strcmp(name + length - 3, "^{}"))
+		return;
+
+	if (gitt_refs_add(command->table, sha1, name) < 0)
+		gitt_log_error("No space for ref: %s\n", name);
+}
+
+/* A non-blocking gitt_command_get_head() is done with this line, it goes on from the next */
+static void gitt_command_adv_next(struct gitt_command *command, uint8_t adv)
+{
+	command->adv = adv;
+	if (command->nonblock)
+		gitt_command_mark(command);
+}
+
+/*
+ * Protocol v2: skip the capability advertisement, then list HEAD and
+ * the ref we track only, or all refs when they are kept in a table. HEAD
+ * wins, the tracked ref is used without it.
+ */
+static int gitt_command_ls_refs(struct gitt_command *command, char head[41], char refs[32])
+{
+	char line[GITT_COMMAND_LINE_SIZE];
+	char token[GITT_COMMAND_TOKEN_SIZE];
+	uint8_t token_len;
+	char *name;
+	char *attr;
+	int ret;
+
+	while (command->adv == GITT_COMMAND_ADV_V2_CAPS) {
+		ret = gitt_command_read_line(command, line, sizeof(line));
+		if (ret < 0)
+			return ret;
+		gitt_log_debug("%s", line);
+
+		/* Features of the fetch command, shallow includes all deepen arguments */
+		if (ret > 6 && !memcmp(line, "fetch=", 6)) {
+			token_len = 0;
+			gitt_command_caps_parse(command, token, &token_len, line + 6, ret - 6 + 1);
+			if (command->caps & GITT_COMMAND_CAP_SHALLOW)
+				command->caps |= GITT_COMMAND_CAP_DEEPEN_SINCE;
+		} else if (ret > 6 && !memcmp(line, "agent=", 6)) {
+			command->caps |= GITT_COMMAND_CAP_AGENT;
+		}
+
+		gitt_command_adv_next(command, ret ? GITT_COMMAND_ADV_V2_CAPS :
+					       GITT_COMMAND_ADV_V2_LS);
+	}
+
+	if (command->adv == GITT_COMMAND_ADV_V2_LS) {
+		/* Always there in the v2 fetch command */
+		command->caps |= GITT_COMMAND_CAP_SIDE_BAND_64K | GITT_COMMAND_CAP_THIN_PACK |
+				 GITT_COMMAND_CAP_OFS_DELTA | GITT_COMMAND_CAP_NO_PROGRESS;
+
+		ret = gitt_command_text_write(command, "command=ls-refs\n", NULL);
+		if (ret)
+			return ret;
+		if (command->caps & GITT_COMMAND_CAP_AGENT) {
+			ret = gitt_command_text_write(command, GITT_COMMAND_AGENT "\n", NULL);
+			if (ret)
+				return ret;
+		}
+		ret = gitt_command_delim_write(command);
+		if (ret)
+			return ret;
+		ret = gitt_command_text_write(command, "symrefs\n", NULL);
+		if (ret)
+			return ret;
+		/* All refs go to the table */
+		if (!command->table) {
+			ret = gitt_command_text_write(command, "ref-prefix ", "HEAD");
+			if (ret)
+				return ret;
+		}
+		if (!command->table && strlen(command->track)) {
+			ret = gitt_command_text_write(command, "ref-prefix ", command->track);
+			if (ret)
+				return ret;
+		}
+		ret = gitt_command_line_write(command, NULL, 0);
+		if (ret)
+			return ret;
+
+		if (command->table)
+			gitt_refs_begin(command->table);
+		command->found = false;
+		gitt_command_adv_next(command, GITT_COMMAND_ADV_V2_REFS);
+	}
+
+	/* Line: <oid> <name>[ symref-target:<target>] */
+	while (1) {
+		ret = gitt_command_read_line(command, line, sizeof(line));
+		if (ret < 0)
+			return ret;
+		else if (ret == 0)
+			break;
+		else if (ret < 40 + 1 + 1 || line[40] != ' ')
+			return -GITT_ERRNO_INVAL;
+		gitt_log_debug("%s", line);
+
+		line[40] = '\0';
+		line[ret - 1] = line[ret - 1] == '\n' ? '\0' : line[ret - 1];
+		name = line + 41;
+		attr = strchr(name, ' ');
+		if (attr)
+			*attr++ = '\0';
+		if (command->table && ret < sizeof(line) - 1)
+			gitt_command_table_add(command, line, name);
+
+		if (!strcmp(name, "HEAD")) {
+			memcpy(head, line, 41);
+			refs[0] = '\0';
+			if (attr && !strncmp(attr, "symref-target:", 14) && strlen(attr + 14) < 32)
+				strcpy(refs, attr + 14);
+			command->found = true;
+		} else if (!command->found && !strcmp(name, command->track)) {
+			memcpy(head, line, 41);
+			strcpy(refs, command->track);
+			command->found = true;
+		}
+
+		gitt_command_adv_next(command, GITT_COMMAND_ADV_V2_REFS);
+	}
+
+	command->adv = GITT_COMMAND_ADV_FIRST;
+	if (!command->found) {
+		gitt_log_error("Remote head not found\n");
 		return -GITT_ERRNO_INVAL;
 	}
 
+	gitt_log_debug("HEAD: %s\n", head);
+	gitt_log_debug("Refs: %s\n", refs);
 	return 0;
 }
 
-int gitt_command_get_head(struct gitt_ssh* ssh, char head[41], char refs[32])
+/* First line: the version, or the head with the capabilities in v0 */
+static int gitt_command_adv_first(struct gitt_command *command, char head[41], char refs[32],
+				  uint8_t *version)
 {
 	int ret;
 	int length;
 	int index;
 	char buf[40];
-
-	length = gitt_command_get_line_length(ssh);
+	char token[GITT_COMMAND_TOKEN_SIZE];
+	char line[GITT_COMMAND_LINE_SIZE];
+	uint8_t token_len;
+	uint8_t name_len;
+	bool named;
+
+	if (version)
+		*version = GITT_COMMAND_VERSION_0;
+	command->caps = 0;
+	command->deepen = false;
+	command->shallow = NULL;
+
+	length = gitt_command_get_line_length(command);
 	gitt_log_debug("First line length: %dbyte\n", length);
+
+	/* Protocol v2 starts with "version 2" */
+	if (length == 4 + 10) {
+		ret = gitt_command_read(command, buf, 10);
+		if (ret != 10 || memcmp(buf, "version 2\n", 10))
+			return -GITT_ERRNO_INVAL;
+		if (version)
+			*version = GITT_COMMAND_VERSION_2;
+		strcpy(command->track, refs);
+		gitt_command_adv_next(command, GITT_COMMAND_ADV_V2_CAPS);
+		return 0;
+	}
+
 	if (length < 4 + 40)
 		return -GITT_ERRNO_INVAL;
 	length -= 4;
 
-	/* Read SHA-1 */
-	ret = gitt_ssh_read(ssh, head, 40);
-	if (ret != 40)
-		return -GITT_ERRNO_INVAL;
-	head[40] = '\0';
-	length -= 40;
-	gitt_log_debug("HEAD: %s\n", head);
+	/* Read SHA-1 */
+	ret = gitt_command_read(command, head, 40);
+	if (ret != 40)
+		return -GITT_ERRNO_INVAL;
+	head[40] = '\0';
+	length -= 40;
+	gitt_log_debug("HEAD: %s\n", head);
+
+	/* The rest is the ref name and the capabilities */
+	token_len = 0;
+	name_len = 0;
+	named = false;
+	while (length) {
+		ret = sizeof(buf);
+		ret = ret < length ? ret : length;
+		ret = gitt_command_read(command, buf, ret);
+
+		if (ret <= 0)
+			return -GITT_ERRNO_INVAL;
+
+		gitt_command_caps_parse(command, token, &token_len, buf, ret);
+		if (ret == length)
+			gitt_command_caps_parse(command, token, &token_len, "\n", 1);
+
+		/* The ref name ends with '\0' */
+		for (index = 0; index < ret && !named; index++) {
+			if (buf[index] == '\0')
+				named = true;
+			else if (name_len < sizeof(line) - 1)
+				line[name_len++] = buf[index];
+		}
+
+		/* Replace: '\0' ==> '\n' */
+		for (index = 0; index < ret; index++)
+			if (buf[index] == '\0')
+				buf[index] = '\n';
+
+		gitt_log_debug("%.*s", ret, buf);
+
+		length -= ret;
+	}
+
+	/* " <name>" of the first ref */
+	if (command->table) {
+		gitt_refs_begin(command->table);
+		line[name_len] = '\0';
+		if (name_len > 1 && name_len < sizeof(line) - 1)
+			gitt_command_table_add(command, head, line + 1);
+	}
+
+	refs[0] = '\0';
+	gitt_command_adv_next(command, GITT_COMMAND_ADV_V0_REFS);
+	return 0;
+}
+
+/* Protocol v0: the other refs, up to the flush */
+static int gitt_command_adv_refs(struct gitt_command *command, char head[41], char refs[32])
+{
+	char line[GITT_COMMAND_LINE_SIZE];
+	int ret;
+
+	while (1) {
+		ret = gitt_command_read_line(command, line, sizeof(line));
+		if (ret < 0)
+			return ret;
+		else if (ret == 0)
+			break;
+		else if (ret < 40 + 1 + 1 || line[40] != ' ')
+			return -GITT_ERRNO_INVAL;
+		gitt_log_debug("%s", line);
+
+		line[40] = '\0';
+		line[ret - 1] = line[ret - 1] == '\n' ? '\0' : line[ret - 1];
+
+		/* A longer line has been cut */
+		if (command->table && ret < sizeof(line) - 1)
+			gitt_command_table_add(command, line, line + 41);
+
+		/* The first ref on the head is the one it points to */
+		if (!refs[0] && !memcmp(line, head, 40)) {
+			if (strlen(line + 41) > 31) {
+				gitt_log_info("Ref name too long: %s\n", line + 41);
+			} else {
+				strcpy(refs, line + 41);
+				gitt_log_debug("Refs: %s\n", refs);
+			}
+		}
+
+		gitt_command_adv_next(command, GITT_COMMAND_ADV_V0_REFS);
+	}
+
+	command->adv = GITT_COMMAND_ADV_FIRST;
+	return 0;
+}
+
+/**
+ * @brief Get the remote head. If the server talks protocol v2, only HEAD
+ *        and the ref in refs (may be empty) are listed, unless command->table
+ *        is set to keep all of them. A non-blocking call goes on from the
+ *        last line it took, head and refs must be kept until it is done.
+ *
+ * @param command
+ * @param head Remote head
+ * @param refs In: the ref we track. Out: the ref of the remote head
+ * @param version Out: GITT_COMMAND_VERSION_0 or GITT_COMMAND_VERSION_2, can be NULL
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_command_get_head(struct gitt_command *command, char head[41], char refs[32], uint8_t *version)
+{
+	int ret;
+
+	if (command->adv == GITT_COMMAND_ADV_FIRST) {
+		ret = gitt_command_adv_first(command, head, refs, version);
+		if (ret)
+			return ret;
+	}
+
+	if (command->adv == GITT_COMMAND_ADV_V0_REFS)
+		return gitt_command_adv_refs(command, head, refs);
+
+	return gitt_command_ls_refs(command, head, refs);
+}
+
+/* Arguments after the want lines, same in v0 and v2 */
+static int gitt_command_options_write(struct gitt_command *command,
+				      struct gitt_command_options *options)
+{
+	char number[12];
+	uint8_t index;
+	int ret;
+
+	for (index = 0; options->shallow && index < options->shallow->number; index++) {
+		ret = gitt_command_text_write(command, "shallow ", options->shallow->ids[index]);
+		if (ret)
+			return ret;
+	}
+
+	if (options->filter) {
+		ret = gitt_command_text_write(command, "filter ", options->filter);
+		if (ret)
+			return ret;
+	}
+
+	if (options->depth) {
+		sprintf(number, "%u", (unsigned int)options->depth);
+		ret = gitt_command_text_write(command, "deepen ", number);
+		if (ret)
+			return ret;
+	}
+
+	if (options->since) {
+		sprintf(number, "%u", (unsigned int)options->since);
+		ret = gitt_command_text_write(command, "deepen-since ", number);
+		if (ret)
+			return ret;
+	}
 
-	/* We don't care about the rest of the data */
-	while (length) {
-		ret = sizeof(buf);
-		ret = ret < length ? ret : length;
-		ret = gitt_ssh_read(ssh, buf, ret);
+	return 0;
+}
 
-		if (ret <= 0)
-			return -GITT_ERRNO_INVAL;
+/*
+ * Want want_sha1 (can be NULL), then the refs of command->table under
+ * options->shards. line[2] to line[part - 1] are the capabilities of the
+ * first line, line needs one more part for the end of the line.
+ */
+static int gitt_command_wants_write(struct gitt_command *command, char want_sha1[41],
+				    struct gitt_command_options *options,
+				    struct line_data *line, uint8_t part)
+{
+	struct line_data next[3];
+	char sha1[41];
+	uint16_t index = 0;
+	bool first = true;
+	int ret;
 
-		/* Replace: '\0' ==> '\n' */
-		for (index = 0; index < ret; index++)
-			if (buf[index] == '\0')
-				buf[index] = '\n';
+	while (1) {
+		if (want_sha1) {
+			memcpy(sha1, want_sha1, sizeof(sha1));
+			want_sha1 = NULL;
+		} else if (command->table && options->shards) {
+			while (index < command->table->number &&
+			       !gitt_refs_match(command->table, index, options->shards, options->every))
+				index++;
+			if (!gitt_refs_entry(command->table, index++, sha1))
+				break;
+		} else {
+			break;
+		}
 
-		gitt_log_debug("%.*s", ret, buf);
+		if (!first) {
+			line = next;
+			part = 2;
+		}
+		line[0].data = "want ";
+		line[0].size = 5;
+		line[1].data = sha1;
+		line[1].size = 40;
+		line[part].data = "\n";
+		line[part].size = 1;
+		ret = gitt_command_line_write(command, line, part + 1);
+		if (ret)
+			return ret;
+		first = false;
+	}
 
-		length -= ret;
+	if (first) {
+		gitt_log_error("Nothing to want\n");
+		return -GITT_ERRNO_INVAL;
 	}
 
-	refs[0] = '\0';
-	while (1) {
-		length = gitt_command_get_line_length(ssh);
-		gitt_log_debug("Line length: %dbyte\n", length);
+	return 0;
+}
 
-		if (length == 0)
+/*
+ * Keep the boundary from a "shallow <id>" or "unshallow <id>" line. A line
+ * may be parsed again after gitt_command_rewind(), which changes nothing.
+ */
+static void gitt_command_shallow_line(struct gitt_command *command, const char *line, int size)
+{
+	struct gitt_command_shallow *shallow = command->shallow;
+	bool unshallow;
+	uint8_t index;
+	char id[41];
+
+	if (!shallow)
+		return;
+
+	unshallow = size >= 10 + 40 && !memcmp(line, "unshallow ", 10);
+	if (!unshallow && (size < 8 + 40 || memcmp(line, "shallow ", 8)))
+		return;
+	memcpy(id, line + (unshallow ? 10 : 8), 40);
+	id[40] = '\0';
+
+	for (index = 0; index < shallow->number; index++)
+		if (!strcmp(shallow->ids[index], id))
 			break;
-		else if (length < 4 + 40 + 1 + 1)
-			return -GITT_ERRNO_INVAL;
-		length -= 4;
 
-		/* Find refs */
-		ret = gitt_ssh_read(ssh, buf, 40);
-		if (ret <= 0) {
-			return -GITT_ERRNO_INVAL;
-		} else if (ret == 40 && !refs[0] && !memcmp(buf, head, 40)) {
-			length -= ret;
-
-			/* Skip a space */
-			ret = gitt_ssh_read(ssh, buf, 1);
-			if (ret != 1)
-				return -GITT_ERRNO_INVAL;
-			length -= ret;
+	if (unshallow && index < shallow->number) {
+		shallow->number--;
+		memmove(shallow->ids[index], shallow->ids[index + 1],
+			sizeof(shallow->ids[0]) * (shallow->number - index));
+	} else if (!unshallow && index == shallow->number) {
+		if (shallow->number == GITT_COMMAND_SHALLOW_NUMBER) {
+			gitt_log_info("Shallow list full, history below %s comes again\n", id);
+			return;
+		}
+		strcpy(shallow->ids[shallow->number++], id);
+	}
+}
 
-			if (length > 31 || length < 2) {
-				gitt_log_error("Head name too long or too short\n");
-				return -GITT_ERRNO_INVAL;
-			}
+/*
+ * Read the answer to a batch of have lines, remember the first common
+ * commit. v0 (multi_ack_detailed): "ACK <id> common|ready" ... "NAK",
+ * with the shallow list in front when deepening. v2: "acknowledgments",
+ * "ACK <id>" or "NAK", optional "ready", up to a flush or delim.
+ */
+static int gitt_command_acks(struct gitt_command *command, uint8_t version,
+			     char common[41], bool *ready)
+{
+	char line[GITT_COMMAND_LINE_SIZE];
+	int ret;
 
-			ret = gitt_ssh_read(ssh, refs, length);
-			if (ret != length)
-				return -GITT_ERRNO_INVAL;
-			refs[ret - 1] = '\0';
-			length -= ret;
-			gitt_log_debug("Refs: %s\n", refs);
-		} else {
-			/* Debug output */
-			gitt_log_debug("%.*s", ret, buf);
-			length -= ret;
-			while (length) {
-				ret = sizeof(buf);
-				ret = ret < length ? ret : length;
-				ret = gitt_ssh_read(ssh, buf, ret);
-				if (ret <= 0)
-					return -GITT_ERRNO_INVAL;
+	while (1) {
+		ret = gitt_command_read_line(command, line, sizeof(line));
+		if (ret < 0)
+			return ret;
+		else if (ret == 0 && command->deepen) {
+			/* End of the shallow list */
+			command->deepen = false;
+			continue;
+		} else if (ret == 0) {
+			if (version == GITT_COMMAND_VERSION_2)
+				break;
+			continue;
+		}
+		gitt_log_debug("%s", line);
 
-				gitt_log_debug("%.*s", ret, buf);
+		if (command->deepen) {
+			gitt_command_shallow_line(command, line, ret);
+			continue;
+		}
 
-				length -= ret;
+		if (ret >= 4 + 40 && !memcmp(line, "ACK ", 4)) {
+			if (!strlen(common)) {
+				memcpy(common, line + 4, 40);
+				common[40] = '\0';
 			}
+			if (ret >= 4 + 40 + 6 && !memcmp(line + 4 + 40, " ready", 6))
+				*ready = true;
+		} else if (!memcmp(line, "ready", 5)) {
+			*ready = true;
+		} else if (!memcmp(line, "NAK", 3)) {
+			if (version == GITT_COMMAND_VERSION_0)
+				break;
 		}
 	}
 
 	return 0;
 }
 
-static void gitt_command_set_line_length(char *line, uint16_t length)
+static int gitt_command_fetch(struct gitt_command *command, char want_sha1[41], char (*haves)[41],
+			      uint8_t have_num, bool done, struct gitt_command_options *options)
 {
-	uint8_t count;
-	const char *tables = "0123456789abcdef";
+	struct line_data line[3];
+	uint8_t index;
+	int ret;
 
-	if (length == 4)
-		length = 0;
+	ret = gitt_command_text_write(command, "command=fetch\n", NULL);
+	if (ret)
+		return ret;
+	if (command->caps & GITT_COMMAND_CAP_AGENT) {
+		ret = gitt_command_text_write(command, GITT_COMMAND_AGENT "\n", NULL);
+		if (ret)
+			return ret;
+	}
+	ret = gitt_command_delim_write(command);
+	if (ret)
+		return ret;
+	if (options->delta) {
+		ret = gitt_command_text_write(command, "thin-pack\n", NULL);
+		if (ret)
+			return ret;
+		ret = gitt_command_text_write(command, "ofs-delta\n", NULL);
+		if (ret)
+			return ret;
+	}
+	ret = gitt_command_text_write(command, "no-progress\n", NULL);
+	if (ret)
+		return ret;
+	ret = gitt_command_wants_write(command, want_sha1, options, line, 2);
+	if (ret)
+		return ret;
+	ret = gitt_command_options_write(command, options);
+	if (ret)
+		return ret;
+	for (index = 0; index < have_num; index++) {
+		ret = gitt_command_text_write(command, "have ", haves[index]);
+		if (ret)
+			return ret;
+	}
+	if (done) {
+		ret = gitt_command_text_write(command, "done\n", NULL);
+		if (ret)
+			return ret;
+	}
 
-	for (count = 0; count < 4; count++)
-		line[count] = tables[(length >> (12 - 4 * count)) & 0xf];
+	return gitt_command_line_write(command, NULL, 0);
 }
 
-static int gitt_command_line_write(struct gitt_ssh* ssh, struct line_data *line, uint8_t part)
+/*
+ * Protocol v2 keeps no state between requests: send each batch of haves
+ * with the want again, and finish with the common commit and done unless
+ * the server is ready to send the pack already.
+ */
+static int gitt_command_negotiate_v2(struct gitt_command *command, char want_sha1[41],
+				     char (*haves)[41], uint8_t have_num,
+				     struct gitt_command_options *options)
 {
-	char buf[5] = {0};
-	uint16_t length;
+	char common[41] = {0};
+	bool ready = false;
+	uint8_t index;
+	uint8_t batch;
 	int ret;
-	uint8_t i;
 
-	/* Total line size */
-	length = 0;
-	for (i = 0; i < part; i++)
-		length += line[i].size;
+	for (index = 0; index < have_num && !strlen(common); index += batch) {
+		batch = have_num - index < GITT_COMMAND_HAVE_BATCH ?
+			have_num - index : GITT_COMMAND_HAVE_BATCH;
+		ret = gitt_command_fetch(command, want_sha1, haves + index, batch, false, options);
+		if (ret)
+			return ret;
+		ret = gitt_command_acks(command, GITT_COMMAND_VERSION_2, common, &ready);
+		if (ret)
+			return ret;
+		if (ready)
+			return 0;
+	}
 
-	if (length)
-		length += 4;
+	if (strlen(common))
+		return gitt_command_fetch(command, want_sha1, &common, 1, true, options);
 
-	/* Set the length of the line and write */
-	gitt_command_set_line_length(buf, length);
-	gitt_log_debug(buf);
-	ret = gitt_ssh_write(ssh, buf, 4);
-	if (ret != 4) {
-		gitt_log_debug("Error writing line, at %d\n", __LINE__);
-		return -GITT_ERRNO_INVAL;
-	}
+	return gitt_command_fetch(command, want_sha1, NULL, 0, true, options);
+}
 
-	if (!length)
-		goto out;
+/**
+ * @brief Ask for the objects from the haves (none for all) to want_sha1.
+ *        The haves are sent in batches, newest first, until the remote
+ *        acknowledges a common commit.
+ *
+ * @param command
+ * @param want_sha1 Can be NULL if options->shards is set
+ * @param haves Commits we have, newest first, can be NULL
+ * @param have_num Number of haves
+ * @param version Protocol version given by gitt_command_get_head()
+ * @param options Optional arguments, can be NULL
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_command_want(struct gitt_command *command, char want_sha1[41], char (*haves)[41],
+		      uint8_t have_num, uint8_t version, struct gitt_command_options *options)
+{
+	struct gitt_command_options supported = {0};
+	struct line_data line[12];
+	char common[41] = {0};
+	bool ready = false;
+	uint8_t index;
+	uint8_t part;
+	int ret;
 
-	/* Write each part of the line */
-	for (i = 0; i < part; i++) {
-		gitt_log_debug(line[i].data);
-		ret = gitt_ssh_write(ssh, line[i].data, line[i].size);
-		if (ret != line[i].size) {
-			gitt_log_debug("Error writing line, at %d\n", __LINE__);
-			return -GITT_ERRNO_INVAL;
+	/* Leave out what the remote does not support */
+	if (options) {
+		supported = *options;
+		if (supported.filter && !(command->caps & GITT_COMMAND_CAP_FILTER)) {
+			gitt_log_info("Filter is not supported by the remote, fetch everything\n");
+			supported.filter = NULL;
+		}
+		if (supported.depth && !(command->caps & GITT_COMMAND_CAP_SHALLOW)) {
+			gitt_log_info("Shallow is not supported by the remote, fetch all history\n");
+			supported.depth = 0;
+		}
+		if (supported.since && !(command->caps & GITT_COMMAND_CAP_DEEPEN_SINCE)) {
+			gitt_log_info("Deepen-since is not supported by the remote, fetch all history\n");
+			supported.since = 0;
 		}
 	}
 
-out:
-	return 0;
-}
+	/* Without the capability, the boundary is not sent and not updated */
+	if (supported.shallow && !(command->caps & GITT_COMMAND_CAP_SHALLOW))
+		supported.shallow = NULL;
+	if (supported.shallow && !supported.shallow->number && !supported.depth &&
+	    !supported.since)
+		supported.shallow = NULL;
+	command->shallow = supported.shallow;
+
+	/*
+	 * With v0, the remote answers a deepen request with a shallow list
+	 * first, shallow lines alone get no list
+	 */
+	command->deepen = version == GITT_COMMAND_VERSION_0 && (supported.depth || supported.since);
+
+	if (version == GITT_COMMAND_VERSION_2)
+		return gitt_command_negotiate_v2(command, want_sha1, haves, have_num, &supported);
+
+	/* Pack data is only read from band 1 */
+	if (!(command->caps & (GITT_COMMAND_CAP_SIDE_BAND_64K | GITT_COMMAND_CAP_SIDE_BAND))) {
+		gitt_log_error("The remote does not support side-band\n");
+		return -GITT_ERRNO_INVAL;
+	}
 
-int gitt_command_want(struct gitt_ssh* ssh, char want_sha1[41], char have_sha1[41])
-{
-	struct line_data line[3];
-	int ret;
+	part = gitt_command_caps_add(command, line, 2, GITT_COMMAND_CAP_MULTI_ACK_DETAILED,
+				     " multi_ack_detailed");
+	part = gitt_command_caps_add_band(command, line, part);
+	if (supported.delta) {
+		part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_THIN_PACK,
+					     " thin-pack");
+		part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_OFS_DELTA,
+					     " ofs-delta");
+	}
+	part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_NO_PROGRESS,
+				     " no-progress");
+	if (supported.depth || supported.since || supported.shallow)
+		part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_SHALLOW,
+					     " shallow");
+	if (supported.since)
+		part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_DEEPEN_SINCE,
+					     " deepen-since");
+	if (supported.filter)
+		part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_FILTER, " filter");
+	part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_AGENT,
+				     " " GITT_COMMAND_AGENT);
+	ret = gitt_command_wants_write(command, want_sha1, &supported, line, part);
+	if (ret)
+		return ret;
 
-	line[0].data = "want ";
-	line[0].size = 5;
-	line[1].data = want_sha1;
-	line[1].size = 40;
-	line[2].data = " multi_ack_detailed side-band-64k thin-pack include-tag ofs-delta deepen-since deepen-not agent=git/2.34.1\n";
-	line[2].size = 107;
-	ret = gitt_command_line_write(ssh, line, 3);
+	ret = gitt_command_options_write(command, &supported);
 	if (ret)
 		return ret;
 
-	ret = gitt_command_line_write(ssh, NULL, 0);
+	ret = gitt_command_line_write(command, NULL, 0);
 	if (ret)
 		return ret;
 
-	/* If there is, then add this line */
-	if (have_sha1) {
+	/*
+	 * Each batch ends with a flush-pkt, the remote answers up to a NAK.
+	 * A stateless remote would forget the wants, so all haves go at once.
+	 */
+	for (index = 0; index < have_num && !strlen(common); index++) {
 		line[0].data = "have ";
 		line[0].size = 5;
-		line[1].data = have_sha1;
+		line[1].data = haves[index];
 		line[1].size = 40;
-		ret = gitt_command_line_write(ssh, line, 2);
+		line[2].data = "\n";
+		line[2].size = 1;
+		ret = gitt_command_line_write(command, line, 3);
+		if (ret)
+			return ret;
+
+		/* Without multi_ack_detailed, a flush-pkt may get no answer */
+		if (!(command->caps & GITT_COMMAND_CAP_MULTI_ACK_DETAILED) ||
+		    gitt_command_stateless(command) ||
+		    ((index + 1) % GITT_COMMAND_HAVE_BATCH && index + 1 < have_num))
+			continue;
+
+		ret = gitt_command_line_write(command, NULL, 0);
+		if (ret)
+			return ret;
+		ret = gitt_command_acks(command, GITT_COMMAND_VERSION_0, common, &ready);
 		if (ret)
 			return ret;
 	}
 
+	if (strlen(common))
+		gitt_log_debug("Common: %s%s\n", common, ready ? " (ready)" : "");
+
 	line[0].data = "done\n";
 	line[0].size = 5;
-	ret = gitt_command_line_write(ssh, line, 1);
+	ret = gitt_command_line_write(command, line, 1);
 	if (ret)
 		return ret;
 
+	return gitt_command_flush(command);
+}
+
+/* Hand the rest of a line of pack data to dump, a non-blocking call goes on after each piece */
+static int gitt_command_pack_data(struct gitt_command *command, gitt_command_pack_dump dump,
+				  void *param)
+{
+	uint8_t *data = NULL;
+	int ret;
+
+	while (command->pack_left) {
+		if (command->nonblock)
+			gitt_command_mark(command);
+
+		ret = gitt_command_span(command, &data, command->pack_left);
+		if (ret <= 0)
+			return -GITT_ERRNO_INVAL;
+
+		gitt_log_debug("+%dbyte\n", ret);
+		if (dump && dump(param, (char *)data, ret))
+			return -GITT_ERRNO_INVAL;
+
+		command->pack_left -= ret;
+	}
+
 	return 0;
 }
 
-int gitt_command_get_pack(struct gitt_ssh* ssh, gitt_command_pack_dump dump, void *param)
+int gitt_command_get_pack(struct gitt_command *command, gitt_command_pack_dump dump, void *param)
 {
-	char buf[32];
+	/* Holds a whole shallow line, so its id can be kept */
+	char buf[64];
 	int length;
 	int ret;
 	bool new_line;
@@ -317,43 +1405,85 @@ int gitt_command_get_pack(struct gitt_ssh* ssh, gitt_command_pack_dump dump, voi
 	int valid;
 
 	while (1) {
+		/* A non-blocking call goes on from the line it stopped at */
+		if (command->nonblock)
+			gitt_command_mark(command);
+
+		if (command->pack_left) {
+			ret = gitt_command_pack_data(command, dump, param);
+			if (ret)
+				return ret;
+			continue;
+		}
+
 		new_line = true;
 		/* Read line length */
-		length = gitt_command_get_line_length(ssh);
+		length = gitt_command_get_line_length(command);
 
 		if (length < 0)
 			return -GITT_ERRNO_INVAL;
-		else if (length == 0)
+		else if (length == 0 && command->deepen) {
+			/* End of the shallow list */
+			command->deepen = false;
+			continue;
+		} else if (length == 0)
 			break;
+		else if (length <= 4)
+			continue;
 		length -= 4;
 
-		while (length) {
-			ret = sizeof(buf);
+		/* The first byte is the band of side-band lines */
+		ret = gitt_command_read(command, buf, 1);
+		if (ret != 1)
+			return -GITT_ERRNO_INVAL;
+		length -= ret;
+
+		/* Pack data goes to dump straight from the read-ahead buffer */
+		if (buf[0] == 0x01) {
+			gitt_log_debug("Pack size: %dbyte\n", length);
+			command->pack_left = length;
+			continue;
+		}
+
+		valid = 1;
+		while (valid || length) {
+			ret = sizeof(buf) - valid;
 			ret = ret < length ? ret : length;
-			ret = gitt_ssh_read(ssh, buf, ret);
-			if (ret <= 0)
-				return -GITT_ERRNO_INVAL;
+			if (ret) {
+				ret = gitt_command_read(command, buf + valid, ret);
+				if (ret <= 0)
+					return -GITT_ERRNO_INVAL;
+			}
 
+			length -= ret;
+			valid += ret;
 			pbuf = buf;
-			valid = ret;
 
 			if (new_line) {
 				/* Parse the data type of each line */
-				if (buf[0] == 0x01) {
-					gitt_log_debug("Pack size: %dbyte\n", length);
-					pbuf++;
-					valid--;
-					type = 0x01;
-				} else if (buf[0] == 0x02) {
+				if (buf[0] == 0x02) {
 					pbuf++;
 					valid--;
 					type = 0x02;
-				} else if (ret >= 3 && buf[0] == 'N' && buf[1] == 'A' && buf[2] == 'K') {
+				} else if (valid >= 3 && buf[0] == 'N' && buf[1] == 'A' && buf[2] == 'K') {
 					gitt_log_debug("NAK\n");
 					type = 0x03;
-				} else if (ret >= 3 && buf[0] == 'A' && buf[1] == 'C' && buf[2] == 'K') {
+				} else if (valid >= 3 && buf[0] == 'A' && buf[1] == 'C' && buf[2] == 'K') {
 					gitt_log_debug("ACK\n");
 					type = 0x04;
+				} else if (valid >= 8 && !memcmp(buf, "packfile", 8)) {
+					/* Protocol v2: section header */
+					gitt_log_debug("Packfile\n");
+					type = 0x05;
+				} else if (valid >= 8 && !memcmp(buf, "shallow", 7)) {
+					/* Shallow list: shallow <sha1> / unshallow <sha1> / shallow-info */
+					gitt_log_debug("%.*s", valid, pbuf);
+					gitt_command_shallow_line(command, pbuf, valid);
+					type = 0x06;
+				} else if (valid >= 10 && !memcmp(buf, "unshallow ", 10)) {
+					gitt_log_debug("%.*s", valid, pbuf);
+					gitt_command_shallow_line(command, pbuf, valid);
+					type = 0x06;
 				} else {
 					if (buf[0] >= '0' && buf[0] <= 'z')
 						gitt_log_error("Unknown case: %.*s\n", valid, pbuf);
@@ -364,15 +1494,10 @@ int gitt_command_get_pack(struct gitt_ssh* ssh, gitt_command_pack_dump dump, voi
 			}
 
 			/* Process this line of data */
-			if (type == 0x01) {
-				gitt_log_debug("+%dbyte\n", valid);
-				if (dump && dump(param, pbuf, valid))
-					return -GITT_ERRNO_INVAL;
-			} else if (type == 0x02) {
+			if (type == 0x02)
 				gitt_log_debug("%.*s", valid, pbuf);
-			}
 
-			length -= ret;
+			valid = 0;
 			new_line = false;
 		}
 	}
@@ -380,11 +1505,19 @@ int gitt_command_get_pack(struct gitt_ssh* ssh, gitt_command_pack_dump dump, voi
 	return 0;
 }
 
-int gitt_command_set_pack(struct gitt_ssh* ssh, const char *head, const char *id, const char *refs)
+int gitt_command_set_pack(struct gitt_command *command, const char *head, const char *id, const char *refs)
 {
-	struct line_data line[7];
+	struct line_data line[10];
+	uint8_t part;
 	int ret;
 
+	/* The result is read from band 1 */
+	if (!(command->caps & (GITT_COMMAND_CAP_REPORT_STATUS_V2 | GITT_COMMAND_CAP_REPORT_STATUS)) ||
+	    !(command->caps & (GITT_COMMAND_CAP_SIDE_BAND_64K | GITT_COMMAND_CAP_SIDE_BAND))) {
+		gitt_log_error("The remote does not support report-status or side-band\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
 	/* First line */
 	line[0].data = (char *)head;
 	line[0].size = 40;
@@ -396,35 +1529,43 @@ int gitt_command_set_pack(struct gitt_ssh* ssh, const char *head, const char *id
 	line[3].size = 1;
 	line[4].data = (char *)refs;
 	line[4].size = strlen(refs);
-	line[5].data = "\0 ";
-	line[5].size = 2;
-	line[6].data = "report-status-v2 side-band-64k object-format=sha1 agent=git/2.34.1";
-	line[6].size = 66;
-	ret = gitt_command_line_write(ssh, line, 7);
+	line[5].data = "\0";
+	line[5].size = 1;
+	if (command->caps & GITT_COMMAND_CAP_REPORT_STATUS_V2)
+		part = gitt_command_caps_add(command, line, 6, GITT_COMMAND_CAP_REPORT_STATUS_V2,
+					     " report-status-v2");
+	else
+		part = gitt_command_caps_add(command, line, 6, GITT_COMMAND_CAP_REPORT_STATUS,
+					     " report-status");
+	part = gitt_command_caps_add_band(command, line, part);
+	part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_QUIET, " quiet");
+	part = gitt_command_caps_add(command, line, part, GITT_COMMAND_CAP_AGENT,
+				     " " GITT_COMMAND_AGENT);
+	ret = gitt_command_line_write(command, line, part);
 	if (ret)
 		return ret;
 
-	ret = gitt_command_line_write(ssh, NULL, 0);
+	ret = gitt_command_line_write(command, NULL, 0);
 	if (ret)
 		return ret;
 
 	return 0;
 }
 
-int gitt_command_write_pack(struct gitt_ssh* ssh, uint8_t *buf, uint16_t size)
+int gitt_command_write_pack(struct gitt_command *command, uint8_t *buf, uint16_t size)
 {
 	int ret;
 
-	ret = gitt_ssh_write(ssh, (char *)buf, size);
-	if (ret != size) {
+	ret = gitt_command_write(command, (char *)buf, size);
+	if (ret) {
 		gitt_log_debug("Error writing pack\n");
-		return -GITT_ERRNO_INVAL;
+		return ret;
 	}
 
 	return 0;
 }
 
-int gitt_command_get_state(struct gitt_ssh* ssh)
+int gitt_command_get_state(struct gitt_command *command)
 {
 	char buf[32];
 	int length;
@@ -435,7 +1576,7 @@ int gitt_command_get_state(struct gitt_ssh* ssh)
 	char type;
 
 	while (1) {
-		length = gitt_command_get_line_length(ssh);
+		length = gitt_command_get_line_length(command);
 
 		if (length < 0)
 			return -GITT_ERRNO_INVAL;
@@ -444,14 +1585,14 @@ int gitt_command_get_state(struct gitt_ssh* ssh)
 		length -= 4;
 
 		/* Read line type */
-		ret = gitt_ssh_read(ssh, &type, 1);
+		ret = gitt_command_read(command, &type, 1);
 		if (ret != 1)
 			return -GITT_ERRNO_INVAL;
 		length -= 1;
 
 		while (length) {
 			if (type == 0x01) {
-				msg_len = gitt_command_get_line_length(ssh);
+				msg_len = gitt_command_get_line_length(command);
 
 				if (msg_len < 0) {
 					return -GITT_ERRNO_INVAL;
@@ -467,7 +1608,7 @@ int gitt_command_get_state(struct gitt_ssh* ssh)
 				buf[1] = '\0';
 
 				read_len = msg_len > sizeof(buf) ? sizeof(buf) : msg_len;
-				ret = gitt_ssh_read(ssh, buf, read_len);
+				ret = gitt_command_read(command, buf, read_len);
 				if (ret != read_len) {
 					gitt_log_error("Data is incomplete, ret:%d\n", ret);
 					return -GITT_ERRNO_INVAL;
@@ -482,7 +1623,7 @@ int gitt_command_get_state(struct gitt_ssh* ssh)
 				/* Read the remaining data */
 				read_len = msg_len > sizeof(buf) ? sizeof(buf) : msg_len;
 				while (read_len) {
-					ret = gitt_ssh_read(ssh, buf, read_len);
+					ret = gitt_command_read(command, buf, read_len);
 					if (ret != read_len) {
 						gitt_log_error("Remaining data is incomplete, ret:%d\n", ret);
 						return -GITT_ERRNO_INVAL;
@@ -494,7 +1635,7 @@ int gitt_command_get_state(struct gitt_ssh* ssh)
 			} else {
 				ret = sizeof(buf);
 				ret = ret < length ? ret : length;
-				ret = gitt_ssh_read(ssh, buf, ret);
+				ret = gitt_command_read(command, buf, ret);
 				if (ret <= 0)
 					return -GITT_ERRNO_INVAL;
 				gitt_log_debug("%.*s", ret, buf);
@@ -512,8 +1653,164 @@ int gitt_command_get_state(struct gitt_ssh* ssh)
 	return retval;
 }
 
-void gitt_command_end(struct gitt_ssh* ssh)
+/**
+ * @brief End the command, the session is kept if idle_max is set
+ *
+ * @param command
+ */
+void gitt_command_end(struct gitt_command *command)
+{
+	if (command->transport) {
+		if (command->link)
+			command->transport->close(command->link);
+		command->link = NULL;
+		return;
+	}
+
+	if (!command->ssh)
+		return;
+
+	if (command->nonblock)
+		gitt_command_nonblock(command, false);
+
+	if (command->conn) {
+		gitt_ssh_conn_close(command->conn, command->ssh);
+		gitt_ssh_free(command->ssh);
+		command->ssh = NULL;
+		return;
+	}
+
+	if (!command->idle_max) {
+		gitt_command_close(command);
+		return;
+	}
+
+	gitt_ssh_channel_close(command->ssh);
+	command->idle = 0;
+	command->quiet = 0;
+}
+
+/**
+ * @brief Time passed without commands, the kept session is sent a keepalive
+ *        or closed when it has been idle too long
+ *
+ * @param command
+ * @param seconds Seconds since the last call or command
+ */
+void gitt_command_idle(struct gitt_command *command, uint32_t seconds)
+{
+	if (!command->ssh)
+		return;
+
+	command->idle += seconds;
+	command->quiet += seconds;
+
+	if (command->idle >= command->idle_max) {
+		gitt_log_debug("Session idle for %us, close it\n", command->idle);
+		gitt_command_close(command);
+		return;
+	}
+
+	if (command->quiet >= GITT_SSH_KEEPALIVE) {
+		command->quiet = 0;
+		if (gitt_ssh_keepalive(command->ssh)) {
+			gitt_log_info("Keepalive fail, connect again when needed\n");
+			gitt_command_close(command);
+		}
+	}
+}
+
+/**
+ * @brief Close the session, whether it is kept or not
+ *
+ * @param command
+ */
+void gitt_command_close(struct gitt_command *command)
+{
+	gitt_ssh_disconnect(command->ssh);
+	gitt_ssh_free(command->ssh);
+	command->ssh = NULL;
+}
+
+/**
+ * @brief Make the calls on the command fail with again set instead of
+ *        waiting for the remote, or wait again
+ *
+ * @param command A started command
+ * @param nonblock
+ * @return int 0: Good
+ * @return int other: Not supported by the transport
+ */
+int gitt_command_nonblock(struct gitt_command *command, bool nonblock)
+{
+	int ret;
+
+	if (!command->transport)
+		ret = gitt_ssh_nonblock(command->ssh, nonblock);
+	else if (command->transport->nonblock)
+		ret = command->transport->nonblock(command->link, nonblock);
+	else
+		ret = -GITT_ERRNO_INVAL;
+	if (ret)
+		return ret;
+
+	command->nonblock = nonblock;
+	command->again = false;
+	gitt_command_mark(command);
+
+	return 0;
+}
+
+/**
+ * @brief A non-blocking call is done up to here, what it read is not
+ *        kept any longer
+ *
+ * @param command
+ */
+void gitt_command_mark(struct gitt_command *command)
+{
+	command->back = 0;
+	command->sent = 0;
+	command->skip = 0;
+}
+
+/**
+ * @brief After a failed non-blocking call, go back to the mark so that it
+ *        can be made again
+ *
+ * @param command
+ * @return int GITT_COMMAND_WANT_READ/GITT_COMMAND_WANT_WRITE: Wait for the fd
+ * @return int 0: The call did not fail for waiting, it is an error
+ */
+int gitt_command_rewind(struct gitt_command *command)
+{
+	if (!command->again)
+		return 0;
+
+	command->again = false;
+	command->head = (command->head + command->ring_len - command->back) % command->ring_len;
+	command->count += command->back;
+	command->back = 0;
+	if (command->sent > command->skip)
+		command->skip = command->sent;
+	command->sent = 0;
+
+	return command->want;
+}
+
+/**
+ * @brief File descriptor to wait on after gitt_command_rewind()
+ *
+ * @param command
+ * @return int >=0: fd
+ * @return int other: Error
+ */
+int gitt_command_fd(struct gitt_command *command)
 {
-	gitt_ssh_disconnect(ssh);
-	gitt_ssh_free(ssh);
+	if (!command->transport)
+		return gitt_ssh_fd(command->ssh);
+	if (!command->transport->fd)
+		return -GITT_ERRNO_INVAL;
+
+	return command->transport->fd(command->link, command->want == GITT_COMMAND_WANT_WRITE);
 }
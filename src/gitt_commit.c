@@ -107,6 +107,8 @@ int gitt_commit_parse(char *buf, uint16_t size, struct gitt_commit *commit)
 
 	/* Padded with empty string */
 	commit->tree.sha1 = empty_str;
+	commit->tree.tree = NULL;
+	commit->source = NULL;
 	commit->parent.sha1 = empty_str;
 	commit->author.date = empty_str;
 	commit->author.email = empty_str;
@@ -378,6 +380,9 @@ int gitt_commit_build(gitt_obj_data dump, void *p, struct gitt_commit *commit)
 		return ret;
 
 	/* Message */
+	if (commit->source)
+		return gitt_obj_source_dump(commit->source, dump, p, true);
+
 	length = strlen(commit->message);
 	ret = dump(p, (uint8_t *)commit->message, length, true);
 	if (ret)
@@ -386,10 +391,10 @@ int gitt_commit_build(gitt_obj_data dump, void *p, struct gitt_commit *commit)
 	return 0;
 }
 
-uint16_t gitt_commit_length(struct gitt_commit *commit)
+uint32_t gitt_commit_length(struct gitt_commit *commit)
 {
 	int length;
-	uint16_t retval = 0;
+	uint32_t retval = 0;
 
 	/* Tree line */
 	length = strlen(commit->tree.sha1);
@@ -434,14 +439,19 @@ uint16_t gitt_commit_length(struct gitt_commit *commit)
 	retval += (uint16_t)length + 2;
 
 	/* Message */
-	length = strlen(commit->message);
-	retval += (uint16_t)length;
+	if (commit->source)
+		retval += commit->source->length;
+	else
+		retval += strlen(commit->message);
 
 	return retval;
 }
 
 static int gitt_obj_data_dump(void *p, uint8_t *buf, uint16_t size, bool end)
 {
+	if (!size)
+		return 0;
+
 	return gitt_sha1_update((struct gitt_sha1 *)p, buf, size);
 }
 
@@ -453,7 +463,7 @@ int gitt_commit_sha1_update(struct gitt_commit *commit)
 
 	gitt_sha1_init(&sha1);
 
-	ret = sprintf(front_str, "commit %u", gitt_commit_length(commit));
+	ret = sprintf(front_str, "commit %u", (unsigned int)gitt_commit_length(commit));
 	if (ret <= 0)
 		return -GITT_ERRNO_INVAL;
 
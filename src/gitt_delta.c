@@ -0,0 +1,428 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <gitt_delta.h>
+#include <gitt_log.h>
+#include <gitt_errno.h>
+
+#define GITT_DELTA_PRIME		0x01000193
+#define GITT_DELTA_INSERT_MAX		0x7f
+
+#define gitt_delta_slot(delta, n)	((delta)->buf + (delta)->slot_len * (n))
+
+struct gitt_delta_out {
+	uint8_t *buf;
+	uint16_t len;
+	uint16_t max;
+};
+
+static inline uint32_t gitt_delta_hash(uint8_t *data)
+{
+	uint32_t hash = 0;
+	uint8_t i;
+
+	for (i = 0; i < GITT_DELTA_BLOCK; i++)
+		hash = hash * GITT_DELTA_PRIME + data[i];
+
+	return hash;
+}
+
+static inline uint16_t gitt_delta_bucket(uint32_t hash)
+{
+	return ((hash * 2654435761u) >> 16) % GITT_DELTA_HASH_SIZE;
+}
+
+static inline int gitt_delta_put(struct gitt_delta_out *out, uint8_t byte)
+{
+	if (out->len >= out->max)
+		return -GITT_ERRNO_NOMEM;
+
+	out->buf[out->len++] = byte;
+	return 0;
+}
+
+static int gitt_delta_put_size(struct gitt_delta_out *out, uint16_t size)
+{
+	int ret;
+
+	/* | 1bit flag | 7bit length |, little-endian */
+	do {
+		ret = gitt_delta_put(out, (size & 0x7f) | (size > 0x7f ? 0x80 : 0));
+		if (ret)
+			return ret;
+		size >>= 7;
+	} while (size);
+
+	return 0;
+}
+
+static int gitt_delta_put_insert(struct gitt_delta_out *out, uint8_t *data, uint16_t size)
+{
+	int ret;
+
+	if (!size)
+		return 0;
+
+	/* | 0 | 7bit length | data | */
+	ret = gitt_delta_put(out, size);
+	if (ret)
+		return ret;
+
+	if (out->len + size > out->max)
+		return -GITT_ERRNO_NOMEM;
+
+	memcpy(out->buf + out->len, data, size);
+	out->len += size;
+
+	return 0;
+}
+
+static int gitt_delta_put_copy(struct gitt_delta_out *out, uint16_t offset, uint16_t size)
+{
+	uint16_t cmd;
+	uint8_t i;
+	int ret;
+
+	/* | 1 | 3bit size flags | 4bit offset flags | offset | size | */
+	cmd = out->len;
+	ret = gitt_delta_put(out, 0x80);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < 2; i++) {
+		if ((offset >> (8 * i)) & 0xff) {
+			out->buf[cmd] |= 1 << i;
+			ret = gitt_delta_put(out, (offset >> (8 * i)) & 0xff);
+			if (ret)
+				return ret;
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		if ((size >> (8 * i)) & 0xff) {
+			out->buf[cmd] |= 0x10 << i;
+			ret = gitt_delta_put(out, (size >> (8 * i)) & 0xff);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Initialization handle
+ *
+ * @param delta
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_delta_init(struct gitt_delta *delta)
+{
+	if (!delta->buf || delta->buf_len < 3 * GITT_DELTA_MIN_SIZE) {
+		gitt_log_error("Delta buffer cannot be empty and the length cannot be less than %d\n",
+			       3 * GITT_DELTA_MIN_SIZE);
+		return -GITT_ERRNO_INVAL;
+	}
+
+	delta->slot_len = delta->buf_len / 3;
+	gitt_delta_reset(delta);
+
+	return 0;
+}
+
+/**
+ * @brief Forget the base object
+ *
+ * @param delta
+ */
+void gitt_delta_reset(struct gitt_delta *delta)
+{
+	delta->base = 0;
+	delta->base_len = 0;
+	delta->target_len = 0;
+	delta->base_sha1[0] = '\0';
+}
+
+/**
+ * @brief Empty the target object, it is then filled by gitt_delta_target_dump()
+ *
+ * @param delta
+ */
+void gitt_delta_target_reset(struct gitt_delta *delta)
+{
+	delta->target_len = 0;
+}
+
+/**
+ * @brief Append data to the target object, can be used as gitt_obj_data
+ *
+ * @return int 0: Good
+ * @return int other: The target is too big
+ */
+int gitt_delta_target_dump(void *p, uint8_t *buf, uint16_t size, bool end)
+{
+	struct gitt_delta *delta = (struct gitt_delta *)p;
+
+	if (delta->target_len + size > delta->slot_len)
+		return -GITT_ERRNO_NOMEM;
+
+	memcpy(gitt_delta_slot(delta, !delta->base) + delta->target_len, buf, size);
+	delta->target_len += size;
+
+	return 0;
+}
+
+/**
+ * @brief Encode the target object as a delta against the base object
+ *
+ * @param delta
+ * @param out Delta data, valid until the next encoding
+ * @param out_len Delta length
+ * @return int 0: Good
+ * @return int other: No base, or the delta does not pay off
+ */
+int gitt_delta_encode(struct gitt_delta *delta, uint8_t **out, uint16_t *out_len)
+{
+	uint8_t *base = gitt_delta_slot(delta, delta->base);
+	uint8_t *target = gitt_delta_slot(delta, !delta->base);
+	uint16_t base_len = delta->base_len;
+	uint16_t target_len = delta->target_len;
+	struct gitt_delta_out dout;
+	uint32_t hash = 0;
+	uint32_t power;
+	bool hashed = false;
+	uint16_t offset;
+	uint16_t index;
+	uint16_t literal;
+	uint16_t match;
+	uint16_t bucket;
+	int ret;
+
+	if (!base_len || target_len < GITT_DELTA_MIN_SIZE)
+		return -GITT_ERRNO_INVAL;
+
+	/* Like git, a delta only pays off when it is less than half the object */
+	dout.buf = gitt_delta_slot(delta, 2);
+	dout.len = 0;
+	dout.max = target_len / 2 - 20;
+	if (dout.max > delta->slot_len)
+		dout.max = delta->slot_len;
+
+	/* Index the base object block by block */
+	memset(delta->index, 0, sizeof(delta->index));
+	for (offset = 0; offset + GITT_DELTA_BLOCK <= base_len; offset += GITT_DELTA_BLOCK) {
+		bucket = gitt_delta_bucket(gitt_delta_hash(base + offset));
+		if (!delta->index[bucket])
+			delta->index[bucket] = offset + 1;
+	}
+
+	for (power = 1, index = 1; index < GITT_DELTA_BLOCK; index++)
+		power *= GITT_DELTA_PRIME;
+
+	ret = gitt_delta_put_size(&dout, base_len);
+	if (ret)
+		return ret;
+
+	ret = gitt_delta_put_size(&dout, target_len);
+	if (ret)
+		return ret;
+
+	index = 0;
+	literal = 0;
+	while (index < target_len) {
+		if (index + GITT_DELTA_BLOCK <= target_len) {
+			if (!hashed) {
+				hash = gitt_delta_hash(target + index);
+				hashed = true;
+			}
+
+			offset = delta->index[gitt_delta_bucket(hash)];
+			if (offset && !memcmp(base + offset - 1, target + index, GITT_DELTA_BLOCK)) {
+				offset--;
+				match = GITT_DELTA_BLOCK;
+
+				/* Extend backward over pending literals */
+				while (literal && offset && base[offset - 1] == target[index - 1]) {
+					offset--;
+					index--;
+					literal--;
+					match++;
+				}
+
+				/* Extend forward */
+				while (index + match < target_len && offset + match < base_len &&
+				       base[offset + match] == target[index + match])
+					match++;
+
+				ret = gitt_delta_put_insert(&dout, target + index - literal, literal);
+				if (ret)
+					return ret;
+
+				ret = gitt_delta_put_copy(&dout, offset, match);
+				if (ret)
+					return ret;
+
+				index += match;
+				literal = 0;
+				hashed = false;
+				continue;
+			}
+		}
+
+		/* Roll the hash one byte forward */
+		if (hashed && index + GITT_DELTA_BLOCK < target_len)
+			hash = (hash - target[index] * power) * GITT_DELTA_PRIME +
+			       target[index + GITT_DELTA_BLOCK];
+		else
+			hashed = false;
+
+		index++;
+		literal++;
+
+		if (literal == GITT_DELTA_INSERT_MAX) {
+			ret = gitt_delta_put_insert(&dout, target + index - literal, literal);
+			if (ret)
+				return ret;
+			literal = 0;
+		}
+	}
+
+	ret = gitt_delta_put_insert(&dout, target + index - literal, literal);
+	if (ret)
+		return ret;
+
+	gitt_log_debug("Delta: %u => %ubyte\n", target_len, dout.len);
+	*out = dout.buf;
+	*out_len = dout.len;
+
+	return 0;
+}
+
+/**
+ * @brief The target object becomes the base object for the next encoding
+ *
+ * @param delta
+ * @param sha1 Id of the target object
+ */
+void gitt_delta_commit(struct gitt_delta *delta, const char *sha1)
+{
+	delta->base = !delta->base;
+	delta->base_len = delta->target_len;
+	delta->target_len = 0;
+	strncpy(delta->base_sha1, sha1, sizeof(delta->base_sha1) - 1);
+	delta->base_sha1[sizeof(delta->base_sha1) - 1] = '\0';
+}
+
+static int gitt_delta_get_size(const uint8_t **p, const uint8_t *end, uint32_t *size)
+{
+	uint8_t shift = 0;
+
+	*size = 0;
+	do {
+		if (*p >= end || shift > 28)
+			return -GITT_ERRNO_INVAL;
+		*size |= (uint32_t)(**p & 0x7f) << shift;
+		shift += 7;
+	} while (*(*p)++ & 0x80);
+
+	return 0;
+}
+
+/**
+ * @brief Rebuild an object from its base and a delta
+ *
+ * @param base
+ * @param base_len
+ * @param data Delta data
+ * @param size Delta length
+ * @param out
+ * @param out_len Space of out
+ * @return int >=0: Length of the object
+ * @return int other: Error, or out is too small
+ */
+int gitt_delta_apply(const uint8_t *base, uint16_t base_len, const uint8_t *data,
+		     uint16_t size, uint8_t *out, uint16_t out_len)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = data + size;
+	uint32_t source_len;
+	uint32_t target_len;
+	uint32_t offset;
+	uint32_t copy;
+	uint32_t len = 0;
+	uint8_t cmd;
+	uint8_t i;
+
+	if (gitt_delta_get_size(&p, end, &source_len) || source_len != base_len)
+		return -GITT_ERRNO_INVAL;
+	if (gitt_delta_get_size(&p, end, &target_len))
+		return -GITT_ERRNO_INVAL;
+	if (target_len > out_len)
+		return -GITT_ERRNO_NOMEM;
+
+	while (p < end) {
+		cmd = *p++;
+		if (cmd & 0x80) {
+			/* | 1 | 3bit size flags | 4bit offset flags | offset | size | */
+			offset = 0;
+			copy = 0;
+			for (i = 0; i < 4; i++) {
+				if (!(cmd & (1 << i)))
+					continue;
+				if (p >= end)
+					return -GITT_ERRNO_INVAL;
+				offset |= (uint32_t)*p++ << (8 * i);
+			}
+			for (i = 0; i < 3; i++) {
+				if (!(cmd & (0x10 << i)))
+					continue;
+				if (p >= end)
+					return -GITT_ERRNO_INVAL;
+				copy |= (uint32_t)*p++ << (8 * i);
+			}
+			if (!copy)
+				copy = 0x10000;
+			if (offset + copy > base_len || len + copy > target_len)
+				return -GITT_ERRNO_INVAL;
+			memcpy(out + len, base + offset, copy);
+			len += copy;
+		} else if (cmd) {
+			/* | 0 | 7bit length | data | */
+			if (p + cmd > end || len + cmd > target_len)
+				return -GITT_ERRNO_INVAL;
+			memcpy(out + len, p, cmd);
+			p += cmd;
+			len += cmd;
+		} else {
+			return -GITT_ERRNO_INVAL;
+		}
+	}
+
+	if (len != target_len)
+		return -GITT_ERRNO_INVAL;
+
+	return len;
+}
@@ -22,6 +22,10 @@
  * SOFTWARE.
  */
 
+#include <stdint.h>
+#include <gitt_obj.h>
+#include <gitt_errno.h>
+
 const char *gitt_obj_types[] = {
 	"none",
 	"commit",
@@ -33,13 +37,16 @@ const char *gitt_obj_types[] = {
 	"ref_delta"
 };
 
-#define ERRNO_STR_MAX		4
+#define ERRNO_STR_MAX		7
 
 const char *gitt_errno_types[ERRNO_STR_MAX] = {
 	"Successful",
 	"Invalid parameter",
 	"Not enough memory",
-	"Please try again"
+	"Please try again",
+	"Would block, call again later",
+	"Timed out",
+	"Canceled"
 };
 
 void gitt_null(const char *fmt, ...)
@@ -54,3 +61,82 @@ const char *gitt_errno_str(int errno)
 	return "Unknown error";
 }
 
+static inline int8_t gitt_obj_half_byte(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	else if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 0xa;
+	else if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 0xa;
+
+	return -GITT_ERRNO_INVAL;
+}
+
+/**
+ * @brief Convert a 40 characters SHA-1 to 20 bytes
+ *
+ * @param hex
+ * @param bin
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_obj_hex_to_bin(const char *hex, uint8_t bin[20])
+{
+	uint8_t i;
+	int8_t high, low;
+
+	for (i = 0; i < 20; i++) {
+		high = gitt_obj_half_byte(hex[i * 2]);
+		if (high < 0)
+			return -GITT_ERRNO_INVAL;
+		low = gitt_obj_half_byte(hex[i * 2 + 1]);
+		if (low < 0)
+			return -GITT_ERRNO_INVAL;
+		bin[i] = high << 4 | low;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Pass the whole content of a source to dump, GITT_OBJ_SOURCE_CHUNK
+ *        bytes at a time
+ *
+ * @param source
+ * @param dump
+ * @param p Parameter of dump
+ * @param end The last piece is dumped with this end flag
+ * @return int 0: Good
+ * @return int other: Error, or the source does not match its length
+ */
+int gitt_obj_source_dump(struct gitt_obj_source *source, gitt_obj_data dump, void *p, bool end)
+{
+	uint8_t chunk[GITT_OBJ_SOURCE_CHUNK];
+	uint32_t remain = source->length;
+	uint16_t size;
+	int ret;
+
+	ret = source->rewind(source->param);
+	if (ret)
+		return ret;
+
+	if (!remain)
+		return dump(p, chunk, 0, end);
+
+	while (remain) {
+		size = remain > sizeof(chunk) ? sizeof(chunk) : remain;
+		ret = source->read(source->param, chunk, size);
+		if (ret < 0)
+			return ret;
+		if (ret == 0 || ret > size)
+			return -GITT_ERRNO_INVAL;
+		remain -= ret;
+
+		ret = dump(p, chunk, ret, end && !remain);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
@@ -22,13 +22,16 @@
  * SOFTWARE.
  */
 
+#include <string.h>
 #include <gitt_pack.h>
 #include <gitt_log.h>
 #include <gitt_errno.h>
 #include <gitt_commit.h>
+#include <gitt_tree.h>
+#include <gitt_blob.h>
 
 #define GITT_PACK_STATE_INIT		0x00
-#define GITT_PACK_STATE_STOP		0xff
+#define GITT_PACK_STATE_STOP		0xffffffff
 
 static int gitt_pack_data_update(struct gitt_pack *pack, uint8_t *buf, uint16_t size)
 {
@@ -37,6 +40,7 @@ static int gitt_pack_data_update(struct gitt_pack *pack, uint8_t *buf, uint16_t
 	ret = gitt_sha1_update(&pack->sha1, buf, size);
 	if (ret)
 		return ret;
+	pack->offset += size;
 
 	if (pack->data_dump) {
 		ret = pack->data_dump(pack, buf, size);
@@ -58,6 +62,9 @@ int gitt_pack_init(struct gitt_pack *pack)
 
 	gitt_sha1_init(&pack->sha1);
 	pack->state = GITT_PACK_STATE_INIT;
+	pack->submitted = 0;
+	pack->offset = 0;
+	pack->last_offset = 0;
 
 	/* 4byte magic */
 	pack->buf[0] = 'P';
@@ -72,10 +79,10 @@ int gitt_pack_init(struct gitt_pack *pack)
 	pack->buf[7] = 2;
 
 	/* 4byte mumber of objects */
-	pack->buf[8] = 0;
-	pack->buf[9] = 0;
-	pack->buf[10] = 0;
-	pack->buf[11] = pack->obj_num;
+	pack->buf[8] = (pack->obj_num >> 24) & 0xff;
+	pack->buf[9] = (pack->obj_num >> 16) & 0xff;
+	pack->buf[10] = (pack->obj_num >> 8) & 0xff;
+	pack->buf[11] = pack->obj_num & 0xff;
 
 	/* Dump */
 	ret = gitt_pack_data_update(pack, pack->buf, 12);
@@ -85,85 +92,210 @@ int gitt_pack_init(struct gitt_pack *pack)
 	return 0;
 }
 
-static int gitt_obj_data_dump(void *p, uint8_t *buf, uint16_t size, bool end)
+static int gitt_pack_obj_head(struct gitt_pack *pack, struct gitt_obj *obj)
 {
-	struct gitt_pack *pack = (struct gitt_pack *)p;
-	uint16_t in_size = size;
-	uint16_t out_size = pack->buf_len;
+	struct gitt_pack_delta *delta = (struct gitt_pack_delta *)obj->data;
+	uint32_t start = pack->offset;
+	uint32_t size = obj->size;
+	uint32_t rel;
+	uint8_t obj_head[20];
+	uint8_t head_len = 0;
 	int ret;
 
-	ret = gitt_zlib_compress_update(&pack->zlib, buf, &in_size, pack->buf,
-					&out_size, end);
+	/* First byte:   | 1bit flag | 3bit type | 4bit length | */
+	obj_head[0] = (obj->type & 0x7) << 4;
+	obj_head[0] |= size & 0xf;
+	size >>= 4;
+	head_len++;
+
+	/* Following bytes:   | 1bit flag | 7bit length | */
+	while (size) {
+		obj_head[head_len - 1] |= 0x80;
+		obj_head[head_len] = size & 0x7f;
+		head_len++;
+		size >>= 7;
+	}
+
+	/* Dump head */
+	ret = gitt_pack_data_update(pack, obj_head, head_len);
 	if (ret)
 		return ret;
 
-	if (out_size) {
-		/* Dump data */
-		ret = gitt_pack_data_update(pack, pack->buf, out_size);
+	if (obj->type == GITT_OBJ_TYPE_REF_DELTA) {
+		/* 20byte SHA-1 of the base */
+		ret = gitt_obj_hex_to_bin(delta->base_sha1, obj_head);
+		if (ret)
+			return ret;
+
+		ret = gitt_pack_data_update(pack, obj_head, 20);
+		if (ret)
+			return ret;
+	} else if (obj->type == GITT_OBJ_TYPE_OFS_DELTA) {
+		/* Distance back to the previous object, big-endian, offset by one per byte */
+		rel = start - pack->last_offset;
+		head_len = sizeof(obj_head) - 1;
+		obj_head[head_len] = rel & 0x7f;
+		while (rel >>= 7)
+			obj_head[--head_len] = 0x80 | (--rel & 0x7f);
+
+		ret = gitt_pack_data_update(pack, obj_head + head_len,
+					    sizeof(obj_head) - head_len);
 		if (ret)
 			return ret;
 	}
 
+	pack->last_offset = start;
+
 	return 0;
 }
 
-int gitt_pack_update(struct gitt_pack *pack, struct gitt_obj *obj)
+static int gitt_pack_obj_build(gitt_obj_data dump, void *p, struct gitt_obj *obj)
 {
-	int ret;
-	uint8_t obj_head[3];
-	uint8_t head_len = 0;
+	struct gitt_pack_delta *delta;
 
-	if (!pack->obj_num)
-		goto done;
+	if (obj->type == GITT_OBJ_TYPE_COMMIT)
+		return gitt_commit_build(dump, p, (struct gitt_commit *)obj->data);
 
-	if (pack->state >= pack->obj_num) {
-		gitt_log_error("Pack fail\n");
-		return -GITT_ERRNO_INVAL;
-	}
+	if (obj->type == GITT_OBJ_TYPE_TREE)
+		return gitt_tree_build(dump, p, (struct gitt_tree *)obj->data);
 
-	obj_head[0] = (obj->type & 0x7) << 4;
-	obj_head[0] |= obj->size & 0xf;
-	obj->size >>= 4;
-	head_len++;
+	if (obj->type == GITT_OBJ_TYPE_BLOB)
+		return gitt_blob_build(dump, p, (struct gitt_blob *)obj->data);
 
-	if (obj->size) {
-		obj_head[0] |= 0x80;
-		obj_head[1] = obj->size & 0x7f;
-		head_len++;
-		obj->size >>= 7;
+	if (obj->type == GITT_OBJ_TYPE_OFS_DELTA || obj->type == GITT_OBJ_TYPE_REF_DELTA) {
+		delta = (struct gitt_pack_delta *)obj->data;
+		return dump(p, delta->data, delta->size, true);
 	}
 
-	if (obj->size) {
-		obj_head[1] |= 0x80;
-		obj_head[2] = obj->size & 0x7f;
-		head_len++;
-	}
+	gitt_log_error("Unsupported object type\n");
+	return -GITT_ERRNO_INVAL;
+}
 
-	/* Dump head */
-	ret = gitt_pack_data_update(pack, obj_head, head_len);
-	if (ret)
-		return ret;
+/* Whether the object content is read from a source */
+static bool gitt_pack_obj_streamed(struct gitt_obj *obj)
+{
+	if (obj->type == GITT_OBJ_TYPE_COMMIT)
+		return ((struct gitt_commit *)obj->data)->source != NULL;
 
-	/* Build object */
-	if (obj->type == GITT_OBJ_TYPE_COMMIT) {
-		ret = gitt_zlib_compress_init(&pack->zlib);
+	if (obj->type == GITT_OBJ_TYPE_BLOB)
+		return ((struct gitt_blob *)obj->data)->source != NULL;
+
+	return false;
+}
+
+static int gitt_obj_data_dump(void *p, uint8_t *buf, uint16_t size, bool end)
+{
+	struct gitt_pack *pack = (struct gitt_pack *)p;
+	uint16_t in_size;
+	uint16_t out_size;
+	int ret;
+
+	do {
+		in_size = size;
+		out_size = pack->buf_len;
+		ret = gitt_zlib_compress_update(&pack->zlib, buf, &in_size, pack->buf,
+						&out_size, end);
 		if (ret)
 			return ret;
 
-		ret = gitt_commit_build(gitt_obj_data_dump, pack,
-					(struct gitt_commit *)obj->data);
-		gitt_zlib_compress_end(&pack->zlib);
+		if (out_size) {
+			/* Dump data */
+			ret = gitt_pack_data_update(pack, pack->buf, out_size);
+			if (ret)
+				return ret;
+		}
+
+		buf += in_size;
+		size -= in_size;
+		/* Flush until the output buffer is no longer filled up */
+	} while (size || (end && out_size == pack->buf_len));
+
+	return 0;
+}
+
+struct gitt_pack_compress_ctx {
+	struct gitt_pack_zobj *zobj;
+	struct gitt_zlib zlib;
+};
+
+static int gitt_zobj_data_dump(void *p, uint8_t *buf, uint16_t size, bool end)
+{
+	struct gitt_pack_compress_ctx *ctx = (struct gitt_pack_compress_ctx *)p;
+	struct gitt_pack_zobj *zobj = ctx->zobj;
+	struct gitt_zlib *zlib = &ctx->zlib;
+	uint32_t space;
+	uint16_t in_size;
+	uint16_t out_size;
+	int ret;
+
+	do {
+		space = zobj->buf_len - zobj->valid_len;
+		if (!space) {
+			gitt_log_error("Compress output buffer does not have enough space\n");
+			return -GITT_ERRNO_NOMEM;
+		}
 
+		in_size = size;
+		out_size = space > 0xffff ? 0xffff : space;
+		ret = gitt_zlib_compress_update(zlib, buf, &in_size,
+						zobj->buf + zobj->valid_len,
+						&out_size, end);
 		if (ret)
 			return ret;
-	} else {
-		gitt_log_error("Unsupported object type\n");
-		return -GITT_ERRNO_INVAL;
-	}
 
-	pack->state++;
+		zobj->valid_len += out_size;
+		buf += in_size;
+		size -= in_size;
+	} while (size || (end && zlib->stream.avail_out == 0));
+
+	return 0;
+}
+
+/**
+ * @brief Get the buffer size that gitt_pack_compress() may need
+ *
+ * @param obj
+ * @return uint32_t Size in bytes
+ */
+uint32_t gitt_pack_compress_bound(struct gitt_obj *obj)
+{
+	uint32_t size = obj->size;
+
+	/* Same as compressBound() of zlib */
+	return size + (size >> 12) + (size >> 14) + (size >> 25) + 13;
+}
+
+/**
+ * @brief Compress an object into zobj->buf. It does not touch any pack,
+ *        so different objects can be compressed at the same time.
+ *
+ * @param zobj
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_pack_compress(struct gitt_pack_zobj *zobj)
+{
+	struct gitt_pack_compress_ctx ctx;
+	int ret;
+
+	zobj->valid_len = 0;
+	ret = gitt_zlib_compress_init(&ctx.zlib);
+	if (ret)
+		goto out;
+
+	ctx.zobj = zobj;
+	ret = gitt_pack_obj_build(gitt_zobj_data_dump, &ctx, &zobj->obj);
+	gitt_zlib_compress_end(&ctx.zlib);
+
+out:
+	zobj->ret = ret;
+	return ret;
+}
+
+static int gitt_pack_done(struct gitt_pack *pack)
+{
+	int ret;
 
-done:
 	/* If done, add SHA-1 */
 	if (pack->state == pack->obj_num) {
 		ret = gitt_sha1_digest(&pack->sha1, pack->buf);
@@ -182,7 +314,190 @@ done:
 	return 0;
 }
 
+static int gitt_pack_emit(struct gitt_pack *pack)
+{
+	struct gitt_pack_worker *worker = pack->worker;
+	struct gitt_pack_zobj *zobj = &pack->window[pack->state % GITT_PACK_WINDOW];
+	uint32_t offset;
+	uint16_t size;
+	int ret;
+
+	ret = worker->wait(worker->param, zobj);
+	if (ret)
+		goto out;
+
+	ret = gitt_pack_obj_head(pack, &zobj->obj);
+	if (ret)
+		goto out;
+
+	/* Write out in order, the pack checksum follows along */
+	for (offset = 0; offset < zobj->valid_len; offset += size) {
+		size = zobj->valid_len - offset > 0xffff ? 0xffff : zobj->valid_len - offset;
+		ret = gitt_pack_data_update(pack, zobj->buf + offset, size);
+		if (ret)
+			goto out;
+	}
+
+out:
+	if (worker->release)
+		worker->release(worker->param, zobj);
+	pack->state++;
+	return ret;
+}
+
+static int gitt_pack_update_worker(struct gitt_pack *pack, struct gitt_obj *obj)
+{
+	struct gitt_pack_worker *worker = pack->worker;
+	struct gitt_pack_zobj *zobj;
+	int ret;
+
+	/* The window is full, write out the oldest one */
+	if (pack->submitted - pack->state == GITT_PACK_WINDOW) {
+		ret = gitt_pack_emit(pack);
+		if (ret)
+			return ret;
+	}
+
+	zobj = &pack->window[pack->submitted % GITT_PACK_WINDOW];
+	zobj->obj = *obj;
+
+	/* The head of a delta is written later, when the caller has moved on */
+	if (obj->type == GITT_OBJ_TYPE_OFS_DELTA || obj->type == GITT_OBJ_TYPE_REF_DELTA) {
+		zobj->delta = *(struct gitt_pack_delta *)obj->data;
+		if (obj->type == GITT_OBJ_TYPE_REF_DELTA) {
+			strcpy(zobj->base_sha1, zobj->delta.base_sha1);
+			zobj->delta.base_sha1 = zobj->base_sha1;
+		}
+		zobj->obj.data = &zobj->delta;
+	}
+	zobj->buf = NULL;
+	zobj->buf_len = 0;
+	zobj->valid_len = 0;
+	zobj->ret = 0;
+	zobj->priv = NULL;
+	ret = worker->submit(worker->param, zobj);
+	if (ret)
+		return ret;
+	pack->submitted++;
+
+	/* Everything has been submitted, write out the rest */
+	while (pack->submitted == pack->obj_num && pack->state < pack->submitted) {
+		ret = gitt_pack_emit(pack);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+int gitt_pack_update(struct gitt_pack *pack, struct gitt_obj *obj)
+{
+	int ret;
+
+	if (!pack->obj_num)
+		goto done;
+
+	if (pack->state >= pack->obj_num || pack->submitted >= pack->obj_num) {
+		gitt_log_error("Pack fail\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	/*
+	 * Compress on the worker. A streamed object would need a buffer as big
+	 * as itself there, so it is compressed here after the pending ones.
+	 */
+	if (pack->worker) {
+		if (!gitt_pack_obj_streamed(obj)) {
+			ret = gitt_pack_update_worker(pack, obj);
+			if (ret)
+				return ret;
+			goto done;
+		}
+
+		ret = gitt_pack_flush(pack);
+		if (ret)
+			return ret;
+	}
+
+	/* Dump head */
+	ret = gitt_pack_obj_head(pack, obj);
+	if (ret)
+		return ret;
+
+	/* Build object */
+	ret = gitt_zlib_compress_init(&pack->zlib);
+	if (ret)
+		return ret;
+
+	ret = gitt_pack_obj_build(gitt_obj_data_dump, pack, obj);
+	gitt_zlib_compress_end(&pack->zlib);
+
+	if (ret)
+		return ret;
+
+	pack->state++;
+	pack->submitted++;
+
+done:
+	return gitt_pack_done(pack);
+}
+
+/**
+ * @brief Write out every object that the worker is still holding
+ *
+ * @param pack
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_pack_flush(struct gitt_pack *pack)
+{
+	int ret;
+
+	while (pack->worker && pack->state != GITT_PACK_STATE_STOP &&
+	       pack->state < pack->submitted) {
+		ret = gitt_pack_emit(pack);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Wait until the worker has compressed the last object given to
+ *        gitt_pack_update(), so that its data can be reused. Unlike
+ *        gitt_pack_flush(), nothing is written out.
+ *
+ * @param pack
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_pack_settle(struct gitt_pack *pack)
+{
+	struct gitt_pack_worker *worker = pack->worker;
+	struct gitt_pack_zobj *zobj;
+
+	if (!worker || pack->state == GITT_PACK_STATE_STOP || pack->state >= pack->submitted)
+		return 0;
+
+	zobj = &pack->window[(pack->submitted - 1) % GITT_PACK_WINDOW];
+	return worker->wait(worker->param, zobj);
+}
+
 void gitt_pack_end(struct gitt_pack *pack)
 {
+	struct gitt_pack_worker *worker = pack->worker;
+	struct gitt_pack_zobj *zobj;
+
+	/* Wait for what is still being compressed */
+	while (worker && pack->state != GITT_PACK_STATE_STOP &&
+	       pack->state < pack->submitted) {
+		zobj = &pack->window[pack->state % GITT_PACK_WINDOW];
+		worker->wait(worker->param, zobj);
+		if (worker->release)
+			worker->release(worker->param, zobj);
+		pack->state++;
+	}
+
 	pack->state = GITT_PACK_STATE_STOP;
 }
@@ -0,0 +1,462 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <gitt_log.h>
+#include <gitt_record.h>
+#include <gitt_errno.h>
+
+/* Data of the open record: flags, exec, '\0' and protocol */
+#define GITT_RECORD_STATELESS		(1 << 0)
+
+static void gitt_record_put32(uint8_t *p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static uint32_t gitt_record_get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint8_t gitt_record_kind(struct gitt_record *record, uint32_t pos)
+{
+	return record->buf[pos];
+}
+
+static uint32_t gitt_record_time(struct gitt_record *record, uint32_t pos)
+{
+	return gitt_record_get32(record->buf + pos + 1);
+}
+
+static uint32_t gitt_record_length(struct gitt_record *record, uint32_t pos)
+{
+	return gitt_record_get32(record->buf + pos + 5);
+}
+
+static uint8_t *gitt_record_data(struct gitt_record *record, uint32_t pos)
+{
+	return record->buf + pos + GITT_RECORD_HEAD_SIZE;
+}
+
+static uint32_t gitt_record_next(struct gitt_record *record, uint32_t pos)
+{
+	return pos + GITT_RECORD_HEAD_SIZE + gitt_record_length(record, pos);
+}
+
+/* Microseconds since the command was opened */
+static uint32_t gitt_record_elapsed(struct gitt_record *record)
+{
+	uint64_t elapsed = record->now() - record->start;
+
+	return elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+}
+
+/* Add a record, once one does not fit the command being recorded is dropped */
+static void gitt_record_append(struct gitt_record *record, uint8_t kind, uint32_t time,
+			       const void *data, uint32_t size, const void *more,
+			       uint32_t more_size)
+{
+	uint8_t *p;
+
+	if (record->overflow)
+		return;
+
+	if (record->buf_len - record->used < GITT_RECORD_HEAD_SIZE + size + more_size) {
+		gitt_log_error("Transcript full, %ubyte\n", record->used);
+		record->overflow = true;
+		record->used = record->begin;
+		return;
+	}
+
+	p = record->buf + record->used;
+	p[0] = kind;
+	gitt_record_put32(p + 1, time);
+	gitt_record_put32(p + 5, size + more_size);
+	p += GITT_RECORD_HEAD_SIZE;
+	if (size)
+		memcpy(p, data, size);
+	if (more_size)
+		memcpy(p + size, more, more_size);
+	record->used += GITT_RECORD_HEAD_SIZE + size + more_size;
+}
+
+static int gitt_record_open(void *param, void **handle, const char *url, const char *exec,
+			    const char *protocol, struct gitt_ssh_limit *limit)
+{
+	struct gitt_record *record = (struct gitt_record *)param;
+	struct gitt_transport *inner = record->inner;
+	uint8_t head[1 + 32];
+	uint32_t size;
+	uint64_t begin;
+	int ret;
+
+	if (record->opened) {
+		gitt_log_error("Only one command at a time is recorded\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	begin = record->now();
+	ret = inner->open(inner->param, &record->link, url, exec, protocol, limit);
+	if (ret)
+		return ret;
+	record->start = record->now();
+
+	size = strlen(exec) + 1;
+	if (size > sizeof(head) - 1) {
+		inner->close(record->link);
+		return -GITT_ERRNO_INVAL;
+	}
+	head[0] = inner->stateless ? GITT_RECORD_STATELESS : 0;
+	memcpy(head + 1, exec, size);
+
+	record->begin = record->used;
+	gitt_record_append(record, GITT_RECORD_OPEN,
+			   record->start - begin > UINT32_MAX ? UINT32_MAX : record->start - begin,
+			   head, 1 + size, protocol, protocol ? strlen(protocol) : 0);
+
+	record->opened = true;
+	*handle = record;
+	return 0;
+}
+
+static int gitt_record_read(void *handle, char *buf, int size)
+{
+	struct gitt_record *record = (struct gitt_record *)handle;
+	int ret;
+
+	ret = record->inner->read(record->link, buf, size);
+	if (ret > 0)
+		gitt_record_append(record, GITT_RECORD_READ, gitt_record_elapsed(record),
+				   buf, ret, NULL, 0);
+
+	return ret;
+}
+
+static int gitt_record_write(void *handle, char *buf, int size)
+{
+	struct gitt_record *record = (struct gitt_record *)handle;
+	int ret;
+
+	ret = record->inner->write(record->link, buf, size);
+	if (ret > 0)
+		gitt_record_append(record, GITT_RECORD_WRITE, gitt_record_elapsed(record),
+				   buf, ret, NULL, 0);
+
+	return ret;
+}
+
+static int gitt_record_nonblock(void *handle, bool nonblock)
+{
+	struct gitt_record *record = (struct gitt_record *)handle;
+
+	if (!record->inner->nonblock)
+		return -GITT_ERRNO_INVAL;
+
+	return record->inner->nonblock(record->link, nonblock);
+}
+
+static int gitt_record_fd(void *handle, bool write)
+{
+	struct gitt_record *record = (struct gitt_record *)handle;
+
+	if (!record->inner->fd)
+		return -GITT_ERRNO_INVAL;
+
+	return record->inner->fd(record->link, write);
+}
+
+static void gitt_record_close(void *handle)
+{
+	struct gitt_record *record = (struct gitt_record *)handle;
+
+	record->inner->close(record->link);
+	record->link = NULL;
+	gitt_record_append(record, GITT_RECORD_CLOSE, gitt_record_elapsed(record),
+			   NULL, 0, NULL, 0);
+	record->opened = false;
+}
+
+/**
+ * @brief Record the commands run through inner into buf, until used
+ *        reaches buf_len. Reach the remote through record->transport.
+ *
+ * @param record buf, buf_len and now are to be set
+ * @param inner The transport that reaches the remote
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_record_init(struct gitt_record *record, struct gitt_transport *inner)
+{
+	if (!record || !inner || !record->buf || !record->now) {
+		gitt_log_error("Recording needs a transport, a buffer and the time\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	memset(&record->transport, 0, sizeof(record->transport));
+	record->transport.open = gitt_record_open;
+	record->transport.read = gitt_record_read;
+	record->transport.write = gitt_record_write;
+	record->transport.nonblock = gitt_record_nonblock;
+	record->transport.fd = gitt_record_fd;
+	record->transport.close = gitt_record_close;
+	record->transport.param = record;
+	record->transport.stateless = inner->stateless;
+
+	record->inner = inner;
+	record->used = 0;
+	record->overflow = false;
+	record->opened = false;
+	record->link = NULL;
+
+	return 0;
+}
+
+/* The next record of that kind with data in the open command, or end */
+static uint32_t gitt_record_find(struct gitt_record *record, uint32_t pos, uint8_t kind)
+{
+	while (pos < record->end && (gitt_record_kind(record, pos) != kind ||
+				     !gitt_record_length(record, pos)))
+		pos = gitt_record_next(record, pos);
+
+	return pos;
+}
+
+/* With the recorded timing, wait until as long after the open as then */
+static void gitt_record_wait(struct gitt_record *record, uint32_t time)
+{
+	uint32_t elapsed;
+
+	if (!record->delay)
+		return;
+
+	elapsed = gitt_record_elapsed(record);
+	if (time > elapsed)
+		record->delay(time - elapsed);
+}
+
+static int gitt_record_replay_open(void *param, void **handle, const char *url,
+				   const char *exec, const char *protocol,
+				   struct gitt_ssh_limit *limit)
+{
+	struct gitt_record *record = (struct gitt_record *)param;
+	uint32_t size = strlen(exec) + 1;
+	uint8_t *data = NULL;
+
+	if (record->opened) {
+		gitt_log_error("Only one command at a time is replayed\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	/* The next command of the transcript running exec */
+	while (record->pos < record->used) {
+		data = gitt_record_data(record, record->pos);
+		if (gitt_record_kind(record, record->pos) == GITT_RECORD_OPEN &&
+		    gitt_record_length(record, record->pos) >= 1 + size &&
+		    !memcmp(data + 1, exec, size))
+			break;
+		if (gitt_record_kind(record, record->pos) == GITT_RECORD_OPEN)
+			record->skipped++;
+		record->pos = gitt_record_next(record, record->pos);
+	}
+	if (record->pos >= record->used) {
+		gitt_log_error("No more %s in the transcript\n", exec);
+		return -GITT_ERRNO_INVAL;
+	}
+
+	record->transport.stateless = data[0] & GITT_RECORD_STATELESS;
+
+	/* Its records go up to its close, or the next open */
+	record->end = gitt_record_next(record, record->pos);
+	while (record->end < record->used &&
+	       gitt_record_kind(record, record->end) != GITT_RECORD_CLOSE &&
+	       gitt_record_kind(record, record->end) != GITT_RECORD_OPEN)
+		record->end = gitt_record_next(record, record->end);
+
+	record->read_pos = gitt_record_next(record, record->pos);
+	record->read_left = 0;
+	record->write_pos = record->read_pos;
+	record->write_left = 0;
+
+	if (record->delay)
+		record->delay(gitt_record_time(record, record->pos));
+	if (record->now)
+		record->start = record->now();
+
+	record->pos = record->end;
+	record->opened = true;
+	*handle = record;
+	return 0;
+}
+
+static int gitt_record_replay_read(void *handle, char *buf, int size)
+{
+	struct gitt_record *record = (struct gitt_record *)handle;
+	uint32_t length;
+	uint32_t len;
+
+	if (!record->read_left) {
+		record->read_pos = gitt_record_find(record, record->read_pos, GITT_RECORD_READ);
+		if (record->read_pos >= record->end)
+			return 0;
+		record->read_left = gitt_record_length(record, record->read_pos);
+		gitt_record_wait(record, gitt_record_time(record, record->read_pos));
+	}
+
+	length = gitt_record_length(record, record->read_pos);
+	len = (uint32_t)size < record->read_left ? (uint32_t)size : record->read_left;
+	memcpy(buf, gitt_record_data(record, record->read_pos) + length - record->read_left, len);
+
+	record->read_left -= len;
+	if (!record->read_left)
+		record->read_pos = gitt_record_next(record, record->read_pos);
+
+	return len;
+}
+
+/* What is written is compared with what was, it may come in other pieces */
+static int gitt_record_replay_write(void *handle, char *buf, int size)
+{
+	struct gitt_record *record = (struct gitt_record *)handle;
+	uint32_t left = size;
+	uint32_t length;
+	uint32_t len;
+	uint8_t *data;
+	uint32_t i;
+
+	while (left) {
+		if (!record->write_left) {
+			record->write_pos = gitt_record_find(record, record->write_pos,
+							     GITT_RECORD_WRITE);
+			if (record->write_pos >= record->end) {
+				record->diverged += left;
+				break;
+			}
+			record->write_left = gitt_record_length(record, record->write_pos);
+		}
+
+		length = gitt_record_length(record, record->write_pos);
+		data = gitt_record_data(record, record->write_pos) + length - record->write_left;
+		len = left < record->write_left ? left : record->write_left;
+		for (i = 0; i < len; i++)
+			if (data[i] != (uint8_t)buf[i])
+				record->diverged++;
+
+		buf += len;
+		left -= len;
+		record->write_left -= len;
+		if (!record->write_left)
+			record->write_pos = gitt_record_next(record, record->write_pos);
+	}
+
+	return size;
+}
+
+/* Served from memory, it never has to wait, so there is no fd either */
+static int gitt_record_replay_nonblock(void *handle, bool nonblock)
+{
+	return 0;
+}
+
+static void gitt_record_replay_close(void *handle)
+{
+	struct gitt_record *record = (struct gitt_record *)handle;
+
+	/* What was written then and not now differs too */
+	record->diverged += record->write_left;
+	if (record->write_left)
+		record->write_pos = gitt_record_next(record, record->write_pos);
+	while ((record->write_pos = gitt_record_find(record, record->write_pos,
+						     GITT_RECORD_WRITE)) < record->end) {
+		record->diverged += gitt_record_length(record, record->write_pos);
+		record->write_pos = gitt_record_next(record, record->write_pos);
+	}
+
+	if (record->pos < record->used &&
+	    gitt_record_kind(record, record->pos) == GITT_RECORD_CLOSE)
+		record->pos = gitt_record_next(record, record->pos);
+	record->opened = false;
+}
+
+/**
+ * @brief Serve the used bytes of buf back through record->transport, for
+ *        the same commands in the same order, with no remote. Commands of
+ *        the transcript that are not asked for are skipped.
+ *
+ * @param record buf and used are to be set, now and delay to replay with
+ *               the recorded timing
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_record_replay(struct gitt_record *record)
+{
+	uint32_t pos;
+
+	if (!record || !record->buf || (record->delay && !record->now)) {
+		gitt_log_error("Replaying needs a transcript, and the time to wait\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	/* Check it once, so that the calls can trust it */
+	for (pos = 0; pos < record->used; pos = gitt_record_next(record, pos)) {
+		if (record->used - pos < GITT_RECORD_HEAD_SIZE ||
+		    record->used - pos - GITT_RECORD_HEAD_SIZE < gitt_record_length(record, pos) ||
+		    !gitt_record_kind(record, pos) ||
+		    !strchr("ORWC", gitt_record_kind(record, pos)) ||
+		    (gitt_record_kind(record, pos) == GITT_RECORD_OPEN &&
+		     !gitt_record_length(record, pos))) {
+			gitt_log_error("Broken transcript at %u\n", pos);
+			return -GITT_ERRNO_INVAL;
+		}
+	}
+
+	memset(&record->transport, 0, sizeof(record->transport));
+	record->transport.open = gitt_record_replay_open;
+	record->transport.read = gitt_record_replay_read;
+	record->transport.write = gitt_record_replay_write;
+	record->transport.nonblock = gitt_record_replay_nonblock;
+	record->transport.close = gitt_record_replay_close;
+	record->transport.param = record;
+
+	record->inner = NULL;
+	gitt_record_rewind(record);
+
+	return 0;
+}
+
+/**
+ * @brief Replay the transcript again from its start
+ *
+ * @param record
+ */
+void gitt_record_rewind(struct gitt_record *record)
+{
+	record->pos = 0;
+	record->skipped = 0;
+	record->diverged = 0;
+	record->opened = false;
+}
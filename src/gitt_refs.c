@@ -0,0 +1,274 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <gitt_refs.h>
+#include <gitt_obj.h>
+#include <gitt_log.h>
+#include <gitt_errno.h>
+
+#define GITT_REFS_FNV_BASIS		0x811c9dc5
+#define GITT_REFS_FNV_PRIME		0x01000193
+
+static inline uint32_t gitt_refs_hash(const char *name)
+{
+	uint32_t hash = GITT_REFS_FNV_BASIS;
+
+	while (*name)
+		hash = (hash ^ (uint8_t)*name++) * GITT_REFS_FNV_PRIME;
+
+	return hash;
+}
+
+/* The slot of name, or the empty slot where it goes */
+static uint16_t gitt_refs_slot(struct gitt_refs *refs, const char *name)
+{
+	uint16_t slot = gitt_refs_hash(name) & (refs->slot_num - 1);
+	uint16_t index;
+
+	while (1) {
+		index = refs->slots[slot];
+		if (index == GITT_REFS_EMPTY ||
+		    !strcmp(refs->arena + refs->entries[index].name, name))
+			return slot;
+		slot = (slot + 1) & (refs->slot_num - 1);
+	}
+}
+
+static void gitt_refs_bin_to_hex(const uint8_t bin[20], char hex[41])
+{
+	const char *tables = "0123456789abcdef";
+	uint8_t i;
+
+	for (i = 0; i < 20; i++) {
+		hex[i * 2] = tables[bin[i] >> 4];
+		hex[i * 2 + 1] = tables[bin[i] & 0xf];
+	}
+	hex[40] = '\0';
+}
+
+/**
+ * @brief Lay out the work buffer for max refs
+ *
+ * @param refs buf, buf_len and max are set by the caller
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_refs_init(struct gitt_refs *refs)
+{
+	uint32_t size;
+
+	if (!refs->buf || !refs->max || refs->max > GITT_REFS_MAX)
+		return -GITT_ERRNO_INVAL;
+
+	/* Keep the hash at most half full */
+	refs->slot_num = 1;
+	while (refs->slot_num < refs->max * 2)
+		refs->slot_num <<= 1;
+
+	size = sizeof(struct gitt_refs_entry) * refs->max + sizeof(uint16_t) * refs->slot_num;
+	if (refs->buf_len <= size) {
+		gitt_log_error("No space for the ref names\n");
+		return -GITT_ERRNO_NOMEM;
+	}
+
+	refs->entries = (struct gitt_refs_entry *)refs->buf;
+	refs->slots = (uint16_t *)(refs->entries + refs->max);
+	refs->arena = (char *)(refs->slots + refs->slot_num);
+	refs->arena_len = refs->buf_len - size;
+	gitt_refs_reset(refs);
+
+	return 0;
+}
+
+/**
+ * @brief Forget all refs
+ *
+ * @param refs
+ */
+void gitt_refs_reset(struct gitt_refs *refs)
+{
+	refs->number = 0;
+	refs->arena_used = 0;
+	memset(refs->slots, 0xff, sizeof(uint16_t) * refs->slot_num);
+}
+
+/**
+ * @brief Start a new advertisement, the refs not added again are not live
+ *
+ * @param refs
+ */
+void gitt_refs_begin(struct gitt_refs *refs)
+{
+	uint16_t index;
+
+	for (index = 0; index < refs->number; index++)
+		refs->entries[index].live = false;
+}
+
+/**
+ * @brief Add a ref, or update its id if it is there already
+ *
+ * @param refs
+ * @param sha1
+ * @param name
+ * @return int >=0: Index of the ref
+ * @return int -GITT_ERRNO_NOMEM: The table is full
+ * @return int other: Error
+ */
+int gitt_refs_add(struct gitt_refs *refs, const char *sha1, const char *name)
+{
+	struct gitt_refs_entry *entry;
+	uint32_t length = strlen(name) + 1;
+	uint8_t oid[20];
+	uint16_t slot;
+	uint16_t index;
+
+	if (gitt_obj_hex_to_bin(sha1, oid))
+		return -GITT_ERRNO_INVAL;
+
+	slot = gitt_refs_slot(refs, name);
+	index = refs->slots[slot];
+	if (index != GITT_REFS_EMPTY) {
+		entry = &refs->entries[index];
+	} else {
+		if (refs->number == refs->max || refs->arena_used + length > refs->arena_len)
+			return -GITT_ERRNO_NOMEM;
+
+		index = refs->number;
+		entry = &refs->entries[index];
+		memset(entry->known, 0, sizeof(entry->known));
+		entry->name = refs->arena_used;
+		memcpy(refs->arena + refs->arena_used, name, length);
+		refs->arena_used += length;
+		refs->slots[slot] = refs->number++;
+	}
+
+	memcpy(entry->oid, oid, sizeof(oid));
+	entry->live = true;
+
+	return index;
+}
+
+/**
+ * @brief Look up a ref
+ *
+ * @param refs
+ * @param name
+ * @return int >=0: Index of the ref
+ * @return int other: Not found
+ */
+int gitt_refs_find(struct gitt_refs *refs, const char *name)
+{
+	uint16_t index = refs->slots[gitt_refs_slot(refs, name)];
+
+	if (index == GITT_REFS_EMPTY)
+		return -GITT_ERRNO_INVAL;
+
+	return index;
+}
+
+/**
+ * @brief Look up the id of a ref
+ *
+ * @param refs
+ * @param name
+ * @param sha1 Out: the id
+ * @return int 0: Good
+ * @return int other: Not found
+ */
+int gitt_refs_get(struct gitt_refs *refs, const char *name, char sha1[41])
+{
+	int index = gitt_refs_find(refs, name);
+
+	if (index < 0)
+		return index;
+
+	gitt_refs_bin_to_hex(refs->entries[index].oid, sha1);
+	return 0;
+}
+
+/**
+ * @brief Get a ref by its index, in the order it was first advertised
+ *
+ * @param refs
+ * @param index
+ * @param sha1 Out: the id
+ * @return const char* Name, NULL if index is out of range
+ */
+const char *gitt_refs_entry(struct gitt_refs *refs, uint16_t index, char sha1[41])
+{
+	if (index >= refs->number)
+		return NULL;
+
+	gitt_refs_bin_to_hex(refs->entries[index].oid, sha1);
+	return refs->arena + refs->entries[index].name;
+}
+
+/**
+ * @brief Whether a live ref has changed since it was settled
+ *
+ * @param refs
+ * @param index
+ * @return true: Changed
+ * @return false: Not changed, or not live
+ */
+bool gitt_refs_changed(struct gitt_refs *refs, uint16_t index)
+{
+	struct gitt_refs_entry *entry = &refs->entries[index];
+
+	return entry->live && memcmp(entry->oid, entry->known, sizeof(entry->oid));
+}
+
+/**
+ * @brief Whether a live ref is under prefix and has changed
+ *
+ * @param refs
+ * @param index
+ * @param prefix
+ * @param every Changed or not
+ * @return true: Match
+ * @return false: No match
+ */
+bool gitt_refs_match(struct gitt_refs *refs, uint16_t index, const char *prefix, bool every)
+{
+	struct gitt_refs_entry *entry = &refs->entries[index];
+
+	if (strncmp(refs->arena + entry->name, prefix, strlen(prefix)))
+		return false;
+
+	return every ? entry->live : gitt_refs_changed(refs, index);
+}
+
+/**
+ * @brief Take the current id of a ref as known
+ *
+ * @param refs
+ * @param index
+ */
+void gitt_refs_settle(struct gitt_refs *refs, uint16_t index)
+{
+	memcpy(refs->entries[index].known, refs->entries[index].oid, sizeof(refs->entries[index].oid));
+}
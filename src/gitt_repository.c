@@ -29,6 +29,37 @@
 #include <gitt_repository.h>
 #include <gitt_errno.h>
 
+/* Steps of a fetch or a push, a non-blocking one is run again from the start of its step */
+#define GITT_REPOSITORY_STEP_HEAD	0
+#define GITT_REPOSITORY_STEP_BYE	1
+#define GITT_REPOSITORY_STEP_WANT	2
+#define GITT_REPOSITORY_STEP_PACK	3
+#define GITT_REPOSITORY_STEP_DONE	4
+#define GITT_REPOSITORY_STEP_SEND_HEAD	5
+#define GITT_REPOSITORY_STEP_SEND_PACK	6
+#define GITT_REPOSITORY_STEP_SEND_STATE	7
+
+/* Why the last command failed, timeouts and cancels are told apart from the rest */
+static int gitt_repository_error(struct gitt_repository *repository)
+{
+	return repository->command.fault ? repository->command.fault : -GITT_ERRNO_INVAL;
+}
+
+/*
+ * Whether the commit is one of ours, pushed before the remote commits under
+ * it were pulled, or was dumped by a pull that did not finish
+ */
+static bool gitt_repository_pushed(struct gitt_repository *repository, const char *id)
+{
+	uint8_t i;
+
+	for (i = 0; i < repository->pushed_num; i++)
+		if (!strcmp(repository->pushed[i], id))
+			return true;
+
+	return false;
+}
+
 static void gitt_obj_dump_callback(struct gitt_obj *obj)
 {
 	int ret;
@@ -36,13 +67,26 @@ static void gitt_obj_dump_callback(struct gitt_obj *obj)
 	struct gitt_unpack *unpack = gitt_containerof(obj, struct gitt_unpack, obj);
 	struct gitt_repository *repository = gitt_containerof(unpack, struct gitt_repository, unpack);
 
-	if (obj->type == GITT_OBJ_TYPE_COMMIT && repository->commit_dump) {
-		ret = gitt_commit_parse(obj->data, obj->size, &commit);
-		if (!ret)
-			repository->commit_dump(repository, &commit);
-	} else {
-		gitt_log_info("Skip type:%s, size:%d\n", GITT_OBJ_STR(obj->type), obj->size);
+	if (obj->type != GITT_OBJ_TYPE_COMMIT || !repository->commit_dump) {
+		gitt_log_info("Skip type:%s, size:%u\n", GITT_OBJ_STR(obj->type), obj->size);
+		return;
 	}
+
+	ret = gitt_commit_parse(obj->data, obj->size, &commit);
+	if (ret)
+		return;
+
+	if (gitt_repository_pushed(repository, commit.id.sha1)) {
+		gitt_log_debug("Skip our own commit\n");
+		return;
+	}
+
+	repository->commit_dump(repository, &commit);
+	repository->pulled++;
+
+	/* If the pull does not finish, the next one does not dump it again */
+	if (repository->pushed_num < GITT_REPOSITORY_PUSHED_NUMBER)
+		strcpy(repository->pushed[repository->pushed_num++], commit.id.sha1);
 }
 
 static int gitt_command_pack_dump_callback(void *param, char *data, int size)
@@ -78,7 +122,10 @@ static void gitt_unpack_verify_dump_callback(bool pass, struct gitt_sha1 *sha1)
  */
 int gitt_repository_init(struct gitt_repository *repository)
 {
-	if (!repository->privkey || !repository->url) {
+	int ret;
+
+	/* Only SSH needs the key */
+	if ((!repository->privkey && !repository->transport) || !repository->url) {
 		gitt_log_error("Privkey and repository cannot be empty\n");
 		return -GITT_ERRNO_INVAL;
 	}
@@ -88,8 +135,45 @@ int gitt_repository_init(struct gitt_repository *repository)
 		return -GITT_ERRNO_INVAL;
 	}
 
+	if (repository->delta) {
+		ret = gitt_delta_init(repository->delta);
+		if (ret)
+			return ret;
+	}
+
+	if (repository->ref_table) {
+		ret = gitt_refs_init(repository->ref_table);
+		if (ret)
+			return ret;
+	}
+
+	if (strlen(repository->shards) && !repository->ref_table) {
+		gitt_log_error("Shards need a ref table\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
 	repository->head[0] = '\0';
-	repository->ssh = NULL;
+	repository->refs[0] = '\0';
+	repository->known_head[0] = '\0';
+	repository->known_num = 0;
+	repository->have_num = 0;
+	repository->pushed_num = 0;
+	repository->shallow.number = 0;
+	repository->step = GITT_REPOSITORY_STEP_DONE;
+	repository->command.ssh = NULL;
+	repository->command.idle_max = repository->session_idle;
+	repository->command.pool = repository->pool;
+	repository->command.conn = NULL;
+	repository->command.transport = repository->transport;
+	repository->command.link = NULL;
+	repository->command.ring = repository->ring;
+	repository->command.ring_len = repository->ring_len;
+	repository->command.out = repository->out;
+	repository->command.out_len = repository->out_len;
+	repository->command.table = repository->ref_table;
+	repository->command.limit.idle = repository->timeout_idle;
+	repository->command.limit.total = repository->timeout_total;
+	repository->command.limit.cancel = repository->cancel;
 
 	return 0;
 }
@@ -104,6 +188,9 @@ int gitt_repository_init(struct gitt_repository *repository)
 int gitt_repository_clone(struct gitt_repository *repository)
 {
 	repository->head[0] = '\0';
+	repository->have_num = 0;
+	repository->pushed_num = 0;
+	repository->shallow.number = 0;
 	return gitt_repository_pull(repository);
 }
 
@@ -112,148 +199,640 @@ static int gitt_pack_data_dump_callback(void *p, uint8_t *buf, uint16_t size)
 	struct gitt_repository *repository = gitt_containerof(p, struct gitt_repository, pack);
 
 	gitt_log_debug("write pack: %ubyte\n", size);
-	return gitt_command_write_pack(repository->ssh, buf, size);
+	return gitt_command_write_pack(&repository->command, buf, size);
 }
 
-int gitt_repository_push_commit(struct gitt_repository *repository, struct gitt_commit *commit)
+/* Whether the object can be reached from known_head */
+static bool gitt_repository_known(struct gitt_repository *repository, const char *sha1)
 {
-	int ret;
+	uint8_t i;
+
+	for (i = 0; i < repository->known_num; i++)
+		if (!strcmp(repository->known[i], sha1))
+			return true;
+
+	return false;
+}
+
+static void gitt_repository_know(struct gitt_repository *repository, const char *sha1)
+{
+	if (gitt_repository_known(repository, sha1))
+		return;
+
+	/* Forget the oldest one */
+	if (repository->known_num == GITT_REPOSITORY_KNOWN_NUMBER) {
+		memmove(repository->known[0], repository->known[1],
+			sizeof(repository->known[0]) * (GITT_REPOSITORY_KNOWN_NUMBER - 1));
+		repository->known_num--;
+	}
+
+	strcpy(repository->known[repository->known_num++], sha1);
+}
+
+/* Put the head in front of the heads we had, they are the haves of a pull */
+static void gitt_repository_have(struct gitt_repository *repository)
+{
+	uint8_t i;
+
+	if (!strlen(repository->head))
+		return;
+
+	for (i = 0; i < repository->have_num; i++)
+		if (!strcmp(repository->haves[i], repository->head))
+			break;
+
+	/* Forget the oldest one */
+	if (i == GITT_REPOSITORY_HAVE_NUMBER)
+		i--;
+	else if (i == repository->have_num)
+		repository->have_num++;
+
+	memmove(repository->haves[1], repository->haves[0], sizeof(repository->haves[0]) * i);
+	strcpy(repository->haves[0], repository->head);
+}
+
+static char *gitt_repository_tree_sha1(struct gitt_tree *tree, int entry)
+{
+	return entry < 0 ? tree->id.sha1 : tree->entries[entry].blob->id.sha1;
+}
+
+/* Whether an object of a commit tree is already in the pack or on the remote */
+static bool gitt_repository_tree_skip(struct gitt_repository *repository,
+				      struct gitt_commit *commits, uint32_t index,
+				      int entry, bool known)
+{
+	struct gitt_tree *tree = commits[index].tree.tree;
+	char *sha1 = gitt_repository_tree_sha1(tree, entry);
+	uint32_t i;
+	int e;
+
+	/* The empty tree always exists */
+	if (entry < 0 && !tree->number)
+		return true;
+
+	if (known && gitt_repository_known(repository, sha1))
+		return true;
+
+	for (i = 0; i <= index; i++) {
+		tree = commits[i].tree.tree;
+		if (!tree)
+			continue;
+
+		for (e = -1; e < tree->number; e++) {
+			if (i == index && e == entry)
+				return false;
+			if (!strcmp(gitt_repository_tree_sha1(tree, e), sha1))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/* Count or pack the trees and blobs that the remote does not have yet */
+static int gitt_repository_pack_trees(struct gitt_repository *repository,
+				      struct gitt_commit *commits, uint32_t number,
+				      bool known, uint32_t *count)
+{
+	struct gitt_tree *tree;
 	struct gitt_obj obj;
-	char remote_head[41];
-	char refs[32];
+	uint32_t index;
+	int entry;
+	int ret;
 
-	gitt_log_debug("Start connecting\n");
-	repository->ssh = gitt_command_start_receive(repository->url, repository->privkey);
-	if (!repository->ssh)
+	for (index = 0; index < number; index++) {
+		tree = commits[index].tree.tree;
+		if (!tree)
+			continue;
+
+		for (entry = -1; entry < tree->number; entry++) {
+			if (gitt_repository_tree_skip(repository, commits, index, entry, known))
+				continue;
+
+			if (count) {
+				(*count)++;
+				continue;
+			}
+
+			if (entry < 0) {
+				obj.type = GITT_OBJ_TYPE_TREE;
+				obj.data = tree;
+				obj.size = gitt_tree_length(tree);
+			} else {
+				obj.type = GITT_OBJ_TYPE_BLOB;
+				obj.data = tree->entries[entry].blob;
+				obj.size = gitt_blob_length(tree->entries[entry].blob);
+			}
+
+			ret = gitt_pack_update(&repository->pack, &obj);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* Update the ids of a commit tree and its blobs */
+static int gitt_repository_tree_update(struct gitt_commit *commit)
+{
+	struct gitt_tree *tree = commit->tree.tree;
+	uint16_t index;
+	int ret;
+
+	if (!tree)
+		return 0;
+
+	for (index = 0; index < tree->number; index++) {
+		ret = gitt_blob_sha1_update(tree->entries[index].blob);
+		if (ret)
+			return ret;
+	}
+
+	ret = gitt_tree_sha1_update(tree);
+	if (ret)
+		return ret;
+
+	commit->tree.sha1 = tree->id.sha1;
+
+	return 0;
+}
+
+static bool gitt_repository_delta(struct gitt_repository *repository, struct gitt_obj *obj,
+				  struct gitt_pack_delta *pack_delta, uint8_t type)
+{
+	struct gitt_delta *delta = repository->delta;
+
+	/* Keep a copy of the commit, it is the base of the next delta */
+	gitt_delta_target_reset(delta);
+	if (gitt_commit_build(gitt_delta_target_dump, delta, (struct gitt_commit *)obj->data)) {
+		gitt_delta_reset(delta);
+		return false;
+	}
+
+	if (type && !gitt_delta_encode(delta, &pack_delta->data, &pack_delta->size)) {
+		pack_delta->base_sha1 = delta->base_sha1;
+		obj->type = type;
+		obj->data = pack_delta;
+		obj->size = pack_delta->size;
+	}
+
+	return true;
+}
+
+/* The id of the ref of the device, zero if the remote does not have it yet */
+static void gitt_repository_shard_head(struct gitt_repository *repository, char head[41])
+{
+	struct gitt_refs *table = repository->ref_table;
+	int index;
+
+	index = gitt_refs_find(table, repository->shard);
+	if (index >= 0 && table->entries[index].live)
+		gitt_refs_entry(table, index, head);
+	else
+		strcpy(head, GITT_REPOSITORY_ZERO_SHA1);
+}
+
+/* Number of shards to pull, and settle them once they are pulled */
+static uint16_t gitt_repository_shards(struct gitt_repository *repository, bool every,
+				       bool settle)
+{
+	struct gitt_refs *table = repository->ref_table;
+	uint16_t number = 0;
+	uint16_t index;
+
+	for (index = 0; index < table->number; index++) {
+		if (!gitt_refs_match(table, index, repository->shards, every))
+			continue;
+		if (settle)
+			gitt_refs_settle(table, index);
+		number++;
+	}
+
+	return number;
+}
+
+static int gitt_repository_send_begin(struct gitt_repository *repository,
+				      struct gitt_commit *commits, uint32_t number)
+{
+	int ret;
+
+	if (!commits || !number)
 		return -GITT_ERRNO_INVAL;
 
+	repository->commits = commits;
+	repository->commit_num = number;
+	repository->remote_refs[0] = '\0';
+	repository->step = GITT_REPOSITORY_STEP_DONE;
+
+	gitt_log_debug("Start connecting\n");
+	ret = gitt_command_start_receive(&repository->command, repository->url,
+				       repository->privkey);
+	if (ret)
+		return gitt_repository_error(repository);
+
+	repository->step = GITT_REPOSITORY_STEP_SEND_HEAD;
+	return 0;
+}
+
+static int gitt_repository_send_head(struct gitt_repository *repository)
+{
+	int ret;
+
 	gitt_log_debug("Get remote head\n");
-	ret = gitt_command_get_head(repository->ssh, remote_head, refs);
+	ret = gitt_command_get_head(&repository->command, repository->remote_head,
+				    repository->remote_refs, NULL);
 	if (ret)
-		goto err0;
+		return ret;
+
+	repository->step = GITT_REPOSITORY_STEP_SEND_PACK;
+	return 0;
+}
+
+/* Base the commits on the remote head, and write them out with what they need */
+static int gitt_repository_send_commits(struct gitt_repository *repository)
+{
+	struct gitt_commit *commits = repository->commits;
+	uint32_t number = repository->commit_num;
+	char *remote_head = repository->remote_head;
+	char *refs = repository->remote_refs;
+	int ret;
+	uint32_t index;
+	struct gitt_obj obj;
+	struct gitt_commit *commit;
+	struct gitt_pack_delta pack_delta;
+	uint8_t delta_type;
+	bool delta_base;
+	bool known;
+	uint32_t obj_num;
+	char *target;
+
+	/* Sharded: push to the ref of the device, based on what it has now */
+	target = strlen(refs) ? refs : repository->refs;
+	if (strlen(repository->shard)) {
+		target = repository->shard;
+		gitt_repository_shard_head(repository, remote_head);
+	}
 
 	/* Auto base */
+	commit = &commits[0];
 	if (commit->parent.sha1 && !strcmp(commit->parent.sha1, GITT_COMMIT_AUTO_BASE))
+		commit->parent.sha1 = strcmp(remote_head, GITT_REPOSITORY_ZERO_SHA1) ?
+				      remote_head : GITT_COMMIT_NO_BASE;
+
+	/*
+	 * Without parent, the commit would replace a remote head that was not
+	 * pulled yet and its events would be lost. Base it on that head instead,
+	 * our head stays behind and the next pull reads them.
+	 */
+	if (commit->parent.sha1 && !strlen(commit->parent.sha1) && !strlen(repository->shard) &&
+	    strcmp(remote_head, GITT_REPOSITORY_ZERO_SHA1) && strcmp(remote_head, repository->head))
 		commit->parent.sha1 = remote_head;
 
 	/* Check parent */
 	if (commit->parent.sha1 && strlen(commit->parent.sha1) &&
 	    strcmp(commit->parent.sha1, remote_head)) {
-		ret = -GITT_ERRNO_RETRY;
 		gitt_log_debug("The current local record is not up to date\n");
-		goto err0;
+		return -GITT_ERRNO_RETRY;
 	}
 
-	/* Update commit id */
-	ret = gitt_commit_sha1_update(commit);
-	if (ret) {
-		gitt_log_error("Update commit id fail\n");
-		goto err0;
+	/* Chain and update commit ids */
+	for (index = 0; index < number; index++) {
+		commit = &commits[index];
+		if (index)
+			commit->parent.sha1 = commits[index - 1].id.sha1;
+
+		ret = gitt_repository_tree_update(commit);
+		if (ret) {
+			gitt_log_error("Update tree id fail\n");
+			return ret;
+		}
+
+		ret = gitt_commit_sha1_update(commit);
+		if (ret) {
+			gitt_log_error("Update commit id fail\n");
+			return ret;
+		}
 	}
 
 	gitt_log_debug("Set pack\n");
-	ret = gitt_command_set_pack(repository->ssh, remote_head, commit->id.sha1,
-				    strlen(refs) ? refs : repository->refs);
+	ret = gitt_command_set_pack(&repository->command, remote_head, commits[number - 1].id.sha1,
+				    target);
 	if (ret)
-		goto err0;
+		return ret;
+
+	/* Commits first, then the trees and blobs that the remote does not have */
+	known = !strcmp(repository->known_head, remote_head);
+	obj_num = number;
+	gitt_repository_pack_trees(repository, commits, number, known, &obj_num);
 
 	/* Initialize header */
 	repository->pack.buf = repository->buf;
 	repository->pack.buf_len = repository->buf_len;
-	repository->pack.obj_num = 1;
+	repository->pack.obj_num = obj_num;
 	repository->pack.data_dump = gitt_pack_data_dump_callback;
+	repository->pack.worker = repository->worker;
 	ret = gitt_pack_init(&repository->pack);
 	if (ret)
-		goto err0;
+		return ret;
 
 	/* Update to pack */
-	obj.type = GITT_OBJ_TYPE_COMMIT;
-	obj.data = commit;
-	obj.size = gitt_commit_length(commit);
-	ret = gitt_pack_update(&repository->pack, &obj);
+	for (index = 0; index < number; index++) {
+		obj.type = GITT_OBJ_TYPE_COMMIT;
+		obj.data = &commits[index];
+		obj.size = gitt_commit_length(&commits[index]);
+
+		/*
+		 * The first commit can only be based on what the remote already has,
+		 * the others are based on the commit before them in the pack, by
+		 * offset if the remote takes it.
+		 */
+		delta_base = false;
+		if (repository->delta) {
+			if (index && (repository->command.caps & GITT_COMMAND_CAP_OFS_DELTA))
+				delta_type = GITT_OBJ_TYPE_OFS_DELTA;
+			else if (index)
+				delta_type = GITT_OBJ_TYPE_REF_DELTA;
+			else if (!strcmp(repository->delta->base_sha1, remote_head))
+				delta_type = GITT_OBJ_TYPE_REF_DELTA;
+			else
+				delta_type = 0;
+			delta_base = gitt_repository_delta(repository, &obj, &pack_delta, delta_type);
+		}
+
+		ret = gitt_pack_update(&repository->pack, &obj);
+		if (ret)
+			goto err1;
+
+		if (delta_base) {
+			/* The next commit reuses the delta data, the rest stays queued */
+			if (obj.type != GITT_OBJ_TYPE_COMMIT) {
+				ret = gitt_pack_settle(&repository->pack);
+				if (ret)
+					goto err1;
+			}
+			gitt_delta_commit(repository->delta, commits[index].id.sha1);
+		}
+	}
+
+	ret = gitt_repository_pack_trees(repository, commits, number, known, NULL);
 	if (ret)
 		goto err1;
 
 	gitt_pack_end(&repository->pack);
 
-	ret = gitt_command_get_state(repository->ssh);
+	/* The whole pack has been queued, send the rest */
+	return gitt_command_flush(&repository->command);
+
+err1:
+	gitt_pack_end(&repository->pack);
+	return ret;
+}
+
+/* Writing the pack cannot be made again from a mark, it waits for the remote */
+static int gitt_repository_send_pack(struct gitt_repository *repository)
+{
+	bool nonblock = repository->command.nonblock;
+	int ret;
+
+	if (nonblock) {
+		ret = gitt_command_nonblock(&repository->command, false);
+		if (ret)
+			return ret;
+	}
+
+	ret = gitt_repository_send_commits(repository);
 	if (ret)
-		goto err0;
+		return ret;
+
+	if (nonblock) {
+		ret = gitt_command_nonblock(&repository->command, true);
+		if (ret)
+			return ret;
+	}
+
+	repository->step = GITT_REPOSITORY_STEP_SEND_STATE;
+	return 0;
+}
 
-	gitt_command_end(repository->ssh);
+/* What the remote said, then our record of what it has */
+static int gitt_repository_send_state(struct gitt_repository *repository)
+{
+	struct gitt_commit *commits = repository->commits;
+	uint32_t number = repository->commit_num;
+	char *remote_head = repository->remote_head;
+	char *refs = repository->remote_refs;
+	struct gitt_tree *tree;
+	uint32_t index;
+	bool known;
+	int entry;
+	int ret;
 
-	/* Update head */
-	memcpy(repository->head, commit->id.sha1, sizeof(commit->id.sha1));
+	ret = gitt_command_get_state(&repository->command);
+	if (ret)
+		return ret;
+	known = !strcmp(repository->known_head, remote_head);
+
+	/*
+	 * Update head, or keep it behind the remote commits we were based on
+	 * without pulling them, until the next pull
+	 */
 	if (strlen(refs))
 		strcpy(repository->refs, refs);
-	gitt_log_debug("Head updated: %s\n", repository->head);
+	if (!strlen(repository->shard) &&
+	    strcmp(repository->head, remote_head) && commits[0].parent.sha1 &&
+	    !strcmp(commits[0].parent.sha1, remote_head) &&
+	    repository->pushed_num + number <= GITT_REPOSITORY_PUSHED_NUMBER) {
+		for (index = 0; index < number; index++)
+			strcpy(repository->pushed[repository->pushed_num++], commits[index].id.sha1);
+		gitt_log_debug("Head kept behind: %s\n", repository->head);
+	} else {
+		memcpy(repository->head, commits[number - 1].id.sha1, sizeof(commits->id.sha1));
+		repository->pushed_num = 0;
+		gitt_log_debug("Head updated: %s\n", repository->head);
+		gitt_repository_have(repository);
+	}
+
+	/* Our own events are not pulled again */
+	if (strlen(repository->shard)) {
+		ret = gitt_refs_add(repository->ref_table, repository->head, repository->shard);
+		if (ret >= 0)
+			gitt_refs_settle(repository->ref_table, ret);
+	}
+
+	/*
+	 * The old objects stay reachable only if the new commits are based on
+	 * them. Otherwise they are unreferenced on the remote, and skipping them
+	 * in a later push would leave its commits broken once they are pruned.
+	 */
+	if (!known || !commits[0].parent.sha1 || strcmp(commits[0].parent.sha1, remote_head))
+		repository->known_num = 0;
+	for (index = 0; index < number; index++) {
+		tree = commits[index].tree.tree;
+		if (!tree || !tree->number)
+			continue;
+		for (entry = -1; entry < tree->number; entry++)
+			gitt_repository_know(repository, gitt_repository_tree_sha1(tree, entry));
+	}
+	strcpy(repository->known_head, commits[number - 1].id.sha1);
 
+	repository->step = GITT_REPOSITORY_STEP_DONE;
 	return 0;
+}
+
+/* Run the next step of the push */
+static int gitt_repository_send_step(struct gitt_repository *repository)
+{
+	int ret;
+
+	switch (repository->step) {
+	case GITT_REPOSITORY_STEP_SEND_HEAD:
+		ret = gitt_repository_send_head(repository);
+		break;
+	case GITT_REPOSITORY_STEP_SEND_PACK:
+		ret = gitt_repository_send_pack(repository);
+		break;
+	case GITT_REPOSITORY_STEP_SEND_STATE:
+		ret = gitt_repository_send_state(repository);
+		break;
+	default:
+		return 0;
+	}
+
+	if (!ret)
+		gitt_command_mark(&repository->command);
 
-err1:
-	gitt_pack_end(&repository->pack);
-err0:
-	gitt_command_end(repository->ssh);
 	return ret;
 }
 
+static void gitt_repository_send_end(struct gitt_repository *repository)
+{
+	repository->step = GITT_REPOSITORY_STEP_DONE;
+	gitt_command_end(&repository->command);
+}
+
 /**
- * @brief Pull repository (Get new commits)
+ * @brief Push a chain of commits in one pack
  *
  * @param repository
+ * @param commits The first commit is based on the remote head, and the parent
+ *                of each of the others is set to the commit before it
+ * @param number Number of commits
  * @return int 0: Good
- * @return int -1: Error
+ * @return int -GITT_ERRNO_RETRY: The local record is not up to date
+ * @return int other: Error
  */
-int gitt_repository_pull(struct gitt_repository *repository)
+int gitt_repository_push_commits(struct gitt_repository *repository,
+				 struct gitt_commit *commits, uint32_t number)
 {
 	int ret;
-	char remote_head[41];
-	char refs[32];
+
+	ret = gitt_repository_send_begin(repository, commits, number);
+	if (ret)
+		return ret;
+
+	while (repository->step != GITT_REPOSITORY_STEP_DONE) {
+		ret = gitt_repository_send_step(repository);
+		if (ret) {
+			gitt_repository_send_end(repository);
+			if (repository->command.fault)
+				return repository->command.fault;
+			return ret;
+		}
+	}
+
+	gitt_repository_send_end(repository);
+	return 0;
+}
+
+int gitt_repository_push_commit(struct gitt_repository *repository, struct gitt_commit *commit)
+{
+	return gitt_repository_push_commits(repository, commit, 1);
+}
+
+static int gitt_repository_fetch_begin(struct gitt_repository *repository, uint32_t depth,
+				       uint32_t since)
+{
+	struct gitt_command_options *options = &repository->options;
+	int ret;
+
+	options->filter = repository->filter;
+	options->depth = depth;
+	options->since = since;
+	options->shards = strlen(repository->shards) ? repository->shards : NULL;
+	options->every = !strlen(repository->head);
+	options->shallow = &repository->shallow;
+	options->delta = repository->delta != NULL;
+
+	repository->step = GITT_REPOSITORY_STEP_DONE;
+	repository->pulled = 0;
+	strcpy(repository->remote_refs, repository->refs);
 
 	gitt_log_debug("Start connecting\n");
-	repository->ssh = gitt_command_start_upload(repository->url, repository->privkey);
-	if (!repository->ssh)
-		return -GITT_ERRNO_INVAL;
+	ret = gitt_command_start_upload(&repository->command, repository->url,
+				      repository->privkey);
+	if (ret)
+		return gitt_repository_error(repository);
+
+	repository->step = GITT_REPOSITORY_STEP_HEAD;
+	return 0;
+}
+
+/* Get the remote head, and whether there is anything to pull */
+static int gitt_repository_fetch_head(struct gitt_repository *repository)
+{
+	struct gitt_command_options *options = &repository->options;
+	bool update;
+	int ret;
 
 	gitt_log_debug("Get remote head\n");
-	ret = gitt_command_get_head(repository->ssh, remote_head, refs);
+	ret = gitt_command_get_head(&repository->command, repository->remote_head,
+				    repository->remote_refs, &repository->version);
 	if (ret)
-		goto err0;
+		return ret;
+
+	/* Sharded: want the refs of the devices that changed, or all of them to clone */
+	if (options->shards)
+		update = gitt_repository_shards(repository, options->every, false);
+	else
+		update = !strlen(repository->head) ||
+			 memcmp(repository->head, repository->remote_head, 41);
+
+	if (!update) {
+		gitt_log_debug("Already up to date\n");
+		repository->step = GITT_REPOSITORY_STEP_BYE;
+	} else {
+		repository->step = GITT_REPOSITORY_STEP_WANT;
+	}
+
+	return 0;
+}
+
+/* Ask for what we do not have, then get ready for the pack */
+static int gitt_repository_fetch_want(struct gitt_repository *repository)
+{
+	char *want;
+	int ret;
+
+	want = repository->options.shards ? NULL : repository->remote_head;
 
 	/* Clone || Pull */
 	if (!strlen(repository->head)) {
 		gitt_log_debug("Start clone\n");
 
-		ret = gitt_command_want(repository->ssh, remote_head, NULL);
+		ret = gitt_command_want(&repository->command, want, NULL, 0,
+					repository->version, &repository->options);
 		if (ret)
-			goto err0;
-
-		/* Update head */
-		memcpy(repository->head, remote_head, sizeof(remote_head));
-		if (strlen(refs))
-			strcpy(repository->refs, refs);
-		gitt_log_debug("Head updated: %s\n", repository->head);
-	} else if (memcmp(repository->head, remote_head, sizeof(remote_head))) {
-		gitt_log_debug("Start pull\n");
-
-		ret = gitt_command_want(repository->ssh, remote_head, repository->head);
-		if (ret)
-			goto err0;
-
-		/* Update head */
-		memcpy(repository->head, remote_head, sizeof(remote_head));
-		if (strlen(refs))
-			strcpy(repository->refs, refs);
-		gitt_log_debug("Head updated: %s\n", repository->head);
+			return ret;
 	} else {
-		gitt_log_debug("Already up to date\n");
+		gitt_log_debug("Start pull\n");
 
-		ret = gitt_command_say_byebye(repository->ssh);
+		gitt_repository_have(repository);
+		ret = gitt_command_want(&repository->command, want, repository->haves,
+					repository->have_num, repository->version,
+					&repository->options);
 		if (ret)
-			goto err0;
-
-		gitt_command_end(repository->ssh);
-		return 0;
+			return ret;
 	}
 
 	/* Initialize Unpack and prepare to unpack */
@@ -264,62 +843,395 @@ int gitt_repository_pull(struct gitt_repository *repository)
 	repository->unpack.verify_dump = gitt_unpack_verify_dump_callback;
 	ret = gitt_unpack_init(&repository->unpack);
 	if (ret)
-		goto err0;
+		return ret;
+
+	repository->step = GITT_REPOSITORY_STEP_PACK;
+	return 0;
+}
+
+static int gitt_repository_fetch_pack(struct gitt_repository *repository)
+{
+	int ret;
 
 	gitt_log_debug("Get pack\n");
-	ret = gitt_command_get_pack(repository->ssh, gitt_command_pack_dump_callback,
+	ret = gitt_command_get_pack(&repository->command, gitt_command_pack_dump_callback,
 				    &repository->unpack);
 	if (ret)
-		goto err1;
+		return ret;
+
+	/* Update head, only once all of the pack is in */
+	memcpy(repository->head, repository->remote_head, sizeof(repository->head));
+	if (strlen(repository->remote_refs))
+		strcpy(repository->refs, repository->remote_refs);
+	gitt_log_debug("Head updated: %s\n", repository->head);
+	gitt_repository_have(repository);
+
+	if (repository->options.shards)
+		gitt_repository_shards(repository, true, true);
+	repository->pushed_num = 0;
 
 	gitt_unpack_end(&repository->unpack);
-	gitt_command_end(repository->ssh);
+	repository->step = GITT_REPOSITORY_STEP_DONE;
+	return 0;
+}
 
+/* Run the next step of the fetch */
+static int gitt_repository_fetch_step(struct gitt_repository *repository)
+{
+	int ret;
+
+	switch (repository->step) {
+	case GITT_REPOSITORY_STEP_HEAD:
+		ret = gitt_repository_fetch_head(repository);
+		break;
+	case GITT_REPOSITORY_STEP_BYE:
+		ret = gitt_command_say_byebye(&repository->command);
+		if (!ret)
+			repository->step = GITT_REPOSITORY_STEP_DONE;
+		break;
+	case GITT_REPOSITORY_STEP_WANT:
+		ret = gitt_repository_fetch_want(repository);
+		break;
+	case GITT_REPOSITORY_STEP_PACK:
+		ret = gitt_repository_fetch_pack(repository);
+		break;
+	default:
+		return 0;
+	}
+
+	if (!ret)
+		gitt_command_mark(&repository->command);
+
+	return ret;
+}
+
+static void gitt_repository_fetch_end(struct gitt_repository *repository)
+{
+	if (repository->step == GITT_REPOSITORY_STEP_PACK)
+		gitt_unpack_end(&repository->unpack);
+	repository->step = GITT_REPOSITORY_STEP_DONE;
+
+	gitt_command_end(&repository->command);
+}
+
+static int gitt_repository_fetch(struct gitt_repository *repository, uint32_t depth,
+				 uint32_t since)
+{
+	int ret;
+
+	ret = gitt_repository_fetch_begin(repository, depth, since);
+	if (ret)
+		return ret;
+
+	while (repository->step != GITT_REPOSITORY_STEP_DONE) {
+		ret = gitt_repository_fetch_step(repository);
+		if (ret) {
+			gitt_repository_fetch_end(repository);
+			return gitt_repository_error(repository);
+		}
+	}
+
+	gitt_repository_fetch_end(repository);
 	return 0;
+}
 
-err1:
-	gitt_unpack_end(&repository->unpack);
-err0:
-	gitt_command_end(repository->ssh);
-	return -GITT_ERRNO_INVAL;
+/**
+ * @brief Pull repository (Get new commits)
+ *
+ * @param repository
+ * @return int 0: Good
+ * @return int -1: Error
+ */
+int gitt_repository_pull(struct gitt_repository *repository)
+{
+	return gitt_repository_fetch(repository, 0, 0);
 }
 
-int gitt_repository_update_head(struct gitt_repository *repository)
+/**
+ * @brief Start a pull that does not wait for the remote, go on with it by
+ *        gitt_repository_pull_step(). Connecting still waits, keep the
+ *        session (session_idle or pool) to make it quick.
+ *
+ * @param repository
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_repository_pull_begin(struct gitt_repository *repository)
 {
-	struct gitt_ssh* ssh;
 	int ret;
 
-	ssh = gitt_command_start_upload(repository->url, repository->privkey);
-	if (!ssh)
+	ret = gitt_repository_fetch_begin(repository, 0, 0);
+	if (ret)
+		return ret;
+
+	ret = gitt_command_nonblock(&repository->command, true);
+	if (ret) {
+		gitt_log_error("The transport cannot do without waiting\n");
+		gitt_repository_fetch_end(repository);
 		return -GITT_ERRNO_INVAL;
+	}
 
-	ret = gitt_command_get_head(ssh, repository->head, repository->refs);
+	return 0;
+}
+
+/* Run the steps as far as the remote lets us, each is made again from its mark */
+static int gitt_repository_steps(struct gitt_repository *repository, int *fd,
+				 int (*step)(struct gitt_repository *repository))
+{
+	int want;
+	int ret;
+
+	while (repository->step != GITT_REPOSITORY_STEP_DONE) {
+		ret = step(repository);
+		if (!ret)
+			continue;
+
+		want = gitt_command_rewind(&repository->command);
+		if (!want)
+			return ret;
+
+		*fd = gitt_command_fd(&repository->command);
+		if (*fd < 0)
+			return -GITT_ERRNO_INVAL;
+		return want;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Go on with the pull as far as the remote lets us. What a step reads
+ *        is kept in the ring until the step is done, so the ring must hold
+ *        the longest line of the advertisement and the acknowledgments (pack
+ *        data need not fit).
+ *
+ * @param repository
+ * @param fd Out: what to wait on when the pull is not done yet
+ * @return int 0: Done, call gitt_repository_pull_end()
+ * @return int GITT_REPOSITORY_WANT_READ: Call again when fd is readable
+ * @return int GITT_REPOSITORY_WANT_WRITE: Call again when fd is writable
+ * @return int other: Error, call gitt_repository_pull_end()
+ */
+int gitt_repository_pull_step(struct gitt_repository *repository, int *fd)
+{
+	int ret;
+
+	ret = gitt_repository_steps(repository, fd, gitt_repository_fetch_step);
+	if (ret < 0)
+		return gitt_repository_error(repository);
+
+	return ret;
+}
+
+/**
+ * @brief End the pull, done or not
+ *
+ * @param repository
+ */
+void gitt_repository_pull_end(struct gitt_repository *repository)
+{
+	gitt_repository_fetch_end(repository);
+}
+
+/**
+ * @brief Start a push that does not wait for the remote, go on with it by
+ *        gitt_repository_push_step(). Connecting still waits like in
+ *        gitt_repository_pull_begin(), and so does writing the pack.
+ *
+ * @param repository
+ * @param commits See gitt_repository_push_commits(), kept until the push ends
+ * @param number Number of commits
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_repository_push_begin(struct gitt_repository *repository,
+			       struct gitt_commit *commits, uint32_t number)
+{
+	int ret;
+
+	ret = gitt_repository_send_begin(repository, commits, number);
+	if (ret)
+		return ret;
+
+	ret = gitt_command_nonblock(&repository->command, true);
+	if (ret) {
+		gitt_log_error("The transport cannot do without waiting\n");
+		gitt_repository_send_end(repository);
+		return -GITT_ERRNO_INVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Go on with the push as far as the remote lets us. The ring must
+ *        hold the longest line of the advertisement and the report.
+ *
+ * @param repository
+ * @param fd Out: what to wait on when the push is not done yet
+ * @return int 0: Done, call gitt_repository_push_end()
+ * @return int GITT_REPOSITORY_WANT_READ: Call again when fd is readable
+ * @return int GITT_REPOSITORY_WANT_WRITE: Call again when fd is writable
+ * @return int -GITT_ERRNO_RETRY: The local record is not up to date
+ * @return int other: Error, call gitt_repository_push_end()
+ */
+int gitt_repository_push_step(struct gitt_repository *repository, int *fd)
+{
+	int ret;
+
+	ret = gitt_repository_steps(repository, fd, gitt_repository_send_step);
+	if (ret < 0 && repository->command.fault)
+		return repository->command.fault;
+
+	return ret;
+}
+
+/**
+ * @brief End the push, done or not
+ *
+ * @param repository
+ */
+void gitt_repository_push_end(struct gitt_repository *repository)
+{
+	gitt_repository_send_end(repository);
+}
+
+/**
+ * @brief Clone only part of the history
+ *
+ * @param repository
+ * @param depth Number of commits from the remote head, 0 for no limit
+ * @param since Only commits newer than this unix time, 0 for no limit
+ * @return int 0: Good
+ * @return int -1: Error
+ */
+int gitt_repository_clone_shallow(struct gitt_repository *repository, uint32_t depth,
+				  uint32_t since)
+{
+	repository->head[0] = '\0';
+	repository->have_num = 0;
+	repository->pushed_num = 0;
+	repository->shallow.number = 0;
+	return gitt_repository_fetch(repository, depth, since);
+}
+
+/* Ask the remote for its head, and every ref into ref_table if it is set */
+static int gitt_repository_ask_head(struct gitt_repository *repository)
+{
+	struct gitt_command *command = &repository->command;
+	int ret;
+
+	ret = gitt_command_start_upload(command, repository->url, repository->privkey);
+	if (ret)
+		return gitt_repository_error(repository);
+
+	strcpy(repository->remote_refs, repository->refs);
+	ret = gitt_command_get_head(command, repository->remote_head, repository->remote_refs,
+				    NULL);
 	if (ret)
 		goto err;
 
-	ret = gitt_command_say_byebye(ssh);
+	ret = gitt_command_say_byebye(command);
 	if (ret)
 		goto err;
 
-	gitt_command_end(ssh);
+	gitt_command_end(command);
+	return 0;
+
+err:
+	gitt_command_end(command);
+	return gitt_repository_error(repository);
+}
+
+/**
+ * @brief Get the remote head, and every ref into ref_table if it is set
+ *
+ * @param repository
+ * @return int 0: Good
+ * @return int -1: Error
+ */
+int gitt_repository_update_head(struct gitt_repository *repository)
+{
+	int ret;
+
+	ret = gitt_repository_ask_head(repository);
+	if (ret)
+		return ret;
+
+	strcpy(repository->head, repository->remote_head);
+	strcpy(repository->refs, repository->remote_refs);
 	gitt_log_debug("Head updated: %s\n", repository->head);
+	repository->pushed_num = 0;
+	gitt_repository_have(repository);
+
+	/* The shards seen now are not pulled later */
+	if (strlen(repository->shards))
+		gitt_repository_shards(repository, true, true);
 
 	if (!strlen(repository->refs))
 		return -GITT_ERRNO_INVAL;
 
 	return 0;
+}
 
-err:
-	gitt_command_end(ssh);
-	return -GITT_ERRNO_INVAL;
+/**
+ * @brief Get the remote head only, what the next pull would start from.
+ *        Nothing is pulled and the head stays.
+ *
+ * @param repository
+ * @param head Out: the remote head
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_repository_remote_head(struct gitt_repository *repository, char head[41])
+{
+	int ret;
+
+	ret = gitt_repository_ask_head(repository);
+	if (ret)
+		return ret;
+
+	strcpy(head, repository->remote_head);
+	return 0;
+}
+
+/**
+ * @brief Time passed without operations, see gitt_command_idle()
+ *
+ * @param repository
+ * @param seconds Seconds since the last call or operation
+ */
+void gitt_repository_idle(struct gitt_repository *repository, uint32_t seconds)
+{
+	gitt_command_idle(&repository->command, seconds);
 }
 
 int gitt_repository_end(struct gitt_repository *repository)
 {
+	/* The kept session */
+	if (repository->command.ssh)
+		gitt_command_close(&repository->command);
+
 	repository->privkey = NULL;
 	repository->url = NULL;
 	repository->buf = NULL;
 	repository->buf_len = 0;
+	repository->worker = NULL;
+	repository->delta = NULL;
+	repository->ring = NULL;
+	repository->ring_len = 0;
+	repository->out = NULL;
+	repository->out_len = 0;
+	repository->filter = NULL;
+	repository->ref_table = NULL;
+	repository->shard[0] = '\0';
+	repository->shards[0] = '\0';
+	repository->session_idle = 0;
+	repository->pool = NULL;
+	repository->transport = NULL;
+	repository->timeout_idle = 0;
+	repository->timeout_total = 0;
+	repository->cancel = NULL;
 
 	return 0;
 }
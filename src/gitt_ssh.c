@@ -26,16 +26,24 @@
 #include <string.h>
 #include <gitt_log.h>
 #include <gitt_ssh.h>
+#include <gitt_transport.h>
 #include <gitt_errno.h>
 
 /* Please implement the following interfaces according to your system type */
 struct gitt_ssh* gitt_ssh_alloc_impl(void);
 void gitt_ssh_free_impl(struct gitt_ssh *ssh);
-int gitt_ssh_connect_impl(struct gitt_ssh *ssh, struct gitt_ssh_url *ssh_url,
-			  const char *exec, const char *privkey);
+int gitt_ssh_open_impl(struct gitt_ssh *ssh, struct gitt_ssh_url *ssh_url, const char *privkey);
+int gitt_ssh_channel_open_impl(struct gitt_ssh *ssh, const char *exec, const char *protocol);
+void gitt_ssh_channel_close_impl(struct gitt_ssh *ssh);
+int gitt_ssh_keepalive_impl(struct gitt_ssh *ssh);
+void gitt_ssh_close_impl(struct gitt_ssh *ssh);
+void gitt_ssh_attach_impl(struct gitt_ssh *ssh, struct gitt_ssh *session);
+void gitt_ssh_detach_impl(struct gitt_ssh *ssh);
 int gitt_ssh_read_impl(struct gitt_ssh *ssh, char *buf, int size);
 int gitt_ssh_write_impl(struct gitt_ssh *ssh, char *buf, int size);
-void gitt_ssh_disconnect_impl(struct gitt_ssh *ssh);
+int gitt_ssh_nonblock_impl(struct gitt_ssh *ssh, bool nonblock);
+int gitt_ssh_fd_impl(struct gitt_ssh *ssh);
+int gitt_ssh_limit_impl(struct gitt_ssh *ssh, struct gitt_ssh_limit *limit);
 
 /**
  * @brief Pad in url information
@@ -95,25 +103,21 @@ void gitt_ssh_free(struct gitt_ssh *ssh)
 }
 
 /**
- * @brief Connect to ssh
+ * @brief Open an authenticated session, it can carry one channel at a time
  *
  * @param ssh Handle
  * @param url The ssh address of the git repository.
  * 	      For example: "git@github.com:huxiangjs/git_things.git"
- * @param exec Commands to be executed.
- * 	       For example: "git-receive-pack"
  * @param privkey private key
  * @return int 0: Good
  * @return int -1: Error
  */
-int gitt_ssh_connect(struct gitt_ssh *ssh, const char *url, const char *exec,
-		     const char *privkey)
+int gitt_ssh_open(struct gitt_ssh *ssh, const char *url, const char *privkey)
 {
 	struct gitt_ssh_url ssh_url;
 	int err;
-	char buffer[96];
 
-	if (!ssh || !url || !exec || !privkey)
+	if (!ssh || !url || !privkey)
 		return -GITT_ERRNO_INVAL;
 
 	err = gitt_ssh_url_pad(&ssh_url, url);
@@ -122,11 +126,101 @@ int gitt_ssh_connect(struct gitt_ssh *ssh, const char *url, const char *exec,
 	gitt_log_debug("User: %s\n", ssh_url.user);
 	gitt_log_debug("Host: %s\n", ssh_url.host);
 	gitt_log_debug("Port: %s\n", ssh_url.port);
+
+	return gitt_ssh_open_impl(ssh, &ssh_url, privkey);
+}
+
+/**
+ * @brief Open a channel on the session and execute a command on it
+ *
+ * @param ssh Handle
+ * @param url The ssh address of the git repository
+ * @param exec Commands to be executed.
+ * 	       For example: "git-receive-pack"
+ * @param protocol Value of GIT_PROTOCOL to be sent with the command, or NULL.
+ * 		   For example: "version=2"
+ * @return int 0: Good
+ * @return int -1: Error, the session may be gone
+ */
+int gitt_ssh_channel_open(struct gitt_ssh *ssh, const char *url, const char *exec,
+			  const char *protocol)
+{
+	struct gitt_ssh_url ssh_url;
+	int err;
+	char buffer[96];
+
+	if (!ssh || !url || !exec)
+		return -GITT_ERRNO_INVAL;
+
+	err = gitt_ssh_url_pad(&ssh_url, url);
+	if (err)
+		return err;
 	gitt_log_debug("Repository: %s\n", ssh_url.repository);
 
 	snprintf(buffer, sizeof(buffer), "%s '%s'", exec, ssh_url.repository);
 
-	return gitt_ssh_connect_impl(ssh, &ssh_url, buffer, privkey);
+	return gitt_ssh_channel_open_impl(ssh, buffer, protocol);
+}
+
+void gitt_ssh_channel_close(struct gitt_ssh *ssh)
+{
+	if (!ssh)
+		return;
+
+	gitt_ssh_channel_close_impl(ssh);
+}
+
+/**
+ * @brief Keep an idle session from being dropped by the server or on the way
+ *
+ * @param ssh Handle
+ * @return int 0: Good
+ * @return int other: The session is gone
+ */
+int gitt_ssh_keepalive(struct gitt_ssh *ssh)
+{
+	if (!ssh)
+		return -GITT_ERRNO_INVAL;
+
+	return gitt_ssh_keepalive_impl(ssh);
+}
+
+void gitt_ssh_close(struct gitt_ssh *ssh)
+{
+	if (!ssh)
+		return;
+
+	gitt_ssh_close_impl(ssh);
+}
+
+/**
+ * @brief Connect to ssh, same as a session with one channel
+ *
+ * @param ssh Handle
+ * @param url The ssh address of the git repository.
+ * 	      For example: "git@github.com:huxiangjs/git_things.git"
+ * @param exec Commands to be executed.
+ * 	       For example: "git-receive-pack"
+ * @param privkey private key
+ * @param protocol Value of GIT_PROTOCOL to be sent with the command, or NULL.
+ * 		   For example: "version=2"
+ * @return int 0: Good
+ * @return int -1: Error
+ */
+int gitt_ssh_connect(struct gitt_ssh *ssh, const char *url, const char *exec,
+		     const char *privkey, const char *protocol)
+{
+	int err;
+
+	err = gitt_ssh_open(ssh, url, privkey);
+	if (err)
+		return err;
+
+	err = gitt_ssh_channel_open(ssh, url, exec, protocol);
+	if (err)
+		gitt_ssh_close(ssh);
+
+	return err;
 }
 
 int gitt_ssh_read(struct gitt_ssh *ssh, char *buf, int size)
@@ -145,10 +239,479 @@ int gitt_ssh_write(struct gitt_ssh *ssh, char *buf, int size)
 	return gitt_ssh_write_impl(ssh, buf, size);
 }
 
+/**
+ * @brief Switch the channel to non-blocking mode, or back. In non-blocking
+ *        mode, read and write return -GITT_ERRNO_AGAIN instead of waiting,
+ *        and write may take only a part of the data.
+ *
+ * @param ssh Handle
+ * @param nonblock
+ * @return int 0: Good
+ * @return int other: Not supported
+ */
+int gitt_ssh_nonblock(struct gitt_ssh *ssh, bool nonblock)
+{
+	if (!ssh)
+		return -GITT_ERRNO_INVAL;
+
+	return gitt_ssh_nonblock_impl(ssh, nonblock);
+}
+
+/**
+ * @brief File descriptor to wait on in non-blocking mode
+ *
+ * @param ssh Handle
+ * @return int >=0: fd
+ * @return int other: Error
+ */
+int gitt_ssh_fd(struct gitt_ssh *ssh)
+{
+	if (!ssh)
+		return -GITT_ERRNO_INVAL;
+
+	return gitt_ssh_fd_impl(ssh);
+}
+
+/**
+ * @brief Bound the calls on the channel from now on, before connecting to
+ *        bound that too. The total time starts again with each call.
+ *
+ * @param ssh Handle
+ * @param limit Copied, NULL for no limits
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_ssh_limit(struct gitt_ssh *ssh, struct gitt_ssh_limit *limit)
+{
+	struct gitt_ssh_limit none = {0};
+
+	if (!ssh)
+		return -GITT_ERRNO_INVAL;
+
+	return gitt_ssh_limit_impl(ssh, limit ? limit : &none);
+}
+
 void gitt_ssh_disconnect(struct gitt_ssh *ssh)
 {
 	if (!ssh)
 		return;
 
-	gitt_ssh_disconnect_impl(ssh);
+	gitt_ssh_channel_close_impl(ssh);
+	gitt_ssh_close_impl(ssh);
+}
+
+static void gitt_ssh_pool_lock(struct gitt_ssh_pool *pool)
+{
+	if (pool->lock)
+		pool->lock->lock(pool->lock->param);
+}
+
+static void gitt_ssh_pool_unlock(struct gitt_ssh_pool *pool)
+{
+	if (pool->lock)
+		pool->lock->unlock(pool->lock->param);
+}
+
+static void gitt_ssh_pool_wake(struct gitt_ssh_pool *pool)
+{
+	if (pool->lock)
+		pool->lock->wake(pool->lock->param);
+}
+
+/* Called without the lock, url and privkey do not change while conn is used */
+static int gitt_ssh_conn_connect(struct gitt_ssh_conn *conn, struct gitt_ssh **ssh)
+{
+	int ret;
+
+	*ssh = gitt_ssh_alloc();
+	if (!*ssh)
+		return -GITT_ERRNO_NOMEM;
+
+	ret = gitt_ssh_open_impl(*ssh, &conn->url, conn->privkey);
+	if (ret) {
+		gitt_ssh_free(*ssh);
+		*ssh = NULL;
+		return ret;
+	}
+	gitt_log_debug("Connection open: %s@%s\n", conn->url.user, conn->url.host);
+
+	return 0;
+}
+
+/* Called with the lock held, the connection can be handed out for another host then */
+static void gitt_ssh_conn_release(struct gitt_ssh_conn *conn)
+{
+	if (conn->users || conn->ssh || conn->connecting)
+		return;
+
+	conn->used = false;
+	gitt_log_debug("Connection released: %s@%s\n", conn->url.user, conn->url.host);
+}
+
+/* Called with the lock held */
+static void gitt_ssh_conn_disconnect(struct gitt_ssh_conn *conn)
+{
+	if (!conn->ssh)
+		return;
+
+	gitt_ssh_close_impl(conn->ssh);
+	gitt_ssh_free(conn->ssh);
+	conn->ssh = NULL;
+	gitt_log_debug("Connection closed: %s@%s\n", conn->url.user, conn->url.host);
+}
+
+/*
+ * Called with the lock held, which is dropped while connecting, so that the
+ * other connections of the pool go on. The channels of conn that come
+ * meanwhile wait for the session, and it is published with the lock again.
+ */
+static int gitt_ssh_conn_ready(struct gitt_ssh_conn *conn, bool reconnect)
+{
+	struct gitt_ssh_pool *pool = conn->pool;
+	struct gitt_ssh *ssh;
+	int ret;
+
+	while (conn->connecting && pool->lock)
+		pool->lock->wait(pool->lock->param);
+
+	if (reconnect)
+		gitt_ssh_conn_disconnect(conn);
+	if (conn->ssh)
+		return 0;
+
+	conn->connecting = true;
+	gitt_ssh_pool_unlock(pool);
+	ret = gitt_ssh_conn_connect(conn, &ssh);
+	gitt_ssh_pool_lock(pool);
+	conn->connecting = false;
+	if (!ret)
+		conn->ssh = ssh;
+	gitt_ssh_pool_wake(pool);
+
+	return ret;
+}
+
+/**
+ * @brief Initialize a pool of shared connections
+ *
+ * @param pool conns and number must be set
+ * @return int 0: Good
+ * @return int -1: Error
+ */
+int gitt_ssh_pool_init(struct gitt_ssh_pool *pool)
+{
+	uint8_t i;
+
+	if (!pool || !pool->conns || !pool->number) {
+		gitt_log_error("Pool needs connections\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	if (pool->lock && (!pool->lock->lock || !pool->lock->unlock ||
+			   !pool->lock->wait || !pool->lock->wake)) {
+		gitt_log_error("Pool lock is incomplete\n");
+		return -GITT_ERRNO_INVAL;
+	}
+
+	if (!pool->channel_max)
+		pool->channel_max = GITT_SSH_CONN_CHANNELS;
+
+	for (i = 0; i < pool->number; i++) {
+		memset(&pool->conns[i], 0, sizeof(pool->conns[i]));
+		pool->conns[i].pool = pool;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Get the connection for the user, host and port of url and the key.
+ *        It is used until gitt_ssh_conn_open() fails or gitt_ssh_conn_close().
+ *
+ * @param pool
+ * @param url The ssh address of the git repository
+ * @param privkey private key
+ * @return struct gitt_ssh_conn* The connection, or NULL if none is left
+ */
+struct gitt_ssh_conn *gitt_ssh_pool_get(struct gitt_ssh_pool *pool, const char *url,
+					const char *privkey)
+{
+	struct gitt_ssh_url ssh_url;
+	struct gitt_ssh_conn *conn;
+	struct gitt_ssh_conn *free_conn = NULL;
+	uint8_t i;
+
+	if (!pool || !url || !privkey || gitt_ssh_url_pad(&ssh_url, url))
+		return NULL;
+
+	gitt_ssh_pool_lock(pool);
+	for (i = 0; i < pool->number; i++) {
+		conn = &pool->conns[i];
+		if (!conn->used) {
+			if (!free_conn)
+				free_conn = conn;
+			continue;
+		}
+		if (!strcmp(conn->url.user, ssh_url.user) &&
+		    !strcmp(conn->url.host, ssh_url.host) &&
+		    !strcmp(conn->url.port, ssh_url.port) &&
+		    !strcmp(conn->privkey, privkey)) {
+			conn->users++;
+			gitt_ssh_pool_unlock(pool);
+			return conn;
+		}
+	}
+
+	conn = free_conn;
+	if (conn) {
+		conn->url = ssh_url;
+		conn->privkey = privkey;
+		conn->used = true;
+		conn->users = 1;
+	}
+	gitt_ssh_pool_unlock(pool);
+
+	if (!conn)
+		gitt_log_error("No connection left for %s@%s\n", ssh_url.user, ssh_url.host);
+
+	return conn;
+}
+
+/**
+ * @brief Time passed, connections without channels are sent keepalives,
+ *        and closed once idle for idle_max seconds
+ *
+ * @param pool
+ * @param seconds Seconds since the last call
+ */
+void gitt_ssh_pool_idle(struct gitt_ssh_pool *pool, uint32_t seconds)
+{
+	struct gitt_ssh_conn *conn;
+	uint8_t i;
+
+	gitt_ssh_pool_lock(pool);
+	for (i = 0; i < pool->number; i++) {
+		conn = &pool->conns[i];
+		if (!conn->ssh || conn->channel_num)
+			continue;
+
+		conn->idle += seconds;
+		conn->quiet += seconds;
+		if (conn->idle >= pool->idle_max) {
+			gitt_ssh_conn_disconnect(conn);
+		} else if (conn->quiet >= GITT_SSH_KEEPALIVE) {
+			conn->quiet = 0;
+			if (gitt_ssh_keepalive_impl(conn->ssh))
+				gitt_ssh_conn_disconnect(conn);
+		}
+		gitt_ssh_conn_release(conn);
+	}
+	gitt_ssh_pool_unlock(pool);
+}
+
+/**
+ * @brief Close every connection, no channel may be open
+ *
+ * @param pool
+ */
+void gitt_ssh_pool_end(struct gitt_ssh_pool *pool)
+{
+	uint8_t i;
+
+	gitt_ssh_pool_lock(pool);
+	for (i = 0; i < pool->number; i++) {
+		gitt_ssh_conn_disconnect(&pool->conns[i]);
+		pool->conns[i].used = false;
+		pool->conns[i].users = 0;
+	}
+	gitt_ssh_pool_unlock(pool);
+}
+
+/**
+ * @brief Open a channel on the shared connection and execute a command on it.
+ *        Wait for a turn if channel_max channels are open.
+ *
+ * @param conn
+ * @param ssh Handle of the channel
+ * @param url The ssh address of the git repository
+ * @param exec Commands to be executed
+ * @param protocol Value of GIT_PROTOCOL to be sent with the command, or NULL
+ * @return int 0: Good
+ * @return int -1: Error
+ */
+int gitt_ssh_conn_open(struct gitt_ssh_conn *conn, struct gitt_ssh *ssh, const char *url,
+		       const char *exec, const char *protocol)
+{
+	struct gitt_ssh_pool *pool;
+	uint32_t ticket;
+	bool alone;
+	int ret = 0;
+
+	if (!conn || !ssh)
+		return -GITT_ERRNO_INVAL;
+	pool = conn->pool;
+
+	/* Turns are taken in order, so no repository waits forever */
+	gitt_ssh_pool_lock(pool);
+	ticket = conn->ticket_next++;
+	while (ticket != conn->ticket_serve || conn->channel_num >= pool->channel_max) {
+		if (!pool->lock) {
+			conn->ticket_next--;
+			conn->users--;
+			gitt_ssh_conn_release(conn);
+			gitt_log_error("No channel left, and no lock to wait with\n");
+			return -GITT_ERRNO_INVAL;
+		}
+		pool->lock->wait(pool->lock->param);
+	}
+	conn->ticket_serve++;
+	conn->channel_num++;
+	conn->idle = 0;
+	conn->quiet = 0;
+	gitt_ssh_pool_wake(pool);
+
+	/* The first channel opens the session, the next ones wait for it */
+	ret = gitt_ssh_conn_ready(conn, false);
+	if (!ret)
+		gitt_ssh_attach_impl(ssh, conn->ssh);
+	gitt_ssh_pool_unlock(pool);
+
+	if (!ret) {
+		ret = gitt_ssh_channel_open(ssh, url, exec, protocol);
+		if (!ret)
+			return 0;
+		gitt_ssh_detach_impl(ssh);
+
+		/* The session may be gone, connect again if no one else is on it */
+		gitt_ssh_pool_lock(pool);
+		alone = conn->channel_num == 1;
+		if (alone) {
+			gitt_log_info("Connection lost, connect again\n");
+			ret = gitt_ssh_conn_ready(conn, true);
+			if (!ret)
+				gitt_ssh_attach_impl(ssh, conn->ssh);
+		}
+		gitt_ssh_pool_unlock(pool);
+
+		if (alone && !ret) {
+			ret = gitt_ssh_channel_open(ssh, url, exec, protocol);
+			if (!ret)
+				return 0;
+			gitt_ssh_detach_impl(ssh);
+		}
+	}
+
+	gitt_ssh_pool_lock(pool);
+	conn->channel_num--;
+	conn->users--;
+	gitt_ssh_conn_release(conn);
+	gitt_ssh_pool_wake(pool);
+	gitt_ssh_pool_unlock(pool);
+
+	return ret;
+}
+
+/**
+ * @brief Close a channel of the shared connection, and give the turn to the
+ *        next one
+ *
+ * @param conn
+ * @param ssh Handle of the channel
+ */
+void gitt_ssh_conn_close(struct gitt_ssh_conn *conn, struct gitt_ssh *ssh)
+{
+	struct gitt_ssh_pool *pool;
+
+	if (!conn || !ssh)
+		return;
+	pool = conn->pool;
+
+	gitt_ssh_channel_close(ssh);
+	gitt_ssh_detach_impl(ssh);
+
+	gitt_ssh_pool_lock(pool);
+	conn->channel_num--;
+	conn->users--;
+	conn->idle = 0;
+	conn->quiet = 0;
+	if (!conn->channel_num && !pool->idle_max)
+		gitt_ssh_conn_disconnect(conn);
+	gitt_ssh_conn_release(conn);
+	gitt_ssh_pool_wake(pool);
+	gitt_ssh_pool_unlock(pool);
+}
+
+static int gitt_ssh_transport_open(void *param, void **handle, const char *url,
+				   const char *exec, const char *protocol,
+				   struct gitt_ssh_limit *limit)
+{
+	struct gitt_ssh *ssh;
+	int ret;
+
+	ssh = gitt_ssh_alloc();
+	if (!ssh)
+		return -GITT_ERRNO_NOMEM;
+
+	gitt_ssh_limit(ssh, limit);
+	ret = gitt_ssh_connect(ssh, url, exec, (const char *)param, protocol);
+	if (ret) {
+		gitt_ssh_free(ssh);
+		return ret;
+	}
+
+	*handle = ssh;
+	return 0;
+}
+
+static int gitt_ssh_transport_read(void *handle, char *buf, int size)
+{
+	return gitt_ssh_read((struct gitt_ssh *)handle, buf, size);
+}
+
+static int gitt_ssh_transport_write(void *handle, char *buf, int size)
+{
+	return gitt_ssh_write((struct gitt_ssh *)handle, buf, size);
+}
+
+static int gitt_ssh_transport_nonblock(void *handle, bool nonblock)
+{
+	return gitt_ssh_nonblock((struct gitt_ssh *)handle, nonblock);
+}
+
+static int gitt_ssh_transport_fd(void *handle, bool write)
+{
+	return gitt_ssh_fd((struct gitt_ssh *)handle);
+}
+
+static void gitt_ssh_transport_close(void *handle)
+{
+	gitt_ssh_disconnect((struct gitt_ssh *)handle);
+	gitt_ssh_free((struct gitt_ssh *)handle);
+}
+
+/**
+ * @brief Fill in a transport that connects over SSH for each command, so
+ *        that it can be wrapped like the others, see gitt_record_init().
+ *        Kept sessions and pools are not used through it.
+ *
+ * @param transport
+ * @param privkey Kept, used by each connection
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_ssh_transport(struct gitt_transport *transport, const char *privkey)
+{
+	if (!transport || !privkey)
+		return -GITT_ERRNO_INVAL;
+
+	memset(transport, 0, sizeof(*transport));
+	transport->open = gitt_ssh_transport_open;
+	transport->read = gitt_ssh_transport_read;
+	transport->write = gitt_ssh_transport_write;
+	transport->nonblock = gitt_ssh_transport_nonblock;
+	transport->fd = gitt_ssh_transport_fd;
+	transport->close = gitt_ssh_transport_close;
+	transport->param = (void *)privkey;
+
+	return 0;
 }
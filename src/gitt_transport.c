@@ -0,0 +1,392 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <gitt_log.h>
+#include <gitt_transport.h>
+#include <gitt_errno.h>
+#include <gitt_version.h>
+
+/* Some servers only speak smart HTTP to agents named git/ */
+#define GITT_TRANSPORT_HTTP_AGENT	"git/gitt-" GITT_VERSION
+
+/**
+ * @brief Pad in the parts of an url
+ *
+ * @param parsed
+ * @param url For example: "git://example.com:9418/repository.git"
+ * @param scheme For example: "git://"
+ * @param port Used if the url has none
+ * @return int 0: Good
+ * @return int other: Error
+ */
+int gitt_transport_url_pad(struct gitt_transport_url *parsed, const char *url,
+			   const char *scheme, const char *port)
+{
+	int i, j;
+
+	if (!parsed || !url || !scheme || !port)
+		return -GITT_ERRNO_INVAL;
+
+	i = strlen(scheme);
+	if (strncmp(url, scheme, i))
+		return -GITT_ERRNO_INVAL;
+
+	/* Host */
+	j = 0;
+	while (url[i] && url[i] != ':' && url[i] != '/' && j < sizeof(parsed->host))
+		parsed->host[j++] = url[i++];
+	if (!j || j == sizeof(parsed->host))
+		return -GITT_ERRNO_INVAL;
+	parsed->host[j] = '\0';
+
+	/* Port */
+	if (url[i] == ':') {
+		i++;
+		j = 0;
+		while (url[i] >= '0' && url[i] <= '9' && j < sizeof(parsed->port))
+			parsed->port[j++] = url[i++];
+		if (!j || j == sizeof(parsed->port))
+			return -GITT_ERRNO_INVAL;
+		parsed->port[j] = '\0';
+	} else {
+		if (strlen(port) >= sizeof(parsed->port))
+			return -GITT_ERRNO_INVAL;
+		strcpy(parsed->port, port);
+	}
+
+	/* Path, with its leading slash */
+	if (url[i] != '/' || strlen(url + i) >= sizeof(parsed->path))
+		return -GITT_ERRNO_INVAL;
+	strcpy(parsed->path, url + i);
+
+	return 0;
+}
+
+/**
+ * @brief Build the first pkt-line sent to git daemon, naming the command
+ *        and the repository
+ *
+ * @param buf
+ * @param size
+ * @param parsed
+ * @param exec For example: "git-upload-pack"
+ * @param protocol Value of GIT_PROTOCOL, or NULL. For example: "version=2"
+ * @return int >0: Bytes in buf
+ * @return int other: Error
+ */
+int gitt_transport_git_request(char *buf, int size, struct gitt_transport_url *parsed,
+			       const char *exec, const char *protocol)
+{
+	const char *tables = "0123456789abcdef";
+	uint8_t count;
+	int len;
+
+	if (!buf || !parsed || !exec || size < 4)
+		return -GITT_ERRNO_INVAL;
+
+	/* "<exec> <path>\0host=<host>:<port>\0[\0<protocol>\0]" */
+	len = snprintf(buf + 4, size - 4, "%s %s%chost=%s:%s%c", exec, parsed->path, '\0',
+		       parsed->host, parsed->port, '\0');
+	if (len < 0 || len >= size - 4)
+		return -GITT_ERRNO_NOMEM;
+	if (protocol) {
+		if (len + 4 + strlen(protocol) + 2 >= size)
+			return -GITT_ERRNO_NOMEM;
+		buf[4 + len++] = '\0';
+		strcpy(buf + 4 + len, protocol);
+		len += strlen(protocol) + 1;
+	}
+	len += 4;
+
+	for (count = 0; count < 4; count++)
+		buf[count] = tables[(len >> (12 - 4 * count)) & 0xf];
+
+	gitt_log_debug("Request: %s %s\n", exec, parsed->path);
+
+	return len;
+}
+
+/**
+ * @brief Build the head of a smart HTTP request. Without
+ *        GITT_TRANSPORT_HTTP_POST it asks for the refs of exec, with it the
+ *        body sent to exec follows in chunks.
+ *
+ * @param buf
+ * @param size
+ * @param parsed
+ * @param exec For example: "git-upload-pack"
+ * @param protocol Value of the Git-Protocol header, or NULL
+ * @param flags GITT_TRANSPORT_HTTP_*
+ * @return int >0: Bytes in buf
+ * @return int other: Error
+ */
+int gitt_transport_http_request(char *buf, int size, struct gitt_transport_url *parsed,
+				const char *exec, const char *protocol, uint8_t flags)
+{
+	char origin[64] = "";
+	int len;
+	int ret;
+
+	if (!buf || !parsed || !exec)
+		return -GITT_ERRNO_INVAL;
+
+	if (flags & GITT_TRANSPORT_HTTP_PROXY)
+		snprintf(origin, sizeof(origin), "http://%s:%s", parsed->host, parsed->port);
+
+	if (flags & GITT_TRANSPORT_HTTP_POST)
+		len = snprintf(buf, size,
+			       "POST %s%s/%s HTTP/1.1\r\n"
+			       "Host: %s:%s\r\n"
+			       "User-Agent: " GITT_TRANSPORT_HTTP_AGENT "\r\n"
+			       "Content-Type: application/x-%s-request\r\n"
+			       "Accept: application/x-%s-result\r\n"
+			       "Accept-Encoding: gzip\r\n"
+			       "Transfer-Encoding: chunked\r\n%s",
+			       origin, parsed->path, exec, parsed->host, parsed->port, exec, exec,
+			       flags & GITT_TRANSPORT_HTTP_GZIP ? "Content-Encoding: gzip\r\n" : "");
+	else
+		len = snprintf(buf, size,
+			       "GET %s%s/info/refs?service=%s HTTP/1.1\r\n"
+			       "Host: %s:%s\r\n"
+			       "User-Agent: " GITT_TRANSPORT_HTTP_AGENT "\r\n"
+			       "Accept: */*\r\n"
+			       "Accept-Encoding: gzip\r\n",
+			       origin, parsed->path, exec, parsed->host, parsed->port);
+	if (len < 0 || len >= size)
+		return -GITT_ERRNO_NOMEM;
+
+	if (protocol)
+		ret = snprintf(buf + len, size - len, "Git-Protocol: %s\r\n\r\n", protocol);
+	else
+		ret = snprintf(buf + len, size - len, "\r\n");
+	if (ret < 0 || ret >= size - len)
+		return -GITT_ERRNO_NOMEM;
+
+	gitt_log_debug("Request: %s %s\n", flags & GITT_TRANSPORT_HTTP_POST ? "POST" : "GET",
+		       exec);
+
+	return len + ret;
+}
+
+/**
+ * @brief Start reading a new response
+ *
+ * @param http
+ */
+void gitt_transport_http_begin(struct gitt_transport_http *http)
+{
+	memset(http, 0, sizeof(struct gitt_transport_http));
+	http->state = GITT_TRANSPORT_HTTP_STATUS;
+}
+
+/* Value of a header field if the line has this name, the line is lower case */
+static const char *gitt_transport_http_field(const char *line, const char *name)
+{
+	int len = strlen(name);
+
+	if (strncmp(line, name, len) || line[len] != ':')
+		return NULL;
+
+	line += len + 1;
+	while (*line == ' ' || *line == '\t')
+		line++;
+
+	return line;
+}
+
+/* The empty line is read, see how the body comes */
+static void gitt_transport_http_head_end(struct gitt_transport_http *http)
+{
+	/* An interim answer, the real one follows */
+	if (http->status >= 100 && http->status < 200) {
+		gitt_transport_http_begin(http);
+		return;
+	}
+
+	if (http->chunked) {
+		http->state = GITT_TRANSPORT_HTTP_CHUNK_SIZE;
+	} else if (http->sized) {
+		http->state = http->length ? GITT_TRANSPORT_HTTP_BODY : GITT_TRANSPORT_HTTP_DONE;
+	} else {
+		http->state = GITT_TRANSPORT_HTTP_BODY;
+		http->close = true;
+	}
+}
+
+static int gitt_transport_http_line(struct gitt_transport_http *http)
+{
+	const char *value;
+	char *end;
+
+	http->line[http->line_len] = '\0';
+
+	/* "http/1.1 200 ok" */
+	if (http->state == GITT_TRANSPORT_HTTP_STATUS) {
+		if (http->line_len < 12 || strncmp(http->line, "http/1.", 7)) {
+			gitt_log_error("Not an HTTP response\n");
+			return -GITT_ERRNO_INVAL;
+		}
+		http->status = strtoul(http->line + 9, NULL, 10);
+		http->close = http->line[7] == '0';
+		http->state = GITT_TRANSPORT_HTTP_FIELD;
+		return 0;
+	}
+
+	if (!http->line_len) {
+		gitt_transport_http_head_end(http);
+		return 0;
+	}
+
+	if ((value = gitt_transport_http_field(http->line, "content-length"))) {
+		http->length = strtoul(value, &end, 10);
+		http->sized = end != value;
+	} else if ((value = gitt_transport_http_field(http->line, "transfer-encoding"))) {
+		http->chunked = strstr(value, "chunked") != NULL;
+	} else if ((value = gitt_transport_http_field(http->line, "content-encoding"))) {
+		http->gzip = strstr(value, "gzip") != NULL;
+	} else if ((value = gitt_transport_http_field(http->line, "connection"))) {
+		if (strstr(value, "close"))
+			http->close = true;
+		else if (strstr(value, "keep-alive"))
+			http->close = false;
+	} else if ((value = gitt_transport_http_field(http->line, "content-type"))) {
+		snprintf(http->type, sizeof(http->type), "%s", value);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Read the status line and the header fields of a response, what
+ *        they say is kept in http. Lines longer than http->line are cut.
+ *
+ * @param http
+ * @param data
+ * @param size
+ * @return int >=0: Bytes used, the head is over once http->state is
+ *         GITT_TRANSPORT_HTTP_BODY or later
+ * @return int other: Error
+ */
+int gitt_transport_http_head(struct gitt_transport_http *http, const char *data, int size)
+{
+	int index = 0;
+	int ret;
+	char ch;
+
+	while (index < size && http->state < GITT_TRANSPORT_HTTP_BODY) {
+		ch = data[index++];
+		if (ch == '\n') {
+			ret = gitt_transport_http_line(http);
+			if (ret)
+				return ret;
+			http->line_len = 0;
+		} else if (ch != '\r' && http->line_len < sizeof(http->line) - 1) {
+			http->line[http->line_len++] = tolower((unsigned char)ch);
+		}
+	}
+
+	return index;
+}
+
+/**
+ * @brief Take the body of a response apart from its chunks
+ *
+ * @param http
+ * @param data Bytes that follow the head
+ * @param size
+ * @param payload Out: the bytes used are part of the body, else framing
+ * @return int >=0: Bytes used, the body is over once http->state is
+ *         GITT_TRANSPORT_HTTP_DONE. A body with no size and no chunks
+ *         only ends when the connection is closed.
+ * @return int other: Error
+ */
+int gitt_transport_http_body(struct gitt_transport_http *http, const uint8_t *data, int size,
+			     bool *payload)
+{
+	uint32_t take;
+	int index = 0;
+	char ch;
+
+	*payload = false;
+
+	if (http->state == GITT_TRANSPORT_HTTP_BODY && !http->sized) {
+		*payload = true;
+		return size;
+	} else if (http->state == GITT_TRANSPORT_HTTP_BODY) {
+		take = http->length < size ? http->length : size;
+		http->length -= take;
+		if (!http->length)
+			http->state = GITT_TRANSPORT_HTTP_DONE;
+		*payload = true;
+		return take;
+	} else if (http->state == GITT_TRANSPORT_HTTP_CHUNK_DATA) {
+		take = http->chunk < size ? http->chunk : size;
+		http->chunk -= take;
+		if (!http->chunk)
+			http->state = GITT_TRANSPORT_HTTP_CHUNK_END;
+		*payload = true;
+		return take;
+	}
+
+	/* "<hex size>[;extension]\r\n<data>\r\n" ... "0\r\n[trailer]\r\n" */
+	while (index < size && http->state >= GITT_TRANSPORT_HTTP_CHUNK_SIZE &&
+	       http->state != GITT_TRANSPORT_HTTP_CHUNK_DATA &&
+	       http->state != GITT_TRANSPORT_HTTP_DONE) {
+		ch = data[index++];
+
+		if (http->state == GITT_TRANSPORT_HTTP_CHUNK_SIZE) {
+			if (ch == '\n') {
+				http->state = http->chunk ? GITT_TRANSPORT_HTTP_CHUNK_DATA :
+							    GITT_TRANSPORT_HTTP_TRAILER;
+				http->line_len = 0;
+			} else if (!http->skip && isxdigit((unsigned char)ch)) {
+				if (http->chunk >> 28)
+					return -GITT_ERRNO_INVAL;
+				http->chunk <<= 4;
+				http->chunk |= isdigit((unsigned char)ch) ? ch - '0' :
+					       tolower((unsigned char)ch) - 'a' + 10;
+			} else if (ch != '\r') {
+				http->skip = true;
+			}
+		} else if (http->state == GITT_TRANSPORT_HTTP_CHUNK_END) {
+			if (ch == '\n') {
+				http->state = GITT_TRANSPORT_HTTP_CHUNK_SIZE;
+				http->skip = false;
+			}
+		} else if (ch == '\n') {
+			/* Trailer fields, up to an empty line */
+			if (!http->line_len)
+				http->state = GITT_TRANSPORT_HTTP_DONE;
+			http->line_len = 0;
+		} else if (ch != '\r') {
+			http->line_len = 1;
+		}
+	}
+
+	return index;
+}
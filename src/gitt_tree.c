@@ -0,0 +1,121 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <gitt_tree.h>
+#include <gitt_log.h>
+#include <gitt_sha1.h>
+#include <gitt_errno.h>
+
+/*
+ * Each entry:
+ * | mode | ' ' | name | '\0' | 20byte SHA-1 |
+ */
+int gitt_tree_build(gitt_obj_data dump, void *p, struct gitt_tree *tree)
+{
+	struct gitt_tree_entry *entry;
+	uint8_t sha1[20];
+	uint16_t index;
+	int ret;
+
+	for (index = 0; index < tree->number; index++) {
+		entry = &tree->entries[index];
+
+		ret = gitt_obj_hex_to_bin(entry->blob->id.sha1, sha1);
+		if (ret)
+			return ret;
+
+		ret = dump(p, (uint8_t *)entry->mode, strlen(entry->mode), false);
+		if (ret)
+			return ret;
+
+		ret = dump(p, (uint8_t *)" ", 1, false);
+		if (ret)
+			return ret;
+
+		/* Name and its terminator */
+		ret = dump(p, (uint8_t *)entry->name, strlen(entry->name) + 1, false);
+		if (ret)
+			return ret;
+
+		ret = dump(p, sha1, sizeof(sha1), index + 1 == tree->number);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+uint16_t gitt_tree_length(struct gitt_tree *tree)
+{
+	uint16_t retval = 0;
+	uint16_t index;
+
+	for (index = 0; index < tree->number; index++) {
+		retval += strlen(tree->entries[index].mode) + 1;
+		retval += strlen(tree->entries[index].name) + 1;
+		retval += 20;
+	}
+
+	return retval;
+}
+
+static int gitt_obj_data_dump(void *p, uint8_t *buf, uint16_t size, bool end)
+{
+	return gitt_sha1_update((struct gitt_sha1 *)p, buf, size);
+}
+
+int gitt_tree_sha1_update(struct gitt_tree *tree)
+{
+	struct gitt_sha1 sha1;
+	int ret;
+	char front_str[16];
+
+	if (!tree->number) {
+		strcpy(tree->id.sha1, GITT_TREE_EMPTY_SHA1);
+		return 0;
+	}
+
+	gitt_sha1_init(&sha1);
+
+	ret = sprintf(front_str, "tree %u", gitt_tree_length(tree));
+	if (ret <= 0)
+		return -GITT_ERRNO_INVAL;
+
+	ret = gitt_sha1_update(&sha1, (uint8_t *)front_str, ret + 1);
+	if (ret)
+		return ret;
+
+	ret = gitt_tree_build(gitt_obj_data_dump, &sha1, tree);
+	if (ret)
+		return ret;
+
+	ret = gitt_sha1_hexdigest(&sha1, tree->id.sha1);
+	if (ret)
+		return ret;
+
+	gitt_log_debug("SHA1: %s\n", tree->id.sha1);
+	return 0;
+}
@@ -22,14 +22,25 @@
  * SOFTWARE.
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <gitt_unpack.h>
+#include <gitt_delta.h>
+#include <gitt_sha1.h>
 #include <gitt_log.h>
 #include <gitt_errno.h>
 
 #define GITT_UNPACK_STATE_INIT		0x00
 #define GITT_UNPACK_STATE_STOP		0xff
 
+/* Object states: size bits, then 20byte base SHA-1 at most, then data */
+#define GITT_UNPACK_OBJ_SIZE		(4 + 7 * 4)
+#define GITT_UNPACK_OBJ_DATA		(GITT_UNPACK_OBJ_SIZE + 20)
+
+/* Base record: | 4byte offset | 2byte length | 1byte type | 20byte SHA-1 | data | */
+#define GITT_UNPACK_BASE_SHA1		7
+#define GITT_UNPACK_BASE_HEAD		27
+
 /**
  * @brief Initialization handle
  *
@@ -46,6 +57,8 @@ int gitt_unpack_init(struct gitt_unpack *unpack)
 
 	unpack->pack_state = GITT_UNPACK_STATE_INIT;
 	unpack->obj_state = GITT_UNPACK_STATE_INIT;
+	unpack->offset = 0;
+	unpack->base_used = 0;
 	gitt_sha1_init(&unpack->sha1);
 
 	return 0;
@@ -98,14 +111,104 @@ static int gitt_unpack_header_step(struct gitt_unpack *unpack, uint8_t *data, ui
 	if (unpack->pack_state == 12 && unpack->header_dump)
 		unpack->header_dump(&unpack->version, &unpack->number);
 
+	/* An empty pack only has the checksum left */
+	if (unpack->pack_state == 12 && !unpack->number)
+		unpack->pack_state++;
+
 	return index;
 }
 
+static void gitt_unpack_base_add(struct gitt_unpack *unpack)
+{
+	uint32_t need = GITT_UNPACK_BASE_HEAD + unpack->obj.size;
+	uint16_t size = unpack->obj.size;
+	struct gitt_sha1 sha1;
+	char head[24];
+	uint8_t *p;
+	int len;
+
+	if (need > sizeof(unpack->base))
+		return;
+
+	/* Oldest bases are dropped all at once */
+	if (unpack->base_used + need > sizeof(unpack->base))
+		unpack->base_used = 0;
+
+	p = unpack->base + unpack->base_used;
+	memcpy(p, &unpack->obj_offset, 4);
+	memcpy(p + 4, &size, 2);
+	p[6] = unpack->obj.type;
+	memcpy(p + GITT_UNPACK_BASE_HEAD, unpack->buf, unpack->obj.size);
+
+	/* The id that a REF_DELTA names it by */
+	len = sprintf(head, "%s %u", GITT_OBJ_STR(unpack->obj.type), unpack->obj.size) + 1;
+	gitt_sha1_init(&sha1);
+	gitt_sha1_update(&sha1, (uint8_t *)head, len);
+	gitt_sha1_update(&sha1, unpack->buf, unpack->obj.size);
+	gitt_sha1_digest(&sha1, p + GITT_UNPACK_BASE_SHA1);
+
+	unpack->base_used += need;
+}
+
+static uint8_t *gitt_unpack_base_find(struct gitt_unpack *unpack, uint16_t *len,
+				      uint8_t *type)
+{
+	uint16_t index = 0;
+	uint32_t offset;
+	uint16_t size;
+
+	while (index + GITT_UNPACK_BASE_HEAD <= unpack->base_used) {
+		memcpy(&offset, unpack->base + index, 4);
+		memcpy(&size, unpack->base + index + 4, 2);
+		if (unpack->obj.type == GITT_OBJ_TYPE_REF_DELTA ?
+		    !memcmp(unpack->base + index + GITT_UNPACK_BASE_SHA1, unpack->base_sha1, 20) :
+		    offset == unpack->base_offset) {
+			*len = size;
+			*type = unpack->base[index + 6];
+			return unpack->base + index + GITT_UNPACK_BASE_HEAD;
+		}
+		index += GITT_UNPACK_BASE_HEAD + size;
+	}
+
+	return NULL;
+}
+
+/* Rebuild a delta in place, the free part of buf is the scratch space */
+static void gitt_unpack_resolve(struct gitt_unpack *unpack)
+{
+	uint32_t scratch = unpack->obj.size + 1;
+	uint16_t base_len;
+	uint8_t type;
+	uint8_t *base;
+	int ret;
+
+	if (scratch + 1 >= unpack->buf_len)
+		return;
+
+	base = gitt_unpack_base_find(unpack, &base_len, &type);
+	if (!base)
+		return;
+
+	ret = gitt_delta_apply(base, base_len, unpack->buf, unpack->obj.size,
+			       unpack->buf + scratch, unpack->buf_len - scratch - 1);
+	if (ret < 0) {
+		gitt_log_info("Delta not resolved at offset %u\n", unpack->obj_offset);
+		return;
+	}
+
+	memmove(unpack->buf, unpack->buf + scratch, ret);
+	unpack->obj.type = type;
+	unpack->obj.size = ret;
+	unpack->buf[ret] = '\0';
+}
+
 static int gitt_unpack_obj_step(struct gitt_unpack *unpack, uint8_t *data, uint16_t size)
 {
 	uint16_t index = 0;
 	uint16_t in_size;
 	uint16_t out_size;
+	uint32_t remain;
+	uint8_t *out;
 	int ret;
 
 	do {
@@ -117,6 +220,7 @@ static int gitt_unpack_obj_step(struct gitt_unpack *unpack, uint8_t *data, uint1
 				return ret;
 			}
 			unpack->valid_len = 0;
+			unpack->obj_offset = unpack->offset + index;
 
 			/* Object type */
 			unpack->obj.type = data[index] >> 4 & 0x7;
@@ -129,7 +233,7 @@ static int gitt_unpack_obj_step(struct gitt_unpack *unpack, uint8_t *data, uint1
 			unpack->obj.size = data[index] & 0xf;
 			unpack->obj_state = 4;
 			if (!(data[index] & 0x80)) {
-				unpack->obj_state += 7 * 2;
+				unpack->obj_state = GITT_UNPACK_OBJ_SIZE;
 				gitt_log_debug("Object size: %u\n", unpack->obj.size);
 			}
 
@@ -137,61 +241,89 @@ static int gitt_unpack_obj_step(struct gitt_unpack *unpack, uint8_t *data, uint1
 		}
 
 		/* High bit of size */
-		while (index < size && unpack->obj_state < 18) {
+		while (index < size && unpack->obj_state < GITT_UNPACK_OBJ_SIZE) {
 			/* Object size */
 			unpack->obj.size |= (data[index] & 0x7f) << unpack->obj_state;
 
 			if (data[index] & 0x80)
 				unpack->obj_state += 7;
 			else
-				unpack->obj_state = 18;
+				unpack->obj_state = GITT_UNPACK_OBJ_SIZE;
 
 			/* End check */
-			if (unpack->obj_state == 18) {
+			if (unpack->obj_state == GITT_UNPACK_OBJ_SIZE) {
 				if (data[index] & 0x80) {
 					gitt_log_error("Object too big\n");
 					goto fail;
 				}
 				gitt_log_debug("Object size: %u\n", unpack->obj.size);
 
-				/* For commit, we need to give it a terminator */
+				/*
+				 * For commit, we need to give it a terminator. Other objects
+				 * that do not fit are decompressed and thrown away.
+				 */
+				unpack->discard = false;
 				if (unpack->obj.size + 1 > unpack->buf_len) {
-					gitt_log_error("Uncompress output buffer does not have enough space\n");
-					goto fail;
+					if (unpack->obj.type == GITT_OBJ_TYPE_COMMIT) {
+						gitt_log_error("Uncompress output buffer does not have enough space\n");
+						goto fail;
+					}
+					unpack->discard = true;
 				}
 			}
 
 			index++;
 		}
 
-		/* We don't deal with OFS_DELTA or REF_DELTA, so we skip its special part directly */
-		if (index < size && unpack->obj_state < 38) {
+		/*
+		 * OFS_DELTA keeps its base offset and REF_DELTA its base SHA-1
+		 * for gitt_unpack_resolve()
+		 */
+		if (index < size && unpack->obj_state < GITT_UNPACK_OBJ_DATA) {
 			if (unpack->obj.type == GITT_OBJ_TYPE_OFS_DELTA) {
-				/* Skip length */
-				while ((index < size) && (data[index] & 0x80))
-					index++;
-				if ((index < size) && !(data[index] & 0x80)) {
-					unpack->obj_state = 38;
+				/* | 1bit flag | 7bit offset |, each next byte adds one first */
+				while (index < size && unpack->obj_state < GITT_UNPACK_OBJ_DATA) {
+					if (unpack->obj_state == GITT_UNPACK_OBJ_SIZE) {
+						unpack->base_offset = data[index] & 0x7f;
+						unpack->obj_state++;
+					} else {
+						unpack->base_offset = ((unpack->base_offset + 1) << 7) |
+								      (data[index] & 0x7f);
+					}
+					if (!(data[index] & 0x80)) {
+						unpack->base_offset = unpack->obj_offset -
+								      unpack->base_offset;
+						unpack->obj_state = GITT_UNPACK_OBJ_DATA;
+					}
 					index++;
 				}
 			} else if (unpack->obj.type == GITT_OBJ_TYPE_REF_DELTA) {
-				/* Skip 20byte SHA-1 */
-				while (index < size && unpack->obj_state < 38) {
+				/* 20byte SHA-1 */
+				while (index < size && unpack->obj_state < GITT_UNPACK_OBJ_DATA) {
+					unpack->base_sha1[unpack->obj_state - GITT_UNPACK_OBJ_SIZE] =
+						data[index];
 					unpack->obj_state++;
 					index++;
 				}
 			} else {
 				/* Do nothing, jump to the next step */
-				unpack->obj_state = 38;
+				unpack->obj_state = GITT_UNPACK_OBJ_DATA;
 			}
 		}
 
 		/* Decompress the data compressed by zlib */
-		if (index < size && unpack->obj_state == 38) {
+		if (index < size && unpack->obj_state == GITT_UNPACK_OBJ_DATA) {
 			in_size = size - index;
-			out_size = unpack->obj.size - unpack->valid_len;
+			remain = unpack->obj.size - unpack->valid_len;
+			if (unpack->discard) {
+				out = unpack->buf;
+				out_size = remain > unpack->buf_len ? unpack->buf_len : remain;
+			} else {
+				out = unpack->buf + unpack->valid_len;
+				out_size = remain;
+			}
 			ret = gitt_zlib_decompress_update(&unpack->zlib, data + index, &in_size,
-							unpack->buf + unpack->valid_len, &out_size);
+							out, &out_size);
 			if (ret)
 				goto fail;
 			unpack->valid_len += out_size;
@@ -200,15 +332,27 @@ static int gitt_unpack_obj_step(struct gitt_unpack *unpack, uint8_t *data, uint1
 			if (in_size == 0 && unpack->obj.size == unpack->valid_len) {
 				gitt_log_debug("Decompress has been completed\n");
 				gitt_zlib_decompress_end(&unpack->zlib);
-				/* Anyway, we add the terminator to it */
-				unpack->buf[unpack->obj.size] = '\0';
-				unpack->obj.data = (char *)unpack->buf;
 				unpack->number--;
 				unpack->obj_state = GITT_UNPACK_STATE_INIT;
 
-				/* Callback */
-				if (unpack->obj_dump)
-					unpack->obj_dump(&unpack->obj);
+				if (unpack->discard) {
+					gitt_log_info("Discard type:%s, size:%u\n",
+						      GITT_OBJ_STR(unpack->obj.type), unpack->obj.size);
+				} else {
+					/* Anyway, we add the terminator to it */
+					unpack->buf[unpack->obj.size] = '\0';
+					unpack->obj.data = (char *)unpack->buf;
+
+					if (unpack->obj.type == GITT_OBJ_TYPE_OFS_DELTA ||
+					    unpack->obj.type == GITT_OBJ_TYPE_REF_DELTA)
+						gitt_unpack_resolve(unpack);
+					if (unpack->obj.type == GITT_OBJ_TYPE_COMMIT)
+						gitt_unpack_base_add(unpack);
+
+					/* Callback */
+					if (unpack->obj_dump)
+						unpack->obj_dump(&unpack->obj);
+				}
 
 				/* Check whether unpack has been completed */
 				if (!unpack->number) {
@@ -296,6 +440,7 @@ int gitt_unpack_update(struct gitt_unpack *unpack, uint8_t *data, uint16_t size)
 		if (cost < 0) {
 			return cost;
 		} else if (cost > 0) {
+			unpack->offset += cost;
 			ret = gitt_sha1_update(&unpack->sha1, data, cost);
 			if (ret) {
 				gitt_log_error("SHA-1 update fail\n");
@@ -312,6 +457,7 @@ int gitt_unpack_update(struct gitt_unpack *unpack, uint8_t *data, uint16_t size)
 		if (cost < 0) {
 			return cost;
 		} else if (cost > 0) {
+			unpack->offset += cost;
 			ret = gitt_sha1_update(&unpack->sha1, data, cost);
 			if (ret) {
 				gitt_log_error("SHA-1 update fail\n");
@@ -0,0 +1,284 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <gitt_pack.h>
+#include <gitt_delta.h>
+#include <gitt_unpack.h>
+#include <gitt_errno.h>
+#include <gitt_commit.h>
+
+static FILE *file;
+
+static int gitt_pack_data_dump(void *p, uint8_t *buf, uint16_t size)
+{
+	int ret;
+
+	ret = fwrite(buf, 1, size, file);
+	if (ret <= 0) {
+		fprintf(stderr, "Error writing file\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint16_t unpacked_num;
+static uint16_t unpacked_rebuilt;
+static struct gitt_commit *unpacked_commits;
+
+/* The OFS_DELTA and the REF_DELTA commits come out rebuilt */
+static void gitt_unpack_obj_callback(struct gitt_obj *obj)
+{
+	if (unpacked_num && obj->type == GITT_OBJ_TYPE_COMMIT &&
+	    strstr((char *)obj->data, unpacked_commits[unpacked_num].message))
+		unpacked_rebuilt++;
+	unpacked_num++;
+}
+
+static int test_unpack(const char *name, struct gitt_commit *commits)
+{
+	struct gitt_unpack unpack = {0};
+	uint8_t buffer[1024];
+	uint8_t data[64];
+	size_t size;
+	FILE *in;
+	int ret = 0;
+
+	in = fopen(name, "rb");
+	if (!in) {
+		fprintf(stderr, "Error opening file\n");
+		return -1;
+	}
+
+	unpacked_num = 0;
+	unpacked_rebuilt = 0;
+	unpacked_commits = commits;
+	unpack.buf = buffer;
+	unpack.buf_len = sizeof(buffer);
+	unpack.obj_dump = gitt_unpack_obj_callback;
+	ret = gitt_unpack_init(&unpack);
+	while (!ret && (size = fread(data, 1, sizeof(data), in)) > 0)
+		ret = gitt_unpack_update(&unpack, data, size) < 0 ? -1 : 0;
+	gitt_unpack_end(&unpack);
+	fclose(in);
+
+	printf("Unpacked: %u objects, deltas rebuilt: %u\n", unpacked_num, unpacked_rebuilt);
+
+	return !ret && unpacked_num == 3 && unpacked_rebuilt == 2 ? 0 : -1;
+}
+
+static uint16_t delta_get_size(uint8_t **p)
+{
+	uint16_t size = 0;
+	uint8_t shift = 0;
+
+	do {
+		size |= (**p & 0x7f) << shift;
+		shift += 7;
+	} while (*(*p)++ & 0x80);
+
+	return size;
+}
+
+/* Rebuild the target from the base and the delta */
+static int delta_apply(uint8_t *base, uint8_t *data, uint16_t size, uint8_t *out)
+{
+	uint8_t *p = data;
+	uint8_t cmd;
+	uint16_t target_len;
+	uint16_t len = 0;
+	uint16_t offset;
+	uint16_t copy;
+
+	delta_get_size(&p);
+	target_len = delta_get_size(&p);
+
+	while (p < data + size) {
+		cmd = *p++;
+		if (cmd & 0x80) {
+			offset = 0;
+			copy = 0;
+			if (cmd & 0x01) offset |= *p++;
+			if (cmd & 0x02) offset |= *p++ << 8;
+			if (cmd & 0x10) copy |= *p++;
+			if (cmd & 0x20) copy |= *p++ << 8;
+			memcpy(out + len, base + offset, copy);
+			len += copy;
+		} else {
+			memcpy(out + len, p, cmd);
+			p += cmd;
+			len += cmd;
+		}
+	}
+
+	return len == target_len ? len : -1;
+}
+
+static void commit_init(struct gitt_commit *commit, char *message)
+{
+	memset(commit, 0, sizeof(*commit));
+	commit->tree.sha1       = "4b825dc642cb6eb9a060e54bf8d69288fbee4904";
+	commit->parent.sha1     = "";
+	commit->author.date     = "170098713";
+	commit->author.email    = "0000000000000000@0_90.GITT";
+	commit->author.name     = "Example Device";
+	commit->author.zone     = "+0800";
+	commit->committer.date  = "170098713";
+	commit->committer.email = "https://github.com/huxiangjs/git_things.git";
+	commit->committer.name  = "GITT";
+	commit->committer.zone  = "+0800";
+	commit->message         = message;
+	gitt_commit_sha1_update(commit);
+}
+
+static int test_delta(void)
+{
+	int ret;
+	struct gitt_obj obj;
+	struct gitt_pack pack;
+	struct gitt_delta delta;
+	struct gitt_pack_delta pack_delta;
+	struct gitt_commit commit[3];
+	uint8_t buffer[4096];
+	uint8_t delta_buffer[3072];
+	uint8_t base[1024];
+	uint8_t out[1024];
+	uint8_t check[1024];
+	uint16_t base_len;
+	char hexdigest[41];
+	int i;
+
+	commit_init(&commit[0], "temperature=21.5 humidity=40 battery=97 state=idle");
+	commit_init(&commit[1], "temperature=21.7 humidity=40 battery=97 state=idle");
+	commit_init(&commit[2], "temperature=21.5 humidity=41 battery=96 state=idle");
+
+	delta.buf = delta_buffer;
+	delta.buf_len = sizeof(delta_buffer);
+	ret = gitt_delta_init(&delta);
+	if (ret) {
+		printf("Delta init fail\n");
+		return ret;
+	}
+
+	file = fopen("pack-delta-test.pack", "wb");
+	if (!file) {
+		fprintf(stderr, "Error opening file\n");
+		return -1;
+	}
+
+	pack.buf = buffer;
+	pack.buf_len = sizeof(buffer);
+	pack.obj_num = 3;
+	pack.data_dump = gitt_pack_data_dump;
+	pack.worker = NULL;
+	ret = gitt_pack_init(&pack);
+	if (ret) {
+		printf("Pack init fail\n");
+		return ret;
+	}
+
+	for (i = 0; i < 3; i++) {
+		obj.type = GITT_OBJ_TYPE_COMMIT;
+		obj.data = &commit[i];
+		obj.size = gitt_commit_length(&commit[i]);
+
+		gitt_delta_target_reset(&delta);
+		ret = gitt_commit_build(gitt_delta_target_dump, &delta, &commit[i]);
+		if (ret) {
+			printf("Delta target fail\n");
+			return ret;
+		}
+
+		if (i && !gitt_delta_encode(&delta, &pack_delta.data, &pack_delta.size)) {
+			/* Check the delta rebuilds the commit */
+			ret = delta_apply(base, pack_delta.data, pack_delta.size, out);
+			if (ret != obj.size) {
+				printf("Delta apply fail\n");
+				return -1;
+			}
+
+			/* The unpacker rebuilds it the same way */
+			ret = gitt_delta_apply(base, base_len, pack_delta.data, pack_delta.size,
+					       check, sizeof(check));
+			if (ret != obj.size || memcmp(check, out, ret)) {
+				printf("Delta apply mismatch\n");
+				return -1;
+			}
+			if (gitt_delta_apply(base, base_len + 1, pack_delta.data, pack_delta.size,
+					     check, sizeof(check)) != -GITT_ERRNO_INVAL ||
+			    gitt_delta_apply(base, base_len, pack_delta.data, pack_delta.size,
+					     check, obj.size - 1) != -GITT_ERRNO_NOMEM ||
+			    gitt_delta_apply(base, base_len, pack_delta.data, pack_delta.size - 1,
+					     check, sizeof(check)) >= 0) {
+				printf("Delta apply check fail\n");
+				return -1;
+			}
+
+			printf("Commit %d: %u => %ubyte delta\n", i, obj.size, pack_delta.size);
+			pack_delta.base_sha1 = delta.base_sha1;
+			obj.type = i == 1 ? GITT_OBJ_TYPE_OFS_DELTA : GITT_OBJ_TYPE_REF_DELTA;
+			obj.data = &pack_delta;
+			obj.size = pack_delta.size;
+		}
+
+		ret = gitt_pack_update(&pack, &obj);
+		if (ret) {
+			printf("Pack update fail\n");
+			return ret;
+		}
+
+		/* Keep a plain copy of the base for checking */
+		base_len = delta.target_len;
+		memcpy(base, delta.buf + delta.slot_len * !delta.base, base_len);
+		gitt_delta_commit(&delta, commit[i].id.sha1);
+	}
+
+	ret = gitt_sha1_hexdigest(&pack.sha1, hexdigest);
+	if (ret) {
+		printf("SH1-A hexdigest fail\n");
+		return ret;
+	}
+	printf("SH1-A: %s\n", hexdigest);
+
+	fclose(file);
+	gitt_pack_end(&pack);
+
+	/* Without any delta buffer, the unpacker rebuilds both delta commits */
+	ret = test_unpack("pack-delta-test.pack", commit);
+
+	printf("Test end\n");
+
+	return ret;
+}
+
+int main(int args, char *argv[])
+{
+	/*
+	 * [git index-pack -v pack-delta-test.pack]  Can generate idx index file.
+	 * [git verify-pack -v pack-delta-test.pack] You can view pack information.
+	 */
+	return test_delta();
+}
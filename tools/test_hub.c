@@ -0,0 +1,364 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <gitt.h>
+#include <gitt_transport.h>
+#include <gitt_errno.h>
+#include "../examples/gitt_hub.h"
+
+#define DEFAULT_REMOTE		"/tmp/test_hub.git"
+#define HEAP_NUMBER		5
+#define STEAL_NUMBER		6
+#define SLOW_OPEN_US		200000
+
+struct gitt_transport *gitt_local_impl(void);
+
+/* Only the local transport is used, SSH is not reached */
+struct gitt_ssh *gitt_ssh_alloc_impl(void) { return NULL; }
+void gitt_ssh_free_impl(struct gitt_ssh *ssh) { }
+int gitt_ssh_open_impl(struct gitt_ssh *ssh, struct gitt_ssh_url *ssh_url,
+		       const char *privkey) { return -GITT_ERRNO_INVAL; }
+int gitt_ssh_channel_open_impl(struct gitt_ssh *ssh, const char *exec,
+			       const char *protocol) { return -GITT_ERRNO_INVAL; }
+void gitt_ssh_channel_close_impl(struct gitt_ssh *ssh) { }
+int gitt_ssh_keepalive_impl(struct gitt_ssh *ssh) { return -GITT_ERRNO_INVAL; }
+void gitt_ssh_close_impl(struct gitt_ssh *ssh) { }
+void gitt_ssh_attach_impl(struct gitt_ssh *ssh, struct gitt_ssh *session) { }
+void gitt_ssh_detach_impl(struct gitt_ssh *ssh) { }
+int gitt_ssh_read_impl(struct gitt_ssh *ssh, char *buf, int size) { return -GITT_ERRNO_INVAL; }
+int gitt_ssh_write_impl(struct gitt_ssh *ssh, char *buf, int size) { return -GITT_ERRNO_INVAL; }
+int gitt_ssh_nonblock_impl(struct gitt_ssh *ssh, bool nonblock) { return -GITT_ERRNO_INVAL; }
+int gitt_ssh_fd_impl(struct gitt_ssh *ssh) { return -GITT_ERRNO_INVAL; }
+int gitt_ssh_limit_impl(struct gitt_ssh *ssh, struct gitt_ssh_limit *limit) { return 0; }
+
+/*
+ * The local transport, slow to open for some repositories, or a remote
+ * that never answers once silent is set
+ */
+struct test_remote {
+	struct gitt_transport transport;
+	bool slow;
+	bool silent;
+	void *local;
+	int pipe[2];
+	bool open;
+};
+
+struct test_repo {
+	struct gitt g;
+	struct gitt_hub_repo repo;
+	struct test_remote remote;
+	uint8_t buf[4096];
+	uint8_t ring[4096];
+	uint32_t polls;
+	int ret;
+};
+
+static struct test_repo repos[HEAP_NUMBER + STEAL_NUMBER + 1];
+static uint32_t order[HEAP_NUMBER];
+static uint32_t order_num;
+
+static int test_open(void *param, void **handle, const char *url, const char *exec,
+		     const char *protocol, struct gitt_ssh_limit *limit)
+{
+	struct test_remote *remote = (struct test_remote *)param;
+	struct gitt_transport *local = gitt_local_impl();
+	int ret;
+
+	if (remote->slow)
+		usleep(SLOW_OPEN_US);
+	if (!remote->silent) {
+		ret = local->open(local->param, &remote->local, url, exec, protocol, limit);
+		if (ret)
+			return ret;
+	} else if (pipe(remote->pipe) || fcntl(remote->pipe[0], F_SETFL, O_NONBLOCK)) {
+		return -GITT_ERRNO_INVAL;
+	}
+	remote->open = true;
+	*handle = remote;
+	return 0;
+}
+
+static int test_read(void *handle, char *buf, int size)
+{
+	struct test_remote *remote = (struct test_remote *)handle;
+
+	if (remote->silent)
+		return -GITT_ERRNO_AGAIN;
+	return gitt_local_impl()->read(remote->local, buf, size);
+}
+
+static int test_write(void *handle, char *buf, int size)
+{
+	struct test_remote *remote = (struct test_remote *)handle;
+
+	if (remote->silent)
+		return size;
+	return gitt_local_impl()->write(remote->local, buf, size);
+}
+
+static int test_nonblock(void *handle, bool nonblock)
+{
+	struct test_remote *remote = (struct test_remote *)handle;
+
+	if (remote->silent)
+		return 0;
+	return gitt_local_impl()->nonblock(remote->local, nonblock);
+}
+
+static int test_fd(void *handle, bool write)
+{
+	struct test_remote *remote = (struct test_remote *)handle;
+
+	if (remote->silent)
+		return remote->pipe[0];
+	return gitt_local_impl()->fd(remote->local, write);
+}
+
+static void test_close(void *handle)
+{
+	struct test_remote *remote = (struct test_remote *)handle;
+
+	if (!remote->silent) {
+		gitt_local_impl()->close(remote->local);
+	} else {
+		close(remote->pipe[0]);
+		close(remote->pipe[1]);
+	}
+	remote->open = false;
+}
+
+static void test_done(struct gitt_hub_repo *repo, int ret)
+{
+	struct test_repo *test = (struct test_repo *)repo->param;
+
+	test->polls++;
+	test->ret = ret;
+	if (test->polls == 2 && order_num < HEAP_NUMBER)
+		order[order_num++] = repo->interval;
+}
+
+static int test_setup(struct test_repo *test, const char *url, uint32_t interval)
+{
+	struct test_remote *remote = &test->remote;
+
+	memset(test, 0, sizeof(*test));
+	remote->transport.open = test_open;
+	remote->transport.read = test_read;
+	remote->transport.write = test_write;
+	remote->transport.nonblock = test_nonblock;
+	remote->transport.fd = test_fd;
+	remote->transport.close = test_close;
+	remote->transport.param = remote;
+
+	test->g.url = (char *)url;
+	test->g.transport = &remote->transport;
+	test->g.buf = test->buf;
+	test->g.buf_len = sizeof(test->buf);
+	test->g.ring = test->ring;
+	test->g.ring_len = sizeof(test->ring);
+	test->repo.g = &test->g;
+	test->repo.interval = interval;
+	test->repo.done = test_done;
+	test->repo.param = test;
+
+	return gitt_init(&test->g);
+}
+
+static uint64_t test_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void test_run(struct gitt_hub *hub, uint32_t ms)
+{
+	uint64_t end = test_now() + ms;
+
+	while (test_now() < end)
+		gitt_hub_run(hub, 50);
+}
+
+/* Added in another order than their intervals, polled again in the order of them */
+static int test_heap(const char *url)
+{
+	static const uint32_t intervals[HEAP_NUMBER] = { 5, 3, 1, 4, 2 };
+	struct gitt_hub *hub;
+	uint32_t index;
+	bool sorted = true;
+	int ret;
+
+	hub = gitt_hub_alloc(2);
+	if (!hub)
+		return -1;
+
+	for (index = 0; index < HEAP_NUMBER; index++) {
+		ret = test_setup(&repos[index], url, intervals[index]);
+		if (!ret)
+			ret = gitt_hub_add(hub, &repos[index].repo);
+		if (ret)
+			goto out;
+	}
+
+	test_run(hub, (HEAP_NUMBER + 1) * 1000);
+
+	printf("Heap: second polls by interval:");
+	for (index = 0; index < order_num; index++) {
+		printf(" %u", order[index]);
+		if (order[index] != index + 1)
+			sorted = false;
+	}
+	printf(", %s\n", sorted && order_num == HEAP_NUMBER ? "in order" : "out of order");
+	ret = sorted && order_num == HEAP_NUMBER ? 0 : -1;
+
+out:
+	for (index = 0; index < HEAP_NUMBER; index++) {
+		while (repos[index].repo.hub && gitt_hub_remove(hub, &repos[index].repo) ==
+		       -GITT_ERRNO_AGAIN)
+			gitt_hub_run(hub, 50);
+		gitt_end(&repos[index].g);
+	}
+	gitt_hub_free(hub);
+	return ret;
+}
+
+/* The repositories of one worker are slow, the other worker takes them */
+static int test_steal(const char *url)
+{
+	struct gitt_hub_metrics metrics;
+	struct test_repo *test;
+	struct gitt_hub *hub;
+	uint32_t done = 0;
+	uint32_t index;
+	int ret = 0;
+
+	hub = gitt_hub_alloc(2);
+	if (!hub)
+		return -1;
+
+	for (index = 0; index < STEAL_NUMBER; index++) {
+		test = &repos[HEAP_NUMBER + index];
+		ret = test_setup(test, url, 60);
+		test->remote.slow = !(index % 2);
+		if (!ret)
+			ret = gitt_hub_add(hub, &test->repo);
+		if (ret)
+			goto out;
+	}
+
+	test_run(hub, STEAL_NUMBER * SLOW_OPEN_US / 1000 * 2);
+
+	for (index = 0; index < STEAL_NUMBER; index++)
+		if (repos[HEAP_NUMBER + index].polls == 1 && !repos[HEAP_NUMBER + index].ret)
+			done++;
+	gitt_hub_metrics(hub, &metrics);
+	printf("Steal: done %u/%u, stolen: %s\n", done, STEAL_NUMBER,
+	       metrics.steals ? "yes" : "no");
+	ret = done == STEAL_NUMBER && metrics.steals ? 0 : -1;
+
+out:
+	for (index = 0; index < STEAL_NUMBER; index++) {
+		test = &repos[HEAP_NUMBER + index];
+		while (test->repo.hub && gitt_hub_remove(hub, &test->repo) == -GITT_ERRNO_AGAIN)
+			gitt_hub_run(hub, 50);
+		gitt_end(&test->g);
+	}
+	gitt_hub_free(hub);
+	return ret;
+}
+
+/* A pull that waits for a silent remote is not kicked, and can be removed */
+static int test_remove(const char *url)
+{
+	struct test_repo *test = &repos[HEAP_NUMBER + STEAL_NUMBER];
+	struct gitt_hub_metrics metrics;
+	struct gitt_hub *hub;
+	int ret;
+
+	hub = gitt_hub_alloc(1);
+	if (!hub)
+		return -1;
+
+	ret = test_setup(test, url, 60);
+	test->remote.silent = true;
+	if (!ret)
+		ret = gitt_hub_add(hub, &test->repo);
+	if (ret)
+		goto out;
+
+	test_run(hub, GITT_HUB_KICK_MAX);
+	gitt_hub_metrics(hub, &metrics);
+	printf("Wait: open: %s, active: %u, kicks: %llu\n", test->remote.open ? "yes" : "no",
+	       metrics.active, (unsigned long long)metrics.kicks);
+
+	ret = gitt_hub_remove(hub, &test->repo);
+	gitt_hub_metrics(hub, &metrics);
+	printf("Remove: %s, open: %s, active: %u, repos: %u\n", GITT_ERRNO_STR(ret),
+	       test->remote.open ? "yes" : "no", metrics.active, metrics.repos);
+	if (!ret && (test->remote.open || metrics.active || metrics.repos || metrics.kicks))
+		ret = -1;
+
+out:
+	test->remote.silent = false;
+	gitt_end(&test->g);
+	gitt_hub_free(hub);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *url = argc > 1 ? argv[1] : DEFAULT_REMOTE;
+	char command[512];
+	int ret;
+
+	/* A bare repository with one commit, for the local transport */
+	snprintf(command, sizeof(command),
+		 "rm -rf %s && git init -q --bare %s && "
+		 "git --git-dir=%s symbolic-ref HEAD refs/heads/main && "
+		 "git --git-dir=%s update-ref refs/heads/main $(git --git-dir=%s "
+		 "-c user.name=test -c user.email=test@test commit-tree "
+		 "4b825dc642cb6eb9a060e54bf8d69288fbee4904 -m init)",
+		 url, url, url, url, url);
+	if (system(command)) {
+		printf("Cannot create %s\n", url);
+		return -1;
+	}
+
+	ret = test_heap(url);
+	if (!ret)
+		ret = test_steal(url);
+	if (!ret)
+		ret = test_remove(url);
+
+	printf("Test end\n");
+	return ret;
+}
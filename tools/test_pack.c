@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdbool.h>
 #include <gitt_pack.h>
 #include <gitt_errno.h>
 #include <gitt_commit.h>
@@ -48,7 +49,155 @@ static int gitt_pack_data_dump(void *p, uint8_t *buf, uint16_t size)
 	return 0;
 }
 
-static int test_pack(void)
+static uint8_t zbuf[4096];
+
+static int test_worker_submit(void *param, struct gitt_pack_zobj *zobj)
+{
+	if (gitt_pack_compress_bound(&zobj->obj) > sizeof(zbuf))
+		return -1;
+
+	/* Compress right away */
+	zobj->buf = zbuf;
+	zobj->buf_len = sizeof(zbuf);
+	gitt_pack_compress(zobj);
+
+	return 0;
+}
+
+static int test_worker_wait(void *param, struct gitt_pack_zobj *zobj)
+{
+	return zobj->ret;
+}
+
+static struct gitt_pack_worker test_worker = {
+	.submit = test_worker_submit,
+	.wait = test_worker_wait,
+};
+
+#define WINDOW_OBJ_NUM		(GITT_PACK_WINDOW * 3 + 3)
+#define WINDOW_PACK_SIZE	(WINDOW_OBJ_NUM * 256 + 64)
+#define WINDOW_POISON		0xa5
+
+struct test_window {
+	uint8_t out[WINDOW_PACK_SIZE];
+	uint32_t out_len;
+};
+
+static struct test_window *window_out;
+/*
+ * A worker that leaves each object pending until the pack waits for one,
+ * then compresses everything pending newest first into the own buffer of
+ * each object. A released buffer is poisoned, so reading it again shows.
+ */
+static struct gitt_pack_zobj *window_pending[GITT_PACK_WINDOW];
+static uint32_t window_pending_num;
+static uint8_t window_zbuf[WINDOW_OBJ_NUM][512];
+static bool window_done[WINDOW_OBJ_NUM];
+static bool window_released[WINDOW_OBJ_NUM];
+static uint32_t window_submitted;
+static uint32_t window_in_flight;
+static uint32_t window_completed;
+static uint32_t window_released_num;
+static bool window_out_of_order;
+
+static int test_window_submit(void *param, struct gitt_pack_zobj *zobj)
+{
+	uint32_t index = window_submitted;
+
+	if (index >= WINDOW_OBJ_NUM || window_pending_num >= GITT_PACK_WINDOW ||
+	    gitt_pack_compress_bound(&zobj->obj) > sizeof(window_zbuf[index]))
+		return -1;
+
+	zobj->buf = window_zbuf[index];
+	zobj->buf_len = sizeof(window_zbuf[index]);
+	zobj->priv = (void *)(uintptr_t)index;
+	window_pending[window_pending_num++] = zobj;
+	window_submitted++;
+
+	if (window_submitted - window_released_num > window_in_flight)
+		window_in_flight = window_submitted - window_released_num;
+
+	return 0;
+}
+
+static int test_window_wait(void *param, struct gitt_pack_zobj *zobj)
+{
+	uint32_t index = (uint32_t)(uintptr_t)zobj->priv;
+	struct gitt_pack_zobj *pending;
+
+	while (!window_done[index] && window_pending_num) {
+		pending = window_pending[--window_pending_num];
+		pending->ret = gitt_pack_compress(pending);
+		window_done[(uint32_t)(uintptr_t)pending->priv] = true;
+		if ((uint32_t)(uintptr_t)pending->priv != window_completed)
+			window_out_of_order = true;
+		window_completed++;
+	}
+
+	return window_done[index] ? zobj->ret : -1;
+}
+
+static void test_window_release(void *param, struct gitt_pack_zobj *zobj)
+{
+	uint32_t index = (uint32_t)(uintptr_t)zobj->priv;
+
+	memset(window_zbuf[index], WINDOW_POISON, sizeof(window_zbuf[index]));
+	window_released[index] = true;
+	window_released_num++;
+}
+
+static struct gitt_pack_worker window_worker = {
+	.submit = test_window_submit,
+	.wait = test_window_wait,
+	.release = test_window_release,
+};
+
+static int test_window_dump(void *p, uint8_t *buf, uint16_t size)
+{
+	struct test_window *window = window_out;
+
+	if (window->out_len + size > sizeof(window->out))
+		return -1;
+
+	memcpy(window->out + window->out_len, buf, size);
+	window->out_len += size;
+
+	return 0;
+}
+
+static int test_window_pack(struct test_window *window, struct gitt_commit *commits,
+			    struct gitt_pack_worker *worker)
+{
+	struct gitt_pack pack;
+	struct gitt_obj obj;
+	uint8_t buffer[4096];
+	uint32_t index;
+	int ret;
+
+	window->out_len = 0;
+	window_out = window;
+	pack.buf = buffer;
+	pack.buf_len = sizeof(buffer);
+	pack.obj_num = WINDOW_OBJ_NUM;
+	pack.data_dump = test_window_dump;
+	pack.worker = worker;
+	ret = gitt_pack_init(&pack);
+	if (ret)
+		return ret;
+
+	for (index = 0; index < WINDOW_OBJ_NUM && !ret; index++) {
+		obj.type = GITT_OBJ_TYPE_COMMIT;
+		obj.data = &commits[index];
+		obj.size = gitt_commit_length(&commits[index]);
+		ret = gitt_pack_update(&pack, &obj);
+	}
+
+	gitt_pack_end(&pack);
+
+	return ret;
+}
+
+static int test_pack(const char *name, struct gitt_pack_worker *worker)
 {
 	int ret;
 	struct gitt_obj obj;
@@ -57,7 +206,7 @@ static int test_pack(void)
 	struct gitt_commit commit = {0};
 	char hexdigest[41];
 
-	file = fopen("pack-test.pack", "wb");
+	file = fopen(name, "wb");
 	if (!file) {
 		fprintf(stderr, "Error opening file\n");
 		return -1;
@@ -87,6 +236,7 @@ static int test_pack(void)
 	pack.buf_len = sizeof(buffer);
 	pack.obj_num = 1;
 	pack.data_dump = gitt_pack_data_dump;
+	pack.worker = worker;
 	ret = gitt_pack_init(&pack);
 	if (ret) {
 		printf("Pack init fail\n");
@@ -120,6 +270,64 @@ static int test_pack(void)
 	return 0;
 }
 
+/*
+ * More objects than the window, completed newest first, each in its own
+ * buffer: the pack must be the same as without a worker
+ */
+static int test_window(void)
+{
+	static struct gitt_commit commits[WINDOW_OBJ_NUM];
+	static char messages[WINDOW_OBJ_NUM][32];
+	static struct test_window plain;
+	static struct test_window deferred;
+	uint32_t released = 0;
+	uint32_t index;
+	bool same;
+	int ret;
+
+	for (index = 0; index < WINDOW_OBJ_NUM; index++) {
+		snprintf(messages[index], sizeof(messages[index]), "Window %u", index);
+		commits[index].tree.sha1       = "4b825dc642cb6eb9a060e54bf8d69288fbee4904";
+		commits[index].parent.sha1     = "1e5d56c3b90714c7761a3c77d4d67aa12c3ae13a";
+		commits[index].author.date     = "170098713";
+		commits[index].author.email    = "huxiangjs1@foxmail.com";
+		commits[index].author.name     = "Hoozz1";
+		commits[index].author.zone     = "+080";
+		commits[index].committer.date  = "170098714";
+		commits[index].committer.email = "huxiangjs2@foxmail.com";
+		commits[index].committer.name  = "Hoozz2";
+		commits[index].committer.zone  = "+081";
+		commits[index].message         = messages[index];
+	}
+
+	ret = test_window_pack(&plain, commits, NULL);
+	if (ret) {
+		printf("Window pack fail\n");
+		return ret;
+	}
+
+	ret = test_window_pack(&deferred, commits, &window_worker);
+	if (ret) {
+		printf("Window pack with worker fail\n");
+		return ret;
+	}
+
+	for (index = 0; index < WINDOW_OBJ_NUM; index++)
+		released += window_released[index];
+	same = plain.out_len == deferred.out_len &&
+	       !memcmp(plain.out, deferred.out, plain.out_len);
+
+	printf("Window: objects %u, in flight %u, out of order: %s, released %u/%u\n",
+	       WINDOW_OBJ_NUM, window_in_flight, window_out_of_order ? "yes" : "no",
+	       released, WINDOW_OBJ_NUM);
+	printf("Window pack: %ubyte, same as without worker: %s\n", deferred.out_len,
+	       same ? "yes" : "no");
+	printf("Test end\n");
+
+	return same && released == WINDOW_OBJ_NUM && window_in_flight == GITT_PACK_WINDOW ?
+	       0 : -1;
+}
+
 int main(int args, char *argv[])
 {
 	/*
@@ -128,7 +336,10 @@ int main(int args, char *argv[])
 	 * [git index-pack -v pack-test.pack]  Can generate idx index file.
 	 * [git verify-pack -v pack-test.pack] You can view pack information.
 	 */
-	test_pack();
+	test_pack("pack-test.pack", NULL);
 
-	return 0;
+	/* Same pack, compressed by a worker */
+	test_pack("pack-test-worker.pack", &test_worker);
+
+	return test_window();
 }
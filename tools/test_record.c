@@ -0,0 +1,260 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <gitt_record.h>
+#include <gitt_errno.h>
+
+/* What the fake remote says for each exec, in pieces of FAKE_PIECE bytes */
+#define FAKE_PIECE		7
+#define FAKE_READ_US		1000
+#define FAKE_OPEN_US		500
+
+static const char fake_upload[] = "0032want 0123456789abcdef0123456789abcdef01234567\n0000";
+static const char fake_upload_answer[] = "0008NAK\nPACK and more data from the remote";
+static const char fake_receive[] = "0000";
+static const char fake_receive_answer[] = "000eunpack ok\n0000";
+
+/* A remote in memory, on a clock that only moves when told to */
+struct fake_remote {
+	const char *answer;
+	int answer_len;
+	int read_pos;
+	int written;
+};
+
+static struct fake_remote fake;
+static uint64_t fake_clock;
+static uint64_t fake_delayed;
+static uint8_t transcript[1024];
+
+static uint64_t fake_now(void)
+{
+	return fake_clock;
+}
+
+static void fake_delay(uint32_t us)
+{
+	fake_clock += us;
+	fake_delayed += us;
+}
+
+static int fake_open(void *param, void **handle, const char *url, const char *exec,
+		     const char *protocol, struct gitt_ssh_limit *limit)
+{
+	bool upload = !strcmp(exec, "git-upload-pack");
+
+	fake.answer = upload ? fake_upload_answer : fake_receive_answer;
+	fake.answer_len = upload ? sizeof(fake_upload_answer) - 1 : sizeof(fake_receive_answer) - 1;
+	fake.read_pos = 0;
+	fake.written = 0;
+	fake_clock += FAKE_OPEN_US;
+	*handle = &fake;
+
+	return 0;
+}
+
+static int fake_read(void *handle, char *buf, int size)
+{
+	int len = fake.answer_len - fake.read_pos;
+
+	if (len > FAKE_PIECE)
+		len = FAKE_PIECE;
+	if (len > size)
+		len = size;
+	memcpy(buf, fake.answer + fake.read_pos, len);
+	fake.read_pos += len;
+	fake_clock += FAKE_READ_US;
+
+	return len;
+}
+
+static int fake_write(void *handle, char *buf, int size)
+{
+	fake.written += size;
+	return size;
+}
+
+static int fake_fd(void *handle, bool write)
+{
+	return 3;
+}
+
+static void fake_close(void *handle)
+{
+}
+
+static struct gitt_transport fake_transport = {
+	.open = fake_open,
+	.read = fake_read,
+	.write = fake_write,
+	.fd = fake_fd,
+	.close = fake_close,
+};
+
+/* Write what is given, then read to the end in pieces of piece bytes */
+static int test_command(struct gitt_transport *transport, const char *exec, const char *send,
+			char *got, int piece)
+{
+	void *handle;
+	int len = 0;
+	int ret;
+
+	ret = transport->open(transport->param, &handle, "fake", exec, "version=2", NULL);
+	if (ret)
+		return ret;
+
+	ret = transport->write(handle, (char *)send, strlen(send));
+	if (ret < 0)
+		goto out;
+
+	while ((ret = transport->read(handle, got + len, piece)) > 0)
+		len += ret;
+	got[len] = '\0';
+
+out:
+	transport->close(handle);
+	return ret < 0 ? ret : 0;
+}
+
+static int test_record(struct gitt_record *record, uint32_t buf_len)
+{
+	char got[128];
+	int ret;
+
+	memset(record, 0, sizeof(*record));
+	record->buf = transcript;
+	record->buf_len = buf_len;
+	record->now = fake_now;
+	ret = gitt_record_init(record, &fake_transport);
+	if (ret)
+		return ret;
+
+	ret = test_command(&record->transport, "git-upload-pack", fake_upload, got, 16);
+	if (!ret)
+		ret = test_command(&record->transport, "git-receive-pack", fake_receive, got, 16);
+
+	printf("Record %ubyte: used %ubyte, overflow:%d, fd:%s\n", buf_len, record->used,
+	       record->overflow, record->transport.fd ? "inner" : "none");
+	return ret;
+}
+
+/* Replay one command, what is read must be what the remote said */
+static int test_replay(struct gitt_record *record, const char *exec, const char *send,
+		       const char *answer, int piece)
+{
+	char got[128];
+	int ret;
+
+	ret = test_command(&record->transport, exec, send, got, piece);
+	if (ret) {
+		printf("Replay %s: %s\n", exec, GITT_ERRNO_STR(ret));
+		return ret;
+	}
+
+	printf("Replay %s, pieces %d: %s, diverged:%u, skipped:%u\n", exec, piece,
+	       strcmp(got, answer) ? "different" : "same", record->diverged, record->skipped);
+	return 0;
+}
+
+int main(int args, char *argv[])
+{
+	struct gitt_record record;
+	char changed[sizeof(fake_upload)];
+	char got[128];
+	uint32_t recorded;
+	int ret;
+
+	/* Both commands fit */
+	ret = test_record(&record, sizeof(transcript));
+	if (ret)
+		goto out;
+
+	ret = gitt_record_replay(&record);
+	if (ret)
+		goto out;
+	printf("Replay fd:%s\n", record.transport.fd ? "set" : "none");
+
+	/* Other read sizes, the same bytes written */
+	ret = test_replay(&record, "git-upload-pack", fake_upload, fake_upload_answer, 3);
+	if (!ret)
+		ret = test_replay(&record, "git-receive-pack", fake_receive, fake_receive_answer, 64);
+	if (ret)
+		goto out;
+
+	/* Two bytes written differ */
+	gitt_record_rewind(&record);
+	strcpy(changed, fake_upload);
+	changed[9] = 'x';
+	changed[10] = 'x';
+	ret = test_replay(&record, "git-upload-pack", changed, fake_upload_answer, 16);
+	if (ret)
+		goto out;
+
+	/* The pull is not asked for */
+	gitt_record_rewind(&record);
+	ret = test_replay(&record, "git-receive-pack", fake_receive, fake_receive_answer, 16);
+	if (ret)
+		goto out;
+	ret = test_command(&record.transport, "git-upload-pack", fake_upload, got, 16);
+	printf("Nothing left: %s\n", ret ? "yes" : "no");
+	if (!ret) {
+		ret = -1;
+		goto out;
+	}
+
+	/* With the recorded timing, the last read comes when it came */
+	recorded = FAKE_OPEN_US + FAKE_READ_US *
+		   ((sizeof(fake_upload_answer) - 1 + FAKE_PIECE - 1) / FAKE_PIECE);
+	record.delay = fake_delay;
+	gitt_record_rewind(&record);
+	fake_clock = 0;
+	fake_delayed = 0;
+	ret = test_replay(&record, "git-upload-pack", fake_upload, fake_upload_answer, 64);
+	if (ret)
+		goto out;
+	printf("Timed: waited %lluus of %uus\n", (unsigned long long)fake_delayed, recorded);
+	if (fake_delayed != recorded) {
+		ret = -1;
+		goto out;
+	}
+
+	/* Only the pull fits, the push is dropped */
+	ret = test_record(&record, record.used - 20);
+	if (ret)
+		goto out;
+	ret = gitt_record_replay(&record);
+	if (!ret)
+		ret = test_replay(&record, "git-upload-pack", fake_upload, fake_upload_answer, 16);
+	if (ret)
+		goto out;
+	ret = test_command(&record.transport, "git-receive-pack", fake_receive, got, 16);
+	printf("Push kept: %s\n", ret ? "no" : "yes");
+	ret = ret ? 0 : -1;
+
+out:
+	printf("Test end\n");
+	return ret;
+}
@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <gitt_refs.h>
+#include <gitt_errno.h>
+
+#define TEST_REFS_NUMBER	1000
+
+static uint32_t buffer[32768];
+
+static void test_sha1(char sha1[41], uint16_t index, uint8_t version)
+{
+	sprintf(sha1, "%04x%02x", index, version);
+	memset(sha1 + 6, 'a' + version % 6, 34);
+	sha1[40] = '\0';
+}
+
+static int test_refs(void)
+{
+	struct gitt_refs refs;
+	char name[48];
+	char sha1[41];
+	char expect[41];
+	const char *entry;
+	uint16_t changed;
+	uint16_t index;
+	int ret;
+
+	refs.buf = (uint8_t *)buffer;
+	refs.buf_len = sizeof(buffer);
+	refs.max = TEST_REFS_NUMBER;
+	ret = gitt_refs_init(&refs);
+	if (ret) {
+		printf("Refs init fail\n");
+		return ret;
+	}
+	printf("Slots: %u, arena: %ubyte\n", refs.slot_num, refs.arena_len);
+
+	/* An advertisement of device refs */
+	for (index = 0; index < TEST_REFS_NUMBER; index++) {
+		sprintf(name, "refs/heads/device-%08u", index);
+		test_sha1(sha1, index, 0);
+		ret = gitt_refs_add(&refs, sha1, name);
+		if (ret < 0) {
+			printf("Refs add fail: %s\n", name);
+			return ret;
+		}
+		gitt_refs_settle(&refs, ret);
+	}
+	printf("Refs: %u, names: %ubyte\n", refs.number, refs.arena_used);
+
+	sprintf(name, "refs/heads/device-%08u", TEST_REFS_NUMBER);
+	ret = gitt_refs_add(&refs, sha1, name);
+	printf("Add when full: %s\n", ret == -GITT_ERRNO_NOMEM ? "no memory" : "unexpected");
+
+	/* A later advertisement, every 7th device has pushed */
+	for (index = 0; index < TEST_REFS_NUMBER; index += 7) {
+		sprintf(name, "refs/heads/device-%08u", index);
+		test_sha1(sha1, index, 1);
+		ret = gitt_refs_add(&refs, sha1, name);
+		if (ret < 0) {
+			printf("Refs update fail: %s\n", name);
+			return ret;
+		}
+	}
+	printf("Refs: %u, names: %ubyte\n", refs.number, refs.arena_used);
+
+	/* Which of them changed? */
+	changed = 0;
+	for (index = 0; index < TEST_REFS_NUMBER; index++) {
+		sprintf(name, "refs/heads/device-%08u", index);
+		ret = gitt_refs_get(&refs, name, sha1);
+		if (ret) {
+			printf("Refs get fail: %s\n", name);
+			return ret;
+		}
+		test_sha1(expect, index, index % 7 ? 0 : 1);
+		if (strcmp(sha1, expect)) {
+			printf("Wrong id of %s: %s\n", name, sha1);
+			return -1;
+		}
+		if (gitt_refs_changed(&refs, gitt_refs_find(&refs, name)))
+			changed++;
+	}
+	printf("Changed: %u\n", changed);
+
+	ret = gitt_refs_get(&refs, "refs/heads/main", sha1);
+	printf("Get unknown: %s\n", ret ? "not found" : "unexpected");
+
+	entry = gitt_refs_entry(&refs, 7, sha1);
+	printf("Entry 7: %s %s\n", sha1, entry);
+
+	gitt_refs_reset(&refs);
+	printf("Refs after reset: %u\n", refs.number);
+
+	printf("Test end\n");
+
+	return 0;
+}
+
+int main(int args, char *argv[])
+{
+	test_refs();
+
+	return 0;
+}
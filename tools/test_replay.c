@@ -0,0 +1,262 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <gitt_repository.h>
+#include <gitt_record.h>
+#include <gitt_errno.h>
+
+#define TRANSCRIPT_SIZE		(16 * 1024 * 1024)
+#define DEFAULT_RUNS		10
+
+/* What a clone dumped, the same for each replay of one transcript */
+struct test_result {
+	struct gitt_sha1 sha1;
+	uint32_t commits;
+	char head[41];
+	char digest[41];
+};
+
+static uint8_t transcript[TRANSCRIPT_SIZE];
+static char privkey[4096];
+static struct gitt_repository repository;
+static uint8_t buffer[4096];
+static uint8_t ring_buffer[16384];
+static uint8_t delta_buffer[32768];
+static struct gitt_delta delta;
+static struct test_result *result;
+
+static uint64_t test_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void test_delay(uint32_t us)
+{
+	usleep(us);
+}
+
+static void test_commit_dump(struct gitt_repository *repository, struct gitt_commit *commit)
+{
+	gitt_sha1_update(&result->sha1, (uint8_t *)commit->id.sha1, 40);
+	result->commits++;
+}
+
+/* Clone as the examples do, so that what is sent is the same each time */
+static int test_clone(struct gitt_transport *transport, const char *url,
+		      struct test_result *out)
+{
+	int ret;
+
+	memset(&repository, 0, sizeof(repository));
+	repository.url = (char *)url;
+	repository.transport = transport;
+	repository.buf = buffer;
+	repository.buf_len = sizeof(buffer);
+	repository.ring = ring_buffer;
+	repository.ring_len = sizeof(ring_buffer);
+	delta.buf = delta_buffer;
+	delta.buf_len = sizeof(delta_buffer);
+	repository.delta = &delta;
+	repository.filter = GITT_REPOSITORY_FILTER_TREE_0;
+	repository.commit_dump = test_commit_dump;
+
+	result = out;
+	memset(out, 0, sizeof(*out));
+	gitt_sha1_init(&out->sha1);
+
+	ret = gitt_repository_init(&repository);
+	if (ret)
+		return ret;
+
+	ret = gitt_repository_clone(&repository);
+	strcpy(out->head, repository.head);
+	gitt_sha1_hexdigest(&out->sha1, out->digest);
+	gitt_repository_end(&repository);
+
+	return ret;
+}
+
+static int test_load(const char *path, void *buf, uint32_t size, uint32_t *len)
+{
+	FILE *file;
+	size_t ret;
+
+	file = fopen(path, "rb");
+	if (!file) {
+		printf("Cannot open file: %s\n", path);
+		return -1;
+	}
+
+	ret = fread(buf, 1, size, file);
+	fclose(file);
+	if (ret == size) {
+		printf("File too big: %s\n", path);
+		return -1;
+	}
+
+	*len = ret;
+	return 0;
+}
+
+/* Clone over SSH and keep what was said */
+static int test_record(const char *url, const char *key_path, const char *path)
+{
+	struct gitt_transport ssh;
+	struct gitt_record record = {0};
+	struct test_result out;
+	uint32_t len;
+	FILE *file;
+	int ret;
+
+	ret = test_load(key_path, privkey, sizeof(privkey) - 1, &len);
+	if (ret)
+		return ret;
+	privkey[len] = '\0';
+
+	gitt_ssh_transport(&ssh, privkey);
+	record.buf = transcript;
+	record.buf_len = sizeof(transcript);
+	record.now = test_now;
+	ret = gitt_record_init(&record, &ssh);
+	if (ret)
+		return ret;
+
+	ret = test_clone(&record.transport, url, &out);
+	printf("Clone: %s, commits: %u, head: %s\n", GITT_ERRNO_STR(ret), out.commits, out.head);
+	if (ret)
+		return ret;
+	if (record.overflow) {
+		printf("Transcript full\n");
+		return -1;
+	}
+
+	file = fopen(path, "wb");
+	if (!file || fwrite(transcript, 1, record.used, file) != record.used) {
+		printf("Cannot write file: %s\n", path);
+		if (file)
+			fclose(file);
+		return -1;
+	}
+	fclose(file);
+	printf("Recorded: %ubyte\n", record.used);
+
+	return 0;
+}
+
+/* Clone from the transcript again and again, each time the same */
+static int test_replay(const char *path, int runs, bool timed)
+{
+	struct gitt_record record = {0};
+	struct test_result first;
+	struct test_result out;
+	uint64_t total = 0;
+	uint64_t best = UINT64_MAX;
+	uint64_t start;
+	uint64_t took;
+	int run;
+	int ret;
+
+	ret = test_load(path, transcript, sizeof(transcript), &record.used);
+	if (ret)
+		return ret;
+
+	record.buf = transcript;
+	record.buf_len = sizeof(transcript);
+	record.now = test_now;
+	record.delay = timed ? test_delay : NULL;
+	ret = gitt_record_replay(&record);
+	if (ret)
+		return ret;
+
+	for (run = 0; run < runs; run++) {
+		gitt_record_rewind(&record);
+
+		start = test_now();
+		ret = test_clone(&record.transport, "replay", &out);
+		took = test_now() - start;
+		if (ret) {
+			printf("Run %d: %s\n", run, GITT_ERRNO_STR(ret));
+			return ret;
+		}
+
+		if (record.diverged) {
+			printf("Run %d: %ubyte sent differ from the transcript\n",
+			       run, record.diverged);
+			return -1;
+		}
+
+		if (!run) {
+			first = out;
+			printf("Commits: %u, head: %s, digest: %s\n", out.commits, out.head,
+			       out.digest);
+		} else if (out.commits != first.commits || strcmp(out.head, first.head) ||
+			   strcmp(out.digest, first.digest)) {
+			printf("Run %d: not the same as the first\n", run);
+			return -1;
+		}
+
+		total += took;
+		if (took < best)
+			best = took;
+	}
+
+	printf("Transcript: %ubyte, skipped: %u, %s\n", record.used, record.skipped,
+	       timed ? "timed" : "fast");
+	printf("Runs: %d, average: %lluus, best: %lluus, %.1fMB/s\n", runs,
+	       (unsigned long long)(total / runs), (unsigned long long)best,
+	       best ? record.used / (double)best : 0.0);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int runs = DEFAULT_RUNS;
+	int ret;
+
+	if (argc == 5 && !strcmp(argv[1], "record")) {
+		ret = test_record(argv[2], argv[3], argv[4]);
+	} else if (argc >= 2 && argc <= 4 && strcmp(argv[1], "record")) {
+		if (argc >= 3)
+			runs = atoi(argv[2]);
+		if (runs < 1)
+			runs = 1;
+		ret = test_replay(argv[1], runs, argc == 4 && !strcmp(argv[3], "timed"));
+	} else {
+		printf("Usage: %s record <url> <privkey> <transcript>\n", argv[0]);
+		printf("       %s <transcript> [runs] [timed]\n", argv[0]);
+		return -1;
+	}
+
+	printf("Test end\n");
+	return ret;
+}
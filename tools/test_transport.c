@@ -0,0 +1,160 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Hoozz <huxiangjs@foxmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <gitt_transport.h>
+#include <gitt_errno.h>
+
+/* An interim answer, then refs in chunks with an extension and a trailer */
+static const char test_chunked[] =
+	"HTTP/1.1 100 Continue\r\n"
+	"\r\n"
+	"HTTP/1.1 200 OK\r\n"
+	"Content-Type: application/x-git-upload-pack-advertisement\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"\r\n"
+	"1e;ext=1\r\n"
+	"001e# service=git-upload-pack\n\r\n"
+	"4\r\n"
+	"0000\r\n"
+	"0\r\n"
+	"X-Trailer: 1\r\n"
+	"\r\n";
+
+static const char test_sized[] =
+	"HTTP/1.0 404 Not Found\r\n"
+	"CONTENT-LENGTH: 9\r\n"
+	"Content-Encoding: gzip\r\n"
+	"\r\n"
+	"Not Found";
+
+static void test_url(const char *url)
+{
+	struct gitt_transport_url parsed;
+	int ret;
+
+	ret = gitt_transport_url_pad(&parsed, url, "http://", GITT_TRANSPORT_HTTP_PORT);
+	if (ret)
+		printf("%s: invalid\n", url);
+	else
+		printf("%s: host:%s, port:%s, path:%s\n", url, parsed.host, parsed.port, parsed.path);
+}
+
+static void test_request(void)
+{
+	struct gitt_transport_url parsed;
+	char buf[512];
+	int ret;
+
+	gitt_transport_url_pad(&parsed, "git://example.com/r.git", "git://", GITT_TRANSPORT_GIT_PORT);
+	ret = gitt_transport_git_request(buf, sizeof(buf), &parsed, "git-upload-pack", "version=2");
+	printf("git:// request: %dbyte, length %.4s\n", ret, buf);
+
+	gitt_transport_url_pad(&parsed, "http://example.com/r.git", "http://",
+			       GITT_TRANSPORT_HTTP_PORT);
+	ret = gitt_transport_http_request(buf, sizeof(buf), &parsed, "git-upload-pack", NULL, 0);
+	printf("GET: %.*s\n", (int)strcspn(buf, "\r"), buf);
+	ret = gitt_transport_http_request(buf, sizeof(buf), &parsed, "git-upload-pack", "version=2",
+					  GITT_TRANSPORT_HTTP_POST | GITT_TRANSPORT_HTTP_GZIP |
+					  GITT_TRANSPORT_HTTP_PROXY);
+	printf("POST: %.*s, gzip:%s, protocol:%s\n", (int)strcspn(buf, "\r"), buf,
+	       strstr(buf, "Content-Encoding: gzip\r\n") ? "yes" : "no",
+	       strstr(buf, "Git-Protocol: version=2\r\n\r\n") ? "yes" : "no");
+	ret = gitt_transport_http_request(buf, 64, &parsed, "git-upload-pack", NULL, 0);
+	printf("Small buffer: %s\n", ret == -GITT_ERRNO_NOMEM ? "no memory" : "unexpected");
+}
+
+/* Feed the response in blocks of each size, the result must not depend on it */
+static int test_response(const char *data, int len)
+{
+	struct gitt_transport_http http;
+	char body[128];
+	char first[128];
+	int first_len = -1;
+	int body_len;
+	int offset;
+	int blk_size;
+	int size;
+	bool payload;
+	int ret;
+
+	for (blk_size = 1; blk_size <= len; blk_size++) {
+		gitt_transport_http_begin(&http);
+		body_len = 0;
+		offset = 0;
+		while (offset < len && http.state != GITT_TRANSPORT_HTTP_DONE) {
+			size = len - offset < blk_size ? len - offset : blk_size;
+			if (http.state < GITT_TRANSPORT_HTTP_BODY) {
+				ret = gitt_transport_http_head(&http, data + offset, size);
+			} else {
+				ret = gitt_transport_http_body(&http, (uint8_t *)data + offset, size,
+							       &payload);
+				if (ret > 0 && payload && body_len + ret <= sizeof(body)) {
+					memcpy(body + body_len, data + offset, ret);
+					body_len += ret;
+				}
+			}
+			if (ret < 0) {
+				printf("Test fail at %d, block %d: %d\n", offset, blk_size, ret);
+				return ret;
+			}
+			offset += ret;
+		}
+
+		if (http.state != GITT_TRANSPORT_HTTP_DONE || offset != len) {
+			printf("Not done, block %d: state %u at %d\n", blk_size, http.state, offset);
+			return -1;
+		}
+		if (first_len < 0) {
+			memcpy(first, body, body_len);
+			first_len = body_len;
+		} else if (body_len != first_len || memcmp(body, first, body_len)) {
+			printf("Different body, block %d\n", blk_size);
+			return -1;
+		}
+	}
+
+	printf("Status:%u, type:%s, gzip:%d, close:%d, body:%dbyte \"", http.status, http.type,
+	       http.gzip, http.close, first_len);
+	for (offset = 0; offset < first_len; offset++)
+		printf(first[offset] == '\n' ? "\\n" : "%c", first[offset]);
+	printf("\", blocks 1~%d\n", len);
+
+	return 0;
+}
+
+int main(int args, char *argv[])
+{
+	test_url("http://example.com/r.git");
+	test_url("http://127.0.0.1:8080/git/r.git");
+	test_url("https://example.com/r.git");
+	test_url("http://example.com:/r.git");
+	test_request();
+	test_response(test_chunked, sizeof(test_chunked) - 1);
+	test_response(test_sized, sizeof(test_sized) - 1);
+	printf("Test end\n");
+
+	return 0;
+}
@@ -32,9 +32,9 @@
 static void gitt_unpack_obj_callback(struct gitt_obj *obj)
 {
 #if 0
-	printf("%s: type:%s, size:%d\n", __func__, GITT_OBJ_STR(obj->type), obj->size);
+	printf("%s: type:%s, size:%u\n", __func__, GITT_OBJ_STR(obj->type), obj->size);
 	if (obj->type == 1 || obj->type == 2)
-		printf("%.*s\n", obj->size, (char *)obj->data);
+		printf("%.*s\n", (int)obj->size, (char *)obj->data);
 #else
 	printf("*");
 #endif
@@ -121,9 +121,30 @@ static int test_unpack_from_file(void)
 	return 0;
 }
 
+/* The server sends a pack without objects when we already have its head */
+static int test_unpack_empty(void)
+{
+	struct gitt_sha1 sha1;
+	uint8_t buffer[32] = {'P', 'A', 'C', 'K', 0, 0, 0, 2, 0, 0, 0, 0};
+	int ret;
+
+	gitt_sha1_init(&sha1);
+	ret = gitt_sha1_update(&sha1, buffer, 12);
+	if (!ret)
+		ret = gitt_sha1_digest(&sha1, buffer + 12);
+	if (ret)
+		return ret;
+	printf("Empty pack: %ubyte\n", (unsigned)sizeof(buffer));
+
+	test_unpack(buffer, sizeof(buffer));
+
+	return 0;
+}
+
 int main(int args, char *argv[])
 {
 	test_unpack_from_file();
+	test_unpack_empty();
 
 	return 0;
 }